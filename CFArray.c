@@ -75,6 +75,25 @@ struct __CFArrayDeque {
     /* struct __CFArrayBucket buckets follow here */
 };
 
+/* A ring keeps the values in a circular buffer, so adding or removing values
+   at either end never moves the others, and it does not turn into a CFStorage
+   when large; arrays used as queues are created this way. */
+struct __CFArrayRing {
+    CFIndex _headIdx;	/* bucket holding the value at index 0 */
+    CFIndex _capacity;	/* always a power of 2 */
+    CFIndex _minCapacity;	/* capacity asked for by the creator or _CFArraySetCapacity(); never shrunk below */
+    /* struct __CFArrayBucket buckets follow here */
+};
+
+CF_INLINE CFIndex __CFArrayRingRoundUpCapacity(CFIndex capacity) {
+    if (capacity < 16) return 16;
+    return (CFIndex)1 << flsl(capacity - 1);
+}
+
+CF_INLINE Boolean __CFArrayRingShouldShrink(struct __CFArrayRing *ring, CFIndex count) {
+    return (1024 < ring->_capacity && ring->_minCapacity < ring->_capacity && count < ring->_capacity / 4);
+}
+
 struct __CFArray {
     CFRuntimeBase _base;
     CFIndex _count;		/* number of objects */
@@ -85,6 +104,7 @@ struct __CFArray {
 /* Flag bits */
 enum {		/* Bits 0-1 */
     __kCFArrayImmutable = 0,
+    __kCFArrayRing = 1,
     __kCFArrayDeque = 2,
     __kCFArrayStorage = 3
 };
@@ -138,8 +158,16 @@ CF_INLINE void __CFArraySetCount(CFArrayRef array, CFIndex v) {
     ((struct __CFArray *)array)->_count = v;
 }
 
-/* Only applies to immutable and mutable-deque-using arrays;
- * Returns the bucket holding the left-most real value in the latter case. */
+CF_INLINE struct __CFArrayBucket *__CFArrayRingGetBuckets(struct __CFArrayRing *ring) {
+    return (struct __CFArrayBucket *)((uint8_t *)ring + sizeof(struct __CFArrayRing));
+}
+
+CF_INLINE CFIndex __CFArrayRingGetBucketIndex(struct __CFArrayRing *ring, CFIndex idx) {
+    return (ring->_headIdx + idx) & (ring->_capacity - 1);
+}
+
+/* Only applies to immutable, mutable-deque-using and unwrapped ring arrays (see __CFArrayRingMakeContiguous());
+ * Returns the bucket holding the left-most real value in the latter cases. */
 CF_INLINE struct __CFArrayBucket *__CFArrayGetBucketsPtr(CFArrayRef array) {
     switch (__CFArrayGetType(array)) {
     case __kCFArrayImmutable:
@@ -148,6 +176,10 @@ CF_INLINE struct __CFArrayBucket *__CFArrayGetBucketsPtr(CFArrayRef array) {
 	struct __CFArrayDeque *deque = (struct __CFArrayDeque *)array->_store;
         return (struct __CFArrayBucket *)((uint8_t *)deque + sizeof(struct __CFArrayDeque) + deque->_leftIdx * sizeof(struct __CFArrayBucket));
     }
+    case __kCFArrayRing: {
+	struct __CFArrayRing *ring = (struct __CFArrayRing *)array->_store;
+	return __CFArrayRingGetBuckets(ring) + ring->_headIdx;
+    }
     }
     return NULL;
 }
@@ -162,6 +194,10 @@ CF_INLINE struct __CFArrayBucket *__CFArrayGetBucketAtIndex(CFArrayRef array, CF
 	CFStorageRef store = (CFStorageRef)array->_store;
 	return (struct __CFArrayBucket *)CFStorageGetValueAtIndex(store, idx, NULL);
     }
+    case __kCFArrayRing: {
+	struct __CFArrayRing *ring = (struct __CFArrayRing *)array->_store;
+	return __CFArrayRingGetBuckets(ring) + __CFArrayRingGetBucketIndex(ring, idx);
+    }
     }
     return NULL;
 }
@@ -182,6 +218,7 @@ CF_INLINE CFArrayCallBacks *__CFArrayGetCallBacks(CFArrayRef array) {
 	break;
     case __kCFArrayDeque:
     case __kCFArrayStorage:
+    case __kCFArrayRing:
 	result = (CFArrayCallBacks *)((uint8_t *)array + sizeof(struct __CFArray));
 	break;
     }
@@ -274,6 +311,112 @@ static void __CFArrayReleaseValues(CFArrayRef array, CFRange range, bool release
 	}
 	break;
     }
+    case __kCFArrayRing: {
+	struct __CFArrayRing *ring = (struct __CFArrayRing *)array->_store;
+	if (0 < range.length && NULL != ring && !hasBeenFinalized(array)) {
+	    struct __CFArrayBucket *buckets = __CFArrayRingGetBuckets(ring);
+	    allocator = __CFGetAllocator(array);
+	    for (idx = 0; idx < range.length; idx++) {
+		struct __CFArrayBucket *bucket = buckets + __CFArrayRingGetBucketIndex(ring, range.location + idx);
+		if (NULL != cb->release) INVOKE_CALLBACK2(cb->release, allocator, bucket->_item);
+		bucket->_item = NULL; // GC:  break strong reference.
+	    }
+	}
+	if (releaseStorageIfPossible && 0 == range.location && __CFArrayGetCount(array) == range.length) {
+	    allocator = __CFGetAllocator(array);
+	    if (NULL != ring) _CFAllocatorDeallocateGC(allocator, ring);
+	    __CFArraySetCount(array, 0);  // GC: _count == 0 ==> _store == NULL.
+	    ((struct __CFArray *)array)->_store = NULL;
+	}
+	break;
+    }
+    }
+}
+
+/* Copies values between a range of the array (which may wrap around the end of the ring) and a flat buffer */
+static void __CFArrayRingGetValues(struct __CFArrayRing *ring, CFRange range, const void **values) {
+    struct __CFArrayBucket *buckets = __CFArrayRingGetBuckets(ring);
+    CFIndex start = __CFArrayRingGetBucketIndex(ring, range.location);
+    CFIndex firstLength = __CFMin(range.length, ring->_capacity - start);
+    if (0 < firstLength) CF_WRITE_BARRIER_MEMMOVE(values, buckets + start, firstLength * sizeof(struct __CFArrayBucket));
+    if (firstLength < range.length) CF_WRITE_BARRIER_MEMMOVE(values + firstLength, buckets, (range.length - firstLength) * sizeof(struct __CFArrayBucket));
+}
+
+static void __CFArrayRingSetValues(struct __CFArrayRing *ring, CFRange range, const void **values) {
+    struct __CFArrayBucket *buckets = __CFArrayRingGetBuckets(ring);
+    CFIndex start = __CFArrayRingGetBucketIndex(ring, range.location);
+    CFIndex firstLength = __CFMin(range.length, ring->_capacity - start);
+    if (0 < firstLength) CF_WRITE_BARRIER_MEMMOVE(buckets + start, values, firstLength * sizeof(struct __CFArrayBucket));
+    if (firstLength < range.length) CF_WRITE_BARRIER_MEMMOVE(buckets, values + firstLength, (range.length - firstLength) * sizeof(struct __CFArrayBucket));
+}
+
+// Moves the values to a new, unwrapped ring of the given capacity, leaving newCount buckets for the values replacing range
+static void __CFArrayRingReallocate(CFMutableArrayRef array, CFIndex capacity, CFRange range, CFIndex newCount) {
+    struct __CFArrayRing *ring = (struct __CFArrayRing *)array->_store;
+    CFIndex cnt = __CFArrayGetCount(array);
+    CFIndex size = sizeof(struct __CFArrayRing) + capacity * sizeof(struct __CFArrayBucket);
+    CFAllocatorRef allocator = __CFGetAllocator(array);
+    struct __CFArrayRing *newRing = (struct __CFArrayRing *)_CFAllocatorAllocateGC(allocator, size, isStrongMemory(array) ? __kCFAllocatorGCScannedMemory : 0);
+    if (__CFOASafe) __CFSetLastAllocationEventName(newRing, "CFArray (store-ring)");
+    memset(newRing, 0, size);
+    newRing->_headIdx = 0;
+    newRing->_capacity = capacity;
+    if (NULL != ring) {
+	newRing->_minCapacity = ring->_minCapacity;
+	struct __CFArrayBucket *newBuckets = __CFArrayRingGetBuckets(newRing);
+	CFIndex C0 = range.location + range.length;
+	__CFArrayRingGetValues(ring, CFRangeMake(0, range.location), (const void **)newBuckets);
+	__CFArrayRingGetValues(ring, CFRangeMake(C0, cnt - C0), (const void **)(newBuckets + range.location + newCount));
+	_CFAllocatorDeallocateGC(allocator, ring);
+    }
+    CF_WRITE_BARRIER_BASE_ASSIGN(allocator, array, array->_store, newRing);
+}
+
+// newCount values are going to replace the (already released) range; moves whichever side of it is shorter, or reallocates
+static void __CFArrayRingRepositionRegions(CFMutableArrayRef array, CFRange range, CFIndex newCount) {
+    struct __CFArrayRing *ring = (struct __CFArrayRing *)array->_store;
+    CFIndex cnt = __CFArrayGetCount(array);
+    CFIndex futureCnt = cnt - range.length + newCount;
+    CFIndex A = range.location;			// length of region to left of replaced range
+    CFIndex B = range.length;			// length of replaced range
+    CFIndex C = cnt - B - A;			// length of region to right of replaced range
+    CFIndex delta = newCount - B, idx;
+    struct __CFArrayBucket *buckets;
+    CFAllocatorRef bucketsAllocator;
+
+    if (NULL == ring || ring->_capacity < futureCnt || __CFArrayRingShouldShrink(ring, futureCnt)) {
+	CFIndex capacity = __CFArrayRingRoundUpCapacity(futureCnt + futureCnt / 2);
+	if (NULL != ring && capacity < ring->_minCapacity) capacity = ring->_minCapacity;
+	__CFArrayRingReallocate(array, capacity, range, newCount);
+	return;
+    }
+    if (0 == delta) return;
+    buckets = __CFArrayRingGetBuckets(ring);
+    bucketsAllocator = isStrongMemory(array) ? __CFGetAllocator(array) : kCFAllocatorNull;
+    if (A < C) {	// move A by -delta, changing where index 0 is
+	if (0 < delta) {
+	    for (idx = 0; idx < A; idx++) CF_WRITE_BARRIER_ASSIGN(bucketsAllocator, buckets[__CFArrayRingGetBucketIndex(ring, idx - delta)]._item, buckets[__CFArrayRingGetBucketIndex(ring, idx)]._item);
+	} else {
+	    for (idx = A; idx--;) CF_WRITE_BARRIER_ASSIGN(bucketsAllocator, buckets[__CFArrayRingGetBucketIndex(ring, idx - delta)]._item, buckets[__CFArrayRingGetBucketIndex(ring, idx)]._item);
+	    for (idx = 0; idx < -delta; idx++) buckets[__CFArrayRingGetBucketIndex(ring, idx)]._item = NULL;	// GC: zero-out newly exposed space
+	}
+	ring->_headIdx = __CFArrayRingGetBucketIndex(ring, -delta);
+    } else {		// move C by delta
+	CFIndex C0 = A + B;
+	if (0 < delta) {
+	    for (idx = C; idx--;) CF_WRITE_BARRIER_ASSIGN(bucketsAllocator, buckets[__CFArrayRingGetBucketIndex(ring, C0 + idx + delta)]._item, buckets[__CFArrayRingGetBucketIndex(ring, C0 + idx)]._item);
+	} else {
+	    for (idx = 0; idx < C; idx++) CF_WRITE_BARRIER_ASSIGN(bucketsAllocator, buckets[__CFArrayRingGetBucketIndex(ring, C0 + idx + delta)]._item, buckets[__CFArrayRingGetBucketIndex(ring, C0 + idx)]._item);
+	    for (idx = futureCnt; idx < cnt; idx++) buckets[__CFArrayRingGetBucketIndex(ring, idx)]._item = NULL;	// GC: zero-out newly exposed space
+	}
+    }
+}
+
+// Rotates the ring so that the values are in one piece, for the callers of __CFArrayGetBucketsPtr()
+static void __CFArrayRingMakeContiguous(CFMutableArrayRef array) {
+    struct __CFArrayRing *ring = (struct __CFArrayRing *)array->_store;
+    if (NULL != ring && ring->_capacity < ring->_headIdx + __CFArrayGetCount(array)) {
+	__CFArrayRingReallocate(array, ring->_capacity, CFRangeMake(__CFArrayGetCount(array), 0), 0);
     }
 }
 
@@ -334,6 +477,9 @@ static CFStringRef __CFArrayCopyDescription(CFTypeRef cf) {
     case __kCFArrayStorage:
 	CFStringAppendFormat(result, NULL, CFSTR("<CFArray %p [%p]>{type = mutable-large, count = %u, values = (\n"), cf, allocator, cnt);
 	break;
+    case __kCFArrayRing:
+	CFStringAppendFormat(result, NULL, CFSTR("<CFArray %p [%p]>{type = mutable-queue, count = %u, values = (\n"), cf, allocator, cnt);
+	break;
     }
     cb = __CFArrayGetCallBacks(array);
     for (idx = 0; idx < cnt; idx++) {
@@ -422,6 +568,7 @@ static CFArrayRef __CFArrayInit(CFAllocatorRef allocator, UInt32 flags, CFIndex
 	break;
     case __kCFArrayDeque:
     case __kCFArrayStorage:
+    case __kCFArrayRing:
 	break;
     }
     memory = (struct __CFArray*)_CFRuntimeCreateInstance(allocator, __kCFArrayTypeID, size, NULL);
@@ -439,6 +586,7 @@ static CFArrayRef __CFArrayInit(CFAllocatorRef allocator, UInt32 flags, CFIndex
 	break;
     case __kCFArrayDeque:
     case __kCFArrayStorage:
+    case __kCFArrayRing:
 	if (__CFOASafe) __CFSetLastAllocationEventName(memory, "CFArray (mutable-variable)");
 	((struct __CFArray *)memory)->_mutations = 1;
 	((struct __CFArray*)memory)->_store = NULL;
@@ -492,6 +640,15 @@ CFMutableArrayRef CFArrayCreateMutable(CFAllocatorRef allocator, CFIndex capacit
     return (CFMutableArrayRef)__CFArrayInit(allocator, __kCFArrayDeque, capacity, callBacks);
 }
 
+CFMutableArrayRef CFArrayCreateMutableQueue(CFAllocatorRef allocator, CFIndex capacity, const CFArrayCallBacks *callBacks) {
+    CFMutableArrayRef result;
+    CFAssert2(0 <= capacity, __kCFLogAssertion, "%s(): capacity (%d) cannot be less than zero", __PRETTY_FUNCTION__, capacity);
+    CFAssert2(capacity <= (CFIndex)(LONG_MAX / sizeof(void *)), __kCFLogAssertion, "%s(): capacity (%d) is too large for this architecture", __PRETTY_FUNCTION__, capacity);
+    result = (CFMutableArrayRef)__CFArrayInit(allocator, __kCFArrayRing, capacity, callBacks);
+    if (0 < capacity) _CFArraySetCapacity(result, capacity);
+    return result;
+}
+
 // This creates an array which is for CFTypes or NSObjects, with an ownership transfer --
 // the array does not take a retain, and the caller does not need to release the inserted objects.
 // The incoming objects must also be collectable if allocated out of a collectable allocator.
@@ -657,6 +814,9 @@ void CFArrayGetValues(CFArrayRef array, CFRange range, const void **values) {
 	    CFStorageGetValues(store, range, values);
 	    break;
 	}
+	case __kCFArrayRing:
+	    __CFArrayRingGetValues((struct __CFArrayRing *)array->_store, range, values);
+	    break;
 	}
     }
 }
@@ -664,7 +824,7 @@ void CFArrayGetValues(CFArrayRef array, CFRange range, const void **values) {
 
 unsigned long _CFArrayFastEnumeration(CFArrayRef array, struct __objcFastEnumerationStateEquivalent *state, void *stackbuffer, unsigned long count) {
     if (array->_count == 0) return 0;
-    enum { ATSTART = 0, ATEND = 1 };
+    enum { ATSTART = 0, ATEND = 1, ATWRAPPED = 2 };
     switch (__CFArrayGetType(array)) {
     case __kCFArrayImmutable:
         if (state->state == ATSTART) { /* first time */
@@ -686,6 +846,22 @@ unsigned long _CFArrayFastEnumeration(CFArrayRef array, struct __objcFastEnumera
     case __kCFArrayStorage:
         state->mutationsPtr = (unsigned long *)&array->_mutations;
         return _CFStorageFastEnumeration((CFStorageRef)array->_store, state, stackbuffer, count);
+    case __kCFArrayRing: {	/* the values up to the end of the ring, then those that wrapped around to the start */
+	struct __CFArrayRing *ring = (struct __CFArrayRing *)array->_store;
+	CFIndex firstLength = __CFMin(array->_count, ring->_capacity - ring->_headIdx);
+        state->mutationsPtr = (unsigned long *)&array->_mutations;
+        if (state->state == ATSTART) {
+            state->state = (firstLength < array->_count) ? ATWRAPPED : ATEND;
+            state->itemsPtr = (unsigned long *)(__CFArrayRingGetBuckets(ring) + ring->_headIdx);
+            return firstLength;
+        }
+        if (state->state == ATWRAPPED) {
+            state->state = ATEND;
+            state->itemsPtr = (unsigned long *)__CFArrayRingGetBuckets(ring);
+            return array->_count - firstLength;
+        }
+        return 0;
+    }
     }
     return 0;
 }
@@ -803,14 +979,45 @@ void CFArrayRemoveValueAtIndex(CFMutableArrayRef array, CFIndex idx) {
 }
 
 void CFArrayRemoveAllValues(CFMutableArrayRef array) {
+    Boolean keepRing;
     CF_OBJC_FUNCDISPATCH0(__kCFArrayTypeID, void, array, "removeAllObjects");
     __CFGenericValidateType(array, __kCFArrayTypeID);
     CFAssert1(__CFArrayGetType(array) != __kCFArrayImmutable, __kCFLogAssertion, "%s(): array is immutable", __PRETTY_FUNCTION__);
-    __CFArrayReleaseValues(array, CFRangeMake(0, __CFArrayGetCount(array)), true);
+    // A ring with a requested capacity keeps its buckets for the values to come
+    keepRing = (__kCFArrayRing == __CFArrayGetType(array) && NULL != array->_store && 0 < ((struct __CFArrayRing *)array->_store)->_minCapacity);
+    __CFArrayReleaseValues(array, CFRangeMake(0, __CFArrayGetCount(array)), !keepRing);
     __CFArraySetCount(array, 0);
     array->_mutations++;
 }
 
+CFIndex CFArrayDequeueValues(CFMutableArrayRef array, const void **values, CFIndex maxCount) {
+    CFIndex cnt, idx;
+    __CFGenericValidateType(array, __kCFArrayTypeID);
+    CFAssert1(__CFArrayGetType(array) != __kCFArrayImmutable, __kCFLogAssertion, "%s(): array is immutable", __PRETTY_FUNCTION__);
+    CFAssert1(NULL != values || 0 == maxCount, __kCFLogAssertion, "%s(): pointer to values may not be NULL", __PRETTY_FUNCTION__);
+    cnt = __CFMin(maxCount, __CFArrayGetCount(array));
+    if (cnt <= 0) return 0;
+    if (__kCFArrayRing == __CFArrayGetType(array) && !__CFArrayRingShouldShrink((struct __CFArrayRing *)array->_store, __CFArrayGetCount(array) - cnt)) {
+	// The array's references go to the caller, so there is nothing to retain or release
+	struct __CFArrayRing *ring = (struct __CFArrayRing *)array->_store;
+	struct __CFArrayBucket *buckets = __CFArrayRingGetBuckets(ring);
+	__CFArrayRingGetValues(ring, CFRangeMake(0, cnt), values);
+	for (idx = 0; idx < cnt; idx++) buckets[__CFArrayRingGetBucketIndex(ring, idx)]._item = NULL; // GC:  break strong reference.
+	ring->_headIdx = __CFArrayRingGetBucketIndex(ring, cnt);
+	__CFArraySetCount(array, __CFArrayGetCount(array) - cnt);
+	array->_mutations++;
+    } else {
+	const CFArrayCallBacks *cb = __CFArrayGetCallBacks(array);
+	CFArrayGetValues(array, CFRangeMake(0, cnt), values);
+	if (NULL != cb->retain && !hasBeenFinalized(array)) {
+	    CFAllocatorRef allocator = __CFGetAllocator(array);
+	    for (idx = 0; idx < cnt; idx++) values[idx] = (void *)INVOKE_CALLBACK2(cb->retain, allocator, values[idx]);
+	}
+	_CFArrayReplaceValues(array, CFRangeMake(0, cnt), NULL, 0);
+    }
+    return cnt;
+}
+
 static void __CFArrayConvertDequeToStore(CFMutableArrayRef array) {
     struct __CFArrayDeque *deque = (struct __CFArrayDeque *)array->_store;
     struct __CFArrayBucket *raw_buckets = (struct __CFArrayBucket *)((uint8_t *)deque + sizeof(struct __CFArrayDeque));
@@ -980,7 +1187,12 @@ void _CFArraySetCapacity(CFMutableArrayRef array, CFIndex cap) {
 	deque->_capacity = capacity;
 	deque->_bias = 0;
 	CF_WRITE_BARRIER_BASE_ASSIGN(allocator, array, array->_store, deque);
-    }    
+    } else if (__CFArrayGetType(array) == __kCFArrayRing) {
+	struct __CFArrayRing *ring = (struct __CFArrayRing *)array->_store;
+	CFIndex capacity = __CFArrayRingRoundUpCapacity(cap);
+	if (NULL == ring || ring->_capacity < capacity) __CFArrayRingReallocate(array, capacity, CFRangeMake(__CFArrayGetCount(array), 0), 0);
+	((struct __CFArrayRing *)array->_store)->_minCapacity = capacity;
+    }
 }
 
 // This function is for Foundation's benefit; no one else should use it.
@@ -1035,7 +1247,9 @@ void _CFArrayReplaceValues(CFMutableArrayRef array, CFRange range, const void **
 	__CFArrayReleaseValues(array, range, false);
     }
     // region B elements are now "dead"
-    if (__kCFArrayStorage == __CFArrayGetType(array)) {
+    if (__kCFArrayRing == __CFArrayGetType(array)) {
+	if (range.length != newCount || NULL == array->_store) __CFArrayRingRepositionRegions(array, range, newCount);
+    } else if (__kCFArrayStorage == __CFArrayGetType(array)) {
 	CFStorageRef store = (CFStorageRef)array->_store;
 	// reposition regions A and C for new region B elements in gap
 	if (range.length < newCount) {
@@ -1085,6 +1299,8 @@ void _CFArrayReplaceValues(CFMutableArrayRef array, CFRange range, const void **
 	if (__kCFArrayStorage == __CFArrayGetType(array)) {
 	    CFStorageRef store = (CFStorageRef)array->_store;
 	    CFStorageReplaceValues(store, CFRangeMake(range.location, newCount), newv);
+	} else if (__kCFArrayRing == __CFArrayGetType(array)) {
+	    __CFArrayRingSetValues((struct __CFArrayRing *)array->_store, CFRangeMake(range.location, newCount), newv);
 	} else {	// Deque
 	    struct __CFArrayDeque *deque = (struct __CFArrayDeque *)array->_store;
 	    struct __CFArrayBucket *raw_buckets = (struct __CFArrayBucket *)((uint8_t *)deque + sizeof(struct __CFArrayDeque));
@@ -1110,9 +1326,7 @@ static CFComparisonResult __CFArrayCompareValues(const void *v1, const void *v2,
     return (CFComparisonResult)(INVOKE_CALLBACK3(context->func, *val1, *val2, context->context));
 }
 
-void CFArraySortValues(CFMutableArrayRef array, CFRange range, CFComparatorFunction comparator, void *context) {
-    FAULT_CALLBACK((void **)&(comparator));
-    CF_OBJC_FUNCDISPATCH3(__kCFArrayTypeID, void, array, "sortUsingFunction:context:range:", comparator, context, range);
+static void __CFArraySortValues(CFMutableArrayRef array, CFRange range, CFComparatorFunction comparator, void *context, Boolean stable, Boolean concurrent) {
     __CFGenericValidateType(array, __kCFArrayTypeID);
     __CFArrayValidateRange(array, range, __PRETTY_FUNCTION__);
     CFAssert1(__CFArrayGetType(array) != __kCFArrayImmutable, __kCFLogAssertion, "%s(): array is immutable", __PRETTY_FUNCTION__);
@@ -1125,6 +1339,9 @@ void CFArraySortValues(CFMutableArrayRef array, CFRange range, CFComparatorFunct
 	ctx.func = comparator;
 	ctx.context = context;
 	switch (__CFArrayGetType(array)) {
+	case __kCFArrayRing:
+	    __CFArrayRingMakeContiguous(array);
+	    /* fall through */
 	case __kCFArrayDeque:
 	    bucket = __CFArrayGetBucketsPtr(array) + range.location;
 	    if (CF_USING_COLLECTABLE_MEMORY && isStrongMemory(array)) {
@@ -1132,7 +1349,7 @@ void CFArraySortValues(CFMutableArrayRef array, CFRange range, CFComparatorFunct
                 __CFObjCWriteBarrierRange(bucket, size);
                 CFQSortArray(bucket, range.length, sizeof(void *), (CFComparatorFunction)__CFArrayCompareValues, &ctx);
             } else {
-                CFQSortArray(bucket, range.length, sizeof(void *), (CFComparatorFunction)__CFArrayCompareValues, &ctx);
+                if (concurrent) __CFSortValuesConcurrent((const void **)bucket, range.length, stable, comparator, context); else __CFSortValues((const void **)bucket, range.length, stable, comparator, context);
             }
 	    break;
 	case __kCFArrayStorage: {
@@ -1142,7 +1359,52 @@ void CFArraySortValues(CFMutableArrayRef array, CFRange range, CFComparatorFunct
 	    values = (range.length <= 256) ? (const void **)buffer : (const void **)CFAllocatorAllocate(allocator, range.length * sizeof(void *), 0); // GC OK
 	    if (values != buffer && __CFOASafe) __CFSetLastAllocationEventName(values, "CFArray (temp)");
 	    CFStorageGetValues(store, range, values);
-	    CFQSortArray(values, range.length, sizeof(void *), (CFComparatorFunction)__CFArrayCompareValues, &ctx);
+	    if (concurrent) __CFSortValuesConcurrent(values, range.length, stable, comparator, context); else __CFSortValues(values, range.length, stable, comparator, context);
+	    CFStorageReplaceValues(store, range, values);
+	    if (values != buffer) CFAllocatorDeallocate(allocator, values);  // GC OK
+	    break;
+	}
+	}
+    }
+}
+
+void CFArraySortValues(CFMutableArrayRef array, CFRange range, CFComparatorFunction comparator, void *context) {
+    FAULT_CALLBACK((void **)&(comparator));
+    CF_OBJC_FUNCDISPATCH3(__kCFArrayTypeID, void, array, "sortUsingFunction:context:range:", comparator, context, range);
+    __CFArraySortValues(array, range, comparator, context, false, false);
+}
+
+void CFArraySortValuesConcurrent(CFMutableArrayRef array, CFRange range, CFComparatorFunction comparator, void *context, Boolean stable) {
+    FAULT_CALLBACK((void **)&(comparator));
+    CF_OBJC_FUNCDISPATCH3(__kCFArrayTypeID, void, array, "sortUsingFunction:context:range:", comparator, context, range);
+    __CFArraySortValues(array, range, comparator, context, stable, true);
+}
+
+void CFArraySortStringValues(CFMutableArrayRef array, CFRange range, CFOptionFlags compareOptions, CFLocaleRef locale) {
+    __CFGenericValidateType(array, __kCFArrayTypeID);
+    __CFArrayValidateRange(array, range, __PRETTY_FUNCTION__);
+    CFAssert1(__CFArrayGetType(array) != __kCFArrayImmutable, __kCFLogAssertion, "%s(): array is immutable", __PRETTY_FUNCTION__);
+    array->_mutations++;
+
+    if (1 < range.length) {
+	struct __CFArrayBucket *bucket;
+	switch (__CFArrayGetType(array)) {
+	case __kCFArrayRing:
+	    __CFArrayRingMakeContiguous(array);
+	    /* fall through */
+	case __kCFArrayDeque:
+	    bucket = __CFArrayGetBucketsPtr(array) + range.location;
+	    if (CF_USING_COLLECTABLE_MEMORY && isStrongMemory(array)) __CFObjCWriteBarrierRange(bucket, range.length * sizeof(void *));
+	    CFStringSortValues((CFStringRef *)bucket, range.length, compareOptions, locale);
+	    break;
+	case __kCFArrayStorage: {
+	    CFStorageRef store = (CFStorageRef)array->_store;
+	    CFAllocatorRef allocator = __CFGetAllocator(array);
+	    const void **values, *buffer[256];
+	    values = (range.length <= 256) ? (const void **)buffer : (const void **)CFAllocatorAllocate(allocator, range.length * sizeof(void *), 0); // GC OK
+	    if (values != buffer && __CFOASafe) __CFSetLastAllocationEventName(values, "CFArray (temp)");
+	    CFStorageGetValues(store, range, values);
+	    CFStringSortValues((CFStringRef *)values, range.length, compareOptions, locale);
 	    CFStorageReplaceValues(store, range, values);
 	    if (values != buffer) CFAllocatorDeallocate(allocator, values);  // GC OK
 	    break;
@@ -1159,7 +1421,7 @@ CFIndex CFArrayBSearchValues(CFArrayRef array, CFRange range, const void *value,
     FAULT_CALLBACK((void **)&(comparator));
     CFIndex idx = 0;
     if (range.length <= 0) return range.location;
-    if (isObjC || __kCFArrayStorage == __CFArrayGetType(array)) {
+    if (isObjC || __kCFArrayStorage == __CFArrayGetType(array) || __kCFArrayRing == __CFArrayGetType(array)) {
 	const void *item;
 	SInt32 lg;
 	item = CFArrayGetValueAtIndex(array, range.location + range.length - 1);
@@ -815,6 +815,11 @@ __private_extern__ pthread_key_t __CFTSDKey = (pthread_key_t)NULL;
 __private_extern__ DWORD __CFTSDKey = 0xFFFFFFFF;
 #endif
 
+#if CF_TSD_USES_TLS
+__private_extern__ __thread __CFThreadSpecificData *__CFTSDCurrent __attribute__((tls_model("initial-exec"))) = NULL;
+static __thread __CFThreadSpecificData __CFTSDStorage __attribute__((tls_model("initial-exec")));
+#endif
+
 extern void _CFRunLoop1(void);
 
 // Called for each thread as it exits
@@ -827,6 +832,8 @@ __private_extern__ void __CFFinalizeThreadData(void *arg) {
 #endif
     if (NULL == tsd) return; 
     if (tsd->_allocator) CFRelease(tsd->_allocator);
+    tsd->_runLoop = NULL;
+    memset(&tsd->_uuidRandom, 0, sizeof(tsd->_uuidRandom));
 #if DEPLOYMENT_TARGET_MACOSX
     _CFRunLoop1();
 #endif
@@ -836,11 +843,26 @@ __private_extern__ void __CFFinalizeThreadData(void *arg) {
 
 #endif
 
+#if CF_TSD_USES_TLS
+    // The storage is the thread's own; forget it, so that any later use on this thread (from other destructors) registers it again
+    tsd->_allocator = NULL;
+    __CFTSDCurrent = NULL;
+#else
     CFAllocatorDeallocate(kCFAllocatorSystemDefault, tsd);
+#endif
 }
 
 __private_extern__ __CFThreadSpecificData *__CFGetThreadSpecificData(void) {
-#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX || DEPLOYMENT_TARGET_FREEBSD
+#if CF_TSD_USES_TLS
+    __CFThreadSpecificData *data = __CFTSDCurrent;
+    if (data) {
+        return data;
+    }
+    data = &__CFTSDStorage;
+    pthread_setspecific(__CFTSDKey, data);
+    __CFTSDCurrent = data;
+    return data;
+#elif DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX || DEPLOYMENT_TARGET_FREEBSD
     __CFThreadSpecificData *data;
     data = (__CFThreadSpecificData*)pthread_getspecific(__CFTSDKey);
     if (data) {
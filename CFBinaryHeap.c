@@ -61,6 +61,10 @@ struct __CFBinaryHeap {
     CFBinaryHeapCallBacks _callbacks;
     CFBinaryHeapCompareContext _context;
     struct __CFBinaryHeapBucket *_buckets;
+    CFIndex *_handles;		/* handle of the value in each bucket; NULL unless indexed */
+    CFIndex *_positions;	/* bucket of each live handle; free handles are chained through negative entries */
+    CFIndex _freeHandle;	/* first free handle, or -1 */
+    CFIndex _numHandles;	/* handles issued so far, live or free */
 };
 
 CF_INLINE CFIndex __CFBinaryHeapCount(CFBinaryHeapRef heap) {
@@ -101,6 +105,15 @@ enum {      /* bits 1-0 */
 
 /* Bits 4-5 are used by GC */
 
+enum {      /* bit 6 */
+    __kCFBinaryHeapQuaternary = 0x40,	/* each bucket has 4 children instead of 2 */
+};
+
+enum {      /* creation flags only, never stored */
+    __kCFBinaryHeapIndexed = 0x100,	/* keep the handle tables */
+    __kCFBinaryHeapOrdered = 0x200,	/* the initial values are already a heap of the same arity */
+};
+
 CF_INLINE bool isStrongMemory_Heap(CFTypeRef collection) {
     return __CFBitfieldGetValue(((const CFRuntimeBase *)collection)->_cfinfo[CF_INFO_BITS], 4, 4) == 0;
 }
@@ -121,6 +134,11 @@ CF_INLINE UInt32 __CFBinaryHeapMutableVarietyFromFlags(UInt32 flags) {
     return __CFBitfieldGetValue(flags, 1, 0);
 }
 
+/* log2 of the number of children of each bucket */
+CF_INLINE CFIndex __CFBinaryHeapShift(CFBinaryHeapRef heap) {
+    return __CFBitfieldGetValue(((const CFRuntimeBase *)heap)->_cfinfo[CF_INFO_BITS], 6, 6) ? 2 : 1;
+}
+
 static Boolean __CFBinaryHeapEqual(CFTypeRef cf1, CFTypeRef cf2) {
     CFBinaryHeapRef heap1 = (CFBinaryHeapRef)cf1;
     CFBinaryHeapRef heap2 = (CFBinaryHeapRef)cf2;
@@ -200,6 +218,10 @@ static void __CFBinaryHeapDeallocate(CFTypeRef cf) {
     if (__CFBinaryHeapMutableVariety(heap) == kCFBinaryHeapMutable) {
 	_CFAllocatorDeallocateGC(allocator, heap->_buckets);
     }
+    if (NULL != heap->_handles) {
+	_CFAllocatorDeallocateGC(allocator, heap->_handles);
+	_CFAllocatorDeallocateGC(allocator, heap->_positions);
+    }
 }
 
 static CFTypeID __kCFBinaryHeapTypeID = _kCFRuntimeNotATypeID;
@@ -224,6 +246,98 @@ CFTypeID CFBinaryHeapGetTypeID(void) {
     return __kCFBinaryHeapTypeID;
 }
 
+static void __CFBinaryHeapGrow(CFBinaryHeapRef heap, CFIndex numNewValues) {
+    CFIndex oldCount = __CFBinaryHeapCount(heap);
+    CFIndex capacity = __CFBinaryHeapRoundUpCapacity(oldCount + numNewValues);
+    CFAllocatorRef allocator = CFGetAllocator(heap);
+    __CFBinaryHeapSetCapacity(heap, capacity);
+    __CFBinaryHeapSetNumBuckets(heap, __CFBinaryHeapNumBucketsForCapacity(capacity));
+    void *buckets = _CFAllocatorReallocateGC(allocator, heap->_buckets, __CFBinaryHeapNumBuckets(heap) * sizeof(struct __CFBinaryHeapBucket), isStrongMemory_Heap(heap) ? __kCFAllocatorGCScannedMemory : 0);
+    CF_WRITE_BARRIER_BASE_ASSIGN(allocator, heap, heap->_buckets, buckets);
+    if (__CFOASafe) __CFSetLastAllocationEventName(heap->_buckets, "CFBinaryHeap (store)");
+    if (NULL == heap->_buckets) HALT;
+    if (NULL != heap->_handles) {
+	heap->_handles = (CFIndex *)_CFAllocatorReallocateGC(allocator, heap->_handles, capacity * sizeof(CFIndex), 0);
+	heap->_positions = (CFIndex *)_CFAllocatorReallocateGC(allocator, heap->_positions, capacity * sizeof(CFIndex), 0);
+	if (NULL == heap->_handles || NULL == heap->_positions) HALT;
+    }
+}
+
+/* Handles are recycled, so no more are ever issued than the heap has held values at once, and the handle tables fit in _capacity. */
+static CFIndex __CFBinaryHeapNewHandle(CFBinaryHeapRef heap) {
+    CFIndex handle = heap->_freeHandle;
+    if (0 <= handle) {
+	heap->_freeHandle = -2 - heap->_positions[handle];
+	return handle;
+    }
+    return heap->_numHandles++;
+}
+
+CF_INLINE void __CFBinaryHeapFreeHandle(CFBinaryHeapRef heap, CFIndex handle) {
+    heap->_positions[handle] = -2 - heap->_freeHandle;
+    heap->_freeHandle = handle;
+}
+
+CF_INLINE Boolean __CFBinaryHeapHandleIsValid(CFBinaryHeapRef heap, CFIndex handle) {
+    return NULL != heap->_handles && 0 <= handle && handle < heap->_numHandles && 0 <= heap->_positions[handle];
+}
+
+CF_INLINE void __CFBinaryHeapSetBucket(CFAllocatorRef allocator, CFBinaryHeapRef heap, CFIndex idx, void *item, CFIndex handle) {
+    CF_WRITE_BARRIER_BASE_ASSIGN(allocator, heap->_buckets, heap->_buckets[idx]._item, item);
+    if (NULL != heap->_handles) {
+	heap->_handles[idx] = handle;
+	heap->_positions[handle] = idx;
+    }
+}
+
+CF_INLINE void __CFBinaryHeapMoveBucket(CFAllocatorRef allocator, CFBinaryHeapRef heap, CFIndex idx, CFIndex fromIdx) {
+    __CFBinaryHeapSetBucket(allocator, heap, idx, heap->_buckets[fromIdx]._item, (NULL != heap->_handles) ? heap->_handles[fromIdx] : 0);
+}
+
+/* Both sifts move the hole at idx until value (already retained) can be stored there. */
+static void __CFBinaryHeapSiftUp(CFAllocatorRef allocator, CFBinaryHeapRef heap, CFIndex idx, void *value, CFIndex handle) {
+    CFIndex shift = __CFBinaryHeapShift(heap);
+    while (0 < idx) {
+	CFIndex pidx = (idx - 1) >> shift;
+	void *item = heap->_buckets[pidx]._item;
+	if (kCFCompareGreaterThan != heap->_callbacks.compare(item, value, heap->_context.info)) break;
+	__CFBinaryHeapMoveBucket(allocator, heap, idx, pidx);
+	idx = pidx;
+    }
+    __CFBinaryHeapSetBucket(allocator, heap, idx, value, handle);
+}
+
+static void __CFBinaryHeapSiftDown(CFAllocatorRef allocator, CFBinaryHeapRef heap, CFIndex idx, void *value, CFIndex handle) {
+    CFIndex shift = __CFBinaryHeapShift(heap);
+    CFIndex cnt = __CFBinaryHeapCount(heap);
+    CFIndex cidx;
+    while ((cidx = (idx << shift) + 1) < cnt) {
+	CFIndex kidx, last = cidx + (1 << shift) - 1;
+	void *item = heap->_buckets[cidx]._item;
+	if (cnt <= last) last = cnt - 1;
+	for (kidx = cidx + 1; kidx <= last; kidx++) {
+	    void *item2 = heap->_buckets[kidx]._item;
+	    if (kCFCompareGreaterThan == heap->_callbacks.compare(item, item2, heap->_context.info)) {
+		cidx = kidx;
+		item = item2;
+	    }
+	}
+	if (kCFCompareGreaterThan == heap->_callbacks.compare(item, value, heap->_context.info)) break;
+	__CFBinaryHeapMoveBucket(allocator, heap, idx, cidx);
+	idx = cidx;
+    }
+    __CFBinaryHeapSetBucket(allocator, heap, idx, value, handle);
+}
+
+/* Stores value in the bucket at idx, which held some other value, and restores the heap order */
+static void __CFBinaryHeapReplace(CFAllocatorRef allocator, CFBinaryHeapRef heap, CFIndex idx, void *value, CFIndex handle) {
+    if (0 < idx && kCFCompareGreaterThan == heap->_callbacks.compare(heap->_buckets[(idx - 1) >> __CFBinaryHeapShift(heap)]._item, value, heap->_context.info)) {
+	__CFBinaryHeapSiftUp(allocator, heap, idx, value, handle);
+    } else {
+	__CFBinaryHeapSiftDown(allocator, heap, idx, value, handle);
+    }
+}
+
 static CFBinaryHeapRef __CFBinaryHeapInit(CFAllocatorRef allocator, UInt32 flags, CFIndex capacity, const void **values, CFIndex numValues, const CFBinaryHeapCallBacks *callBacks, const CFBinaryHeapCompareContext *compareContext) {
     CFBinaryHeapRef memory;
     CFIndex idx;
@@ -242,8 +356,8 @@ static CFBinaryHeapRef __CFBinaryHeapInit(CFAllocatorRef allocator, UInt32 flags
     if (NULL == memory) {
 	return NULL;
     }
-	__CFBinaryHeapSetCapacity(memory, __CFBinaryHeapRoundUpCapacity(1));
-	__CFBinaryHeapSetNumBuckets(memory, __CFBinaryHeapNumBucketsForCapacity(__CFBinaryHeapRoundUpCapacity(1)));
+	__CFBinaryHeapSetCapacity(memory, __CFBinaryHeapRoundUpCapacity(numValues));
+	__CFBinaryHeapSetNumBuckets(memory, __CFBinaryHeapNumBucketsForCapacity(__CFBinaryHeapRoundUpCapacity(numValues)));
 	void *buckets = _CFAllocatorAllocateGC(allocator, __CFBinaryHeapNumBuckets(memory) * sizeof(struct __CFBinaryHeapBucket), isStrongMemory_Heap(memory) ? __kCFAllocatorGCScannedMemory : 0);
 	CF_WRITE_BARRIER_BASE_ASSIGN(allocator, memory, memory->_buckets, buckets);
 	if (__CFOASafe) __CFSetLastAllocationEventName(memory->_buckets, "CFBinaryHeap (store)");
@@ -251,6 +365,16 @@ static CFBinaryHeapRef __CFBinaryHeapInit(CFAllocatorRef allocator, UInt32 flags
 	    CFRelease(memory);
 	    return NULL;
 	}
+    memory->_freeHandle = -1;
+    if (flags & __kCFBinaryHeapIndexed) {
+	memory->_handles = (CFIndex *)_CFAllocatorAllocateGC(allocator, __CFBinaryHeapCapacity(memory) * sizeof(CFIndex), 0);
+	memory->_positions = (CFIndex *)_CFAllocatorAllocateGC(allocator, __CFBinaryHeapCapacity(memory) * sizeof(CFIndex), 0);
+	if (NULL == memory->_handles || NULL == memory->_positions) {
+	    CFRelease(memory);
+	    return NULL;
+	}
+    }
+    if (flags & __kCFBinaryHeapQuaternary) __CFBitfieldSetValue(((CFRuntimeBase *)memory)->_cfinfo[CF_INFO_BITS], 6, 6, 1);
     __CFBinaryHeapSetNumBucketsUsed(memory, 0);
     __CFBinaryHeapSetCount(memory, 0);
     if (NULL != callBacks) {
@@ -264,22 +388,62 @@ static CFBinaryHeapRef __CFBinaryHeapInit(CFAllocatorRef allocator, UInt32 flags
 	memory->_callbacks.copyDescription = 0;
 	memory->_callbacks.compare = 0;
     }
-    __CFBinaryHeapSetMutableVariety(memory, kCFBinaryHeapMutable);
+    if (compareContext) memcpy(&memory->_context, compareContext, sizeof(CFBinaryHeapCompareContext));
+    /* Bottom-up heap construction: O(n) comparisons rather than the O(n log n) of adding the values one by one */
     for (idx = 0; idx < numValues; idx++) {
-	CFBinaryHeapAddValue(memory, values[idx]);
+	void *value = (void *)values[idx];
+	if (memory->_callbacks.retain) value = (void *)memory->_callbacks.retain(allocator, value);
+	CF_WRITE_BARRIER_BASE_ASSIGN(allocator, memory->_buckets, memory->_buckets[idx]._item, value);
+	if (NULL != memory->_handles) memory->_handles[idx] = memory->_positions[idx] = idx;
+    }
+    __CFBinaryHeapSetNumBucketsUsed(memory, numValues);
+    __CFBinaryHeapSetCount(memory, numValues);
+    memory->_numHandles = (NULL != memory->_handles) ? numValues : 0;
+    if (!(flags & __kCFBinaryHeapOrdered)) {
+	for (idx = (numValues - 2) >> __CFBinaryHeapShift(memory); 0 <= idx; idx--) {
+	    __CFBinaryHeapSiftDown(allocator, memory, idx, memory->_buckets[idx]._item, idx);
+	}
     }
     __CFBinaryHeapSetMutableVariety(memory, __CFBinaryHeapMutableVarietyFromFlags(flags));
-    if (compareContext) memcpy(&memory->_context, compareContext, sizeof(CFBinaryHeapCompareContext));
     return memory;
 }
 
+CF_INLINE UInt32 __CFBinaryHeapFlagsFromOptions(CFOptionFlags options) {
+    UInt32 flags = kCFBinaryHeapMutable;
+    if (options & kCFBinaryHeapIndexed) flags |= __kCFBinaryHeapIndexed;
+    if (options & kCFBinaryHeapQuaternary) flags |= __kCFBinaryHeapQuaternary;
+    return flags;
+}
+
 CFBinaryHeapRef CFBinaryHeapCreate(CFAllocatorRef allocator, CFIndex capacity, const CFBinaryHeapCallBacks *callBacks, const CFBinaryHeapCompareContext *compareContext) {
    return __CFBinaryHeapInit(allocator, kCFBinaryHeapMutable, capacity, NULL, 0, callBacks, compareContext);
 }
 
+CFBinaryHeapRef CFBinaryHeapCreateWithOptions(CFAllocatorRef allocator, CFIndex capacity, CFOptionFlags options, const CFBinaryHeapCallBacks *callBacks, const CFBinaryHeapCompareContext *compareContext) {
+   return __CFBinaryHeapInit(allocator, __CFBinaryHeapFlagsFromOptions(options), capacity, NULL, 0, callBacks, compareContext);
+}
+
+CFBinaryHeapRef CFBinaryHeapCreateWithValues(CFAllocatorRef allocator, const void **values, CFIndex numValues, CFOptionFlags options, const CFBinaryHeapCallBacks *callBacks, const CFBinaryHeapCompareContext *compareContext) {
+    CFAssert1(NULL != values || 0 == numValues, __kCFLogAssertion, "%s(): pointer to values may not be NULL", __PRETTY_FUNCTION__);
+    return __CFBinaryHeapInit(allocator, __CFBinaryHeapFlagsFromOptions(options), 0, values, numValues, callBacks, compareContext);
+}
+
+/* The copy has the same layout and, if the heap is indexed, the same handles */
 CFBinaryHeapRef CFBinaryHeapCreateCopy(CFAllocatorRef allocator, CFIndex capacity, CFBinaryHeapRef heap) {
-   __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
-    return __CFBinaryHeapInit(allocator, kCFBinaryHeapMutable, capacity, (const void **)heap->_buckets, __CFBinaryHeapCount(heap), &(heap->_callbacks), &(heap->_context));
+    CFBinaryHeapRef result;
+    UInt32 flags = kCFBinaryHeapMutable | __kCFBinaryHeapOrdered;
+    __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
+    if (2 == __CFBinaryHeapShift(heap)) flags |= __kCFBinaryHeapQuaternary;
+    if (NULL != heap->_handles) flags |= __kCFBinaryHeapIndexed;
+    result = __CFBinaryHeapInit(allocator, flags, capacity, (const void **)heap->_buckets, __CFBinaryHeapCount(heap), &(heap->_callbacks), &(heap->_context));
+    if (NULL != result && NULL != heap->_handles) {
+	if (__CFBinaryHeapCapacity(result) < heap->_numHandles) __CFBinaryHeapGrow(result, heap->_numHandles - __CFBinaryHeapCount(result));
+	memmove(result->_handles, heap->_handles, __CFBinaryHeapCount(heap) * sizeof(CFIndex));
+	memmove(result->_positions, heap->_positions, heap->_numHandles * sizeof(CFIndex));
+	result->_numHandles = heap->_numHandles;
+	result->_freeHandle = heap->_freeHandle;
+    }
+    return result;
 }
 
 CFIndex CFBinaryHeapGetCount(CFBinaryHeapRef heap) {
@@ -370,23 +534,9 @@ void CFBinaryHeapApplyFunction(CFBinaryHeapRef heap, CFBinaryHeapApplierFunction
     CFRelease(heapCopy);
 }
 
-static void __CFBinaryHeapGrow(CFBinaryHeapRef heap, CFIndex numNewValues) {
-    CFIndex oldCount = __CFBinaryHeapCount(heap);
-    CFIndex capacity = __CFBinaryHeapRoundUpCapacity(oldCount + numNewValues);
-    CFAllocatorRef allocator = CFGetAllocator(heap);
-    __CFBinaryHeapSetCapacity(heap, capacity);
-    __CFBinaryHeapSetNumBuckets(heap, __CFBinaryHeapNumBucketsForCapacity(capacity));
-    void *buckets = _CFAllocatorReallocateGC(allocator, heap->_buckets, __CFBinaryHeapNumBuckets(heap) * sizeof(struct __CFBinaryHeapBucket), isStrongMemory_Heap(heap) ? __kCFAllocatorGCScannedMemory : 0);
-    CF_WRITE_BARRIER_BASE_ASSIGN(allocator, heap, heap->_buckets, buckets);
-    if (__CFOASafe) __CFSetLastAllocationEventName(heap->_buckets, "CFBinaryHeap (store)");
-    if (NULL == heap->_buckets) HALT;
-}
-
-void CFBinaryHeapAddValue(CFBinaryHeapRef heap, const void *value) {
-    CFIndex idx, pidx;
-    CFIndex cnt;
+static CFIndex __CFBinaryHeapAddValue(CFBinaryHeapRef heap, const void *value) {
+    CFIndex cnt, handle = kCFNotFound;
     CFAllocatorRef allocator = CFGetAllocator(heap);
-    __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
     switch (__CFBinaryHeapMutableVariety(heap)) {
     case kCFBinaryHeapMutable:
 	if (__CFBinaryHeapNumBucketsUsed(heap) == __CFBinaryHeapCapacity(heap))
@@ -394,55 +544,32 @@ void CFBinaryHeapAddValue(CFBinaryHeapRef heap, const void *value) {
 	break;
     }
     cnt = __CFBinaryHeapCount(heap);
-    idx = cnt;
     __CFBinaryHeapSetNumBucketsUsed(heap, cnt + 1);
     __CFBinaryHeapSetCount(heap, cnt + 1);
-    pidx = (idx - 1) >> 1;
-    while (0 < idx) {
-	void *item = heap->_buckets[pidx]._item;
-	if (kCFCompareGreaterThan != heap->_callbacks.compare(item, value, heap->_context.info)) break;
-	CF_WRITE_BARRIER_BASE_ASSIGN(allocator, heap->_buckets, heap->_buckets[idx]._item, item);
-	idx = pidx;
-	pidx = (idx - 1) >> 1;
-    }
-    if (heap->_callbacks.retain) {
-	CF_WRITE_BARRIER_BASE_ASSIGN(allocator, heap->_buckets, heap->_buckets[idx]._item, (void *)heap->_callbacks.retain(allocator, (void *)value));
-    } else {
-	CF_WRITE_BARRIER_BASE_ASSIGN(allocator, heap->_buckets, heap->_buckets[idx]._item, (void *)value);
-    }
+    if (NULL != heap->_handles) handle = __CFBinaryHeapNewHandle(heap);
+    if (heap->_callbacks.retain) value = heap->_callbacks.retain(allocator, value);
+    __CFBinaryHeapSiftUp(allocator, heap, cnt, (void *)value, handle);
+    return handle;
+}
+
+void CFBinaryHeapAddValue(CFBinaryHeapRef heap, const void *value) {
+    __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
+    __CFBinaryHeapAddValue(heap, value);
 }
 
 void CFBinaryHeapRemoveMinimumValue(CFBinaryHeapRef heap) {
-    void *val;
-    CFIndex idx, cidx;
     CFIndex cnt;
     CFAllocatorRef allocator;
     __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
     cnt = __CFBinaryHeapCount(heap);
     if (0 == cnt) return;
-    idx = 0;
     __CFBinaryHeapSetNumBucketsUsed(heap, cnt - 1);
     __CFBinaryHeapSetCount(heap, cnt - 1);
     allocator = CFGetAllocator(heap);
     if (heap->_callbacks.release)
-	heap->_callbacks.release(allocator, heap->_buckets[idx]._item);
-    val = heap->_buckets[cnt - 1]._item;
-    cidx = (idx << 1) + 1;
-    while (cidx < __CFBinaryHeapCount(heap)) {
-	void *item = heap->_buckets[cidx]._item;
-	if (cidx + 1 < __CFBinaryHeapCount(heap)) {
-	    void *item2 = heap->_buckets[cidx + 1]._item;
-	    if (kCFCompareGreaterThan == heap->_callbacks.compare(item, item2, heap->_context.info)) {
-		cidx++;
-		item = item2;
-	    }
-	}
-	if (kCFCompareGreaterThan == heap->_callbacks.compare(item, val, heap->_context.info)) break;
-	CF_WRITE_BARRIER_BASE_ASSIGN(allocator, heap->_buckets, heap->_buckets[idx]._item, item);
-	idx = cidx;
-	cidx = (idx << 1) + 1;
-    }
-    CF_WRITE_BARRIER_BASE_ASSIGN(allocator, heap->_buckets, heap->_buckets[idx]._item, val);
+	heap->_callbacks.release(allocator, heap->_buckets[0]._item);
+    if (NULL != heap->_handles) __CFBinaryHeapFreeHandle(heap, heap->_handles[0]);
+    if (1 < cnt) __CFBinaryHeapSiftDown(allocator, heap, 0, heap->_buckets[cnt - 1]._item, (NULL != heap->_handles) ? heap->_handles[cnt - 1] : 0);
 }
 
 void CFBinaryHeapRemoveAllValues(CFBinaryHeapRef heap) {
@@ -455,5 +582,57 @@ void CFBinaryHeapRemoveAllValues(CFBinaryHeapRef heap) {
 	    heap->_callbacks.release(CFGetAllocator(heap), heap->_buckets[idx]._item);
     __CFBinaryHeapSetNumBucketsUsed(heap, 0);
     __CFBinaryHeapSetCount(heap, 0);
+    heap->_numHandles = 0;
+    heap->_freeHandle = -1;
+}
+
+CFBinaryHeapHandle CFBinaryHeapAddValueReturningHandle(CFBinaryHeapRef heap, const void *value) {
+    __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
+    CFAssert1(NULL != heap->_handles, __kCFLogAssertion, "%s(): binary heap was not created with kCFBinaryHeapIndexed", __PRETTY_FUNCTION__);
+    return __CFBinaryHeapAddValue(heap, value);
 }
 
+Boolean CFBinaryHeapContainsHandle(CFBinaryHeapRef heap, CFBinaryHeapHandle handle) {
+    __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
+    return __CFBinaryHeapHandleIsValid(heap, handle);
+}
+
+const void *CFBinaryHeapGetValueWithHandle(CFBinaryHeapRef heap, CFBinaryHeapHandle handle) {
+    __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
+    CFAssert2(__CFBinaryHeapHandleIsValid(heap, handle), __kCFLogAssertion, "%s(): handle (%d) is not in the heap", __PRETTY_FUNCTION__, handle);
+    return heap->_buckets[heap->_positions[handle]]._item;
+}
+
+CFBinaryHeapHandle CFBinaryHeapGetMinimumHandle(CFBinaryHeapRef heap) {
+    __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
+    CFAssert1(NULL != heap->_handles, __kCFLogAssertion, "%s(): binary heap was not created with kCFBinaryHeapIndexed", __PRETTY_FUNCTION__);
+    return (0 < __CFBinaryHeapCount(heap) && NULL != heap->_handles) ? heap->_handles[0] : kCFNotFound;
+}
+
+void CFBinaryHeapRemoveValueWithHandle(CFBinaryHeapRef heap, CFBinaryHeapHandle handle) {
+    CFIndex idx, cnt;
+    CFAllocatorRef allocator = CFGetAllocator(heap);
+    __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
+    CFAssert2(__CFBinaryHeapHandleIsValid(heap, handle), __kCFLogAssertion, "%s(): handle (%d) is not in the heap", __PRETTY_FUNCTION__, handle);
+    idx = heap->_positions[handle];
+    cnt = __CFBinaryHeapCount(heap) - 1;
+    __CFBinaryHeapSetNumBucketsUsed(heap, cnt);
+    __CFBinaryHeapSetCount(heap, cnt);
+    if (heap->_callbacks.release)
+	heap->_callbacks.release(allocator, heap->_buckets[idx]._item);
+    __CFBinaryHeapFreeHandle(heap, handle);
+    if (idx < cnt) __CFBinaryHeapReplace(allocator, heap, idx, heap->_buckets[cnt]._item, heap->_handles[cnt]);
+}
+
+void CFBinaryHeapUpdateValueWithHandle(CFBinaryHeapRef heap, CFBinaryHeapHandle handle, const void *value) {
+    CFIndex idx;
+    void *old;
+    CFAllocatorRef allocator = CFGetAllocator(heap);
+    __CFGenericValidateType(heap, __kCFBinaryHeapTypeID);
+    CFAssert2(__CFBinaryHeapHandleIsValid(heap, handle), __kCFLogAssertion, "%s(): handle (%d) is not in the heap", __PRETTY_FUNCTION__, handle);
+    idx = heap->_positions[handle];
+    old = heap->_buckets[idx]._item;
+    if (heap->_callbacks.retain) value = heap->_callbacks.retain(allocator, value);
+    if (heap->_callbacks.release) heap->_callbacks.release(allocator, old);
+    __CFBinaryHeapReplace(allocator, heap, idx, (void *)value, handle);
+}
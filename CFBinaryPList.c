@@ -107,6 +107,7 @@ CF_INLINE uint64_t __check_uint64_mul_unsigned_unsigned(uint64_t x, uint64_t y,
 
 
 CF_INLINE CFTypeID __CFGenericTypeID_genericobj_inline(const void *cf) {
+    if (CF_IS_TAGGED_OBJ(cf)) return __CFGenericTypeID(cf);
     CFTypeID typeID = (*(uint32_t *)(((CFRuntimeBase *)cf)->_cfinfo) >> 8) & 0xFFFF;
     return CF_IS_OBJC(typeID, cf) ? CFGetTypeID(cf) : typeID;
 }
@@ -36,6 +36,7 @@
 */
 
 #include <CoreFoundation/CFBitVector.h>
+#include <CoreFoundation/CFByteOrder.h>
 #include "CFInternal.h"
 #include <string.h>
 
@@ -79,6 +80,20 @@ CF_INLINE UInt32 __CFBitVectorMutableVarietyFromFlags(UInt32 flags) {
     return __CFBitfieldGetValue(flags, 1, 0);
 }
 
+enum {
+    kCFBitVectorImmutable = 0x0,		/* unchangable and fixed capacity; default */
+    kCFBitVectorMutable = 0x1,		/* changeable and variable capacity */
+    kCFBitVectorCompressed = 0x2,	/* changeable and variable capacity, kept in compressed chunks */
+    kCFBitVectorFixedMutable = 0x3	/* changeable and fixed capacity */
+};
+
+enum {
+    __kCFBitVectorAnd = 0,
+    __kCFBitVectorOr,
+    __kCFBitVectorXor,
+    __kCFBitVectorAndNot
+};
+
 // ensure that uses of these inlines are correct, bytes vs. buckets vs. bits
 CF_INLINE CFIndex __CFBitVectorCount(CFBitVectorRef bv) {
     return bv->_count;
@@ -142,6 +157,39 @@ CF_INLINE void __CFFlipBitVectorBit(__CFBitVectorBucket *buckets, CFIndex idx) {
     buckets[bucketIdx] ^= (1 << (__CF_BITS_PER_BUCKET - 1 - bitOfBucket));
 }
 
+/* Word-at-a-time access. Since bit 0 is the most significant bit of the first
+   byte, bytes read in big-endian order give a word holding the bits in vector
+   order from the left, ready for clz-based forward and ctz-based backward scans. */
+CF_INLINE uint64_t __CFBitVectorLoadWord(const __CFBitVectorBucket *buckets, CFIndex byteIdx, CFIndex numBytes) {
+    uint64_t word = 0;
+    CFIndex idx;
+    if (8 == numBytes) {
+	memcpy(&word, buckets + byteIdx, 8);
+	return CFSwapInt64BigToHost(word);
+    }
+    for (idx = 0; idx < numBytes; idx++) {
+	word |= (uint64_t)buckets[byteIdx + idx] << (56 - 8 * idx);
+    }
+    return word;
+}
+
+/* The leftmost n bits of a word, 0 <= n <= 64 */
+CF_INLINE uint64_t __CFBitVectorTopBits(CFIndex n) {
+    return (64 <= n) ? ~(uint64_t)0 : ~(~(uint64_t)0 >> n);
+}
+
+/* Returns the bits from *location up to at most end, left-aligned, with the count in *numBits, and advances *location past them.
+   Each call takes at least 57 bits, and reads no byte beyond the one holding bit end - 1. */
+CF_INLINE uint64_t __CFBitVectorNextWord(const __CFBitVectorBucket *buckets, CFIndex *location, CFIndex end, CFIndex *numBits) {
+    CFIndex byteIdx = *location / __CF_BITS_PER_BYTE;
+    CFIndex offset = *location & (__CF_BITS_PER_BYTE - 1);
+    CFIndex numBytes = __CFMin(8, (end - 1) / __CF_BITS_PER_BYTE - byteIdx + 1);
+    CFIndex n = __CFMin(64 - offset, end - *location);
+    *numBits = n;
+    *location += n;
+    return (__CFBitVectorLoadWord(buckets, byteIdx, numBytes) << offset) & __CFBitVectorTopBits(n);
+}
+
 #if defined(DEBUG)
 CF_INLINE void __CFBitVectorValidateRange(CFBitVectorRef bv, CFRange range, const char *func) {
     CFAssert2(0 <= range.location && range.location < __CFBitVectorCount(bv), __kCFLogAssertion, "%s(): range.location index (%d) out of bounds", func, range.location);
@@ -152,6 +200,777 @@ CF_INLINE void __CFBitVectorValidateRange(CFBitVectorRef bv, CFRange range, cons
 #define __CFBitVectorValidateRange(bf,r,f)
 #endif
 
+static CFTypeID __kCFBitVectorTypeID = _kCFRuntimeNotATypeID;
+
+/* Compressed bit vectors keep their bits in chunks of 64K. A chunk with no bits set takes no space; the others are kept as
+   a sorted array of the set bits, a bitmap, or a list of runs of set bits, whichever is smallest (as in "roaring" bitmaps).
+   The _buckets of a compressed vector point to its chunk list, and no bit at or past _count is ever set. */
+enum {
+    __kCFBitVectorChunkBits = 65536,
+    __kCFBitVectorChunkWords = 1024,		/* 64-bit words in a chunk bitmap */
+    __kCFBitVectorChunkMaxArray = 4096		/* past this many set bits a bitmap is smaller than an array */
+};
+
+enum {
+    __kCFBitVectorArrayChunk = 0,		/* _length sorted uint16_t values */
+    __kCFBitVectorBitmapChunk = 1,		/* 1024 uint64_t words; bit 0 is the most significant bit of the first word */
+    __kCFBitVectorRunChunk = 2			/* _length runs, each a uint16_t first and last set bit */
+};
+
+typedef struct {
+    CFIndex _key;		/* index of the chunk's first bit / 65536 */
+    int32_t _type;
+    int32_t _count;		/* number of bits set, at least 1 */
+    int32_t _length;		/* values or runs */
+    int32_t _capacity;		/* bytes allocated for _data */
+    void *_data;
+} __CFBitVectorChunk;
+
+typedef struct {
+    CFIndex _numChunks;
+    CFIndex _capacity;
+    __CFBitVectorChunk *_chunks;	/* sorted by key */
+} __CFBitVectorChunkList;
+
+CF_INLINE Boolean __CFBitVectorIsCompressed(CFBitVectorRef bv) {
+    return __CFBitVectorMutableVariety(bv) == kCFBitVectorCompressed;
+}
+
+CF_INLINE __CFBitVectorChunkList *__CFBitVectorChunks(CFBitVectorRef bv) {
+    return (__CFBitVectorChunkList *)bv->_buckets;
+}
+
+CF_INLINE uint64_t __CFBitVectorChunkBit(CFIndex low) {
+    return (uint64_t)1 << (63 - (low & 63));
+}
+
+/* The bits from first to last that fall in word idx of a chunk bitmap */
+CF_INLINE uint64_t __CFBitVectorWordMask(CFIndex idx, CFIndex first, CFIndex last) {
+    CFIndex lo = (idx == (first >> 6)) ? (first & 63) : 0;
+    CFIndex hi = (idx == (last >> 6)) ? (last & 63) : 63;
+    return __CFBitVectorTopBits(hi + 1) & ~__CFBitVectorTopBits(lo);
+}
+
+static CFIndex __CFBitVectorWordsCount(const uint64_t *words, CFIndex first, CFIndex last) {
+    CFIndex idx, count = 0;
+    for (idx = first >> 6; idx <= (last >> 6); idx++) {
+	count += __CFPopCount64(words[idx] & __CFBitVectorWordMask(idx, first, last));
+    }
+    return count;
+}
+
+/* Sets, flips or clears bits first through last of a chunk bitmap, for op Or, Xor or AndNot */
+static void __CFBitVectorMapWords(uint64_t *words, CFIndex first, CFIndex last, int op) {
+    CFIndex idx;
+    for (idx = first >> 6; idx <= (last >> 6); idx++) {
+	uint64_t mask = __CFBitVectorWordMask(idx, first, last);
+	switch (op) {
+	case __kCFBitVectorOr: words[idx] |= mask; break;
+	case __kCFBitVectorXor: words[idx] ^= mask; break;
+	default: words[idx] &= ~mask; break;
+	}
+    }
+}
+
+/* The first bit at or after low with the given value, or 65536 */
+static CFIndex __CFBitVectorWordsNext(const uint64_t *words, CFIndex low, CFBit value) {
+    CFIndex idx = low >> 6;
+    uint64_t word;
+    if (__kCFBitVectorChunkBits <= low) return __kCFBitVectorChunkBits;
+    word = (value ? words[idx] : ~words[idx]) & ~__CFBitVectorTopBits(low & 63);
+    while (0 == word) {
+	if (__kCFBitVectorChunkWords == ++idx) return __kCFBitVectorChunkBits;
+	word = value ? words[idx] : ~words[idx];
+    }
+    return (idx << 6) + __CFCountLeadingZeros64(word);
+}
+
+/* The last bit at or before low with the given value, or -1 */
+static CFIndex __CFBitVectorWordsPrev(const uint64_t *words, CFIndex low, CFBit value) {
+    CFIndex idx = low >> 6;
+    uint64_t word = (value ? words[idx] : ~words[idx]) & __CFBitVectorTopBits((low & 63) + 1);
+    while (0 == word) {
+	if (--idx < 0) return -1;
+	word = value ? words[idx] : ~words[idx];
+    }
+    return (idx << 6) + 63 - __CFCountTrailingZeros64(word);
+}
+
+/* The index of the first value not less than value, or count */
+static CFIndex __CFBitVectorLowerBound(const uint16_t *values, CFIndex count, CFIndex value) {
+    CFIndex lo = 0, hi = count;
+    while (lo < hi) {
+	CFIndex mid = (lo + hi) / 2;
+	if (values[mid] < value) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* The index of the first run ending at or after low, or numRuns */
+static CFIndex __CFBitVectorFindRun(const uint16_t *runs, CFIndex numRuns, CFIndex low) {
+    CFIndex lo = 0, hi = numRuns;
+    while (lo < hi) {
+	CFIndex mid = (lo + hi) / 2;
+	if (runs[2 * mid + 1] < low) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static CFIndex __CFBitVectorChunkSize(const __CFBitVectorChunk *chunk) {
+    switch (chunk->_type) {
+    case __kCFBitVectorArrayChunk: return chunk->_length * sizeof(uint16_t);
+    case __kCFBitVectorRunChunk: return chunk->_length * 2 * sizeof(uint16_t);
+    default: return __kCFBitVectorChunkWords * sizeof(uint64_t);
+    }
+}
+
+static void __CFBitVectorChunkReserve(CFAllocatorRef allocator, __CFBitVectorChunk *chunk, CFIndex size) {
+    if (size <= chunk->_capacity) return;
+    size = __CFMax(size, 2 * chunk->_capacity);
+    chunk->_data = CFAllocatorReallocate(allocator, chunk->_data, size, 0);
+    if (__CFOASafe) __CFSetLastAllocationEventName(chunk->_data, "CFBitVector (chunk)");
+    if (NULL == chunk->_data) HALT;
+    chunk->_capacity = (int32_t)size;
+}
+
+static Boolean __CFBitVectorChunkContains(const __CFBitVectorChunk *chunk, CFIndex low) {
+    const uint16_t *values = (const uint16_t *)chunk->_data;
+    CFIndex idx;
+    switch (chunk->_type) {
+    case __kCFBitVectorArrayChunk:
+	idx = __CFBitVectorLowerBound(values, chunk->_length, low);
+	return (idx < chunk->_length && values[idx] == low);
+    case __kCFBitVectorRunChunk:
+	idx = __CFBitVectorFindRun(values, chunk->_length, low);
+	return (idx < chunk->_length && values[2 * idx] <= low);
+    default:
+	return 0 != (((const uint64_t *)chunk->_data)[low >> 6] & __CFBitVectorChunkBit(low));
+    }
+}
+
+static void __CFBitVectorChunkGetWords(const __CFBitVectorChunk *chunk, uint64_t *words) {
+    const uint16_t *values = (const uint16_t *)chunk->_data;
+    CFIndex idx;
+    if (__kCFBitVectorBitmapChunk == chunk->_type) {
+	memmove(words, chunk->_data, __kCFBitVectorChunkWords * sizeof(uint64_t));
+	return;
+    }
+    memset(words, 0, __kCFBitVectorChunkWords * sizeof(uint64_t));
+    for (idx = 0; idx < chunk->_length; idx++) {
+	if (__kCFBitVectorArrayChunk == chunk->_type) {
+	    words[values[idx] >> 6] |= __CFBitVectorChunkBit(values[idx]);
+	} else {
+	    __CFBitVectorMapWords(words, values[2 * idx], values[2 * idx + 1], __kCFBitVectorOr);
+	}
+    }
+}
+
+/* The chunk as a bitmap: its own for a bitmap chunk, otherwise expanded into scratch */
+CF_INLINE const uint64_t *__CFBitVectorChunkWords(const __CFBitVectorChunk *chunk, uint64_t *scratch) {
+    if (__kCFBitVectorBitmapChunk == chunk->_type) return (const uint64_t *)chunk->_data;
+    __CFBitVectorChunkGetWords(chunk, scratch);
+    return scratch;
+}
+
+static CFIndex __CFBitVectorWordsRuns(const uint64_t *words) {
+    CFIndex idx, numRuns = 0;
+    uint64_t prev = 0;
+    for (idx = 0; idx < __kCFBitVectorChunkWords; idx++) {	/* runs start at set bits that follow a clear bit */
+	numRuns += __CFPopCount64(words[idx] & ~((words[idx] >> 1) | (prev << 63)));
+	prev = words[idx];
+    }
+    return numRuns;
+}
+
+/* The smallest form for count bits set in numRuns runs, and its size */
+static int32_t __CFBitVectorBestChunkType(CFIndex count, CFIndex numRuns, CFIndex *size) {
+    *size = (count <= __kCFBitVectorChunkMaxArray) ? count * (CFIndex)sizeof(uint16_t) : __kCFBitVectorChunkWords * (CFIndex)sizeof(uint64_t);
+    if (numRuns * 2 * (CFIndex)sizeof(uint16_t) < *size) {
+	*size = numRuns * 2 * sizeof(uint16_t);
+	return __kCFBitVectorRunChunk;
+    }
+    return (count <= __kCFBitVectorChunkMaxArray) ? __kCFBitVectorArrayChunk : __kCFBitVectorBitmapChunk;
+}
+
+/* Fills values with the set bits of words in an array or run chunk's form, returning the number of values or runs */
+static CFIndex __CFBitVectorWordsGetValues(const uint64_t *words, int32_t type, uint16_t *values) {
+    CFIndex idx, length = 0;
+    if (__kCFBitVectorArrayChunk == type) {
+	for (idx = 0; idx < __kCFBitVectorChunkWords; idx++) {
+	    uint64_t word = words[idx];
+	    while (0 != word) {
+		CFIndex bit = __CFCountLeadingZeros64(word);
+		values[length++] = (uint16_t)((idx << 6) + bit);
+		word &= ~((uint64_t)1 << (63 - bit));
+	    }
+	}
+    } else {
+	for (idx = __CFBitVectorWordsNext(words, 0, 1); idx < __kCFBitVectorChunkBits; length++) {
+	    CFIndex end = __CFBitVectorWordsNext(words, idx, 0);
+	    values[2 * length] = (uint16_t)idx;
+	    values[2 * length + 1] = (uint16_t)(end - 1);
+	    idx = __CFBitVectorWordsNext(words, end, 1);
+	}
+    }
+    return length;
+}
+
+/* Stores a bitmap with count (> 0) bits set in the chunk, in whichever form is smallest. words may be the chunk's own bitmap. */
+static void __CFBitVectorChunkSetWords(CFAllocatorRef allocator, __CFBitVectorChunk *chunk, const uint64_t *words, CFIndex count) {
+    CFIndex size, length = 0;
+    int32_t type = __CFBitVectorBestChunkType(count, __CFBitVectorWordsRuns(words), &size);
+    uint16_t *values;
+    if ((const void *)words == chunk->_data) {
+	if (__kCFBitVectorBitmapChunk == type) {
+	    chunk->_count = (int32_t)count;
+	    return;
+	}
+	values = (uint16_t *)CFAllocatorAllocate(allocator, size, 0);
+	if (__CFOASafe) __CFSetLastAllocationEventName(values, "CFBitVector (chunk)");
+	if (NULL == values) HALT;
+    } else {
+	__CFBitVectorChunkReserve(allocator, chunk, size);
+	values = (uint16_t *)chunk->_data;
+    }
+    if (__kCFBitVectorBitmapChunk == type) {
+	memmove(values, words, size);
+    } else {
+	length = __CFBitVectorWordsGetValues(words, type, values);
+    }
+    if (values != chunk->_data) {
+	CFAllocatorDeallocate(allocator, chunk->_data);
+	chunk->_data = values;
+	chunk->_capacity = (int32_t)size;
+    }
+    chunk->_type = type;
+    chunk->_length = (int32_t)length;
+    chunk->_count = (int32_t)count;
+}
+
+static void __CFBitVectorChunkSetRun(CFAllocatorRef allocator, __CFBitVectorChunk *chunk, CFIndex first, CFIndex last) {
+    __CFBitVectorChunkReserve(allocator, chunk, 2 * sizeof(uint16_t));
+    ((uint16_t *)chunk->_data)[0] = (uint16_t)first;
+    ((uint16_t *)chunk->_data)[1] = (uint16_t)last;
+    chunk->_type = __kCFBitVectorRunChunk;
+    chunk->_length = 1;
+    chunk->_count = (int32_t)(last - first + 1);
+}
+
+static void __CFBitVectorChunkCopy(CFAllocatorRef allocator, __CFBitVectorChunk *chunk, const __CFBitVectorChunk *source) {
+    CFIndex size = __CFBitVectorChunkSize(source);
+    *chunk = *source;
+    chunk->_data = CFAllocatorAllocate(allocator, size, 0);
+    if (__CFOASafe) __CFSetLastAllocationEventName(chunk->_data, "CFBitVector (chunk)");
+    if (NULL == chunk->_data) HALT;
+    memmove(chunk->_data, source->_data, size);
+    chunk->_capacity = (int32_t)size;
+}
+
+/* Set bits from first to last */
+static CFIndex __CFBitVectorChunkCount(const __CFBitVectorChunk *chunk, CFIndex first, CFIndex last) {
+    const uint16_t *values = (const uint16_t *)chunk->_data;
+    CFIndex idx, count = 0;
+    if (0 == first && __kCFBitVectorChunkBits - 1 == last) return chunk->_count;
+    switch (chunk->_type) {
+    case __kCFBitVectorArrayChunk:
+	return __CFBitVectorLowerBound(values, chunk->_length, last + 1) - __CFBitVectorLowerBound(values, chunk->_length, first);
+    case __kCFBitVectorRunChunk:
+	for (idx = __CFBitVectorFindRun(values, chunk->_length, first); idx < chunk->_length && values[2 * idx] <= last; idx++) {
+	    count += __CFMin(values[2 * idx + 1], last) - __CFMax(values[2 * idx], first) + 1;
+	}
+	return count;
+    default:
+	return __CFBitVectorWordsCount((const uint64_t *)chunk->_data, first, last);
+    }
+}
+
+/* The first bit at or after low with the given value, or 65536 */
+static CFIndex __CFBitVectorChunkNext(const __CFBitVectorChunk *chunk, CFIndex low, CFBit value, uint64_t *scratch) {
+    const uint16_t *values = (const uint16_t *)chunk->_data;
+    CFIndex idx;
+    if (__kCFBitVectorRunChunk == chunk->_type) {	/* runs are never adjacent, so a run is followed by a clear bit */
+	idx = __CFBitVectorFindRun(values, chunk->_length, low);
+	if (value) return (idx < chunk->_length) ? __CFMax(values[2 * idx], low) : __kCFBitVectorChunkBits;
+	return (idx < chunk->_length && values[2 * idx] <= low) ? values[2 * idx + 1] + 1 : low;
+    }
+    if (value && __kCFBitVectorArrayChunk == chunk->_type) {
+	idx = __CFBitVectorLowerBound(values, chunk->_length, low);
+	return (idx < chunk->_length) ? values[idx] : __kCFBitVectorChunkBits;
+    }
+    return __CFBitVectorWordsNext(__CFBitVectorChunkWords(chunk, scratch), low, value);
+}
+
+/* The last bit at or before low with the given value, or -1 */
+static CFIndex __CFBitVectorChunkPrev(const __CFBitVectorChunk *chunk, CFIndex low, CFBit value, uint64_t *scratch) {
+    const uint16_t *values = (const uint16_t *)chunk->_data;
+    CFIndex idx;
+    if (__kCFBitVectorRunChunk == chunk->_type) {
+	idx = __CFBitVectorFindRun(values, chunk->_length, low);
+	if (idx < chunk->_length && values[2 * idx] <= low) return value ? low : values[2 * idx] - 1;
+	return value ? ((0 < idx) ? values[2 * idx - 1] : -1) : low;
+    }
+    if (value && __kCFBitVectorArrayChunk == chunk->_type) {
+	idx = __CFBitVectorLowerBound(values, chunk->_length, low + 1) - 1;
+	return (0 <= idx) ? values[idx] : -1;
+    }
+    return __CFBitVectorWordsPrev(__CFBitVectorChunkWords(chunk, scratch), low, value);
+}
+
+/* The index of the first chunk whose key is not less than key, or the number of chunks */
+static CFIndex __CFBitVectorChunkSearch(const __CFBitVectorChunkList *list, CFIndex key) {
+    CFIndex lo = 0, hi = list->_numChunks;
+    while (lo < hi) {
+	CFIndex mid = (lo + hi) / 2;
+	if (list->_chunks[mid]._key < key) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static __CFBitVectorChunk *__CFBitVectorFindChunk(const __CFBitVectorChunkList *list, CFIndex key) {
+    CFIndex idx = __CFBitVectorChunkSearch(list, key);
+    return (idx < list->_numChunks && list->_chunks[idx]._key == key) ? list->_chunks + idx : NULL;
+}
+
+/* Inserts an empty chunk; pointers to other chunks of the list may be invalidated */
+static __CFBitVectorChunk *__CFBitVectorInsertChunk(CFAllocatorRef allocator, __CFBitVectorChunkList *list, CFIndex idx, CFIndex key) {
+    __CFBitVectorChunk *chunk;
+    if (list->_numChunks == list->_capacity) {
+	list->_capacity = __CFMax(4, 2 * list->_capacity);
+	list->_chunks = (__CFBitVectorChunk *)CFAllocatorReallocate(allocator, list->_chunks, list->_capacity * sizeof(__CFBitVectorChunk), 0);
+	if (__CFOASafe) __CFSetLastAllocationEventName(list->_chunks, "CFBitVector (chunks)");
+	if (NULL == list->_chunks) HALT;
+    }
+    chunk = list->_chunks + idx;
+    memmove(chunk + 1, chunk, (list->_numChunks - idx) * sizeof(__CFBitVectorChunk));
+    list->_numChunks++;
+    memset(chunk, 0, sizeof(__CFBitVectorChunk));
+    chunk->_key = key;
+    return chunk;
+}
+
+static void __CFBitVectorRemoveChunk(CFAllocatorRef allocator, __CFBitVectorChunkList *list, CFIndex idx) {
+    CFAllocatorDeallocate(allocator, list->_chunks[idx]._data);
+    memmove(list->_chunks + idx, list->_chunks + idx + 1, (list->_numChunks - idx - 1) * sizeof(__CFBitVectorChunk));
+    list->_numChunks--;
+}
+
+static CFBit __CFBitVectorChunksBit(CFBitVectorRef bv, CFIndex idx) {
+    const __CFBitVectorChunk *chunk = __CFBitVectorFindChunk(__CFBitVectorChunks(bv), idx >> 16);
+    return (chunk && __CFBitVectorChunkContains(chunk, idx & 0xFFFF)) ? 1 : 0;
+}
+
+static void __CFBitVectorChunksSetBit(CFMutableBitVectorRef bv, CFIndex bitIdx, CFBit value) {
+    CFAllocatorRef allocator = CFGetAllocator(bv);
+    __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+    CFIndex key = bitIdx >> 16, low = bitIdx & 0xFFFF;
+    CFIndex chunkIdx = __CFBitVectorChunkSearch(list, key), idx;
+    __CFBitVectorChunk *chunk;
+    uint16_t *values;
+    uint64_t scratch[__kCFBitVectorChunkWords];
+    if (chunkIdx == list->_numChunks || list->_chunks[chunkIdx]._key != key) {
+	if (!value) return;
+	chunk = __CFBitVectorInsertChunk(allocator, list, chunkIdx, key);
+	__CFBitVectorChunkReserve(allocator, chunk, 4 * sizeof(uint16_t));
+	((uint16_t *)chunk->_data)[0] = (uint16_t)low;
+	chunk->_type = __kCFBitVectorArrayChunk;
+	chunk->_length = chunk->_count = 1;
+	return;
+    }
+    chunk = list->_chunks + chunkIdx;
+    if (__CFBitVectorChunkContains(chunk, low) == (value ? true : false)) return;
+    switch (chunk->_type) {
+    case __kCFBitVectorArrayChunk:
+	if (value && __kCFBitVectorChunkMaxArray == chunk->_length) {
+	    __CFBitVectorChunkGetWords(chunk, scratch);
+	    scratch[low >> 6] |= __CFBitVectorChunkBit(low);
+	    __CFBitVectorChunkSetWords(allocator, chunk, scratch, chunk->_count + 1);
+	    return;
+	}
+	if (value) __CFBitVectorChunkReserve(allocator, chunk, (chunk->_length + 1) * sizeof(uint16_t));
+	values = (uint16_t *)chunk->_data;
+	idx = __CFBitVectorLowerBound(values, chunk->_length, low);
+	if (value) {
+	    memmove(values + idx + 1, values + idx, (chunk->_length - idx) * sizeof(uint16_t));
+	    values[idx] = (uint16_t)low;
+	    chunk->_length++;
+	} else {
+	    memmove(values + idx, values + idx + 1, (chunk->_length - idx - 1) * sizeof(uint16_t));
+	    chunk->_length--;
+	}
+	chunk->_count = chunk->_length;
+	break;
+    case __kCFBitVectorBitmapChunk:
+	((uint64_t *)chunk->_data)[low >> 6] ^= __CFBitVectorChunkBit(low);
+	chunk->_count += value ? 1 : -1;
+	/* Go back to an array well below the point where the bitmap became smaller, so that alternating changes don't convert every time */
+	if (0 < chunk->_count && chunk->_count <= __kCFBitVectorChunkMaxArray / 2) __CFBitVectorChunkSetWords(allocator, chunk, (uint64_t *)chunk->_data, chunk->_count);
+	break;
+    case __kCFBitVectorRunChunk:
+	__CFBitVectorChunkReserve(allocator, chunk, (chunk->_length + 1) * 2 * sizeof(uint16_t));
+	values = (uint16_t *)chunk->_data;
+	idx = __CFBitVectorFindRun(values, chunk->_length, low);
+	if (value) {	/* idx is the run after low, if any */
+	    Boolean joinsPrev = (0 < idx && values[2 * idx - 1] + 1 == low), joinsNext = (idx < chunk->_length && values[2 * idx] == low + 1);
+	    if (joinsPrev && joinsNext) {
+		values[2 * idx - 1] = values[2 * idx + 1];
+		memmove(values + 2 * idx, values + 2 * idx + 2, (chunk->_length - idx - 1) * 2 * sizeof(uint16_t));
+		chunk->_length--;
+	    } else if (joinsPrev) {
+		values[2 * idx - 1] = (uint16_t)low;
+	    } else if (joinsNext) {
+		values[2 * idx] = (uint16_t)low;
+	    } else {
+		memmove(values + 2 * idx + 2, values + 2 * idx, (chunk->_length - idx) * 2 * sizeof(uint16_t));
+		values[2 * idx] = values[2 * idx + 1] = (uint16_t)low;
+		chunk->_length++;
+	    }
+	    chunk->_count++;
+	} else {	/* idx is the run holding low */
+	    if (values[2 * idx] == values[2 * idx + 1]) {
+		memmove(values + 2 * idx, values + 2 * idx + 2, (chunk->_length - idx - 1) * 2 * sizeof(uint16_t));
+		chunk->_length--;
+	    } else if (values[2 * idx] == low) {
+		values[2 * idx]++;
+	    } else if (values[2 * idx + 1] == low) {
+		values[2 * idx + 1]--;
+	    } else {
+		memmove(values + 2 * idx + 2, values + 2 * idx, (chunk->_length - idx) * 2 * sizeof(uint16_t));
+		values[2 * idx + 1] = (uint16_t)(low - 1);
+		values[2 * idx + 2] = (uint16_t)(low + 1);
+		chunk->_length++;
+	    }
+	    chunk->_count--;
+	}
+	if (0 < chunk->_count && chunk->_length * 2 * sizeof(uint16_t) > __CFMin(chunk->_count, __kCFBitVectorChunkMaxArray) * sizeof(uint16_t)) {
+	    __CFBitVectorChunkGetWords(chunk, scratch);
+	    __CFBitVectorChunkSetWords(allocator, chunk, scratch, chunk->_count);
+	}
+	break;
+    }
+    if (0 == chunk->_count) __CFBitVectorRemoveChunk(allocator, list, chunkIdx);
+}
+
+/* Sets, flips or clears the bits of range, for op Or, Xor or AndNot */
+static void __CFBitVectorChunksMapRange(CFMutableBitVectorRef bv, CFRange range, int op) {
+    CFAllocatorRef allocator = CFGetAllocator(bv);
+    __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+    CFIndex end = range.location + range.length, firstKey = range.location >> 16, lastKey, key, idx;
+    uint64_t scratch[__kCFBitVectorChunkWords];
+    if (0 == range.length) return;
+    lastKey = (end - 1) >> 16;
+    idx = __CFBitVectorChunkSearch(list, firstKey);
+    for (key = firstKey; key <= lastKey;) {
+	CFIndex first = (key == firstKey) ? (range.location & 0xFFFF) : 0;
+	CFIndex last = (key == lastKey) ? ((end - 1) & 0xFFFF) : __kCFBitVectorChunkBits - 1;
+	__CFBitVectorChunk *chunk;
+	if (idx == list->_numChunks || list->_chunks[idx]._key != key) {
+	    if (__kCFBitVectorAndNot == op) {	/* nothing to clear up to the next chunk */
+		if (idx == list->_numChunks) break;
+		key = list->_chunks[idx]._key;
+		continue;
+	    }
+	    chunk = __CFBitVectorInsertChunk(allocator, list, idx, key);
+	    __CFBitVectorChunkSetRun(allocator, chunk, first, last);
+	} else if (0 == first && __kCFBitVectorChunkBits - 1 == last && __kCFBitVectorXor != op) {
+	    if (__kCFBitVectorAndNot == op) {
+		__CFBitVectorRemoveChunk(allocator, list, idx);
+		key++;
+		continue;
+	    }
+	    __CFBitVectorChunkSetRun(allocator, list->_chunks + idx, first, last);
+	} else {
+	    uint64_t *words;
+	    CFIndex count;
+	    chunk = list->_chunks + idx;
+	    if (__kCFBitVectorBitmapChunk == chunk->_type) {
+		words = (uint64_t *)chunk->_data;
+	    } else {
+		__CFBitVectorChunkGetWords(chunk, scratch);
+		words = scratch;
+	    }
+	    __CFBitVectorMapWords(words, first, last, op);
+	    count = __CFBitVectorWordsCount(words, 0, __kCFBitVectorChunkBits - 1);
+	    if (0 == count) {
+		__CFBitVectorRemoveChunk(allocator, list, idx);
+		key++;
+		continue;
+	    }
+	    __CFBitVectorChunkSetWords(allocator, chunk, words, count);
+	}
+	idx++;
+	key++;
+    }
+}
+
+/* Clears every bit at or past count */
+static void __CFBitVectorChunksTruncate(CFMutableBitVectorRef bv, CFIndex count) {
+    __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+    CFIndex end;
+    if (0 == list->_numChunks) return;
+    end = (list->_chunks[list->_numChunks - 1]._key + 1) << 16;
+    if (count < end) __CFBitVectorChunksMapRange(bv, CFRangeMake(count, end - count), __kCFBitVectorAndNot);
+}
+
+static CFIndex __CFBitVectorChunksCountOfBit(CFBitVectorRef bv, CFRange range) {
+    const __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+    CFIndex end = range.location + range.length, firstKey = range.location >> 16, lastKey = (end - 1) >> 16, idx, count = 0;
+    if (0 == range.length) return 0;
+    for (idx = __CFBitVectorChunkSearch(list, firstKey); idx < list->_numChunks && list->_chunks[idx]._key <= lastKey; idx++) {
+	CFIndex key = list->_chunks[idx]._key;
+	CFIndex first = (key == firstKey) ? (range.location & 0xFFFF) : 0;
+	CFIndex last = (key == lastKey) ? ((end - 1) & 0xFFFF) : __kCFBitVectorChunkBits - 1;
+	count += __CFBitVectorChunkCount(list->_chunks + idx, first, last);
+    }
+    return count;
+}
+
+static CFIndex __CFBitVectorChunksFirstIndexOfBit(CFBitVectorRef bv, CFRange range, CFBit value) {
+    const __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+    CFIndex location, end = range.location + range.length, idx = __CFBitVectorChunkSearch(list, range.location >> 16);
+    uint64_t scratch[__kCFBitVectorChunkWords];
+    for (location = range.location; location < end;) {
+	CFIndex key = location >> 16, last = __CFMin(end - 1, ((key + 1) << 16) - 1) & 0xFFFF, found;
+	if (idx == list->_numChunks || list->_chunks[idx]._key != key) {	/* no bits set up to the next chunk */
+	    if (!value) return location;
+	    if (idx == list->_numChunks) break;
+	    location = list->_chunks[idx]._key << 16;
+	    continue;
+	}
+	found = __CFBitVectorChunkNext(list->_chunks + idx, location & 0xFFFF, value, scratch);
+	if (found <= last) return (key << 16) + found;
+	idx++;
+	location = (key + 1) << 16;
+    }
+    return kCFNotFound;
+}
+
+static CFIndex __CFBitVectorChunksLastIndexOfBit(CFBitVectorRef bv, CFRange range, CFBit value) {
+    const __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+    CFIndex location;
+    uint64_t scratch[__kCFBitVectorChunkWords];
+    for (location = range.location + range.length - 1; range.location <= location;) {
+	CFIndex key = location >> 16, first = __CFMax(range.location, key << 16) & 0xFFFF, found;
+	CFIndex idx = __CFBitVectorChunkSearch(list, key);
+	if (idx == list->_numChunks || list->_chunks[idx]._key != key) {
+	    if (!value) return location;
+	    if (0 == idx) break;
+	    location = ((list->_chunks[idx - 1]._key + 1) << 16) - 1;
+	    continue;
+	}
+	found = __CFBitVectorChunkPrev(list->_chunks + idx, location & 0xFFFF, value, scratch);
+	if (first <= found) return (key << 16) + found;
+	location = (key << 16) - 1;
+    }
+    return kCFNotFound;
+}
+
+static CFIndex __CFBitVectorChunksGetIndexesOfBit(CFBitVectorRef bv, CFRange range, CFBit value, CFIndex *indexes, CFIndex maxCount) {
+    const __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+    CFIndex location, end = range.location + range.length, idx = __CFBitVectorChunkSearch(list, range.location >> 16), found = 0;
+    uint64_t scratch[__kCFBitVectorChunkWords];
+    for (location = range.location; location < end && found < maxCount;) {
+	CFIndex key = location >> 16, limit = __CFMin(end, (key + 1) << 16);
+	const __CFBitVectorChunk *chunk;
+	if (idx == list->_numChunks || list->_chunks[idx]._key != key) {
+	    if (value) {
+		location = (idx == list->_numChunks) ? end : (list->_chunks[idx]._key << 16);
+	    } else {
+		while (location < limit && found < maxCount) indexes[found++] = location++;
+	    }
+	    continue;
+	}
+	chunk = list->_chunks + idx;
+	if (value && __kCFBitVectorArrayChunk == chunk->_type) {
+	    const uint16_t *values = (const uint16_t *)chunk->_data;
+	    CFIndex valueIdx;
+	    for (valueIdx = __CFBitVectorLowerBound(values, chunk->_length, location & 0xFFFF); valueIdx < chunk->_length && (key << 16) + values[valueIdx] < limit && found < maxCount; valueIdx++) {
+		indexes[found++] = (key << 16) + values[valueIdx];
+	    }
+	} else {
+	    const uint64_t *words = __CFBitVectorChunkWords(chunk, scratch);
+	    CFIndex low = location & 0xFFFF, last = (limit - 1) & 0xFFFF;
+	    while (found < maxCount && (low = __CFBitVectorWordsNext(words, low, value)) <= last) {
+		indexes[found++] = (key << 16) + low++;
+	    }
+	}
+	idx++;
+	location = limit;
+    }
+    return found;
+}
+
+static void __CFBitVectorChunksGetBits(CFBitVectorRef bv, CFRange range, uint8_t *bytes) {
+    const __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+    CFIndex end = range.location + range.length, firstKey = range.location >> 16, lastKey = (end - 1) >> 16, idx;
+    uint64_t scratch[__kCFBitVectorChunkWords];
+    memset(bytes, 0, (range.length + __CF_BITS_PER_BYTE - 1) / __CF_BITS_PER_BYTE);
+    for (idx = __CFBitVectorChunkSearch(list, firstKey); idx < list->_numChunks && list->_chunks[idx]._key <= lastKey; idx++) {
+	CFIndex key = list->_chunks[idx]._key, base = (key << 16) - range.location;
+	CFIndex low = (key == firstKey) ? (range.location & 0xFFFF) : 0;
+	CFIndex last = (key == lastKey) ? ((end - 1) & 0xFFFF) : __kCFBitVectorChunkBits - 1;
+	const uint64_t *words = __CFBitVectorChunkWords(list->_chunks + idx, scratch);
+	while ((low = __CFBitVectorWordsNext(words, low, 1)) <= last) {
+	    CFIndex offset = base + low++;
+	    bytes[offset / __CF_BITS_PER_BYTE] |= 0x80 >> (offset & (__CF_BITS_PER_BYTE - 1));
+	}
+    }
+}
+
+/* Combines the bits of another compressed vector into bv chunk by chunk, building a new chunk list that takes over bv's chunks
+   and copies other's as needed; other may not be bv */
+static void __CFBitVectorChunksCombine(CFMutableBitVectorRef bv, CFBitVectorRef other, int op) {
+    CFAllocatorRef allocator = CFGetAllocator(bv);
+    __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+    const __CFBitVectorChunkList *otherList = __CFBitVectorChunks(other);
+    __CFBitVectorChunk *result;
+    CFIndex count = __CFBitVectorCount(bv), capacity, numResults = 0, idx = 0, otherIdx = 0, wordIdx;
+    uint64_t scratch[__kCFBitVectorChunkWords], otherScratch[__kCFBitVectorChunkWords];
+    capacity = list->_numChunks + ((__kCFBitVectorOr == op || __kCFBitVectorXor == op) ? otherList->_numChunks : 0);
+    if (0 == capacity) return;
+    result = (__CFBitVectorChunk *)CFAllocatorAllocate(allocator, capacity * sizeof(__CFBitVectorChunk), 0);
+    if (__CFOASafe) __CFSetLastAllocationEventName(result, "CFBitVector (chunks)");
+    if (NULL == result) HALT;
+    for (;;) {
+	__CFBitVectorChunk *chunk = (idx < list->_numChunks) ? list->_chunks + idx : NULL;
+	const __CFBitVectorChunk *otherChunk = (otherIdx < otherList->_numChunks && (otherList->_chunks[otherIdx]._key << 16) < count) ? otherList->_chunks + otherIdx : NULL;
+	if (NULL == chunk && NULL == otherChunk) break;
+	if (NULL != chunk && (NULL == otherChunk || chunk->_key < otherChunk->_key)) {
+	    if (__kCFBitVectorAnd == op) CFAllocatorDeallocate(allocator, chunk->_data); else result[numResults++] = *chunk;
+	    idx++;
+	    continue;
+	}
+	if (NULL == chunk || otherChunk->_key < chunk->_key) {
+	    if (__kCFBitVectorOr == op || __kCFBitVectorXor == op) __CFBitVectorChunkCopy(allocator, result + numResults++, otherChunk);
+	    otherIdx++;
+	    continue;
+	}
+	if ((__kCFBitVectorAnd == op || __kCFBitVectorAndNot == op) && __kCFBitVectorArrayChunk == chunk->_type) {
+	    uint16_t *values = (uint16_t *)chunk->_data;
+	    CFIndex valueIdx, length = 0;
+	    for (valueIdx = 0; valueIdx < chunk->_length; valueIdx++) {
+		if (__CFBitVectorChunkContains(otherChunk, values[valueIdx]) == (__kCFBitVectorAnd == op)) values[length++] = values[valueIdx];
+	    }
+	    chunk->_length = chunk->_count = (int32_t)length;
+	} else if (__kCFBitVectorArrayChunk == chunk->_type && __kCFBitVectorArrayChunk == otherChunk->_type && chunk->_count + otherChunk->_count <= __kCFBitVectorChunkMaxArray) {
+	    /* Merge two small arrays; only Or and Xor get here */
+	    const uint16_t *values = (const uint16_t *)chunk->_data, *otherValues = (const uint16_t *)otherChunk->_data;
+	    uint16_t *merged = (uint16_t *)scratch;
+	    CFIndex valueIdx = 0, otherValueIdx = 0, length = 0;
+	    while (valueIdx < chunk->_length || otherValueIdx < otherChunk->_length) {
+		if (otherValueIdx == otherChunk->_length || (valueIdx < chunk->_length && values[valueIdx] < otherValues[otherValueIdx])) {
+		    merged[length++] = values[valueIdx++];
+		} else if (valueIdx == chunk->_length || otherValues[otherValueIdx] < values[valueIdx]) {
+		    merged[length++] = otherValues[otherValueIdx++];
+		} else {
+		    if (__kCFBitVectorOr == op) merged[length++] = values[valueIdx];
+		    valueIdx++;
+		    otherValueIdx++;
+		}
+	    }
+	    __CFBitVectorChunkReserve(allocator, chunk, length * sizeof(uint16_t));
+	    memmove(chunk->_data, merged, length * sizeof(uint16_t));
+	    chunk->_length = chunk->_count = (int32_t)length;
+	} else {
+	    const uint64_t *otherWords = __CFBitVectorChunkWords(otherChunk, otherScratch);
+	    uint64_t *words;
+	    CFIndex setBits = 0;
+	    if (__kCFBitVectorBitmapChunk == chunk->_type) {
+		words = (uint64_t *)chunk->_data;
+	    } else {
+		__CFBitVectorChunkGetWords(chunk, scratch);
+		words = scratch;
+	    }
+	    switch (op) {
+	    case __kCFBitVectorAnd: for (wordIdx = 0; wordIdx < __kCFBitVectorChunkWords; wordIdx++) words[wordIdx] &= otherWords[wordIdx]; break;
+	    case __kCFBitVectorOr: for (wordIdx = 0; wordIdx < __kCFBitVectorChunkWords; wordIdx++) words[wordIdx] |= otherWords[wordIdx]; break;
+	    case __kCFBitVectorXor: for (wordIdx = 0; wordIdx < __kCFBitVectorChunkWords; wordIdx++) words[wordIdx] ^= otherWords[wordIdx]; break;
+	    case __kCFBitVectorAndNot: for (wordIdx = 0; wordIdx < __kCFBitVectorChunkWords; wordIdx++) words[wordIdx] &= ~otherWords[wordIdx]; break;
+	    }
+	    for (wordIdx = 0; wordIdx < __kCFBitVectorChunkWords; wordIdx++) setBits += __CFPopCount64(words[wordIdx]);
+	    if (0 < setBits) __CFBitVectorChunkSetWords(allocator, chunk, words, setBits); else chunk->_count = 0;
+	}
+	if (0 == chunk->_count) CFAllocatorDeallocate(allocator, chunk->_data); else result[numResults++] = *chunk;
+	idx++;
+	otherIdx++;
+    }
+    CFAllocatorDeallocate(allocator, list->_chunks);
+    list->_chunks = result;
+    list->_numChunks = numResults;
+    list->_capacity = capacity;
+    __CFBitVectorChunksTruncate(bv, count);
+}
+
+/* A new compressed vector holding the bits of bv, or an empty one if bv is NULL */
+static CFMutableBitVectorRef __CFBitVectorCreateCompressed(CFAllocatorRef allocator, CFBitVectorRef bv) {
+    CFMutableBitVectorRef memory;
+    __CFBitVectorChunkList *list;
+    memory = (CFMutableBitVectorRef)_CFRuntimeCreateInstance(allocator, __kCFBitVectorTypeID, sizeof(struct __CFBitVector) - sizeof(CFRuntimeBase), NULL);
+    if (NULL == memory) {
+	return NULL;
+    }
+    allocator = CFGetAllocator(memory);
+    list = (__CFBitVectorChunkList *)CFAllocatorAllocate(allocator, sizeof(__CFBitVectorChunkList), 0);
+    if (__CFOASafe) __CFSetLastAllocationEventName(list, "CFBitVector (chunks)");
+    if (NULL == list) {
+	CFRelease(memory);
+	return NULL;
+    }
+    memset(list, 0, sizeof(__CFBitVectorChunkList));
+    memory->_buckets = (__CFBitVectorBucket *)list;
+    __CFBitVectorSetCapacity(memory, 0);
+    __CFBitVectorSetCount(memory, 0);
+    __CFBitVectorSetMutableVariety(memory, kCFBitVectorCompressed);
+    if (NULL == bv) return memory;
+    __CFBitVectorSetCount(memory, __CFBitVectorCount(bv));
+    if (__CFBitVectorIsCompressed(bv)) {
+	const __CFBitVectorChunkList *source = __CFBitVectorChunks(bv);
+	CFIndex idx;
+	for (idx = 0; idx < source->_numChunks; idx++) {
+	    __CFBitVectorChunkCopy(allocator, __CFBitVectorInsertChunk(allocator, list, idx, source->_chunks[idx]._key), source->_chunks + idx);
+	}
+    } else {
+	uint64_t words[__kCFBitVectorChunkWords];
+	CFIndex location, end = __CFBitVectorCount(bv), numBits;
+	for (location = 0; location < end;) {
+	    CFIndex key = location >> 16, wordIdx, count = 0;
+	    for (wordIdx = 0; wordIdx < __kCFBitVectorChunkWords; wordIdx++) {
+		words[wordIdx] = (location < end) ? __CFBitVectorNextWord(bv->_buckets, &location, end, &numBits) : 0;
+		count += __CFPopCount64(words[wordIdx]);
+	    }
+	    if (0 < count) __CFBitVectorChunkSetWords(allocator, __CFBitVectorInsertChunk(allocator, list, list->_numChunks, key), words, count);
+	}
+    }
+    return memory;
+}
+
+static Boolean __CFBitVectorChunksEqual(CFBitVectorRef bv1, CFBitVectorRef bv2) {
+    const __CFBitVectorChunkList *list1 = __CFBitVectorChunks(bv1);
+    uint64_t scratch1[__kCFBitVectorChunkWords], scratch2[__kCFBitVectorChunkWords];
+    CFIndex idx;
+    if (!__CFBitVectorIsCompressed(bv2)) {	/* same number of bits set, and all of bv1's set in bv2 */
+	if (CFBitVectorGetCountOfBit(bv2, CFRangeMake(0, __CFBitVectorCount(bv2)), 1) != __CFBitVectorChunksCountOfBit(bv1, CFRangeMake(0, __CFBitVectorCount(bv1)))) return false;
+	for (idx = 0; idx < list1->_numChunks; idx++) {
+	    const uint64_t *words = __CFBitVectorChunkWords(list1->_chunks + idx, scratch1);
+	    CFIndex low = 0;
+	    while ((low = __CFBitVectorWordsNext(words, low, 1)) < __kCFBitVectorChunkBits) {
+		if (!__CFBitVectorBit(bv2->_buckets, (list1->_chunks[idx]._key << 16) + low++)) return false;
+	    }
+	}
+	return true;
+    }
+    if (list1->_numChunks != __CFBitVectorChunks(bv2)->_numChunks) return false;
+    for (idx = 0; idx < list1->_numChunks; idx++) {
+	const __CFBitVectorChunk *chunk1 = list1->_chunks + idx, *chunk2 = __CFBitVectorChunks(bv2)->_chunks + idx;
+	if (chunk1->_key != chunk2->_key || chunk1->_count != chunk2->_count) return false;
+	if (chunk1->_type == chunk2->_type && chunk1->_length == chunk2->_length) {
+	    if (0 != memcmp(chunk1->_data, chunk2->_data, __CFBitVectorChunkSize(chunk1))) return false;
+	} else {
+	    if (0 != memcmp(__CFBitVectorChunkWords(chunk1, scratch1), __CFBitVectorChunkWords(chunk2, scratch2), sizeof(scratch1))) return false;
+	}
+    }
+    return true;
+}
+
 static Boolean __CFBitVectorEqual(CFTypeRef cf1, CFTypeRef cf2) {
     CFBitVectorRef bv1 = (CFBitVectorRef)cf1;
     CFBitVectorRef bv2 = (CFBitVectorRef)cf2;
@@ -159,11 +978,17 @@ static Boolean __CFBitVectorEqual(CFTypeRef cf1, CFTypeRef cf2) {
     cnt = __CFBitVectorCount(bv1);
     if (cnt != __CFBitVectorCount(bv2)) return false;
     if (0 == cnt) return true;
-    for (idx = 0; idx < (cnt / __CF_BITS_PER_BUCKET) + 1; idx++) {
+    if (__CFBitVectorIsCompressed(bv1)) return __CFBitVectorChunksEqual(bv1, bv2);
+    if (__CFBitVectorIsCompressed(bv2)) return __CFBitVectorChunksEqual(bv2, bv1);
+    for (idx = 0; idx < cnt / __CF_BITS_PER_BUCKET; idx++) {
 	__CFBitVectorBucket val1 = bv1->_buckets[idx];
 	__CFBitVectorBucket val2 = bv2->_buckets[idx];
 	if (val1 != val2) return false;
     }
+    if (0 != (cnt & (__CF_BITS_PER_BUCKET - 1))) {	/* bits past the count may be left over from a longer vector */
+	__CFBitVectorBucket mask = __CFBitBucketMask(0, (cnt & (__CF_BITS_PER_BUCKET - 1)) - 1);
+	if ((bv1->_buckets[idx] & mask) != (bv2->_buckets[idx] & mask)) return false;
+    }
     return true;
 }
 
@@ -180,6 +1005,16 @@ static CFStringRef __CFBitVectorCopyDescription(CFTypeRef cf) {
     cnt = __CFBitVectorCount(bv);
     buckets = bv->_buckets;
     result = CFStringCreateMutable(kCFAllocatorSystemDefault, 0);
+    if (__CFBitVectorIsCompressed(bv)) {
+	static const char *chunkTypes[] = {"array", "bitmap", "runs"};
+	const __CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+	CFStringAppendFormat(result, NULL, CFSTR("<CFBitVector %p [%p]>{count = %u, compressed, chunks = (\n"), cf, CFGetAllocator(bv), cnt);
+	for (idx = 0; idx < list->_numChunks; idx++) {
+	    CFStringAppendFormat(result, NULL, CFSTR("\t%u : %d set (%s)\n"), (list->_chunks[idx]._key << 16), list->_chunks[idx]._count, chunkTypes[list->_chunks[idx]._type]);
+	}
+	CFStringAppend(result, CFSTR(")}"));
+	return result;
+    }
     CFStringAppendFormat(result, NULL, CFSTR("<CFBitVector %p [%p]>{count = %u, capacity = %u, objects = (\n"), cf, CFGetAllocator(bv), cnt, __CFBitVectorCapacity(bv));
     for (idx = 0; idx < (cnt / 64); idx++) {	/* Print groups of 64 */
 	CFIndex idx2;
@@ -204,22 +1039,20 @@ static CFStringRef __CFBitVectorCopyDescription(CFTypeRef cf) {
     return result;
 }
 
-enum {
-    kCFBitVectorImmutable = 0x0,		/* unchangable and fixed capacity; default */
-    kCFBitVectorMutable = 0x1,		/* changeable and variable capacity */
-    kCFBitVectorFixedMutable = 0x3	/* changeable and fixed capacity */
-};
-
 static void __CFBitVectorDeallocate(CFTypeRef cf) {
     CFMutableBitVectorRef bv = (CFMutableBitVectorRef)cf;
     CFAllocatorRef allocator = CFGetAllocator(bv);
     if (__CFBitVectorMutableVariety(bv) == kCFBitVectorMutable) {
 	_CFAllocatorDeallocateGC(allocator, bv->_buckets);
+    } else if (__CFBitVectorIsCompressed(bv)) {
+	__CFBitVectorChunkList *list = __CFBitVectorChunks(bv);
+	CFIndex idx;
+	for (idx = 0; idx < list->_numChunks; idx++) CFAllocatorDeallocate(allocator, list->_chunks[idx]._data);
+	CFAllocatorDeallocate(allocator, list->_chunks);
+	CFAllocatorDeallocate(allocator, list);
     }
 }
 
-static CFTypeID __kCFBitVectorTypeID = _kCFRuntimeNotATypeID;
-
 static const CFRuntimeClass __CFBitVectorClass = {
     _kCFRuntimeScannedObject,
     "CFBitVector",
@@ -255,8 +1088,8 @@ static CFMutableBitVectorRef __CFBitVectorInit(CFAllocatorRef allocator, CFOptio
     }
     switch (__CFBitVectorMutableVarietyFromFlags(flags)) {
     case kCFBitVectorMutable:
-	__CFBitVectorSetCapacity(memory, __CFBitVectorRoundUpCapacity(1));
-	__CFBitVectorSetNumBuckets(memory, __CFBitVectorNumBucketsForCapacity(__CFBitVectorRoundUpCapacity(1)));
+	__CFBitVectorSetCapacity(memory, __CFBitVectorRoundUpCapacity(__CFMax(numBits, 1)));
+	__CFBitVectorSetNumBuckets(memory, __CFBitVectorNumBucketsForCapacity(__CFBitVectorRoundUpCapacity(__CFMax(numBits, 1))));
 	CF_WRITE_BARRIER_BASE_ASSIGN(allocator, memory, memory->_buckets, _CFAllocatorAllocateGC(allocator, __CFBitVectorNumBuckets(memory) * sizeof(__CFBitVectorBucket), 0));
 	if (__CFOASafe) __CFSetLastAllocationEventName(memory->_buckets, "CFBitVector (store)");
 	if (NULL == memory->_buckets) {
@@ -292,14 +1125,36 @@ CFMutableBitVectorRef CFBitVectorCreateMutable(CFAllocatorRef allocator, CFIndex
 
 CFBitVectorRef CFBitVectorCreateCopy(CFAllocatorRef allocator, CFBitVectorRef bv) {
    __CFGenericValidateType(bv, __kCFBitVectorTypeID);
+    if (__CFBitVectorIsCompressed(bv)) return __CFBitVectorCreateCompressed(allocator, bv);
     return __CFBitVectorInit(allocator, kCFBitVectorImmutable, __CFBitVectorCount(bv), (const uint8_t *)bv->_buckets, __CFBitVectorCount(bv));
 }
 
 CFMutableBitVectorRef CFBitVectorCreateMutableCopy(CFAllocatorRef allocator, CFIndex capacity, CFBitVectorRef bv) {
    __CFGenericValidateType(bv, __kCFBitVectorTypeID);
+    if (__CFBitVectorIsCompressed(bv)) {
+	CFMutableBitVectorRef result;
+	if (0 == capacity) return __CFBitVectorCreateCompressed(allocator, bv);
+	result = __CFBitVectorInit(allocator, kCFBitVectorFixedMutable, capacity, NULL, __CFBitVectorCount(bv));
+	if (result && 0 < __CFBitVectorCount(bv)) __CFBitVectorChunksGetBits(bv, CFRangeMake(0, __CFBitVectorCount(bv)), result->_buckets);
+	return result;
+    }
     return __CFBitVectorInit(allocator, (0 == capacity) ? kCFBitVectorMutable : kCFBitVectorFixedMutable, capacity, (const uint8_t *)bv->_buckets, __CFBitVectorCount(bv));
 }
 
+CFMutableBitVectorRef CFBitVectorCreateMutableCompressed(CFAllocatorRef allocator) {
+    return __CFBitVectorCreateCompressed(allocator, NULL);
+}
+
+CFMutableBitVectorRef CFBitVectorCreateMutableCompressedCopy(CFAllocatorRef allocator, CFBitVectorRef bv) {
+    __CFGenericValidateType(bv, __kCFBitVectorTypeID);
+    return __CFBitVectorCreateCompressed(allocator, bv);
+}
+
+Boolean CFBitVectorIsCompressed(CFBitVectorRef bv) {
+    __CFGenericValidateType(bv, __kCFBitVectorTypeID);
+    return __CFBitVectorIsCompressed(bv);
+}
+
 CFIndex CFBitVectorGetCount(CFBitVectorRef bv) {
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     return __CFBitVectorCount(bv);
@@ -341,119 +1196,107 @@ static void __CFBitVectorInternalMap(CFMutableBitVectorRef bv, CFRange range, __
     }
 }
 
-struct _occursContext {
-    CFBit value;
-    CFIndex count;
-};
-
-static __CFBitVectorBucket __CFBitVectorCountBits(__CFBitVectorBucket bucketValue, __CFBitVectorBucket bucketValueMask, struct _occursContext *context) {
-    static const __CFBitVectorBucket __CFNibbleBitCount[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
-    __CFBitVectorBucket val;
-    CFIndex idx;
-    val = (context->value) ? (bucketValue & bucketValueMask) : (~bucketValue & bucketValueMask);
-    for (idx = 0; idx < (CFIndex)sizeof(__CFBitVectorBucket) * 2; idx++) {
-	context->count += __CFNibbleBitCount[val & 0xF];
-	val = val >> 4;
-    }
-    return bucketValue;
-}
-
 CFIndex CFBitVectorGetCountOfBit(CFBitVectorRef bv, CFRange range, CFBit value) {
-    struct _occursContext context;
+    CFIndex location, end, numBits, count = 0;
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     __CFBitVectorValidateRange(bv, range, __PRETTY_FUNCTION__);
-    if (0 == range.length) return 0;
-    context.value = value;
-    context.count = 0;
-    __CFBitVectorInternalMap((CFMutableBitVectorRef)bv, range, (__CFInternalMapper)__CFBitVectorCountBits, &context);
-    return context.count;
+    if (__CFBitVectorIsCompressed(bv)) {
+	count = __CFBitVectorChunksCountOfBit(bv, range);
+	return value ? count : range.length - count;
+    }
+    for (location = range.location, end = range.location + range.length; location < end;) {
+	count += __CFPopCount64(__CFBitVectorNextWord(bv->_buckets, &location, end, &numBits));
+    }
+    return value ? count : range.length - count;
+}
+
+static CFIndex __CFBitVectorFirstIndexOfBit(CFBitVectorRef bv, CFRange range, CFBit value) {
+    CFIndex location, end, numBits;
+    if (__CFBitVectorIsCompressed(bv)) return __CFBitVectorChunksFirstIndexOfBit(bv, range, value);
+    for (location = range.location, end = range.location + range.length; location < end;) {
+	CFIndex start = location;
+	uint64_t word = __CFBitVectorNextWord(bv->_buckets, &location, end, &numBits);
+	if (!value) word = ~word & __CFBitVectorTopBits(numBits);
+	if (0 != word) return start + __CFCountLeadingZeros64(word);
+    }
+    return kCFNotFound;
 }
 
 Boolean CFBitVectorContainsBit(CFBitVectorRef bv, CFRange range, CFBit value) {
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     __CFBitVectorValidateRange(bv, range, __PRETTY_FUNCTION__);
-    return (CFBitVectorGetCountOfBit(bv, range, value) != 0) ? true : false;
+    return (__CFBitVectorFirstIndexOfBit(bv, range, value) != kCFNotFound) ? true : false;
 }
 
 CFBit CFBitVectorGetBitAtIndex(CFBitVectorRef bv, CFIndex idx) {
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     CFAssert2(0 <= idx && idx < __CFBitVectorCount(bv), __kCFLogAssertion, "%s(): index (%d) out of bounds", __PRETTY_FUNCTION__, idx);
+    if (__CFBitVectorIsCompressed(bv)) return __CFBitVectorChunksBit(bv, idx);
     return __CFBitVectorBit(bv->_buckets, idx);
 }
 
-struct _getBitsContext {
-    uint8_t *curByte;
-    CFIndex initBits;	/* Bits to extract off the front for the prev. byte */
-    CFIndex totalBits;	/* This is for stopping at the end */
-    bool ignoreFirstInitBits;
-};
-
-static __CFBitVectorBucket __CFBitVectorGetBits(__CFBitVectorBucket bucketValue, __CFBitVectorBucket bucketValueMask, void *ctx) {
-    struct _getBitsContext *context = (struct _getBitsContext *)ctx;
-    __CFBitVectorBucket val;
-    CFIndex nBits;
-    val = bucketValue & bucketValueMask;
-    nBits = __CFMin(__CF_BITS_PER_BUCKET - context->initBits, context->totalBits);
-    /* First initBits bits go in *curByte ... */
-    if (0 < context->initBits) {
-	if (!context->ignoreFirstInitBits) {
-	    *context->curByte |= (uint8_t)(val >> (__CF_BITS_PER_BUCKET - context->initBits));
-	    context->curByte++;
-	    context->totalBits -= context->initBits;
-	    context->ignoreFirstInitBits = false;
-	}
-	val <<= context->initBits;
-    }
-    /* ... then next groups of __CF_BITS_PER_BYTE go in *curByte ... */
-    while (__CF_BITS_PER_BYTE <= nBits) {
-	*context->curByte = (uint8_t)(val >> (__CF_BITS_PER_BUCKET - __CF_BITS_PER_BYTE));
-	context->curByte++;
-	context->totalBits -= context->initBits;
-	nBits -= __CF_BITS_PER_BYTE;
-	val <<= __CF_BITS_PER_BYTE;
-    }
-    /* ... then remaining bits go in *curByte */
-    if (0 < nBits) {
-	*context->curByte = (uint8_t)(val >> (__CF_BITS_PER_BUCKET - __CF_BITS_PER_BYTE));
-	context->totalBits -= nBits;
-    }
-    return bucketValue;
-}
-
 void CFBitVectorGetBits(CFBitVectorRef bv, CFRange range, uint8_t *bytes) {
-    struct _getBitsContext context;
+    CFIndex idx, numBytes;
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     __CFBitVectorValidateRange(bv, range, __PRETTY_FUNCTION__);
     if (0 == range.length) return;
-    context.curByte = bytes;
-    context.initBits = range.location & (__CF_BITS_PER_BUCKET - 1);
-    context.totalBits = range.length;
-    context.ignoreFirstInitBits = true;
-    __CFBitVectorInternalMap((CFMutableBitVectorRef)bv, range, __CFBitVectorGetBits, &context);
+    if (__CFBitVectorIsCompressed(bv)) {
+	__CFBitVectorChunksGetBits(bv, range, bytes);
+	return;
+    }
+    /* Each byte takes the bits from one or two buckets; a bucket is only read if it holds bits of the range */
+    numBytes = (range.length + __CF_BITS_PER_BYTE - 1) / __CF_BITS_PER_BYTE;
+    for (idx = 0; idx < numBytes; idx++) {
+	CFIndex location = range.location + idx * __CF_BITS_PER_BYTE;
+	CFIndex numBits = __CFMin(__CF_BITS_PER_BYTE, range.location + range.length - location);
+	CFIndex bucketIdx = location / __CF_BITS_PER_BYTE, offset = location & (__CF_BITS_PER_BYTE - 1);
+	uint32_t pair = (uint32_t)bv->_buckets[bucketIdx] << __CF_BITS_PER_BYTE;
+	if (__CF_BITS_PER_BYTE < offset + numBits) pair |= bv->_buckets[bucketIdx + 1];
+	bytes[idx] = (uint8_t)((pair << offset) >> __CF_BITS_PER_BYTE) & (uint8_t)(0xFF << (__CF_BITS_PER_BYTE - numBits));
+    }
 }
 
 CFIndex CFBitVectorGetFirstIndexOfBit(CFBitVectorRef bv, CFRange range, CFBit value) {
-    CFIndex idx;
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     __CFBitVectorValidateRange(bv, range, __PRETTY_FUNCTION__);
-    for (idx = 0; idx < range.length; idx++) {
-	if (value == CFBitVectorGetBitAtIndex(bv, range.location + idx)) {
-	    return range.location + idx;
-	}
+    return __CFBitVectorFirstIndexOfBit(bv, range, value);
+}
+
+CFIndex CFBitVectorGetLastIndexOfBit(CFBitVectorRef bv, CFRange range, CFBit value) {
+    CFIndex end;
+    __CFGenericValidateType(bv, __kCFBitVectorTypeID);
+    __CFBitVectorValidateRange(bv, range, __PRETTY_FUNCTION__);
+    if (__CFBitVectorIsCompressed(bv)) return __CFBitVectorChunksLastIndexOfBit(bv, range, value);
+    /* Scan backwards a word at a time; the word's bits start at the bit numbered firstByte * 8 */
+    for (end = range.location + range.length; range.location < end;) {
+	CFIndex lastByte = (end - 1) / __CF_BITS_PER_BYTE;
+	CFIndex firstByte = __CFMax(lastByte - 7, range.location / __CF_BITS_PER_BYTE);
+	CFIndex start = __CFMax(firstByte * __CF_BITS_PER_BYTE, range.location);
+	uint64_t word = __CFBitVectorLoadWord(bv->_buckets, firstByte, lastByte - firstByte + 1);
+	if (!value) word = ~word;
+	word &= __CFBitVectorTopBits(end - firstByte * __CF_BITS_PER_BYTE) & ~__CFBitVectorTopBits(start - firstByte * __CF_BITS_PER_BYTE);
+	if (0 != word) return firstByte * __CF_BITS_PER_BYTE + 63 - __CFCountTrailingZeros64(word);
+	end = start;
     }
     return kCFNotFound;
 }
 
-CFIndex CFBitVectorGetLastIndexOfBit(CFBitVectorRef bv, CFRange range, CFBit value) {
-    CFIndex idx;
+CFIndex CFBitVectorGetIndexesOfBit(CFBitVectorRef bv, CFRange range, CFBit value, CFIndex *indexes, CFIndex maxCount) {
+    CFIndex location, end, numBits, found = 0;
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     __CFBitVectorValidateRange(bv, range, __PRETTY_FUNCTION__);
-    for (idx = range.length; idx--;) {
-	if (value == CFBitVectorGetBitAtIndex(bv, range.location + idx)) {
-	    return range.location + idx;
+    if (__CFBitVectorIsCompressed(bv)) return __CFBitVectorChunksGetIndexesOfBit(bv, range, value, indexes, maxCount);
+    for (location = range.location, end = range.location + range.length; location < end && found < maxCount;) {
+	CFIndex start = location;
+	uint64_t word = __CFBitVectorNextWord(bv->_buckets, &location, end, &numBits);
+	if (!value) word = ~word & __CFBitVectorTopBits(numBits);
+	while (0 != word && found < maxCount) {
+	    CFIndex bit = __CFCountLeadingZeros64(word);
+	    indexes[found++] = start + bit;
+	    word &= ~((uint64_t)1 << (63 - bit));
 	}
     }
-    return kCFNotFound;
+    return found;
 }
 
 static void __CFBitVectorGrow(CFMutableBitVectorRef bv, CFIndex numNewValues) {
@@ -477,8 +1320,13 @@ static __CFBitVectorBucket __CFBitVectorOneBits(__CFBitVectorBucket bucketValue,
 
 void CFBitVectorSetCount(CFMutableBitVectorRef bv, CFIndex count) {
     CFIndex cnt;
-    CFAssert1(__CFBitVectorMutableVariety(bv) == kCFBitVectorMutable || __CFBitVectorMutableVariety(bv) == kCFBitVectorFixedMutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
+    CFAssert1(__CFBitVectorMutableVariety(bv) != kCFBitVectorImmutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
     cnt = __CFBitVectorCount(bv);
+    if (__CFBitVectorIsCompressed(bv)) {	/* bits past the count are never set */
+	if (count < cnt) __CFBitVectorChunksTruncate(bv, count);
+	__CFBitVectorSetCount(bv, count);
+	return;
+    }
     switch (__CFBitVectorMutableVariety(bv)) {
     case kCFBitVectorMutable:
 	if (cnt < count) {
@@ -500,7 +1348,11 @@ void CFBitVectorSetCount(CFMutableBitVectorRef bv, CFIndex count) {
 void CFBitVectorFlipBitAtIndex(CFMutableBitVectorRef bv, CFIndex idx) {
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     CFAssert2(0 <= idx && idx < __CFBitVectorCount(bv), __kCFLogAssertion, "%s(): index (%d) out of bounds", __PRETTY_FUNCTION__, idx);
-    CFAssert1(__CFBitVectorMutableVariety(bv) == kCFBitVectorMutable || __CFBitVectorMutableVariety(bv) == kCFBitVectorFixedMutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
+    CFAssert1(__CFBitVectorMutableVariety(bv) != kCFBitVectorImmutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
+    if (__CFBitVectorIsCompressed(bv)) {
+	__CFBitVectorChunksSetBit(bv, idx, !__CFBitVectorChunksBit(bv, idx));
+	return;
+    }
     __CFFlipBitVectorBit(bv->_buckets, idx);
 }
 
@@ -511,23 +1363,35 @@ static __CFBitVectorBucket __CFBitVectorFlipBits(__CFBitVectorBucket bucketValue
 void CFBitVectorFlipBits(CFMutableBitVectorRef bv, CFRange range) {
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     __CFBitVectorValidateRange(bv, range, __PRETTY_FUNCTION__);
-    CFAssert1(__CFBitVectorMutableVariety(bv) == kCFBitVectorMutable || __CFBitVectorMutableVariety(bv) == kCFBitVectorFixedMutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
+    CFAssert1(__CFBitVectorMutableVariety(bv) != kCFBitVectorImmutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
     if (0 == range.length) return;
+    if (__CFBitVectorIsCompressed(bv)) {
+	__CFBitVectorChunksMapRange(bv, range, __kCFBitVectorXor);
+	return;
+    }
     __CFBitVectorInternalMap(bv, range, __CFBitVectorFlipBits, NULL);
 }
 
 void CFBitVectorSetBitAtIndex(CFMutableBitVectorRef bv, CFIndex idx, CFBit value) {
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     CFAssert2(0 <= idx && idx < __CFBitVectorCount(bv), __kCFLogAssertion, "%s(): index (%d) out of bounds", __PRETTY_FUNCTION__, idx);
-    CFAssert1(__CFBitVectorMutableVariety(bv) == kCFBitVectorMutable || __CFBitVectorMutableVariety(bv) == kCFBitVectorFixedMutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
+    CFAssert1(__CFBitVectorMutableVariety(bv) != kCFBitVectorImmutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
+    if (__CFBitVectorIsCompressed(bv)) {
+	__CFBitVectorChunksSetBit(bv, idx, value);
+	return;
+    }
     __CFSetBitVectorBit(bv->_buckets, idx, value);
 }
 
 void CFBitVectorSetBits(CFMutableBitVectorRef bv, CFRange range, CFBit value) {
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
     __CFBitVectorValidateRange(bv, range, __PRETTY_FUNCTION__);
-    CFAssert1(__CFBitVectorMutableVariety(bv) == kCFBitVectorMutable || __CFBitVectorMutableVariety(bv) == kCFBitVectorFixedMutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
+    CFAssert1(__CFBitVectorMutableVariety(bv) != kCFBitVectorImmutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
     if (0 == range.length) return;
+    if (__CFBitVectorIsCompressed(bv)) {
+	__CFBitVectorChunksMapRange(bv, range, value ? __kCFBitVectorOr : __kCFBitVectorAndNot);
+	return;
+    }
     if (value) {
 	__CFBitVectorInternalMap(bv, range, __CFBitVectorOneBits, NULL);
     } else {
@@ -538,7 +1402,11 @@ void CFBitVectorSetBits(CFMutableBitVectorRef bv, CFRange range, CFBit value) {
 void CFBitVectorSetAllBits(CFMutableBitVectorRef bv, CFBit value) {
     CFIndex nBuckets, leftover;
     __CFGenericValidateType(bv, __kCFBitVectorTypeID);
-    CFAssert1(__CFBitVectorMutableVariety(bv) == kCFBitVectorMutable || __CFBitVectorMutableVariety(bv) == kCFBitVectorFixedMutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
+    CFAssert1(__CFBitVectorMutableVariety(bv) != kCFBitVectorImmutable, __kCFLogAssertion, "%s(): bit vector is immutable", __PRETTY_FUNCTION__);
+    if (__CFBitVectorIsCompressed(bv)) {
+	__CFBitVectorChunksMapRange(bv, CFRangeMake(0, __CFBitVectorCount(bv)), value ? __kCFBitVectorOr : __kCFBitVectorAndNot);
+	return;
+    }
     nBuckets = __CFBitVectorCount(bv) / __CF_BITS_PER_BUCKET;
     leftover = __CFBitVectorCount(bv) - nBuckets * __CF_BITS_PER_BUCKET;
     if (0 < leftover) {
@@ -552,5 +1420,243 @@ void CFBitVectorSetAllBits(CFMutableBitVectorRef bv, CFBit value) {
     memset(bv->_buckets, (value ? ~0 : 0), nBuckets);
 }
 
+CF_INLINE uint8_t __CFBitVectorByteMask(CFIndex byteIdx, CFIndex numBits) {	/* bits of the byte below numBits */
+    CFIndex n = numBits - byteIdx * __CF_BITS_PER_BYTE;
+    return (n <= 0) ? 0 : (__CF_BITS_PER_BYTE <= n) ? 0xFF : (uint8_t)(0xFF << (__CF_BITS_PER_BYTE - n));
+}
+
+static void __CFBitVectorCombineBits(CFMutableBitVectorRef bv, CFBitVectorRef other, int op, const char *func) {
+    CFIndex count, shared, byteIdx, fullBytes, lastByte;
+    __CFBitVectorBucket *dst;
+    const __CFBitVectorBucket *src;
+    __CFBitVectorBucket *otherBits = NULL;
+    uint64_t word, otherWord;
+    __CFGenericValidateType(bv, __kCFBitVectorTypeID);
+    __CFGenericValidateType(other, __kCFBitVectorTypeID);
+    CFAssert1(__CFBitVectorMutableVariety(bv) != kCFBitVectorImmutable, __kCFLogAssertion, "%s(): bit vector is immutable", func);
+    if (__CFBitVectorIsCompressed(bv)) {
+	CFBitVectorRef source = (__CFBitVectorIsCompressed(other) && other != bv) ? other : __CFBitVectorCreateCompressed(kCFAllocatorSystemDefault, other);
+	__CFBitVectorChunksCombine(bv, source, op);
+	if (source != other) CFRelease(source);
+	return;
+    }
+    count = __CFBitVectorCount(bv);
+    shared = __CFMin(count, __CFBitVectorCount(other));
+    dst = bv->_buckets;
+    src = other->_buckets;
+    if (__CFBitVectorIsCompressed(other) && 0 < shared) {
+	otherBits = (__CFBitVectorBucket *)CFAllocatorAllocate(kCFAllocatorSystemDefault, (shared + __CF_BITS_PER_BYTE - 1) / __CF_BITS_PER_BYTE, 0);
+	if (NULL == otherBits) HALT;
+	__CFBitVectorChunksGetBits(other, CFRangeMake(0, shared), otherBits);
+	src = otherBits;
+    }
+    /* Whole words shared by both vectors; bitwise operations don't care about byte order.
+       Each loop is branch-free so that compilers can unroll and vectorize it. */
+    fullBytes = (shared / __CF_BITS_PER_BYTE) & ~(CFIndex)7;
+    switch (op) {
+    case __kCFBitVectorAnd:
+	for (byteIdx = 0; byteIdx < fullBytes; byteIdx += 8) {
+	    memcpy(&word, dst + byteIdx, 8); memcpy(&otherWord, src + byteIdx, 8);
+	    word &= otherWord;
+	    memcpy(dst + byteIdx, &word, 8);
+	}
+	break;
+    case __kCFBitVectorOr:
+	for (byteIdx = 0; byteIdx < fullBytes; byteIdx += 8) {
+	    memcpy(&word, dst + byteIdx, 8); memcpy(&otherWord, src + byteIdx, 8);
+	    word |= otherWord;
+	    memcpy(dst + byteIdx, &word, 8);
+	}
+	break;
+    case __kCFBitVectorXor:
+	for (byteIdx = 0; byteIdx < fullBytes; byteIdx += 8) {
+	    memcpy(&word, dst + byteIdx, 8); memcpy(&otherWord, src + byteIdx, 8);
+	    word ^= otherWord;
+	    memcpy(dst + byteIdx, &word, 8);
+	}
+	break;
+    case __kCFBitVectorAndNot:
+	for (byteIdx = 0; byteIdx < fullBytes; byteIdx += 8) {
+	    memcpy(&word, dst + byteIdx, 8); memcpy(&otherWord, src + byteIdx, 8);
+	    word &= ~otherWord;
+	    memcpy(dst + byteIdx, &word, 8);
+	}
+	break;
+    }
+    /* The remaining bytes a bit at a time; bits past the end of other count as 0, and bits past the end of bv are left alone */
+    lastByte = (0 < count) ? (count - 1) / __CF_BITS_PER_BYTE : -1;
+    for (byteIdx = fullBytes; byteIdx <= lastByte; byteIdx++) {
+	uint8_t mask = __CFBitVectorByteMask(byteIdx, count);
+	uint8_t otherByte = (byteIdx * __CF_BITS_PER_BYTE < shared) ? (src[byteIdx] & __CFBitVectorByteMask(byteIdx, shared)) : 0;
+	uint8_t result;
+	switch (op) {
+	case __kCFBitVectorAnd: result = dst[byteIdx] & otherByte; break;
+	case __kCFBitVectorOr: result = dst[byteIdx] | otherByte; break;
+	case __kCFBitVectorXor: result = dst[byteIdx] ^ otherByte; break;
+	default: result = dst[byteIdx] & ~otherByte; break;
+	}
+	dst[byteIdx] = (dst[byteIdx] & ~mask) | (result & mask);
+    }
+    if (otherBits) CFAllocatorDeallocate(kCFAllocatorSystemDefault, otherBits);
+}
+
+void CFBitVectorAndBits(CFMutableBitVectorRef bv, CFBitVectorRef other) {
+    __CFBitVectorCombineBits(bv, other, __kCFBitVectorAnd, __PRETTY_FUNCTION__);
+}
+
+void CFBitVectorOrBits(CFMutableBitVectorRef bv, CFBitVectorRef other) {
+    __CFBitVectorCombineBits(bv, other, __kCFBitVectorOr, __PRETTY_FUNCTION__);
+}
+
+void CFBitVectorXorBits(CFMutableBitVectorRef bv, CFBitVectorRef other) {
+    __CFBitVectorCombineBits(bv, other, __kCFBitVectorXor, __PRETTY_FUNCTION__);
+}
+
+void CFBitVectorAndNotBits(CFMutableBitVectorRef bv, CFBitVectorRef other) {
+    __CFBitVectorCombineBits(bv, other, __kCFBitVectorAndNot, __PRETTY_FUNCTION__);
+}
+
+/* Serialized form, all little-endian: "CFBV", the count (8 bytes) and the number of chunks (4 bytes), then for each chunk its
+   key (4 bytes), type, set bits - 1 and number of runs (2 bytes each), followed by its values, bitmap words or run pairs.
+   Each chunk is written in its smallest form, so equal vectors give equal bytes. */
+static const uint8_t __CFBitVectorCookie[4] = {'C', 'F', 'B', 'V'};
+
+static void __CFBitVectorPutInteger(uint8_t **bytes, uint64_t value, CFIndex size) {
+    CFIndex idx;
+    for (idx = 0; idx < size; idx++) (*bytes)[idx] = (uint8_t)(value >> (8 * idx));
+    *bytes += size;
+}
+
+static uint64_t __CFBitVectorGetInteger(const uint8_t **bytes, CFIndex size) {
+    uint64_t value = 0;
+    CFIndex idx;
+    for (idx = 0; idx < size; idx++) value |= (uint64_t)(*bytes)[idx] << (8 * idx);
+    *bytes += size;
+    return value;
+}
+
+/* The number of runs of set bits in a chunk */
+static CFIndex __CFBitVectorChunkRuns(const __CFBitVectorChunk *chunk) {
+    const uint16_t *values = (const uint16_t *)chunk->_data;
+    CFIndex idx, numRuns = 1;
+    switch (chunk->_type) {
+    case __kCFBitVectorArrayChunk:
+	for (idx = 1; idx < chunk->_length; idx++) if (values[idx] != values[idx - 1] + 1) numRuns++;
+	return numRuns;
+    case __kCFBitVectorRunChunk:
+	return chunk->_length;
+    default:
+	return __CFBitVectorWordsRuns((const uint64_t *)chunk->_data);
+    }
+}
+
+CFDataRef CFBitVectorCreateCompressedData(CFAllocatorRef allocator, CFBitVectorRef bv) {
+    CFBitVectorRef source;
+    const __CFBitVectorChunkList *list;
+    CFMutableDataRef data;
+    CFIndex idx, valueIdx, chunkSize, size = 16;
+    uint8_t *bytes;
+    uint64_t scratch[__kCFBitVectorChunkWords];
+    uint16_t values[2 * __kCFBitVectorChunkMaxArray];
+    __CFGenericValidateType(bv, __kCFBitVectorTypeID);
+    source = __CFBitVectorIsCompressed(bv) ? bv : __CFBitVectorCreateCompressed(kCFAllocatorSystemDefault, bv);
+    list = __CFBitVectorChunks(source);
+    for (idx = 0; idx < list->_numChunks; idx++) {
+	__CFBitVectorBestChunkType(list->_chunks[idx]._count, __CFBitVectorChunkRuns(list->_chunks + idx), &chunkSize);
+	size += 10 + chunkSize;
+    }
+    data = CFDataCreateMutable(allocator, size);
+    CFDataSetLength(data, size);
+    bytes = CFDataGetMutableBytePtr(data);
+    memmove(bytes, __CFBitVectorCookie, sizeof(__CFBitVectorCookie));
+    bytes += sizeof(__CFBitVectorCookie);
+    __CFBitVectorPutInteger(&bytes, __CFBitVectorCount(source), 8);
+    __CFBitVectorPutInteger(&bytes, list->_numChunks, 4);
+    for (idx = 0; idx < list->_numChunks; idx++) {
+	const __CFBitVectorChunk *chunk = list->_chunks + idx;
+	CFIndex numRuns = __CFBitVectorChunkRuns(chunk);
+	int32_t type = __CFBitVectorBestChunkType(chunk->_count, numRuns, &chunkSize);
+	const void *contents = chunk->_data;
+	CFAssert1(chunk->_key <= 0xFFFFFFFFL, __kCFLogAssertion, "%s(): bit vector is too long to serialize", __PRETTY_FUNCTION__);
+	if (type != chunk->_type) {	/* convert through the bitmap */
+	    const uint64_t *words = __CFBitVectorChunkWords(chunk, scratch);
+	    if (__kCFBitVectorBitmapChunk == type) {
+		contents = words;
+	    } else {
+		__CFBitVectorWordsGetValues(words, type, values);
+		contents = values;
+	    }
+	}
+	__CFBitVectorPutInteger(&bytes, chunk->_key, 4);
+	__CFBitVectorPutInteger(&bytes, type, 2);
+	__CFBitVectorPutInteger(&bytes, chunk->_count - 1, 2);
+	__CFBitVectorPutInteger(&bytes, (__kCFBitVectorRunChunk == type) ? numRuns : 0, 2);
+	if (__kCFBitVectorBitmapChunk == type) {
+	    for (valueIdx = 0; valueIdx < __kCFBitVectorChunkWords; valueIdx++) __CFBitVectorPutInteger(&bytes, ((const uint64_t *)contents)[valueIdx], 8);
+	} else {
+	    for (valueIdx = 0; valueIdx < chunkSize / (CFIndex)sizeof(uint16_t); valueIdx++) __CFBitVectorPutInteger(&bytes, ((const uint16_t *)contents)[valueIdx], 2);
+	}
+    }
+    if (source != bv) CFRelease(source);
+    return data;
+}
+
+CFBitVectorRef CFBitVectorCreateWithCompressedBytes(CFAllocatorRef allocator, const uint8_t *bytes, CFIndex length) {
+    const uint8_t *end = bytes + length;
+    CFMutableBitVectorRef bv;
+    __CFBitVectorChunkList *list;
+    uint64_t count, numChunks, idx, words[__kCFBitVectorChunkWords];
+    CFIndex prevKey = -1;
+    if (length < 16 || 0 != memcmp(bytes, __CFBitVectorCookie, sizeof(__CFBitVectorCookie))) return NULL;
+    bytes += sizeof(__CFBitVectorCookie);
+    count = __CFBitVectorGetInteger(&bytes, 8);
+    numChunks = __CFBitVectorGetInteger(&bytes, 4);
+    if ((CFIndex)count < 0 || (uint64_t)(CFIndex)count != count) return NULL;
+    bv = __CFBitVectorCreateCompressed(allocator, NULL);
+    if (NULL == bv) return NULL;
+    __CFBitVectorSetCount(bv, (CFIndex)count);
+    list = __CFBitVectorChunks(bv);
+    /* Each chunk is rebuilt from its bitmap, which checks that its parts agree and puts it in the smallest form */
+    for (idx = 0; idx < numChunks; idx++) {
+	CFIndex key, type, setBits, numRuns, valueIdx, size;
+	if (end - bytes < 10) goto invalid;
+	key = (CFIndex)__CFBitVectorGetInteger(&bytes, 4);
+	type = (CFIndex)__CFBitVectorGetInteger(&bytes, 2);
+	setBits = (CFIndex)__CFBitVectorGetInteger(&bytes, 2) + 1;
+	numRuns = (CFIndex)__CFBitVectorGetInteger(&bytes, 2);
+	if (key <= prevKey || (CFIndex)count <= (key << 16)) goto invalid;
+	switch (type) {
+	case __kCFBitVectorArrayChunk: size = setBits * sizeof(uint16_t); break;
+	case __kCFBitVectorBitmapChunk: size = sizeof(words); break;
+	case __kCFBitVectorRunChunk: size = numRuns * 2 * sizeof(uint16_t); break;
+	default: goto invalid;
+	}
+	if (end - bytes < size) goto invalid;
+	memset(words, 0, sizeof(words));
+	for (valueIdx = 0; valueIdx < size / (CFIndex)((__kCFBitVectorBitmapChunk == type) ? sizeof(uint64_t) : sizeof(uint16_t)); valueIdx++) {
+	    if (__kCFBitVectorBitmapChunk == type) {
+		words[valueIdx] = __CFBitVectorGetInteger(&bytes, 8);
+	    } else if (__kCFBitVectorArrayChunk == type) {
+		CFIndex low = (CFIndex)__CFBitVectorGetInteger(&bytes, 2);
+		words[low >> 6] |= __CFBitVectorChunkBit(low);
+	    } else {
+		CFIndex first = (CFIndex)__CFBitVectorGetInteger(&bytes, 2), last = (CFIndex)__CFBitVectorGetInteger(&bytes, 2);
+		if (last < first) goto invalid;
+		__CFBitVectorMapWords(words, first, last, __kCFBitVectorOr);
+		valueIdx++;
+	    }
+	}
+	if (__CFBitVectorWordsCount(words, 0, __kCFBitVectorChunkBits - 1) != setBits) goto invalid;
+	if ((CFIndex)count <= (key << 16) + __CFBitVectorWordsPrev(words, __kCFBitVectorChunkBits - 1, 1)) goto invalid;
+	__CFBitVectorChunkSetWords(CFGetAllocator(bv), __CFBitVectorInsertChunk(CFGetAllocator(bv), list, list->_numChunks, key), words, setBits);
+	prevKey = key;
+    }
+    if (bytes != end) goto invalid;
+    return bv;
+invalid:
+    CFRelease(bv);
+    return NULL;
+}
+
 #undef __CFBitVectorValidateRange
 
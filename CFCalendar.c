@@ -126,8 +126,23 @@ __private_extern__ UCalendar *__CFCalendarCreateUCalendar(CFStringRef calendarID
     if (BUFFER_SIZE < cnt) cnt = BUFFER_SIZE;
     CFStringGetCharacters(tznam, CFRangeMake(0, cnt), (UniChar *)ubuffer);
 
+    // Opening a calendar loads the locale's and zone's data; clone a shared prototype instead, set to now as ucal_open() would be
     UErrorCode status = U_ZERO_ERROR;
-    UCalendar *cal = ucal_open(ubuffer, cnt, cstr, UCAL_TRADITIONAL, &status);
+    CFStringRef key = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("ucal %s %@"), cstr, tznam);
+    const UCalendar *proto = (const UCalendar *)__CFICUPrototypeGet(key);
+    UCalendar *cal;
+    if (proto) {
+	cal = ucal_clone(proto, &status);
+	if (NULL != cal) ucal_setMillis(cal, ucal_getNow(), &status);
+    } else {
+	cal = ucal_open(ubuffer, cnt, cstr, UCAL_TRADITIONAL, &status);
+	if (NULL != cal) {
+	    UErrorCode cstatus = U_ZERO_ERROR;
+	    UCalendar *copy = ucal_clone(cal, &cstatus);
+	    if (NULL != copy && !__CFICUPrototypeAdd(key, copy)) ucal_close(copy);
+	}
+    }
+    CFRelease(key);
     if (calendarID) CFRelease(localeID);
     return cal;
 }
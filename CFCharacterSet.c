@@ -45,6 +45,9 @@
 #include "CFUniCharPriv.h"
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 #define BITSPERBYTE	8	/* (CHAR_BIT * sizeof(unsigned char)) */
@@ -2696,17 +2699,9 @@ void CFCharacterSetInitInlineBuffer(CFCharacterSetRef cset, CFCharacterSetInline
                 buffer->rangeStart = *__CFCSetStringBuffer(cset);
                 buffer->rangeLimit = *(__CFCSetStringBuffer(cset) + __CFCSetStringLength(cset) - 1) + 1;
 
-                if (__CFCSetIsInverted(cset)) {
-                    if (0 == buffer->rangeStart) {
-                        buffer->rangeStart = buffer->rangeLimit;
-                        buffer->rangeLimit = 0x10000;
-                    } else if (0x10000 == buffer->rangeLimit) {
-                        buffer->rangeLimit = buffer->rangeStart;
-                        buffer->rangeStart = 0;
-                    } else {
-                        buffer->rangeStart = 0;
-                        buffer->rangeLimit = 0x10000;
-                    }
+                if (__CFCSetIsInverted(cset)) { // Only U+0000 and U+FFFF can be excluded; the members between are not contiguous
+                    buffer->rangeStart = ((0 == buffer->rangeStart) ? 1 : 0);
+                    buffer->rangeLimit = ((0x10000 == buffer->rangeLimit) ? 0xFFFF : 0x10000);
                 }
             }
             break;
@@ -2740,3 +2735,232 @@ void CFCharacterSetInitInlineBuffer(CFCharacterSetRef cset, CFCharacterSetInline
         }
     }
 }
+
+/* Compiled buffer support
+*/
+#define __kCFCSetCompiledMaxRanges (sizeof(((CFCharacterSetCompiledBuffer *)NULL)->ranges) / sizeof(((CFCharacterSetCompiledBuffer *)NULL)->ranges[0]))
+#define __kCFCSetCompiledAllPlanes ((1 << (MAX_ANNEX_PLANE + 1)) - 1)
+
+CF_INLINE bool __CFCSetCompiledIsMember(const CFCharacterSetCompiledBuffer *compiled, UTF32Char character) {
+    if (character < 0x100) return __CFCSetIsMemberBitmap(compiled->latin1, character);
+    if (0 == (compiled->planes & (1 << (character >> 16)))) return false;
+    return CFCharacterSetInlineBufferIsLongCharacterMember((CFCharacterSetInlineBuffer *)&compiled->buffer, character);
+}
+
+// Tests a character at or above U+0100, pairing surrogates; low surrogates are only ever reported through their high surrogate
+CF_INLINE bool __CFCSetCompiledIsNonLatin1Member(const CFCharacterSetCompiledBuffer *compiled, const UniChar *chars, CFIndex idx, CFIndex length) {
+    UniChar character = chars[idx];
+
+    if (CFUniCharIsSurrogateHighCharacter(character)) {
+        return ((idx + 1 < length) && CFUniCharIsSurrogateLowCharacter(chars[idx + 1]) && __CFCSetCompiledIsMember(compiled, CFUniCharGetLongCharacterForSurrogatePair(character, chars[idx + 1])));
+    } else if (CFUniCharIsSurrogateLowCharacter(character)) {
+        return false;
+    }
+    return __CFCSetCompiledIsMember(compiled, character);
+}
+
+static void __CFCSetCompileLatin1(CFCharacterSetRef cset, CFCharacterSetCompiledBuffer *compiled) {
+    const CFCharacterSetInlineBuffer *buffer = &compiled->buffer;
+    uint8_t *latin1 = compiled->latin1;
+    uint32_t start = buffer->rangeStart;
+    uint32_t limit = (buffer->rangeLimit < 0x100 ? buffer->rangeLimit : 0x100);
+    uint32_t character;
+    CFIndex idx;
+
+    if (start < limit) {
+        if (buffer->flags & kCFCharacterSetNoBitmapAvailable) {
+            if (cset && __CFCSetIsString(cset)) {
+                const UniChar *string = __CFCSetStringBuffer(cset);
+                CFIndex length = __CFCSetStringLength(cset);
+
+                for (idx = 0;(idx < length) && (string[idx] < 0x100);idx++) __CFCSetBitmapAddCharacter(latin1, string[idx]);
+                if (__CFCSetIsInverted(cset)) {
+                    for (idx = 0;idx < 32;idx++) latin1[idx] = ~latin1[idx];
+                }
+            } else {
+                for (character = start;character < limit;character++) {
+                    if (CFCharacterSetIsLongCharacterMember(buffer->cset, character)) __CFCSetBitmapAddCharacter(latin1, character);
+                }
+            }
+        } else if (NULL == buffer->bitmap) {
+            if (0 == (buffer->flags & kCFCharacterSetIsCompactBitmap)) memset(latin1, 0xFF, 32);
+        } else if (0 == (buffer->flags & kCFCharacterSetIsCompactBitmap)) {
+            memmove(latin1, buffer->bitmap, 32);
+        } else {
+            uint8_t value = buffer->bitmap[0];
+
+            if (value == UINT8_MAX) {
+                memset(latin1, 0xFF, 32);
+            } else if (value > 0) {
+                memmove(latin1, buffer->bitmap + __kCFCompactBitmapNumPages + (__kCFCompactBitmapPageSize * (value - 1)), 32);
+            }
+        }
+        for (character = 0;character < start;character++) __CFCSetBitmapRemoveCharacter(latin1, character);
+        for (character = limit;character < 0x100;character++) __CFCSetBitmapRemoveCharacter(latin1, character);
+    }
+
+    // Outside of [rangeStart, rangeLimit) the inline buffer answers isInverted
+    if (buffer->flags & kCFCharacterSetIsInverted) {
+        for (idx = 0;idx < 32;idx++) latin1[idx] = ~latin1[idx];
+    }
+
+    compiled->numRanges = 0;
+    for (character = 0;character < 0x100;) {
+        if (__CFCSetIsMemberBitmap(latin1, character)) {
+            uint32_t first = character;
+
+            while ((character < 0x100) && __CFCSetIsMemberBitmap(latin1, character)) character++;
+            if (compiled->numRanges == __kCFCSetCompiledMaxRanges) {
+                compiled->numRanges = UINT8_MAX;
+                break;
+            }
+            compiled->ranges[compiled->numRanges][0] = first;
+            compiled->ranges[compiled->numRanges][1] = character - 1;
+            compiled->numRanges++;
+        } else if (0 == latin1[character >> LOG_BPB]) {
+            character += BITSPERBYTE;
+        } else {
+            character++;
+        }
+    }
+}
+
+static uint32_t __CFCSetCompilePlanes(CFCharacterSetRef cset, const CFCharacterSetInlineBuffer *buffer) {
+    uint32_t start = buffer->rangeStart;
+    uint32_t limit = buffer->rangeLimit;
+    uint32_t planes = 0;
+
+    if (buffer->flags & kCFCharacterSetIsInverted) return __kCFCSetCompiledAllPlanes;
+
+    if ((start < 0x10000) && (limit > 0x100)) {
+        uint32_t first = (start > 0x100 ? start : 0x100);
+        uint32_t last = (limit < 0x10000 ? limit : 0x10000) - 1;
+
+        if (buffer->flags & kCFCharacterSetNoBitmapAvailable) {
+            planes = 1;
+        } else if (NULL == buffer->bitmap) {
+            if (0 == (buffer->flags & kCFCharacterSetIsCompactBitmap)) planes = 1;
+        } else {
+            const uint8_t *bytes;
+            const uint8_t *end;
+
+            if (0 == (buffer->flags & kCFCharacterSetIsCompactBitmap)) {
+                bytes = buffer->bitmap + (first >> LOG_BPB);
+                end = buffer->bitmap + (last >> LOG_BPB);
+            } else { // The page index is enough; a listed page has at least one member
+                bytes = buffer->bitmap + (first >> 8);
+                end = buffer->bitmap + (last >> 8);
+            }
+            while ((bytes <= end) && (0 == *bytes)) bytes++;
+            if (bytes <= end) planes = 1;
+        }
+    }
+
+    if (limit > 0x10000) {
+        uint32_t plane = ((start >> 16) > 1 ? (start >> 16) : 1);
+        uint32_t mask = 0;
+
+        for (;(plane <= MAX_ANNEX_PLANE) && ((plane << 16) < limit);plane++) mask |= (1 << plane);
+
+        // Non-builtin sets answer from their annex, except a plain range that spills past the BMP
+        if (cset && !__CFCSetIsBuiltin(cset) && !__CFCSetAnnexIsInverted(cset) && (__CFCSetHasNonBMPPlane(cset) || !__CFCSetIsRange(cset))) mask &= __CFCSetAnnexValidEntriesBitmap(cset);
+        planes |= mask;
+    }
+
+    return planes;
+}
+
+// Builtin sets are immutable and may have no bitmap, so their compiled form is kept per type and inversion
+static CFCharacterSetCompiledBuffer *__CFCSetCompiledBuiltins[__kCFLastBuiltinSetID][2] = {{NULL}};
+
+void CFCharacterSetInitCompiledBuffer(CFCharacterSetRef cset, CFCharacterSetCompiledBuffer *compiled) {
+    CFCharacterSetRef expandedSet = cset;
+    CFCharacterSetCompiledBuffer **builtinSlot = NULL;
+
+    if (CF_IS_OBJC(__kCFCharacterSetTypeID, cset)) {
+        expandedSet = __CFCharacterSetGetExpandedSetForNSCharacterSet(cset);
+    } else if (__CFCSetIsBuiltin(cset)) {
+        builtinSlot = &__CFCSetCompiledBuiltins[__CFCSetBuiltinType(cset) - 1][__CFCSetIsInverted(cset) ? 1 : 0];
+        if (NULL != *builtinSlot) {
+            memmove(compiled, *builtinSlot, sizeof(CFCharacterSetCompiledBuffer));
+            compiled->buffer.cset = cset;
+            return;
+        }
+    }
+
+    memset(compiled, 0, sizeof(CFCharacterSetCompiledBuffer));
+    CFCharacterSetInitInlineBuffer(cset, &compiled->buffer);
+
+    __CFCSetCompileLatin1(expandedSet, compiled);
+    compiled->planes = __CFCSetCompilePlanes(expandedSet, &compiled->buffer);
+
+    if (NULL != builtinSlot) {
+        CFCharacterSetCompiledBuffer *copy = (CFCharacterSetCompiledBuffer *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(CFCharacterSetCompiledBuffer), 0);
+
+        memmove(copy, compiled, sizeof(CFCharacterSetCompiledBuffer));
+        if (!_CFAtomicCompareAndSwapPtrBarrier(NULL, copy, (void *volatile *)builtinSlot)) CFAllocatorDeallocate(kCFAllocatorSystemDefault, copy);
+    }
+}
+
+CFIndex CFCharacterSetCompiledBufferFindFirstMember(const CFCharacterSetCompiledBuffer *compiled, const UniChar *chars, CFIndex length) {
+    CFIndex idx = 0;
+
+#if defined(__SSE2__)
+    // Latin-1 members are tested as up to eight runs with saturating subtraction; everything above U+00FF is flagged for the scalar path only if the set can contain such characters
+    if (compiled->numRanges <= __kCFCSetCompiledMaxRanges) {
+        __m128i firsts[__kCFCSetCompiledMaxRanges];
+        __m128i widths[__kCFCSetCompiledMaxRanges];
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i highMask = _mm_set1_epi16((short)0xFF00);
+        uint32_t highFlags = (compiled->planes ? 0xFFFFFFFF : 0);
+        CFIndex numRanges = compiled->numRanges;
+        CFIndex range;
+
+        for (range = 0;range < numRanges;range++) {
+            firsts[range] = _mm_set1_epi16(compiled->ranges[range][0]);
+            widths[range] = _mm_set1_epi16(compiled->ranges[range][1] - compiled->ranges[range][0]);
+        }
+
+        for (;idx + 16 <= length;idx += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i *)(chars + idx));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(chars + idx + 8));
+            __m128i loHits = zero;
+            __m128i hiHits = zero;
+            uint32_t hits;
+
+            for (range = 0;range < numRanges;range++) {
+                loHits = _mm_or_si128(loHits, _mm_cmpeq_epi16(_mm_subs_epu16(_mm_sub_epi16(lo, firsts[range]), widths[range]), zero));
+                hiHits = _mm_or_si128(hiHits, _mm_cmpeq_epi16(_mm_subs_epu16(_mm_sub_epi16(hi, firsts[range]), widths[range]), zero));
+            }
+            hits = (uint32_t)_mm_movemask_epi8(loHits) | ((uint32_t)_mm_movemask_epi8(hiHits) << 16);
+            hits |= highFlags & ~((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(lo, highMask), zero)) | ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(hi, highMask), zero)) << 16));
+
+            while (hits) {
+                CFIndex lane = idx + (__CFCountTrailingZeros64(hits) >> 1);
+
+                if ((chars[lane] < 0x100) || __CFCSetCompiledIsNonLatin1Member(compiled, chars, lane, length)) return lane;
+                hits &= ~(3U << ((lane - idx) << 1));
+            }
+        }
+    }
+#endif
+
+    for (;idx < length;idx++) {
+        UniChar character = chars[idx];
+
+        if (character < 0x100) {
+            if (__CFCSetIsMemberBitmap(compiled->latin1, character)) return idx;
+        } else if (compiled->planes && __CFCSetCompiledIsNonLatin1Member(compiled, chars, idx, length)) {
+            return idx;
+        }
+    }
+
+    return kCFNotFound;
+}
+
+CFIndex CFCharacterSetFindFirstMember(CFCharacterSetRef theSet, const UniChar *chars, CFIndex length) {
+    CFCharacterSetCompiledBuffer compiled;
+
+    CFCharacterSetInitCompiledBuffer(theSet, &compiled);
+    return CFCharacterSetCompiledBufferFindFirstMember(&compiled, chars, length);
+}
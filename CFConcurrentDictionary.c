@@ -0,0 +1,607 @@
+/*
+ * Copyright (c) 2008-2009 Brent Fulgham <bfulgham@gmail.org>.  All rights reserved.
+ *
+ * This source code is a modified version of the CoreFoundation sources released by Apple Inc. under
+ * the terms of the APSL version 2.0 (see below).
+ *
+ * For information about changes from the original Apple source release can be found by reviewing the
+ * source control system for the project at https://sourceforge.net/svn/?group_id=246198.
+ *
+ * The original license information is as follows:
+ *
+ * Copyright (c) 2008 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*	CFConcurrentDictionary.c
+	A dictionary for read-mostly data shared between threads
+*/
+
+#include <CoreFoundation/CFDictionary.h>
+#include "CFPriv.h"
+#include "CFInternal.h"
+#if DEPLOYMENT_TARGET_WINDOWS
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+/* The contents are a persistent hash array mapped trie. Each branch node
+   consumes 5 bits of the key's hash and holds only its occupied slots, found
+   by counting the bits of a 32-bit map; keys whose hashes are identical end
+   up together in a collision node. Nodes are never modified once published.
+   A mutation copies the path from the root to the changed leaf (at most a
+   dozen small nodes) and shares every other node with the previous version,
+   so nodes carry their own reference counts.
+
+   Writers are serialized by a lock and publish a new root with a single
+   store. Readers take no lock: they register in one of two counters
+   selected by the current epoch, and a writer flips the epoch and waits for
+   the old counter to drain before releasing the root it replaced. A
+   snapshot is just an extra reference to a root, taken inside a read. */
+
+enum {
+    __kCFConcurrentDictionaryLeaf = 0,
+    __kCFConcurrentDictionaryBranch = 1,
+    __kCFConcurrentDictionaryCollision = 2
+};
+
+enum {
+    __kCFConcurrentDictionaryBitsPerLevel = 5,
+    __kCFConcurrentDictionaryHashBits = sizeof(CFHashCode) * 8
+};
+
+typedef struct __CFConcurrentDictionaryNode __CFConcurrentDictionaryNode;
+
+struct __CFConcurrentDictionaryNode {
+    volatile int32_t _rc;
+    uint16_t _type;
+    uint32_t _count;		/* children, for branch and collision nodes */
+    uint32_t _bitmap;		/* occupied slots, for branch nodes */
+    CFIndex _size;		/* entries in this subtree */
+    CFHashCode _hash;		/* leaf and collision nodes */
+    const void *_key;		/* leaf nodes */
+    const void *_value;
+    __CFConcurrentDictionaryNode *_children[0];
+};
+
+struct __CFConcurrentDictionary {
+    CFRuntimeBase _base;
+    __CFConcurrentDictionaryNode *volatile _root;	/* NULL when empty */
+    CFDictionaryKeyCallBacks _keyCallBacks;
+    CFDictionaryValueCallBacks _valueCallBacks;
+    CFSpinLock_t _lock;		/* the rest is only used by mutable dictionaries */
+    volatile int32_t _epoch;
+    volatile int32_t _readers[2];
+};
+
+static const CFDictionaryKeyCallBacks __kCFNullConcurrentDictionaryKeyCallBacks = {0, NULL, NULL, NULL, NULL, NULL};
+static const CFDictionaryValueCallBacks __kCFNullConcurrentDictionaryValueCallBacks = {0, NULL, NULL, NULL, NULL};
+
+/* Bit 0 of the info bits: set for a mutable dictionary, clear for a snapshot */
+
+CF_INLINE Boolean __CFConcurrentDictionaryIsMutable(CFConcurrentDictionaryRef cd) {
+    return __CFBitfieldGetValue(((const CFRuntimeBase *)cd)->_cfinfo[CF_INFO_BITS], 0, 0) != 0;
+}
+
+CF_INLINE void __CFConcurrentDictionarySetMutable(CFConcurrentDictionaryRef cd) {
+    __CFBitfieldSetValue(((CFRuntimeBase *)cd)->_cfinfo[CF_INFO_BITS], 0, 0, 1);
+}
+
+CF_INLINE CFHashCode __CFConcurrentDictionaryHashKey(CFConcurrentDictionaryRef cd, const void *key) {
+    CFHashCode hash = cd->_keyCallBacks.hash ? (CFHashCode)INVOKE_CALLBACK1(cd->_keyCallBacks.hash, key) : (CFHashCode)key;
+    // Spread small integers and aligned pointers over the low bits, which the trie consumes first
+#if __LP64__
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 32);
+#else
+    hash *= 0x9E3779B9UL;
+    return hash ^ (hash >> 16);
+#endif
+}
+
+CF_INLINE Boolean __CFConcurrentDictionaryKeysEqual(CFConcurrentDictionaryRef cd, const void *key1, const void *key2) {
+    return key1 == key2 || (cd->_keyCallBacks.equal && INVOKE_CALLBACK2(cd->_keyCallBacks.equal, key1, key2));
+}
+
+CF_INLINE uint32_t __CFConcurrentDictionarySlot(CFHashCode hash, CFIndex shift) {
+    return (uint32_t)(hash >> shift) & 31;
+}
+
+/* Position of slot's child in a branch node's children */
+CF_INLINE CFIndex __CFConcurrentDictionaryChildIndex(const __CFConcurrentDictionaryNode *node, uint32_t slot) {
+    return __CFPopCount64(node->_bitmap & ((1U << slot) - 1));
+}
+
+/* Nodes */
+
+static __CFConcurrentDictionaryNode *__CFConcurrentDictionaryAllocateNode(CFAllocatorRef allocator, uint16_t type, CFIndex numChildren) {
+    __CFConcurrentDictionaryNode *node = (__CFConcurrentDictionaryNode *)CFAllocatorAllocate(allocator, sizeof(__CFConcurrentDictionaryNode) + numChildren * sizeof(__CFConcurrentDictionaryNode *), 0);
+    if (NULL == node) {
+	CFStringRef msg = CFSTR("Attempt to allocate a concurrent dictionary node failed");
+	CFLog(kCFLogLevelCritical, CFSTR("%@"), msg);
+	HALT;
+    }
+    if (__CFOASafe) __CFSetLastAllocationEventName(node, "CFConcurrentDictionary (node)");
+    node->_rc = 1;
+    node->_type = type;
+    node->_count = (uint32_t)numChildren;
+    node->_bitmap = 0;
+    node->_size = 0;
+    node->_hash = 0;
+    node->_key = NULL;
+    node->_value = NULL;
+    return node;
+}
+
+CF_INLINE __CFConcurrentDictionaryNode *__CFConcurrentDictionaryRetainNode(__CFConcurrentDictionaryNode *node) {
+    _CFAtomicIncrement32(&node->_rc);
+    return node;
+}
+
+static void __CFConcurrentDictionaryReleaseNode(CFConcurrentDictionaryRef cd, __CFConcurrentDictionaryNode *node) {
+    if (NULL == node || 0 != _CFAtomicDecrement32(&node->_rc)) return;
+    CFAllocatorRef allocator = __CFGetAllocator(cd);
+    if (__kCFConcurrentDictionaryLeaf == node->_type) {
+	if (cd->_keyCallBacks.release) INVOKE_CALLBACK2(cd->_keyCallBacks.release, allocator, node->_key);
+	if (cd->_valueCallBacks.release) INVOKE_CALLBACK2(cd->_valueCallBacks.release, allocator, node->_value);
+    } else {
+	for (CFIndex idx = 0; idx < node->_count; idx++) __CFConcurrentDictionaryReleaseNode(cd, node->_children[idx]);
+    }
+    CFAllocatorDeallocate(allocator, node);
+}
+
+static __CFConcurrentDictionaryNode *__CFConcurrentDictionaryCreateLeaf(CFConcurrentDictionaryRef cd, CFHashCode hash, const void *key, const void *value) {
+    CFAllocatorRef allocator = __CFGetAllocator(cd);
+    __CFConcurrentDictionaryNode *leaf = __CFConcurrentDictionaryAllocateNode(allocator, __kCFConcurrentDictionaryLeaf, 0);
+    leaf->_size = 1;
+    leaf->_hash = hash;
+    leaf->_key = cd->_keyCallBacks.retain ? (const void *)INVOKE_CALLBACK2(cd->_keyCallBacks.retain, allocator, key) : key;
+    leaf->_value = cd->_valueCallBacks.retain ? (const void *)INVOKE_CALLBACK2(cd->_valueCallBacks.retain, allocator, value) : value;
+    return leaf;
+}
+
+/* Copies a branch or collision node, retaining its children, leaving out the child at skip and a gap at insert (either may be -1) */
+static __CFConcurrentDictionaryNode *__CFConcurrentDictionaryCopyNode(CFConcurrentDictionaryRef cd, const __CFConcurrentDictionaryNode *node, CFIndex skip, CFIndex insert) {
+    __CFConcurrentDictionaryNode *copy = __CFConcurrentDictionaryAllocateNode(__CFGetAllocator(cd), node->_type, node->_count - (0 <= skip ? 1 : 0) + (0 <= insert ? 1 : 0));
+    CFIndex to = 0;
+    for (CFIndex idx = 0; idx < node->_count; idx++) {
+	if (to == insert) to++;
+	if (idx == skip) continue;
+	copy->_children[to++] = __CFConcurrentDictionaryRetainNode(node->_children[idx]);
+    }
+    copy->_bitmap = node->_bitmap;
+    copy->_size = node->_size;
+    copy->_hash = node->_hash;
+    return copy;
+}
+
+/* Joins two subtrees whose hashes differ in or below the level at shift, both references consumed */
+static __CFConcurrentDictionaryNode *__CFConcurrentDictionaryJoin(CFConcurrentDictionaryRef cd, __CFConcurrentDictionaryNode *node1, __CFConcurrentDictionaryNode *node2, CFIndex shift) {
+    CFAllocatorRef allocator = __CFGetAllocator(cd);
+    __CFConcurrentDictionaryNode *result;
+    if (__kCFConcurrentDictionaryHashBits <= shift) {
+	// Only whole-hash collisions get this far; node1 and node2 are leaves
+	result = __CFConcurrentDictionaryAllocateNode(allocator, __kCFConcurrentDictionaryCollision, 2);
+	result->_hash = node1->_hash;
+	result->_children[0] = node1;
+	result->_children[1] = node2;
+    } else {
+	uint32_t slot1 = __CFConcurrentDictionarySlot(node1->_hash, shift), slot2 = __CFConcurrentDictionarySlot(node2->_hash, shift);
+	if (slot1 == slot2) {
+	    result = __CFConcurrentDictionaryAllocateNode(allocator, __kCFConcurrentDictionaryBranch, 1);
+	    result->_children[0] = __CFConcurrentDictionaryJoin(cd, node1, node2, shift + __kCFConcurrentDictionaryBitsPerLevel);
+	} else {
+	    result = __CFConcurrentDictionaryAllocateNode(allocator, __kCFConcurrentDictionaryBranch, 2);
+	    result->_children[slot1 < slot2 ? 0 : 1] = node1;
+	    result->_children[slot1 < slot2 ? 1 : 0] = node2;
+	}
+	result->_bitmap = (1U << slot1) | (1U << slot2);
+    }
+    result->_size = node1->_size + node2->_size;
+    return result;
+}
+
+static const __CFConcurrentDictionaryNode *__CFConcurrentDictionaryFind(CFConcurrentDictionaryRef cd, const __CFConcurrentDictionaryNode *node, CFHashCode hash, const void *key) {
+    for (CFIndex shift = 0; NULL != node; shift += __kCFConcurrentDictionaryBitsPerLevel) {
+	switch (node->_type) {
+	case __kCFConcurrentDictionaryLeaf:
+	    return (node->_hash == hash && __CFConcurrentDictionaryKeysEqual(cd, node->_key, key)) ? node : NULL;
+	case __kCFConcurrentDictionaryCollision:
+	    if (node->_hash != hash) return NULL;
+	    for (CFIndex idx = 0; idx < node->_count; idx++) {
+		if (__CFConcurrentDictionaryKeysEqual(cd, node->_children[idx]->_key, key)) return node->_children[idx];
+	    }
+	    return NULL;
+	default: {
+	    uint32_t slot = __CFConcurrentDictionarySlot(hash, shift);
+	    if (0 == (node->_bitmap & (1U << slot))) return NULL;
+	    node = node->_children[__CFConcurrentDictionaryChildIndex(node, slot)];
+	    break;
+	}
+	}
+    }
+    return NULL;
+}
+
+/* Returns a new version of node with leaf in place of any entry with an equal key, consuming the leaf reference.
+   The previous entry, if any, is left in *replaced (unretained). */
+static __CFConcurrentDictionaryNode *__CFConcurrentDictionaryInsert(CFConcurrentDictionaryRef cd, const __CFConcurrentDictionaryNode *node, CFIndex shift, __CFConcurrentDictionaryNode *leaf, const __CFConcurrentDictionaryNode **replaced) {
+    __CFConcurrentDictionaryNode *result;
+    if (NULL == node) return leaf;
+    switch (node->_type) {
+    case __kCFConcurrentDictionaryLeaf:
+	if (node->_hash == leaf->_hash && __CFConcurrentDictionaryKeysEqual(cd, node->_key, leaf->_key)) {
+	    *replaced = node;
+	    return leaf;
+	}
+	return __CFConcurrentDictionaryJoin(cd, __CFConcurrentDictionaryRetainNode((__CFConcurrentDictionaryNode *)node), leaf, shift);
+    case __kCFConcurrentDictionaryCollision:
+	if (node->_hash != leaf->_hash) {
+	    return __CFConcurrentDictionaryJoin(cd, __CFConcurrentDictionaryRetainNode((__CFConcurrentDictionaryNode *)node), leaf, shift);
+	}
+	for (CFIndex idx = 0; idx < node->_count; idx++) {
+	    if (__CFConcurrentDictionaryKeysEqual(cd, node->_children[idx]->_key, leaf->_key)) {
+		*replaced = node->_children[idx];
+		result = __CFConcurrentDictionaryCopyNode(cd, node, idx, idx);
+		result->_children[idx] = leaf;
+		return result;
+	    }
+	}
+	result = __CFConcurrentDictionaryCopyNode(cd, node, -1, node->_count);
+	result->_children[node->_count] = leaf;
+	result->_size++;
+	return result;
+    default: {
+	uint32_t slot = __CFConcurrentDictionarySlot(leaf->_hash, shift);
+	CFIndex idx = __CFConcurrentDictionaryChildIndex(node, slot);
+	if (0 == (node->_bitmap & (1U << slot))) {
+	    result = __CFConcurrentDictionaryCopyNode(cd, node, -1, idx);
+	    result->_children[idx] = leaf;
+	    result->_bitmap |= (1U << slot);
+	    result->_size++;
+	} else {
+	    __CFConcurrentDictionaryNode *child = __CFConcurrentDictionaryInsert(cd, node->_children[idx], shift + __kCFConcurrentDictionaryBitsPerLevel, leaf, replaced);
+	    result = __CFConcurrentDictionaryCopyNode(cd, node, idx, idx);
+	    result->_children[idx] = child;
+	    result->_size += child->_size - node->_children[idx]->_size;
+	}
+	return result;
+    }
+    }
+}
+
+/* Returns a new version of node without the entry for key, which must be present; NULL when nothing is left.
+   A branch left with a single leaf or collision child is replaced by that child, keeping the trie canonical. */
+static __CFConcurrentDictionaryNode *__CFConcurrentDictionaryRemove(CFConcurrentDictionaryRef cd, const __CFConcurrentDictionaryNode *node, CFIndex shift, CFHashCode hash, const void *key) {
+    __CFConcurrentDictionaryNode *result;
+    switch (node->_type) {
+    case __kCFConcurrentDictionaryLeaf:
+	return NULL;
+    case __kCFConcurrentDictionaryCollision:
+	for (CFIndex idx = 0; idx < node->_count; idx++) {
+	    if (__CFConcurrentDictionaryKeysEqual(cd, node->_children[idx]->_key, key)) {
+		if (2 == node->_count) return __CFConcurrentDictionaryRetainNode(node->_children[1 - idx]);
+		result = __CFConcurrentDictionaryCopyNode(cd, node, idx, -1);
+		result->_size--;
+		return result;
+	    }
+	}
+	return __CFConcurrentDictionaryRetainNode((__CFConcurrentDictionaryNode *)node);
+    default: {
+	uint32_t slot = __CFConcurrentDictionarySlot(hash, shift);
+	CFIndex idx = __CFConcurrentDictionaryChildIndex(node, slot);
+	__CFConcurrentDictionaryNode *child = __CFConcurrentDictionaryRemove(cd, node->_children[idx], shift + __kCFConcurrentDictionaryBitsPerLevel, hash, key);
+	if (NULL == child) {
+	    if (1 == node->_count) return NULL;
+	    if (2 == node->_count && __kCFConcurrentDictionaryBranch != node->_children[1 - idx]->_type) return __CFConcurrentDictionaryRetainNode(node->_children[1 - idx]);
+	    result = __CFConcurrentDictionaryCopyNode(cd, node, idx, -1);
+	    result->_bitmap &= ~(1U << slot);
+	} else {
+	    if (1 == node->_count && __kCFConcurrentDictionaryBranch != child->_type) return child;
+	    result = __CFConcurrentDictionaryCopyNode(cd, node, idx, idx);
+	    result->_children[idx] = child;
+	}
+	result->_size--;
+	return result;
+    }
+    }
+}
+
+static void __CFConcurrentDictionaryApplyToNode(const __CFConcurrentDictionaryNode *node, CFDictionaryApplierFunction applier, void *context) {
+    if (__kCFConcurrentDictionaryLeaf == node->_type) {
+	INVOKE_CALLBACK3(applier, node->_key, node->_value, context);
+    } else {
+	for (CFIndex idx = 0; idx < node->_count; idx++) __CFConcurrentDictionaryApplyToNode(node->_children[idx], applier, context);
+    }
+}
+
+/* Reads and grace periods */
+
+CF_INLINE int32_t __CFConcurrentDictionaryBeginRead(CFConcurrentDictionaryRef cd) {
+    struct __CFConcurrentDictionary *mcd = (struct __CFConcurrentDictionary *)cd;
+    for (;;) {
+	int32_t epoch = mcd->_epoch;
+	_CFAtomicIncrement32(&mcd->_readers[epoch & 1]);
+	if (epoch == mcd->_epoch) return epoch;
+	_CFAtomicDecrement32(&mcd->_readers[epoch & 1]);
+    }
+}
+
+CF_INLINE void __CFConcurrentDictionaryEndRead(CFConcurrentDictionaryRef cd, int32_t epoch) {
+    _CFAtomicDecrement32(&((struct __CFConcurrentDictionary *)cd)->_readers[epoch & 1]);
+}
+
+/* Called with the lock held, after publishing a new root: returns once no reader can still see the old one */
+static void __CFConcurrentDictionaryWaitForReaders(struct __CFConcurrentDictionary *cd) {
+    int32_t epoch = cd->_epoch;
+    _CFAtomicCompareAndSwap32Barrier(epoch, (int32_t)((uint32_t)epoch + 1), &cd->_epoch);
+    while (0 != cd->_readers[epoch & 1]) {
+#if DEPLOYMENT_TARGET_WINDOWS
+	Sleep(0);
+#else
+	sched_yield();
+#endif
+    }
+}
+
+/* Returns the current root, retained; the caller releases it with __CFConcurrentDictionaryReleaseNode() */
+static __CFConcurrentDictionaryNode *__CFConcurrentDictionaryCopyRoot(CFConcurrentDictionaryRef cd) {
+    __CFConcurrentDictionaryNode *root;
+    if (!__CFConcurrentDictionaryIsMutable(cd)) {
+	root = cd->_root;
+	return root ? __CFConcurrentDictionaryRetainNode(root) : NULL;
+    }
+    int32_t epoch = __CFConcurrentDictionaryBeginRead(cd);
+    root = cd->_root;
+    if (root) __CFConcurrentDictionaryRetainNode(root);
+    __CFConcurrentDictionaryEndRead(cd, epoch);
+    return root;
+}
+
+/* Runtime class */
+
+/* Whether every entry under node has an equal value in cd2 */
+static Boolean __CFConcurrentDictionaryContainsEntries(CFConcurrentDictionaryRef cd2, const __CFConcurrentDictionaryNode *root2, const __CFConcurrentDictionaryNode *node) {
+    if (__kCFConcurrentDictionaryLeaf != node->_type) {
+	for (CFIndex idx = 0; idx < node->_count; idx++) {
+	    if (!__CFConcurrentDictionaryContainsEntries(cd2, root2, node->_children[idx])) return false;
+	}
+	return true;
+    }
+    const __CFConcurrentDictionaryNode *other = __CFConcurrentDictionaryFind(cd2, root2, node->_hash, node->_key);
+    return other && (other->_value == node->_value || (cd2->_valueCallBacks.equal && INVOKE_CALLBACK2(cd2->_valueCallBacks.equal, node->_value, other->_value)));
+}
+
+static Boolean __CFConcurrentDictionaryEqual(CFTypeRef cf1, CFTypeRef cf2) {
+    CFConcurrentDictionaryRef cd1 = (CFConcurrentDictionaryRef)cf1, cd2 = (CFConcurrentDictionaryRef)cf2;
+    if (cd1->_keyCallBacks.hash != cd2->_keyCallBacks.hash || cd1->_keyCallBacks.equal != cd2->_keyCallBacks.equal || cd1->_valueCallBacks.equal != cd2->_valueCallBacks.equal) return false;
+    __CFConcurrentDictionaryNode *root1 = __CFConcurrentDictionaryCopyRoot(cd1), *root2 = __CFConcurrentDictionaryCopyRoot(cd2);
+    Boolean result = (root1 ? root1->_size : 0) == (root2 ? root2->_size : 0);
+    if (result && root1 && root1 != root2) result = __CFConcurrentDictionaryContainsEntries(cd2, root2, root1);
+    __CFConcurrentDictionaryReleaseNode(cd1, root1);
+    __CFConcurrentDictionaryReleaseNode(cd2, root2);
+    return result;
+}
+
+static CFHashCode __CFConcurrentDictionaryHash(CFTypeRef cf) {
+    return CFConcurrentDictionaryGetCount((CFConcurrentDictionaryRef)cf);
+}
+
+static void __CFConcurrentDictionaryDescribe(const void *key, const void *value, void *context) {
+    CFConcurrentDictionaryRef cd = (CFConcurrentDictionaryRef)((const void **)context)[0];
+    CFMutableStringRef result = (CFMutableStringRef)((const void **)context)[1];
+    CFStringRef kdesc = cd->_keyCallBacks.copyDescription ? (CFStringRef)INVOKE_CALLBACK1(cd->_keyCallBacks.copyDescription, key) : NULL;
+    CFStringRef vdesc = cd->_valueCallBacks.copyDescription ? (CFStringRef)INVOKE_CALLBACK1(cd->_valueCallBacks.copyDescription, value) : NULL;
+    if (kdesc) {
+	CFStringAppendFormat(result, NULL, CFSTR("\t%@ = "), kdesc);
+	CFRelease(kdesc);
+    } else {
+	CFStringAppendFormat(result, NULL, CFSTR("\t<%p> = "), key);
+    }
+    if (vdesc) {
+	CFStringAppendFormat(result, NULL, CFSTR("%@\n"), vdesc);
+	CFRelease(vdesc);
+    } else {
+	CFStringAppendFormat(result, NULL, CFSTR("<%p>\n"), value);
+    }
+}
+
+static CFStringRef __CFConcurrentDictionaryCopyDescription(CFTypeRef cf) {
+    CFConcurrentDictionaryRef cd = (CFConcurrentDictionaryRef)cf;
+    CFAllocatorRef allocator = CFGetAllocator(cd);
+    CFMutableStringRef result = CFStringCreateMutable(allocator, 0);
+    __CFConcurrentDictionaryNode *root = __CFConcurrentDictionaryCopyRoot(cd);
+    const void *context[2] = {cd, result};
+    CFStringAppendFormat(result, NULL, CFSTR("<CFConcurrentDictionary %p [%p]>{type = %s, count = %u, entries =>\n"), cf, allocator, __CFConcurrentDictionaryIsMutable(cd) ? "mutable" : "snapshot", root ? root->_size : 0);
+    if (root) __CFConcurrentDictionaryApplyToNode(root, __CFConcurrentDictionaryDescribe, context);
+    CFStringAppend(result, CFSTR("}"));
+    __CFConcurrentDictionaryReleaseNode(cd, root);
+    return result;
+}
+
+static void __CFConcurrentDictionaryDeallocate(CFTypeRef cf) {
+    struct __CFConcurrentDictionary *cd = (struct __CFConcurrentDictionary *)cf;
+    __CFConcurrentDictionaryReleaseNode(cd, cd->_root);
+    cd->_root = NULL;
+}
+
+static CFTypeID __kCFConcurrentDictionaryTypeID = _kCFRuntimeNotATypeID;
+
+static const CFRuntimeClass __CFConcurrentDictionaryClass = {
+    0,
+    "CFConcurrentDictionary",
+    NULL,	// init
+    NULL,	// copy
+    __CFConcurrentDictionaryDeallocate,
+    __CFConcurrentDictionaryEqual,
+    __CFConcurrentDictionaryHash,
+    NULL,	//
+    __CFConcurrentDictionaryCopyDescription
+};
+
+static void __CFConcurrentDictionaryInitialize(void) {
+    __kCFConcurrentDictionaryTypeID = _CFRuntimeRegisterClass(&__CFConcurrentDictionaryClass);
+}
+
+CFTypeID CFConcurrentDictionaryGetTypeID(void) {
+    if (_kCFRuntimeNotATypeID == __kCFConcurrentDictionaryTypeID) __CFConcurrentDictionaryInitialize();
+    return __kCFConcurrentDictionaryTypeID;
+}
+
+static struct __CFConcurrentDictionary *__CFConcurrentDictionaryInit(CFAllocatorRef allocator, const CFDictionaryKeyCallBacks *keyCallBacks, const CFDictionaryValueCallBacks *valueCallBacks) {
+    CFIndex size = sizeof(struct __CFConcurrentDictionary) - sizeof(CFRuntimeBase);
+    struct __CFConcurrentDictionary *memory = (struct __CFConcurrentDictionary *)_CFRuntimeCreateInstance(allocator, CFConcurrentDictionaryGetTypeID(), size, NULL);
+    if (NULL == memory) {
+	return NULL;
+    }
+    memory->_root = NULL;
+    memory->_keyCallBacks = keyCallBacks ? *keyCallBacks : __kCFNullConcurrentDictionaryKeyCallBacks;
+    memory->_valueCallBacks = valueCallBacks ? *valueCallBacks : __kCFNullConcurrentDictionaryValueCallBacks;
+    CF_SPINLOCK_INIT_FOR_STRUCTS(memory->_lock);
+    memory->_epoch = 0;
+    memory->_readers[0] = 0;
+    memory->_readers[1] = 0;
+    return memory;
+}
+
+CFMutableConcurrentDictionaryRef CFConcurrentDictionaryCreateMutable(CFAllocatorRef allocator, const CFDictionaryKeyCallBacks *keyCallBacks, const CFDictionaryValueCallBacks *valueCallBacks) {
+    struct __CFConcurrentDictionary *cd = __CFConcurrentDictionaryInit(allocator, keyCallBacks, valueCallBacks);
+    if (cd) __CFConcurrentDictionarySetMutable(cd);
+    return (CFMutableConcurrentDictionaryRef)cd;
+}
+
+CFConcurrentDictionaryRef CFConcurrentDictionaryCopySnapshot(CFConcurrentDictionaryRef cd) {
+    __CFGenericValidateType(cd, __kCFConcurrentDictionaryTypeID);
+    if (!__CFConcurrentDictionaryIsMutable(cd)) return (CFConcurrentDictionaryRef)CFRetain(cd);
+    struct __CFConcurrentDictionary *snapshot = __CFConcurrentDictionaryInit(CFGetAllocator(cd), &cd->_keyCallBacks, &cd->_valueCallBacks);
+    if (snapshot) snapshot->_root = __CFConcurrentDictionaryCopyRoot(cd);
+    return snapshot;
+}
+
+static void __CFConcurrentDictionaryGetEntry(const void *key, const void *value, void *context) {
+    const void ***lists = (const void ***)context;
+    *lists[0]++ = key;
+    *lists[1]++ = value;
+}
+
+CFDictionaryRef CFConcurrentDictionaryCreateDictionary(CFAllocatorRef allocator, CFConcurrentDictionaryRef cd) {
+    __CFGenericValidateType(cd, __kCFConcurrentDictionaryTypeID);
+    __CFConcurrentDictionaryNode *root = __CFConcurrentDictionaryCopyRoot(cd);
+    CFIndex count = root ? root->_size : 0;
+    const void **keys = NULL, *buffer[2 * 256];
+    if (0 < count) {
+	keys = (count <= 256) ? buffer : (const void **)CFAllocatorAllocate(kCFAllocatorSystemDefault, 2 * count * sizeof(void *), 0); // GC OK
+	if (__CFOASafe && keys != buffer) __CFSetLastAllocationEventName(keys, "CFConcurrentDictionary (temp)");
+	const void **lists[2] = {keys, keys + count};
+	__CFConcurrentDictionaryApplyToNode(root, __CFConcurrentDictionaryGetEntry, lists);
+    }
+    CFDictionaryRef result = CFDictionaryCreate(allocator, keys, keys + count, count, &cd->_keyCallBacks, &cd->_valueCallBacks);
+    if (keys && keys != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, keys); // GC OK
+    __CFConcurrentDictionaryReleaseNode(cd, root);
+    return result;
+}
+
+CFIndex CFConcurrentDictionaryGetCount(CFConcurrentDictionaryRef cd) {
+    __CFGenericValidateType(cd, __kCFConcurrentDictionaryTypeID);
+    if (!__CFConcurrentDictionaryIsMutable(cd)) return cd->_root ? cd->_root->_size : 0;
+    int32_t epoch = __CFConcurrentDictionaryBeginRead(cd);
+    __CFConcurrentDictionaryNode *root = cd->_root;
+    CFIndex count = root ? root->_size : 0;
+    __CFConcurrentDictionaryEndRead(cd, epoch);
+    return count;
+}
+
+Boolean CFConcurrentDictionaryGetValueIfPresent(CFConcurrentDictionaryRef cd, const void *key, const void **value) {
+    __CFGenericValidateType(cd, __kCFConcurrentDictionaryTypeID);
+    CFHashCode hash = __CFConcurrentDictionaryHashKey(cd, key);
+    Boolean isMutable = __CFConcurrentDictionaryIsMutable(cd);
+    int32_t epoch = isMutable ? __CFConcurrentDictionaryBeginRead(cd) : 0;
+    const __CFConcurrentDictionaryNode *leaf = __CFConcurrentDictionaryFind(cd, cd->_root, hash, key);
+    if (leaf && value) *value = leaf->_value;
+    if (isMutable) __CFConcurrentDictionaryEndRead(cd, epoch);
+    return NULL != leaf;
+}
+
+const void *CFConcurrentDictionaryGetValue(CFConcurrentDictionaryRef cd, const void *key) {
+    const void *value = NULL;
+    CFConcurrentDictionaryGetValueIfPresent(cd, key, &value);
+    return value;
+}
+
+void CFConcurrentDictionaryApplyFunction(CFConcurrentDictionaryRef cd, CFDictionaryApplierFunction applier, void *context) {
+    __CFGenericValidateType(cd, __kCFConcurrentDictionaryTypeID);
+    FAULT_CALLBACK((void **)&(applier));
+    __CFConcurrentDictionaryNode *root = __CFConcurrentDictionaryCopyRoot(cd);
+    if (root) __CFConcurrentDictionaryApplyToNode(root, applier, context);
+    __CFConcurrentDictionaryReleaseNode(cd, root);
+}
+
+/* Replaces the root with newRoot (already retained) and releases the old one once readers are done with it */
+static void __CFConcurrentDictionaryPublish(struct __CFConcurrentDictionary *cd, __CFConcurrentDictionaryNode *newRoot) {
+    __CFConcurrentDictionaryNode *oldRoot = cd->_root;
+    _CFAtomicCompareAndSwapPtrBarrier(oldRoot, newRoot, (void *volatile *)&cd->_root);
+    if (oldRoot) __CFConcurrentDictionaryWaitForReaders(cd);
+    __CFSpinUnlock(&cd->_lock);
+    __CFConcurrentDictionaryReleaseNode(cd, oldRoot);
+}
+
+static void __CFConcurrentDictionaryStore(CFMutableConcurrentDictionaryRef cd, const void *key, const void *value, Boolean replace) {
+    __CFGenericValidateType(cd, __kCFConcurrentDictionaryTypeID);
+    CFAssert2(__CFConcurrentDictionaryIsMutable(cd), __kCFLogAssertion, "%s(): snapshot %p passed to mutating operation", __PRETTY_FUNCTION__, cd);
+    CFHashCode hash = __CFConcurrentDictionaryHashKey(cd, key);
+    __CFSpinLock(&cd->_lock);
+    const __CFConcurrentDictionaryNode *existing = __CFConcurrentDictionaryFind(cd, cd->_root, hash, key);
+    if (existing && !replace) {
+	__CFSpinUnlock(&cd->_lock);
+	return;
+    }
+    // Like CFDictionarySetValue(), replacing a value keeps the original key
+    __CFConcurrentDictionaryNode *leaf = __CFConcurrentDictionaryCreateLeaf(cd, hash, existing ? existing->_key : key, value);
+    const __CFConcurrentDictionaryNode *replaced = NULL;
+    __CFConcurrentDictionaryPublish(cd, __CFConcurrentDictionaryInsert(cd, cd->_root, 0, leaf, &replaced));
+}
+
+void CFConcurrentDictionarySetValue(CFMutableConcurrentDictionaryRef cd, const void *key, const void *value) {
+    __CFConcurrentDictionaryStore(cd, key, value, true);
+}
+
+void CFConcurrentDictionaryAddValue(CFMutableConcurrentDictionaryRef cd, const void *key, const void *value) {
+    __CFConcurrentDictionaryStore(cd, key, value, false);
+}
+
+void CFConcurrentDictionaryRemoveValue(CFMutableConcurrentDictionaryRef cd, const void *key) {
+    __CFGenericValidateType(cd, __kCFConcurrentDictionaryTypeID);
+    CFAssert2(__CFConcurrentDictionaryIsMutable(cd), __kCFLogAssertion, "%s(): snapshot %p passed to mutating operation", __PRETTY_FUNCTION__, cd);
+    CFHashCode hash = __CFConcurrentDictionaryHashKey(cd, key);
+    __CFSpinLock(&cd->_lock);
+    if (NULL == __CFConcurrentDictionaryFind(cd, cd->_root, hash, key)) {
+	__CFSpinUnlock(&cd->_lock);
+	return;
+    }
+    __CFConcurrentDictionaryPublish(cd, __CFConcurrentDictionaryRemove(cd, cd->_root, 0, hash, key));
+}
+
+void CFConcurrentDictionaryRemoveAllValues(CFMutableConcurrentDictionaryRef cd) {
+    __CFGenericValidateType(cd, __kCFConcurrentDictionaryTypeID);
+    CFAssert2(__CFConcurrentDictionaryIsMutable(cd), __kCFLogAssertion, "%s(): snapshot %p passed to mutating operation", __PRETTY_FUNCTION__, cd);
+    __CFSpinLock(&cd->_lock);
+    __CFConcurrentDictionaryPublish(cd, NULL);
+}
@@ -195,15 +195,55 @@ CFTypeID CFDateGetTypeID(void) {
     return __kCFDateTypeID;
 }
 
+// Optional uniquing cache of recently created dates, used only for the
+// system default allocator; see _CFDateSetUniquingEnabled().  Hit/miss
+// counts are updated without synchronization and so are approximate.
+#if !defined(CF_DATE_UNIQUING_CACHE_SIZE)
+#define CF_DATE_UNIQUING_CACHE_SIZE 512	// must be a power of 2
+#endif
+static CFTypeRef volatile __CFDateUniquingCache[CF_DATE_UNIQUING_CACHE_SIZE] = {NULL};
+static Boolean __CFDateUniquingEnabled = false;
+static uint64_t __CFDateUniquingHits = 0;
+static uint64_t __CFDateUniquingMisses = 0;
+
+void _CFDateSetUniquingEnabled(Boolean enabled) {
+    __CFDateUniquingEnabled = enabled;
+    if (!enabled) __CFValueCacheFlush(__CFDateUniquingCache, CF_DATE_UNIQUING_CACHE_SIZE);
+}
+
+void _CFDateGetUniquingStatistics(uint64_t *hits, uint64_t *misses) {
+    if (hits) *hits = __CFDateUniquingHits;
+    if (misses) *misses = __CFDateUniquingMisses;
+}
+
 CFDateRef CFDateCreate(CFAllocatorRef allocator, CFAbsoluteTime at) {
     CFDateRef memory; 
     uint32_t size;
+    CFTypeRef volatile *slot = NULL;
+    if (__CFDateUniquingEnabled && kCFAllocatorSystemDefault == (allocator ? allocator : __CFGetDefaultAllocator())) {
+	// Compare bit patterns, so that -0.0 and 0.0 stay distinct
+	uint64_t bits;
+	memmove(&bits, &at, sizeof(bits));
+	slot = &__CFDateUniquingCache[(CFIndex)((bits * 0x9E3779B97F4A7C15ULL) >> 32) & (CF_DATE_UNIQUING_CACHE_SIZE - 1)];
+	CFDateRef cached = (CFDateRef)__CFValueCacheTake(slot);
+	if (NULL != cached) {
+	    Boolean match = (0 == memcmp(&cached->_time, &at, sizeof(at)));
+	    if (match) CFRetain(cached);
+	    __CFValueCacheReturn(slot, cached);
+	    if (match) {
+		__CFDateUniquingHits++;
+		return cached;
+	    }
+	}
+	__CFDateUniquingMisses++;
+    }
     size = sizeof(struct __CFDate) - sizeof(CFRuntimeBase);
     memory = (CFDateRef)_CFRuntimeCreateInstance(allocator, CFDateGetTypeID(), size, NULL);
     if (NULL == memory) {
         return NULL;
     }
     ((struct __CFDate *)memory)->_time = at;
+    if (NULL != slot) __CFValueCacheStore(slot, memory);
     return memory;
 }
 
@@ -363,6 +403,75 @@ CFGregorianDate CFAbsoluteTimeGetGregorianDate(CFAbsoluteTime at, CFTimeZoneRef
     return gdate;
 }
 
+#define __kCFGregorianDatesBatch	256
+#define __kCFGregorianDatesIntegerLimit	1.0e15	/* whole seconds stay exact in a double below 2^53 */
+
+/* Gregorian year, month and day from days since 2001/1/1 in integer arithmetic without loops or
+   tables, after H. Hinnant's civil_from_days(); years here are Gregorian, not absolute */
+CF_INLINE void __CFYMDFromDays(int64_t days, int64_t *year, int32_t *month, int32_t *day) {
+    int64_t z = days + 730791;	/* days since 0000/3/1 */
+    int64_t era = ((0 <= z) ? z : z - 146096) / 146097;
+    uint32_t doe = (uint32_t)(z - era * 146097);	/* [0, 146096] */
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;	/* [0, 399] */
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);	/* [0, 365], from March 1 */
+    uint32_t mp = (5 * doy + 2) / 153;	/* [0, 11], from March */
+    *day = (int32_t)(doy - (153 * mp + 2) / 5 + 1);
+    *month = (int32_t)((mp < 10) ? mp + 3 : mp - 9);
+    *year = (int64_t)yoe + era * 400 + (*month <= 2);
+}
+
+void CFAbsoluteTimeGetGregorianDates(const CFAbsoluteTime *times, CFIndex count, CFTimeZoneRef tz, SInt32 *years, SInt8 *months, SInt8 *days, SInt8 *hours, SInt8 *minutes, double *seconds) {
+    CFTimeInterval offsets[__kCFGregorianDatesBatch];
+    int32_t y[__kCFGregorianDatesBatch], mo[__kCFGregorianDatesBatch], d[__kCFGregorianDatesBatch], h[__kCFGregorianDatesBatch], mi[__kCFGregorianDatesBatch];
+    double s[__kCFGregorianDatesBatch];
+    CFIndex base, idx;
+    if (NULL != tz) {
+	__CFGenericValidateType(tz, CFTimeZoneGetTypeID());
+    }
+    for (base = 0; base < count; base += __kCFGregorianDatesBatch) {
+	CFIndex cnt = __CFMin(count - base, __kCFGregorianDatesBatch);
+	if (NULL != tz) {
+	    CFTimeZoneGetSecondsFromGMTForTimes(tz, times + base, offsets, cnt);
+	} else {
+	    memset(offsets, 0, cnt * sizeof(CFTimeInterval));
+	}
+	for (idx = 0; idx < cnt; idx++) {
+	    CFAbsoluteTime fixedat = times[base + idx] + offsets[idx];
+	    double whole;
+	    int64_t secs, daynum, sod, year;
+	    if (!(-__kCFGregorianDatesIntegerLimit < fixedat && fixedat < __kCFGregorianDatesIntegerLimit)) fixedat = 0.0;	/* done below */
+	    secs = (int64_t)fixedat;	/* truncated; floor without a call */
+	    secs -= ((double)secs > fixedat);
+	    whole = (double)secs;
+	    daynum = ((0 <= secs) ? secs : secs - 86399) / 86400;
+	    sod = secs - daynum * 86400;
+	    __CFYMDFromDays(daynum, &year, &mo[idx], &d[idx]);
+	    y[idx] = (int32_t)year;
+	    h[idx] = (int32_t)(sod / 3600);
+	    mi[idx] = (int32_t)(sod / 60 % 60);
+	    s[idx] = (double)(sod % 60) + (fixedat - whole);
+	}
+	for (idx = 0; idx < cnt; idx++) {
+	    CFAbsoluteTime fixedat = times[base + idx] + offsets[idx];
+	    if (!(-__kCFGregorianDatesIntegerLimit < fixedat && fixedat < __kCFGregorianDatesIntegerLimit)) {
+		CFGregorianDate gdate = CFAbsoluteTimeGetGregorianDate(times[base + idx], tz);
+		y[idx] = gdate.year;
+		mo[idx] = gdate.month;
+		d[idx] = gdate.day;
+		h[idx] = gdate.hour;
+		mi[idx] = gdate.minute;
+		s[idx] = gdate.second;
+	    }
+	}
+	for (idx = 0; NULL != years && idx < cnt; idx++) years[base + idx] = y[idx];
+	for (idx = 0; NULL != months && idx < cnt; idx++) months[base + idx] = (SInt8)mo[idx];
+	for (idx = 0; NULL != days && idx < cnt; idx++) days[base + idx] = (SInt8)d[idx];
+	for (idx = 0; NULL != hours && idx < cnt; idx++) hours[base + idx] = (SInt8)h[idx];
+	for (idx = 0; NULL != minutes && idx < cnt; idx++) minutes[base + idx] = (SInt8)mi[idx];
+	for (idx = 0; NULL != seconds && idx < cnt; idx++) seconds[base + idx] = s[idx];
+    }
+}
+
 /* Note that the units of years and months are not equal length, but are treated as such. */
 CFAbsoluteTime CFAbsoluteTimeAddGregorianUnits(CFAbsoluteTime at, CFTimeZoneRef tz, CFGregorianUnits units) {
     CFGregorianDate gdate;
@@ -107,6 +107,33 @@ CFTypeID CFDateFormatterGetTypeID(void) {
     return __kCFDateFormatterTypeID;
 }
 
+// Opening a date format loads the locale's data; clone a shared prototype instead when one was opened the same way before
+static UDateFormat *__CFDateFormatterOpenUDateFormat(int32_t utstyle, int32_t udstyle, const char *cstr, CFStringRef tzName, UErrorCode *status) {
+    UChar ubuffer[BUFFER_SIZE];
+    CFIndex cnt = 0;
+    if (tzName) {
+	cnt = CFStringGetLength(tzName);
+	if (BUFFER_SIZE < cnt) cnt = BUFFER_SIZE;
+	CFStringGetCharacters(tzName, CFRangeMake(0, cnt), (UniChar *)ubuffer);
+    }
+    if (NULL == cstr) return udat_open((UDateFormatStyle)utstyle, (UDateFormatStyle)udstyle, cstr, tzName ? ubuffer : NULL, cnt, NULL, 0, status);
+    CFStringRef key = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("udat %d %d %s %@"), utstyle, udstyle, cstr, tzName ? tzName : CFSTR("-"));
+    const UDateFormat *proto = (const UDateFormat *)__CFICUPrototypeGet(key);
+    UDateFormat *df;
+    if (proto) {
+	df = udat_clone(proto, status);
+    } else {
+	df = udat_open((UDateFormatStyle)utstyle, (UDateFormatStyle)udstyle, cstr, tzName ? ubuffer : NULL, cnt, NULL, 0, status);
+	if (NULL != df) {
+	    UErrorCode cstatus = U_ZERO_ERROR;
+	    UDateFormat *copy = udat_clone(df, &cstatus);
+	    if (NULL != copy && !__CFICUPrototypeAdd(key, copy)) udat_close(copy);
+	}
+    }
+    CFRelease(key);
+    return df;
+}
+
 CFDateFormatterRef CFDateFormatterCreate(CFAllocatorRef allocator, CFLocaleRef locale, CFDateFormatterStyle dateStyle, CFDateFormatterStyle timeStyle) {
     struct __CFDateFormatter *memory;
     uint32_t size = sizeof(struct __CFDateFormatter) - sizeof(CFRuntimeBase);
@@ -175,11 +202,8 @@ CFDateFormatterRef CFDateFormatterCreate(CFAllocatorRef allocator, CFLocaleRef l
 #else
     CFStringRef tznam = CFTimeZoneGetName(memory->_tz);
 #endif
-    CFIndex cnt = CFStringGetLength(tznam);
-    if (BUFFER_SIZE < cnt) cnt = BUFFER_SIZE;
-    CFStringGetCharacters(tznam, CFRangeMake(0, cnt), (UniChar *)ubuffer);
     UErrorCode status = U_ZERO_ERROR;
-    memory->_df = udat_open((UDateFormatStyle)utstyle, (UDateFormatStyle)udstyle, cstr, ubuffer, cnt, NULL, 0, &status);
+    memory->_df = __CFDateFormatterOpenUDateFormat(utstyle, udstyle, cstr, tznam, &status);
     CFAssert2(memory->_df, __kCFLogAssertion, "%s(): error (%d) creating date formatter", __PRETTY_FUNCTION__, status);
     if (NULL == memory->_df) {
 	CFRelease(memory->_tz);
@@ -241,7 +265,7 @@ static void __substituteFormatStringFromPrefsDF(CFDateFormatterRef formatter, bo
                 if (CFStringGetCString(localeName, buffer, BUFFER_SIZE, kCFStringEncodingASCII)) cstr = buffer;
             }
             UErrorCode status = U_ZERO_ERROR;
-            UDateFormat *df = udat_open((UDateFormatStyle)(doTime ? icustyle : UDAT_NONE), (UDateFormatStyle)(doTime ? UDAT_NONE : icustyle), cstr, NULL, 0, NULL, 0, &status);
+            UDateFormat *df = __CFDateFormatterOpenUDateFormat(doTime ? icustyle : UDAT_NONE, doTime ? UDAT_NONE : icustyle, cstr, NULL, &status);
             if (NULL != df) {
                 UChar ubuffer[BUFFER_SIZE];
                 status = U_ZERO_ERROR;
@@ -168,6 +168,32 @@ extern void __CFGenericValidateType_(CFTypeRef cf, CFTypeID type, const char *fu
 #define __CFBitfieldSetValue(V, N1, N2, X)	((V) = ((V) & ~__CFBitfieldMask(N1, N2)) | (((X) << (N2)) & __CFBitfieldMask(N1, N2)))
 #define __CFBitfieldMaxValue(N1, N2)	__CFBitfieldGetValue(0xFFFFFFFFUL, (N1), (N2))
 
+/* Set-bit and leading/trailing zero-bit counts of a 64-bit word; the zero counts are undefined for 0 */
+#if defined(__GNUC__)
+#define __CFPopCount64(V)		((CFIndex)__builtin_popcountll(V))
+#define __CFCountLeadingZeros64(V)	((CFIndex)__builtin_clzll(V))
+#define __CFCountTrailingZeros64(V)	((CFIndex)__builtin_ctzll(V))
+#else
+CF_INLINE CFIndex __CFPopCount64(uint64_t v) {
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    return (CFIndex)((((v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL) * 0x0101010101010101ULL) >> 56);
+}
+CF_INLINE CFIndex __CFCountLeadingZeros64(uint64_t v) {
+    CFIndex n = 0;
+    if (0 == (v >> 32)) { n += 32; v <<= 32; }
+    if (0 == (v >> 48)) { n += 16; v <<= 16; }
+    if (0 == (v >> 56)) { n += 8; v <<= 8; }
+    if (0 == (v >> 60)) { n += 4; v <<= 4; }
+    if (0 == (v >> 62)) { n += 2; v <<= 2; }
+    if (0 == (v >> 63)) { n += 1; }
+    return n;
+}
+CF_INLINE CFIndex __CFCountTrailingZeros64(uint64_t v) {
+    return __CFPopCount64((v & (0 - v)) - 1);
+}
+#endif
+
 #define __CFBitIsSet(V, N)  (((V) & (1UL << (N))) != 0)
 #define __CFBitSet(V, N)  ((V) |= (1UL << (N)))
 #define __CFBitClear(V, N)  ((V) &= ~(1UL << (N)))
@@ -184,6 +210,12 @@ CF_INLINE bool _CFAtomicCompareAndSwapPtrBarrier(void* oldValue, void* newValue,
 CF_INLINE int32_t _CFAtomicIncrement32(volatile int32_t *theValue) {
 	return (unsigned int)InterlockedIncrement((volatile LONG*)theValue);
 }
+CF_INLINE int32_t _CFAtomicDecrement32(volatile int32_t *theValue) {
+	return (unsigned int)InterlockedDecrement((volatile LONG*)theValue);
+}
+CF_INLINE int64_t _CFAtomicIncrement64(volatile int64_t *theValue) {
+	return InterlockedIncrement64((volatile LONGLONG*)theValue);
+}
 CF_INLINE void _CFMemoryBarrier(void) {
 	MemoryBarrier();
 }
@@ -197,6 +229,12 @@ CF_INLINE bool _CFAtomicCompareAndSwapPtrBarrier(void* __oldValue, void* __newVa
 CF_INLINE int32_t _CFAtomicIncrement32(volatile int32_t *theValue) {
 	return OSAtomicIncrement32(theValue);
 }
+CF_INLINE int32_t _CFAtomicDecrement32(volatile int32_t *theValue) {
+	return OSAtomicDecrement32(theValue);
+}
+CF_INLINE int64_t _CFAtomicIncrement64(volatile int64_t *theValue) {
+	return OSAtomicIncrement64(theValue);
+}
 CF_INLINE void _CFMemoryBarrier(void) {
 	OSMemoryBarrier();
 }
@@ -209,7 +247,13 @@ CF_INLINE bool _CFAtomicCompareAndSwapPtrBarrier(void* __oldValue, void* __newVa
 	return __sync_bool_compare_and_swap(__theValue, __oldValue, __newValue);
 }
 CF_INLINE int32_t _CFAtomicIncrement32(volatile int32_t *theValue) {
-	return __sync_fetch_and_add(theValue, 1);
+	return __sync_add_and_fetch(theValue, 1);	// The new value, as OSAtomicIncrement32() and InterlockedIncrement() return
+}
+CF_INLINE int32_t _CFAtomicDecrement32(volatile int32_t *theValue) {
+	return __sync_sub_and_fetch(theValue, 1);
+}
+CF_INLINE int64_t _CFAtomicIncrement64(volatile int64_t *theValue) {
+	return __sync_add_and_fetch(theValue, 1);
 }
 CF_INLINE void _CFMemoryBarrier(void) {
 	__sync_synchronize();
@@ -232,9 +276,30 @@ CF_INLINE bool _CFIsSetUgid(void) {
 #endif /* DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_FREEBSD */
 
 
+// The leaf a thread last used in a CFStorage, so that readers on different threads do not evict each other's (see CFStorage.c)
+typedef struct {
+    int64_t _serial;		// Of the storage; 0 for an unused entry
+    int64_t _mutations;		// The storage's mutation count when the entry was made
+    void *_node;
+    CFIndex _location, _length;	// In values
+} __CFStorageAccessCache;
+
+#define __kCFStorageAccessCacheCount 4
+
+// A thread's generator of random UUIDs (see CFUUID.c)
+typedef struct {
+    uint32_t _key[8];
+    uint32_t _generation;	// The process's fork generation when the key was seeded; 0 if never seeded
+    uint32_t _available;	// Unused bytes at the start of _buffer
+    uint8_t _buffer[224];
+} __CFUUIDRandomState;
+
 typedef struct ___CFThreadSpecificData {
     void *_unused1;
     void *_allocator;
+    void *_runLoop;	// Not retained; a cache of this thread's entry in the run loop table
+    __CFStorageAccessCache _storageCache[__kCFStorageAccessCacheCount];
+    __CFUUIDRandomState _uuidRandom;
 #if DEPLOYMENT_TARGET_WINDOWS
     HHOOK _messageHook;
 #endif
@@ -252,8 +317,19 @@ extern DWORD __CFTSDKey;
 
 //extern void *pthread_getspecific(pthread_key_t key);
 
+// On Linux the thread data lives in initial-exec TLS, so finding it is a single load; __CFTSDKey is then only used to get __CFFinalizeThreadData() called at thread exit
+#if DEPLOYMENT_TARGET_LINUX && !defined(CF_TSD_USE_PTHREAD_KEY)
+#define CF_TSD_USES_TLS 1
+extern __thread __CFThreadSpecificData *__CFTSDCurrent __attribute__((tls_model("initial-exec")));
+#else
+#define CF_TSD_USES_TLS 0
+#endif
+
 CF_INLINE __CFThreadSpecificData *__CFGetThreadSpecificData_inline(void) {
-#if DEPLOYMENT_TARGET_MACOSX|| DEPLOYMENT_TARGET_LINUX || DEPLOYMENT_TARGET_FREEBSD
+#if CF_TSD_USES_TLS
+    __CFThreadSpecificData *data = __CFTSDCurrent;
+    return data ? data : __CFGetThreadSpecificData();
+#elif DEPLOYMENT_TARGET_MACOSX|| DEPLOYMENT_TARGET_LINUX || DEPLOYMENT_TARGET_FREEBSD
     __CFThreadSpecificData *data = (__CFThreadSpecificData *)pthread_getspecific(__CFTSDKey);
     return data ? data : __CFGetThreadSpecificData();
 #elif DEPLOYMENT_TARGET_WINDOWS
@@ -274,11 +350,58 @@ CF_INLINE CFAllocatorRef __CFGetDefaultAllocator(void) {
 
 extern CFTypeID __CFGenericTypeID(const void *cf);
 
+/* Tagged objects.  On LP64, some immutable values are encoded in the
+   object pointer itself instead of being allocated.  Real CF objects are
+   always at least 8-byte aligned, so a set low bit marks a tagged pointer:
+	bit 0		1
+	bits 3..1	tagged class, one of the __kCFTagged... constants below
+	bits 7..4	class-specific bits
+	bits 63..8	signed 56-bit payload
+   Tagged objects have no storage: retain and release are no-ops, and the
+   allocator is always kCFAllocatorSystemDefault. */
+#if __LP64__ && !defined(COCOTRON)
+#define CF_TAGGED_OBJECTS 1
+#else
+#define CF_TAGGED_OBJECTS 0
+#endif
+
+#if CF_TAGGED_OBJECTS
+enum {
+    __kCFTaggedNumber = 1		// class bits hold the canonical CFNumberType
+};
+
+#define __kCFTaggedPayloadMin	(-((int64_t)1 << 55))
+#define __kCFTaggedPayloadMax	(((int64_t)1 << 55) - 1)
+
+extern CFTypeID __CFTaggedTypeIDs[8];
+
+#define CF_IS_TAGGED_OBJ(cf)	((((uintptr_t)(cf)) & 0x1) != 0)
+
+CF_INLINE uintptr_t __CFTaggedObjectClass(const void *cf) {
+    return ((uintptr_t)cf >> 1) & 0x7;
+}
+
+CF_INLINE uintptr_t __CFTaggedObjectClassBits(const void *cf) {
+    return ((uintptr_t)cf >> 4) & 0xF;
+}
+
+CF_INLINE int64_t __CFTaggedObjectPayload(const void *cf) {
+    return (int64_t)(intptr_t)cf >> 8;
+}
+
+CF_INLINE const void *__CFTaggedObjectCreate(uintptr_t cls, uintptr_t classBits, int64_t payload) {
+    return (const void *)(((uintptr_t)payload << 8) | ((classBits & 0xF) << 4) | ((cls & 0x7) << 1) | 0x1);
+}
+#else
+#define CF_IS_TAGGED_OBJ(cf)	(false)
+#endif
+
 // This should only be used in CF types, not toll-free bridged objects!
 // It should not be used with CFAllocator arguments!
 // Use CFGetAllocator() in the general case, and this inline function in a few limited (but often called) situations.
 CF_INLINE CFAllocatorRef __CFGetAllocator(CFTypeRef cf) {	// !!! Use with CF types only, and NOT WITH CFAllocator!
     CFAssert1(__kCFAllocatorTypeID_CONST != __CFGenericTypeID(cf), __kCFLogAssertion, "__CFGetAllocator(): CFAllocator argument", cf);
+    if (CF_IS_TAGGED_OBJ(cf)) return kCFAllocatorSystemDefault;
     if (__builtin_expect(__CFBitfieldGetValue(((const CFRuntimeBase *)cf)->_cfinfo[CF_INFO_BITS], 7, 7), 1)) {
 	return kCFAllocatorSystemDefault;
     }
@@ -418,6 +541,16 @@ CF_EXPORT CFStringRef _CFCreateLimitedUniqueString(void);
 /* Comparators are passed the address of the values; this is somewhat different than CFComparatorFunction is used in public API usually. */
 CF_EXPORT CFIndex	CFBSearch(const void *element, CFIndex elementSize, const void *list, CFIndex count, CFComparatorFunction comparator, void *context);
 
+/* Sorts an array of pointers; unlike CFQSortArray(), the comparator is passed the values themselves, not their addresses. */
+__private_extern__ void __CFSortValues(const void **values, CFIndex count, Boolean stable, CFComparatorFunction comparator, void *context);
+__private_extern__ void __CFSortValuesConcurrent(const void **values, CFIndex count, Boolean stable, CFComparatorFunction comparator, void *context);
+
+/* Process-wide prototypes of ICU objects that are costly to open (formatters, calendars, collators), keyed by a string naming
+   everything the object was opened with. A prototype lives as long as the process and is only ever cloned. After opening an
+   object, offer a clone of it with __CFICUPrototypeAdd(); if that returns false the clone was not kept and must be closed. */
+__private_extern__ const void *__CFICUPrototypeGet(CFStringRef key);
+__private_extern__ Boolean __CFICUPrototypeAdd(CFStringRef key, const void *prototype);
+
 CF_EXPORT CFHashCode	CFHashBytes(UInt8 *bytes, CFIndex length);
 
 CF_EXPORT CFStringEncoding CFStringFileSystemEncoding(void);
@@ -494,6 +627,43 @@ CF_INLINE void __CFSpinUnlock(CFSpinLock_t *lockp) {
 
 #endif
 
+/* Bounded, lock-free caches of immutable value objects (CFNumber, CFDate).
+   Each slot owns one retain on the object it holds.  A reader takes the
+   object out of its slot while it examines it, so a concurrent store can
+   never release the object from under the reader; the price is an
+   occasional spurious miss under contention, which is harmless. */
+CF_INLINE CFTypeRef __CFValueCacheTake(CFTypeRef volatile *slot) {
+    CFTypeRef cf;
+    do {
+	cf = *slot;
+	if (NULL == cf) return NULL;
+    } while (!_CFAtomicCompareAndSwapPtrBarrier((void *)cf, NULL, (void *volatile *)slot));
+    return cf;
+}
+
+/* Puts back an object previously taken; drops it if the slot was refilled meanwhile. */
+CF_INLINE void __CFValueCacheReturn(CFTypeRef volatile *slot, CFTypeRef cf) {
+    if (!_CFAtomicCompareAndSwapPtrBarrier(NULL, (void *)cf, (void *volatile *)slot)) CFRelease(cf);
+}
+
+/* Stores a newly created object, evicting whatever the slot held. */
+CF_INLINE void __CFValueCacheStore(CFTypeRef volatile *slot, CFTypeRef cf) {
+    CFTypeRef old;
+    CFRetain(cf);
+    do {
+	old = *slot;
+    } while (!_CFAtomicCompareAndSwapPtrBarrier((void *)old, (void *)cf, (void *volatile *)slot));
+    if (old) CFRelease(old);
+}
+
+CF_INLINE void __CFValueCacheFlush(CFTypeRef volatile *slots, CFIndex count) {
+    CFIndex idx;
+    for (idx = 0; idx < count; idx++) {
+	CFTypeRef cf = __CFValueCacheTake(&slots[idx]);
+	if (cf) CFRelease(cf);
+    }
+}
+
 #if !defined(CHECK_FOR_FORK)
 #define CHECK_FOR_FORK() do { } while (0)
 #endif
@@ -391,9 +391,24 @@ static const struct {
 };
 
 CF_INLINE CFNumberType __CFNumberGetType(CFNumberRef num) {
+#if CF_TAGGED_OBJECTS
+    if (CF_IS_TAGGED_OBJ(num)) return (CFNumberType)__CFTaggedObjectClassBits(num);
+#endif
     return __CFBitfieldGetValue(num->_base._cfinfo[CF_INFO_BITS], 4, 0);
 }
 
+// Returns a pointer to the number's canonical storage; tagged numbers are
+// unpacked into *tagged, which must stay live while the result is used.
+CF_INLINE const void *__CFNumberGetStorage(CFNumberRef num, int64_t *tagged) {
+#if CF_TAGGED_OBJECTS
+    if (CF_IS_TAGGED_OBJ(num)) {
+	*tagged = __CFTaggedObjectPayload(num);
+	return tagged;
+    }
+#endif
+    return &(num->_pad);
+}
+
 #define CVT(SRC_TYPE, DST_TYPE, DST_MIN, DST_MAX) do { \
 	SRC_TYPE sv; memmove(&sv, data, sizeof(SRC_TYPE)); \
 	DST_TYPE dv = (sv < DST_MIN) ? (DST_TYPE)DST_MIN : (DST_TYPE)(((DST_MAX < sv) ? DST_MAX : sv)); \
@@ -421,7 +436,8 @@ CF_INLINE CFNumberType __CFNumberGetType(CFNumberRef num) {
 static Boolean __CFNumberGetValue(CFNumberRef number, CFNumberType type, void *valuePtr) {
     type = __CFNumberTypeTable[type].canonicalType;
     CFNumberType ntype = __CFNumberGetType(number);
-    const void *data = &(number->_pad);
+    int64_t tagged;
+    const void *data = __CFNumberGetStorage(number, &tagged);
     switch (type) {
     case kCFNumberSInt8Type:
 	if (__CFNumberTypeTable[ntype].floatBit) {
@@ -611,7 +627,8 @@ static Boolean __CFNumberGetValue(CFNumberRef number, CFNumberType type, void *v
 static Boolean __CFNumberGetValueCompat(CFNumberRef number, CFNumberType type, void *valuePtr) {
     type = __CFNumberTypeTable[type].canonicalType;
     CFNumberType ntype = __CFNumberGetType(number);
-    const void *data = &(number->_pad);
+    int64_t tagged;
+    const void *data = __CFNumberGetStorage(number, &tagged);
     switch (type) {
     case kCFNumberSInt8Type:
 	if (__CFNumberTypeTable[ntype].floatBit) {
@@ -883,6 +900,8 @@ static const CFRuntimeClass __CFNumberClass = {
     __CFNumberCopyDescription
 };
 
+static void __CFNumberInitializeCache(void);
+
 __private_extern__ void __CFNumberInitialize(void) {
     __kCFNumberTypeID = _CFRuntimeRegisterClass(&__CFNumberClass);
 
@@ -900,16 +919,71 @@ __private_extern__ void __CFNumberInitialize(void) {
     __kCFNumberPositiveInfinity._base._cfisa = __CFISAForTypeID(__kCFNumberTypeID);
     __CFBitfieldSetValue(__kCFNumberPositiveInfinity._base._cfinfo[CF_INFO_BITS], 4, 0, kCFNumberFloat64Type);
     __kCFNumberPositiveInfinity._pad = BITSFORDOUBLEPOSINF;
+
+    __CFNumberInitializeCache();
+#if CF_TAGGED_OBJECTS
+    __CFTaggedTypeIDs[__kCFTaggedNumber] = __kCFNumberTypeID;
+#endif
 }
 
 CFTypeID CFNumberGetTypeID(void) {
     return __kCFNumberTypeID;
 }
 
-#define MinCachedInt (-1)
-#define MaxCachedInt (12)
+// Integers in [MinCachedInt, MaxCachedInt] created with the system default
+// allocator are shared, immortal, statically allocated instances, so creating,
+// retaining and releasing them never touches the heap or the retain count.
+// The range can be changed at build time with -DCF_NUMBER_MIN_CACHED_INT=n
+// and -DCF_NUMBER_MAX_CACHED_INT=n.
+#if !defined(CF_NUMBER_MIN_CACHED_INT)
+#define CF_NUMBER_MIN_CACHED_INT (-128)
+#endif
+#if !defined(CF_NUMBER_MAX_CACHED_INT)
+#define CF_NUMBER_MAX_CACHED_INT (1023)
+#endif
+#define MinCachedInt (CF_NUMBER_MIN_CACHED_INT)
+#define MaxCachedInt (CF_NUMBER_MAX_CACHED_INT)
 #define NotToBeCached (MinCachedInt - 1)
-static CFNumberRef __CFNumberCache[MaxCachedInt - MinCachedInt + 1] = {NULL};	// Storing CFNumberRefs for range MinCachedInt..MaxCachedInt
+static struct __CFNumber __CFNumberCache[MaxCachedInt - MinCachedInt + 1];	// Immortal CFNumbers for range MinCachedInt..MaxCachedInt
+
+// Optional uniquing cache for the values outside the immortal range.  This is
+// a direct-mapped table of recently created numbers; it is off by default and
+// turned on with _CFNumberSetUniquingEnabled().  Hit/miss counts are updated
+// without synchronization and so are approximate.
+#if !defined(CF_NUMBER_UNIQUING_CACHE_SIZE)
+#define CF_NUMBER_UNIQUING_CACHE_SIZE 1024	// must be a power of 2
+#endif
+static CFTypeRef volatile __CFNumberUniquingCache[CF_NUMBER_UNIQUING_CACHE_SIZE] = {NULL};
+static Boolean __CFNumberUniquingEnabled = false;
+static uint64_t __CFNumberUniquingHits = 0;
+static uint64_t __CFNumberUniquingMisses = 0;
+
+static void __CFNumberInitializeCache(void) {
+    CFIndex idx;
+    for (idx = 0; idx < MaxCachedInt - MinCachedInt + 1; idx++) {
+	struct __CFNumber *num = &__CFNumberCache[idx];
+	_CFRuntimeInitStaticInstance(num, __kCFNumberTypeID);
+	// All cached numbers have the same type, so that the type does not
+	// depend on the type with which the number was asked for.
+	__CFBitfieldSetValue(num->_base._cfinfo[CF_INFO_BITS], 4, 0, kCFNumberSInt32Type);
+	num->_pad = (uint64_t)(int64_t)(idx + MinCachedInt);
+    }
+}
+
+CF_INLINE CFIndex __CFNumberUniquingSlot(CFNumberType type, const uint64_t *bits) {
+    uint64_t h = (bits[0] ^ (bits[1] * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)type) * 0x9E3779B97F4A7C15ULL;
+    return (CFIndex)(h >> 32) & (CF_NUMBER_UNIQUING_CACHE_SIZE - 1);
+}
+
+void _CFNumberSetUniquingEnabled(Boolean enabled) {
+    __CFNumberUniquingEnabled = enabled;
+    if (!enabled) __CFValueCacheFlush(__CFNumberUniquingCache, CF_NUMBER_UNIQUING_CACHE_SIZE);
+}
+
+void _CFNumberGetUniquingStatistics(uint64_t *hits, uint64_t *misses) {
+    if (hits) *hits = __CFNumberUniquingHits;
+    if (misses) *misses = __CFNumberUniquingMisses;
+}
 
 CFNumberRef CFNumberCreate(CFAllocatorRef allocator, CFNumberType type, const void *valuePtr) {
     __CFAssertIsValidNumberType(type);
@@ -922,7 +996,6 @@ CFNumberRef CFNumberCreate(CFAllocatorRef allocator, CFNumberType type, const vo
     // regardless of allocator, since that is what has always
     // been done (and now must for compatibility).
     if (!allocator) allocator = __CFGetDefaultAllocator();
-    int64_t valToBeCached = NotToBeCached;
 
     if (__CFNumberTypeTable[type].floatBit) {
 	CFNumberRef cached = NULL;
@@ -937,6 +1010,7 @@ CFNumberRef CFNumberCreate(CFAllocatorRef allocator, CFNumberType type, const vo
 	}
 	if (cached) return (CFNumberRef)CFRetain(cached);
     } else if (kCFAllocatorSystemDefault == allocator) {
+	int64_t valToBeCached = NotToBeCached;
 	switch (__CFNumberTypeTable[type].canonicalType) {
 	case kCFNumberSInt8Type:   {int8_t  val = *(int8_t *)valuePtr;  if (MinCachedInt <= val && val <= MaxCachedInt) valToBeCached = (int64_t)val; break;}
 	case kCFNumberSInt16Type:  {int16_t val = *(int16_t *)valuePtr; if (MinCachedInt <= val && val <= MaxCachedInt) valToBeCached = (int64_t)val; break;}
@@ -944,51 +1018,63 @@ CFNumberRef CFNumberCreate(CFAllocatorRef allocator, CFNumberType type, const vo
 	case kCFNumberSInt64Type:  {int64_t val = *(int64_t *)valuePtr; if (MinCachedInt <= val && val <= MaxCachedInt) valToBeCached = (int64_t)val; break;}
 	}
 	if (NotToBeCached != valToBeCached) {
-	    CFNumberRef cached = __CFNumberCache[valToBeCached - MinCachedInt];	    // Atomic to access the value in the cache
-	    if (NULL != cached) return (CFNumberRef)CFRetain(cached);
+	    return (CFNumberRef)&__CFNumberCache[valToBeCached - MinCachedInt];
 	}
     }
 
-    CFIndex size = 8 + ((!__CFNumberTypeTable[type].floatBit && __CFNumberTypeTable[type].storageBit) ? 8 : 0);
-    CFNumberRef result = (CFNumberRef)_CFRuntimeCreateInstance(allocator, __kCFNumberTypeID, size, NULL);
-    if (NULL == result) {
-	return NULL;
+#if CF_TAGGED_OBJECTS
+    // Integers that fit in the tagged payload need no object at all
+    if (kCFAllocatorSystemDefault == allocator && !__CFNumberTypeTable[type].floatBit && !__CFNumberTypeTable[type].storageBit) {
+	int64_t val = 0;
+	switch (__CFNumberTypeTable[type].canonicalType) {
+	case kCFNumberSInt8Type:   val = *(int8_t *)valuePtr; break;
+	case kCFNumberSInt16Type:  val = *(int16_t *)valuePtr; break;
+	case kCFNumberSInt32Type:  val = *(int32_t *)valuePtr; break;
+	case kCFNumberSInt64Type:  memmove(&val, valuePtr, 8); break;
+	}
+	if (__kCFTaggedPayloadMin <= val && val <= __kCFTaggedPayloadMax) {
+	    return (CFNumberRef)__CFTaggedObjectCreate(__kCFTaggedNumber, __CFNumberTypeTable[type].canonicalType, val);
+	}
     }
-    __CFBitfieldSetValue(((struct __CFNumber *)result)->_base._cfinfo[CF_INFO_BITS], 4, 0, (uint8_t)__CFNumberTypeTable[type].canonicalType);
-
-
-    // for a value to be cached, we already have the value handy
-    if (NotToBeCached != valToBeCached) {
-	memmove((void *)&result->_pad, &valToBeCached, 8);
-	// Put this in the cache unless the cache is already filled (by another thread).  If we do put it in the cache, retain it an extra time for the cache.
-	// Note that we don't bother freeing this result and returning the cached value if the cache was filled, since cached CFNumbers are not guaranteed unique.
-	// Barrier assures that the number that is placed in the cache is properly formed.
-	CFNumberType origType = __CFNumberGetType(result);
-	// Force all cached numbers to have the same type, so that the type does not
-	// depend on the order and original type in/with which the numbers are created.
-	// Forcing the type AFTER it was cached would cause a race condition with other
-	// threads pulling the number object out of the cache and using it.
-	__CFBitfieldSetValue(((struct __CFNumber *)result)->_base._cfinfo[CF_INFO_BITS], 4, 0, (uint8_t)kCFNumberSInt32Type);
-	if (_CFAtomicCompareAndSwapPtrBarrier(NULL, (void *)result, (void *volatile *)&__CFNumberCache[valToBeCached - MinCachedInt])) {
-	    CFRetain(result);
-	} else {
-	    // Did not cache the number object, put original type back.
-	    __CFBitfieldSetValue(((struct __CFNumber *)result)->_base._cfinfo[CF_INFO_BITS], 4, 0, (uint8_t)origType);
+#endif
+
+    // Canonical storage for the value; also the key for the uniquing cache.
+    CFNumberType canonicalType = __CFNumberTypeTable[type].canonicalType;
+    uint64_t bits[2] = {0ULL, 0ULL};
+    switch (canonicalType) {
+    case kCFNumberSInt8Type:   bits[0] = (uint64_t)(int64_t)*(int8_t *)valuePtr; break;
+    case kCFNumberSInt16Type:  bits[0] = (uint64_t)(int64_t)*(int16_t *)valuePtr; break;
+    case kCFNumberSInt32Type:  bits[0] = (uint64_t)(int64_t)*(int32_t *)valuePtr; break;
+    case kCFNumberSInt64Type:  memmove(bits, valuePtr, 8); break;
+    case kCFNumberSInt128Type: memmove(bits, valuePtr, 16); break;
+    case kCFNumberFloat32Type: memmove(bits, valuePtr, 4); break;
+    case kCFNumberFloat64Type: memmove(bits, valuePtr, 8); break;
+    }
+
+    CFIndex size = 8 + ((!__CFNumberTypeTable[type].floatBit && __CFNumberTypeTable[type].storageBit) ? 8 : 0);
+    CFTypeRef volatile *slot = NULL;
+    if (__CFNumberUniquingEnabled && kCFAllocatorSystemDefault == allocator) {
+	slot = &__CFNumberUniquingCache[__CFNumberUniquingSlot(canonicalType, bits)];
+	CFNumberRef cached = (CFNumberRef)__CFValueCacheTake(slot);
+	if (NULL != cached) {
+	    Boolean match = (__CFNumberGetType(cached) == canonicalType && 0 == memcmp(&cached->_pad, bits, size));
+	    if (match) CFRetain(cached);
+	    __CFValueCacheReturn(slot, cached);
+	    if (match) {
+		__CFNumberUniquingHits++;
+		return cached;
+	    }
 	}
-	return result;
+	__CFNumberUniquingMisses++;
     }
 
-    uint64_t value;
-    switch (__CFNumberTypeTable[type].canonicalType) {
-    case kCFNumberSInt8Type:   value = (uint64_t)(int64_t)*(int8_t *)valuePtr; goto smallVal;
-    case kCFNumberSInt16Type:  value = (uint64_t)(int64_t)*(int16_t *)valuePtr; goto smallVal;
-    case kCFNumberSInt32Type:  value = (uint64_t)(int64_t)*(int32_t *)valuePtr; goto smallVal;
-			smallVal: memmove((void *)&result->_pad, &value, 8); break;
-    case kCFNumberSInt64Type:  memmove((void *)&result->_pad, valuePtr, 8); break;
-    case kCFNumberSInt128Type: memmove((void *)&result->_pad, valuePtr, 16); break;
-    case kCFNumberFloat32Type: memmove((void *)&result->_pad, valuePtr, 4); break;
-    case kCFNumberFloat64Type: memmove((void *)&result->_pad, valuePtr, 8); break;
+    CFNumberRef result = (CFNumberRef)_CFRuntimeCreateInstance(allocator, __kCFNumberTypeID, size, NULL);
+    if (NULL == result) {
+	return NULL;
     }
+    __CFBitfieldSetValue(((struct __CFNumber *)result)->_base._cfinfo[CF_INFO_BITS], 4, 0, (uint8_t)canonicalType);
+    memmove((void *)&result->_pad, bits, size);
+    if (NULL != slot) __CFValueCacheStore(slot, result);
 //printf("  => %p\n", result);
     return result;
 }
@@ -1133,4 +1219,5 @@ CFComparisonResult CFNumberCompare(CFNumberRef number1, CFNumberRef number2, voi
 #undef MinCachedInt
 #undef MaxCachedInt
 #undef NotToBeCached
+#undef CF_NUMBER_UNIQUING_CACHE_SIZE
 
@@ -95,6 +95,26 @@ CFTypeID CFNumberFormatterGetTypeID(void) {
     return __kCFNumberFormatterTypeID;
 }
 
+// Opening a number format loads the locale's data; clone a shared prototype instead when one was opened the same way before
+static UNumberFormat *__CFNumberFormatterOpenUNumberFormat(int32_t ustyle, const char *cstr, UErrorCode *status) {
+    if (NULL == cstr) return unum_open((UNumberFormatStyle)ustyle, NULL, 0, cstr, NULL, status);
+    CFStringRef key = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("unum %d %s"), ustyle, cstr);
+    const UNumberFormat *proto = (const UNumberFormat *)__CFICUPrototypeGet(key);
+    UNumberFormat *nf;
+    if (proto) {
+	nf = unum_clone(proto, status);
+    } else {
+	nf = unum_open((UNumberFormatStyle)ustyle, NULL, 0, cstr, NULL, status);
+	if (NULL != nf) {
+	    UErrorCode cstatus = U_ZERO_ERROR;
+	    UNumberFormat *copy = unum_clone(nf, &cstatus);
+	    if (NULL != copy && !__CFICUPrototypeAdd(key, copy)) unum_close(copy);
+	}
+    }
+    CFRelease(key);
+    return nf;
+}
+
 CFNumberFormatterRef CFNumberFormatterCreate(CFAllocatorRef allocator, CFLocaleRef locale, CFNumberFormatterStyle style) {
     struct __CFNumberFormatter *memory;
     uint32_t size = sizeof(struct __CFNumberFormatter) - sizeof(CFRuntimeBase);
@@ -138,7 +158,7 @@ CFNumberFormatterRef CFNumberFormatterCreate(CFAllocatorRef allocator, CFLocaleR
 	return NULL;
     }
     UErrorCode status = U_ZERO_ERROR;
-    memory->_nf = unum_open((UNumberFormatStyle)ustyle, NULL, 0, cstr, NULL, &status);
+    memory->_nf = __CFNumberFormatterOpenUNumberFormat(ustyle, cstr, &status);
     CFAssert2(memory->_nf, __kCFLogAssertion, "%s(): error (%d) creating number formatter", __PRETTY_FUNCTION__, status);
     if (NULL == memory->_nf) {
 	CFRelease(memory);
@@ -211,7 +231,7 @@ static void __substituteFormatStringFromPrefsNF(CFNumberFormatterRef formatter)
 		if (CFStringGetCString(localeName, buffer, BUFFER_SIZE, kCFStringEncodingASCII)) cstr = buffer;
 	    }
 	    UErrorCode status = U_ZERO_ERROR;
-	    UNumberFormat *nf = unum_open((UNumberFormatStyle)icustyle, NULL, 0, cstr, NULL, &status);
+	    UNumberFormat *nf = __CFNumberFormatterOpenUNumberFormat(icustyle, cstr, &status);
 	    if (NULL != nf) {
 		UChar ubuffer[BUFFER_SIZE];
 		status = U_ZERO_ERROR;
@@ -757,7 +777,7 @@ CFTypeRef CFNumberFormatterCopyProperty(CFNumberFormatterRef formatter, CFString
 	        return NULL;
 	    }
 	    UErrorCode status = U_ZERO_ERROR;
-	    UNumberFormat *nf = unum_open(UNUM_CURRENCY, NULL, 0, cstr, NULL, &status);
+	    UNumberFormat *nf = __CFNumberFormatterOpenUNumberFormat(UNUM_CURRENCY, cstr, &status);
 	    if (NULL != nf) {
 		cnt = unum_getTextAttribute(nf, UNUM_CURRENCY_CODE, ubuffer, BUFFER_SIZE, &status);
 		unum_close(nf);
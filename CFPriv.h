@@ -44,8 +44,11 @@
 #include <string.h>
 #include <CoreFoundation/CFBase.h>
 #include <CoreFoundation/CFArray.h>
+#include <CoreFoundation/CFBinaryHeap.h>
+#include <CoreFoundation/CFBitVector.h>
 #include <CoreFoundation/CFString.h>
 #include <CoreFoundation/CFURL.h>
+#include <CoreFoundation/CFUUID.h>
 #include <CoreFoundation/CFBundlePriv.h>
 
 
@@ -53,7 +56,7 @@
 #include <CoreFoundation/CFMachPort.h>
 #endif
 
-#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_WINDOWS
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_WINDOWS || DEPLOYMENT_TARGET_LINUX
 #include <CoreFoundation/CFRunLoop.h>
 #include <CoreFoundation/CFSocket.h>
 #endif
@@ -101,6 +104,14 @@ CF_EXPORT CFURLRef _CFURLCreateFromPropertyListRepresentation(CFAllocatorRef all
 
 CF_EXPORT void CFPreferencesFlushCaches(void);
 
+/* Uniquing of recently created CFNumbers and CFDates allocated with the
+   system default allocator.  Off by default; disabling flushes the cache.
+   The statistics are approximate. */
+CF_EXPORT void _CFNumberSetUniquingEnabled(Boolean enabled);
+CF_EXPORT void _CFNumberGetUniquingStatistics(uint64_t *hits, uint64_t *misses);
+CF_EXPORT void _CFDateSetUniquingEnabled(Boolean enabled);
+CF_EXPORT void _CFDateGetUniquingStatistics(uint64_t *hits, uint64_t *misses);
+
 #if !__LP64__
 #if !defined(__WIN32__)
 struct FSSpec;
@@ -250,6 +261,169 @@ CF_EXPORT const CFStringRef _kCFSystemVersionBuildStringKey;		// Localized strin
 CF_EXPORT void CFMergeSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context);
 CF_EXPORT void CFQSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context);
 
+/* Sorts large arrays on several threads (serially below a size threshold). The comparator must be safe to call concurrently.
+   CFSortArrayConcurrent() passes the comparator the addresses of the elements, as CFQSortArray() does; CFArraySortValuesConcurrent() passes the values, as CFArraySortValues() does. */
+CF_EXPORT void CFSortArrayConcurrent(void *list, CFIndex count, CFIndex elementSize, Boolean stable, CFComparatorFunction comparator, void *context);
+CF_EXPORT void CFArraySortValuesConcurrent(CFMutableArrayRef array, CFRange range, CFComparatorFunction comparator, void *context, Boolean stable);
+
+/* Stable sorts of strings by CFStringCompareWithOptionsAndLocale() order, computing a sort key for each string once instead of comparing strings directly.
+   With kCFCompareLocalized the order is instead the ICU collation order of the locale (the current locale when NULL), which
+   CFStringCompareWithOptionsAndLocale() does not implement; otherwise the locale is ignored, as that function ignores it. */
+CF_EXPORT void CFStringSortValues(CFStringRef *strings, CFIndex count, CFOptionFlags compareOptions, CFLocaleRef locale);
+CF_EXPORT void CFArraySortStringValues(CFMutableArrayRef array, CFRange range, CFOptionFlags compareOptions, CFLocaleRef locale);
+
+/* A mutable array kept in a ring buffer: adding and removing values at either end takes constant time at any size, at the cost of
+   somewhat slower insertion and removal in the middle. Otherwise it behaves like an array from CFArrayCreateMutable(). */
+CF_EXPORT CFMutableArrayRef CFArrayCreateMutableQueue(CFAllocatorRef allocator, CFIndex capacity, const CFArrayCallBacks *callBacks);
+
+/* Removes up to maxCount values from the start of the array into values, returning how many. The array's references pass to the
+   caller, who must release the values as the array's release callback would (CFRelease() for kCFTypeArrayCallBacks). */
+CF_EXPORT CFIndex CFArrayDequeueValues(CFMutableArrayRef array, const void **values, CFIndex maxCount);
+
+/* A dictionary that many threads can read while one thread at a time changes it. Reads take no lock and never wait for a writer;
+   each change publishes a new version that shares all but a few internal nodes with the previous one, so it suits tables that are
+   read far more often than they are written. CFConcurrentDictionaryCopySnapshot() returns an immutable view of the current version
+   in constant time; later changes do not affect it. A value returned by CFConcurrentDictionaryGetValue() from a mutable dictionary
+   is only guaranteed to stay valid while no other thread can remove or replace it; read through a snapshot when one might. */
+typedef const struct __CFConcurrentDictionary * CFConcurrentDictionaryRef;
+typedef struct __CFConcurrentDictionary * CFMutableConcurrentDictionaryRef;
+
+CF_EXPORT CFTypeID CFConcurrentDictionaryGetTypeID(void);
+CF_EXPORT CFMutableConcurrentDictionaryRef CFConcurrentDictionaryCreateMutable(CFAllocatorRef allocator, const CFDictionaryKeyCallBacks *keyCallBacks, const CFDictionaryValueCallBacks *valueCallBacks);
+CF_EXPORT CFConcurrentDictionaryRef CFConcurrentDictionaryCopySnapshot(CFConcurrentDictionaryRef cd);
+CF_EXPORT CFDictionaryRef CFConcurrentDictionaryCreateDictionary(CFAllocatorRef allocator, CFConcurrentDictionaryRef cd);
+CF_EXPORT CFIndex CFConcurrentDictionaryGetCount(CFConcurrentDictionaryRef cd);
+CF_EXPORT const void *CFConcurrentDictionaryGetValue(CFConcurrentDictionaryRef cd, const void *key);
+CF_EXPORT Boolean CFConcurrentDictionaryGetValueIfPresent(CFConcurrentDictionaryRef cd, const void *key, const void **value);
+CF_EXPORT void CFConcurrentDictionaryApplyFunction(CFConcurrentDictionaryRef cd, CFDictionaryApplierFunction applier, void *context);
+CF_EXPORT void CFConcurrentDictionaryAddValue(CFMutableConcurrentDictionaryRef cd, const void *key, const void *value);
+CF_EXPORT void CFConcurrentDictionarySetValue(CFMutableConcurrentDictionaryRef cd, const void *key, const void *value);
+CF_EXPORT void CFConcurrentDictionaryRemoveValue(CFMutableConcurrentDictionaryRef cd, const void *key);
+CF_EXPORT void CFConcurrentDictionaryRemoveAllValues(CFMutableConcurrentDictionaryRef cd);
+
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_WINDOWS || DEPLOYMENT_TARGET_LINUX
+/* A pool of worker threads, each running its own run loop in kCFRunLoopDefaultMode. A version 0 source added to the pool is
+   scheduled on every worker's run loop in the given mode; when it is signalled, whichever worker is free performs it (an idle
+   worker takes work from busy ones), and a source is never performed by two workers at once. Signalling a pooled source wakes a
+   worker, so CFRunLoopWakeUp() is not needed. Timers and version 1 sources are bound to one run loop, so they are added to the
+   least loaded worker. numWorkers < 1 means one per processor. The workers keep the pool alive until CFRunLoopPoolInvalidate(),
+   which detaches its sources and lets the workers exit once their current callouts return. */
+typedef struct __CFRunLoopPool * CFRunLoopPoolRef;
+
+CF_EXPORT CFTypeID CFRunLoopPoolGetTypeID(void);
+CF_EXPORT CFRunLoopPoolRef CFRunLoopPoolCreate(CFAllocatorRef allocator, CFIndex numWorkers);
+CF_EXPORT CFIndex CFRunLoopPoolGetWorkerCount(CFRunLoopPoolRef pool);
+CF_EXPORT CFRunLoopRef CFRunLoopPoolGetWorkerRunLoop(CFRunLoopPoolRef pool, CFIndex idx);
+CF_EXPORT void CFRunLoopPoolAddSource(CFRunLoopPoolRef pool, CFRunLoopSourceRef source, CFStringRef mode);
+CF_EXPORT void CFRunLoopPoolRemoveSource(CFRunLoopPoolRef pool, CFRunLoopSourceRef source, CFStringRef mode);
+CF_EXPORT Boolean CFRunLoopPoolContainsSource(CFRunLoopPoolRef pool, CFRunLoopSourceRef source, CFStringRef mode);
+CF_EXPORT void CFRunLoopPoolAddTimer(CFRunLoopPoolRef pool, CFRunLoopTimerRef timer, CFStringRef mode);
+CF_EXPORT void CFRunLoopPoolRemoveTimer(CFRunLoopPoolRef pool, CFRunLoopTimerRef timer, CFStringRef mode);
+CF_EXPORT Boolean CFRunLoopPoolContainsTimer(CFRunLoopPoolRef pool, CFRunLoopTimerRef timer, CFStringRef mode);
+CF_EXPORT void CFRunLoopPoolInvalidate(CFRunLoopPoolRef pool);
+CF_EXPORT Boolean CFRunLoopPoolIsValid(CFRunLoopPoolRef pool);
+
+/* Run loop instrumentation. With kCFRunLoopInstrumentStatistics the run loop counts the callouts of its version 0 sources,
+   version 1 sources, timers and observers, the time spent in them, how late timers fired and how long it slept; with
+   kCFRunLoopInstrumentTrace it also records each callout and sleep into a ring of the last traceCapacity events, which other
+   threads can copy without stopping the run loop. The ring is allocated by the first call that enables tracing, and its
+   capacity cannot change after that. Passing 0 turns instrumentation off again; the data gathered so far can still be copied.
+   _CFRunLoopCopyStatistics() returns a property list dictionary keyed by "source0", "source1", "timer", "observer", "sleep"
+   and "timerLateness", each holding "count", "total" and "max" (in seconds) and "histogram", where element i counts events
+   that took less than 2^i microseconds but at least 2^(i-1); the last element also counts anything longer. A callout that
+   runs a nested run loop includes the callouts made by that nested run. _CFRunLoopCopyTrace() returns the recorded events
+   in the order they ended, each a dictionary with "kind", "start" (an absolute time), "duration", "object" and "callout", plus
+   "lateness" for timers and "activity" for observers. */
+enum {
+    kCFRunLoopInstrumentStatistics = (1UL << 0),
+    kCFRunLoopInstrumentTrace = (1UL << 1)
+};
+
+enum {
+    kCFRunLoopTraceFormatXMLPropertyList = 1,	/* the array returned by _CFRunLoopCopyTrace() */
+    kCFRunLoopTraceFormatChromeJSON = 2	/* Trace Event Format, as loaded by chrome://tracing */
+};
+
+CF_EXPORT void _CFRunLoopSetInstrumentation(CFRunLoopRef rl, CFOptionFlags options, CFIndex traceCapacity);
+CF_EXPORT CFOptionFlags _CFRunLoopGetInstrumentation(CFRunLoopRef rl);
+CF_EXPORT CFDictionaryRef _CFRunLoopCopyStatistics(CFRunLoopRef rl);
+CF_EXPORT void _CFRunLoopResetStatistics(CFRunLoopRef rl);
+CF_EXPORT CFArrayRef _CFRunLoopCopyTrace(CFRunLoopRef rl);
+CF_EXPORT CFDataRef _CFRunLoopCreateTraceData(CFRunLoopRef rl, CFIndex format);
+#endif
+
+/* Set algebra between bit vectors: each bit of bv, over its whole count, is combined with the bit at the same index in other.
+   Bits past the end of other count as 0. AndNot clears the bits of bv that are set in other. */
+CF_EXPORT void CFBitVectorAndBits(CFMutableBitVectorRef bv, CFBitVectorRef other);
+CF_EXPORT void CFBitVectorOrBits(CFMutableBitVectorRef bv, CFBitVectorRef other);
+CF_EXPORT void CFBitVectorXorBits(CFMutableBitVectorRef bv, CFBitVectorRef other);
+CF_EXPORT void CFBitVectorAndNotBits(CFMutableBitVectorRef bv, CFBitVectorRef other);
+
+/* Stores the indexes within range of up to maxCount bits equal to value, in increasing order, and returns how many it stored.
+   To visit every such bit in batches, call again with the range starting just past the last index returned. */
+CF_EXPORT CFIndex CFBitVectorGetIndexesOfBit(CFBitVectorRef bv, CFRange range, CFBit value, CFIndex *indexes, CFIndex maxCount);
+
+/* A compressed bit vector keeps its bits in chunks of 64K, each stored as a sorted array of its set bits, a bitmap or a list of
+   runs, whichever is smallest; chunks with no bits set take no space. It suits sparse or clustered sets over a large index range
+   and works with every CFBitVector function. Counting set bits uses per-chunk totals, and set algebra between two compressed
+   vectors goes chunk by chunk. It has no capacity limit. CFBitVectorCreateCopy() and CFBitVectorCreateMutableCopy() with a
+   capacity of 0 keep a compressed vector compressed. */
+CF_EXPORT CFMutableBitVectorRef CFBitVectorCreateMutableCompressed(CFAllocatorRef allocator);
+CF_EXPORT CFMutableBitVectorRef CFBitVectorCreateMutableCompressedCopy(CFAllocatorRef allocator, CFBitVectorRef bv);
+CF_EXPORT Boolean CFBitVectorIsCompressed(CFBitVectorRef bv);
+
+/* A portable, compressed serialized form of any bit vector, and a compressed bit vector read back from one. The reader
+   returns NULL if the bytes are not a valid serialized bit vector. */
+CF_EXPORT CFDataRef CFBitVectorCreateCompressedData(CFAllocatorRef allocator, CFBitVectorRef bv);
+CF_EXPORT CFBitVectorRef CFBitVectorCreateWithCompressedBytes(CFAllocatorRef allocator, const UInt8 *bytes, CFIndex length);
+
+/* Options for binary heaps. An indexed heap gives each value a handle when it is added, through which the value can later be
+   removed or replaced wherever it is in the heap. A quaternary heap gives each node four children instead of two: it is half
+   as deep and a node's children are usually in one cache line, which makes additions and removals faster in large heaps. */
+enum {
+    kCFBinaryHeapIndexed = (1UL << 0),
+    kCFBinaryHeapQuaternary = (1UL << 1)
+};
+
+/* Identifies a value in an indexed heap until the value is removed; after that the handle may be given to another value.
+   The values of a heap from CFBinaryHeapCreateWithValues() have the handles 0 through numValues - 1, in order, and a copy
+   of an indexed heap has the same handles as the original. */
+typedef CFIndex CFBinaryHeapHandle;
+
+CF_EXPORT CFBinaryHeapRef CFBinaryHeapCreateWithOptions(CFAllocatorRef allocator, CFIndex capacity, CFOptionFlags options, const CFBinaryHeapCallBacks *callBacks, const CFBinaryHeapCompareContext *compareContext);
+
+/* Builds the heap from all the values at once, in time linear in numValues. */
+CF_EXPORT CFBinaryHeapRef CFBinaryHeapCreateWithValues(CFAllocatorRef allocator, const void **values, CFIndex numValues, CFOptionFlags options, const CFBinaryHeapCallBacks *callBacks, const CFBinaryHeapCompareContext *compareContext);
+
+/* Handle operations, for indexed heaps only. Removing or updating a value takes logarithmic time. Update replaces the value
+   (it may be the same value, after its ordering key has changed) and moves it to its new place. */
+CF_EXPORT CFBinaryHeapHandle CFBinaryHeapAddValueReturningHandle(CFBinaryHeapRef heap, const void *value);
+CF_EXPORT Boolean CFBinaryHeapContainsHandle(CFBinaryHeapRef heap, CFBinaryHeapHandle handle);
+CF_EXPORT const void *CFBinaryHeapGetValueWithHandle(CFBinaryHeapRef heap, CFBinaryHeapHandle handle);
+CF_EXPORT CFBinaryHeapHandle CFBinaryHeapGetMinimumHandle(CFBinaryHeapRef heap);
+CF_EXPORT void CFBinaryHeapRemoveValueWithHandle(CFBinaryHeapRef heap, CFBinaryHeapHandle handle);
+CF_EXPORT void CFBinaryHeapUpdateValueWithHandle(CFBinaryHeapRef heap, CFBinaryHeapHandle handle, const void *value);
+
+/* Stores in offsets[i] what CFTimeZoneGetSecondsFromGMT(tz, times[i]) would return, for count times. Runs of times in
+   the same period (as when converting a sorted log) cost a pair of comparisons each. */
+CF_EXPORT void CFTimeZoneGetSecondsFromGMTForTimes(CFTimeZoneRef tz, const CFAbsoluteTime *times, CFTimeInterval *offsets, CFIndex count);
+
+/* Decomposes count absolute times in tz (GMT if NULL) into the fields CFAbsoluteTimeGetGregorianDate() would return, one
+   array per field. Pass NULL for any field that is not wanted. */
+CF_EXPORT void CFAbsoluteTimeGetGregorianDates(const CFAbsoluteTime *times, CFIndex count, CFTimeZoneRef tz, SInt32 *years, SInt8 *months, SInt8 *days, SInt8 *hours, SInt8 *minutes, double *seconds);
+
+/* Fills in bytes with a new random (version 4) UUID without creating a CFUUID. The bytes come from a per-thread ChaCha20
+   generator seeded from the system's random source, so no lock is taken. */
+CF_EXPORT void CFUUIDGetBytesDirect(CFUUIDBytes *bytes);
+
+/* Creates a random UUID like CFUUIDCreate(), but does not enter it in the table that lets equal UUIDs share an instance, so
+   neither creating nor freeing it takes a lock. CFEqual() and CFHash() compare UUIDs by their bytes. */
+CF_EXPORT CFUUIDRef CFUUIDCreateUnuniqued(CFAllocatorRef alloc);
+
+/* Writes the string CFUUIDCreateString() would return for bytes into buffer as a NUL-terminated C string, which takes 37
+   bytes. Returns false, writing nothing, if bufferSize is too small. */
+CF_EXPORT Boolean CFUUIDGetCStringForBytes(const CFUUIDBytes *bytes, char *buffer, CFIndex bufferSize);
+
 /* _CFExecutableLinkedOnOrAfter(releaseVersionName) will return YES if the current executable seems to be linked on or after the specified release. Example: If you specify CFSystemVersionPuma (10.1), you will get back true for executables linked on Puma or Jaguar(10.2), but false for those linked on Cheetah (10.0) or any of its software updates (10.0.x). You will also get back false for any app whose version info could not be figured out.
     This function caches its results, so no need to cache at call sites.
 
@@ -421,6 +595,58 @@ CF_INLINE bool CFCharacterSetInlineBufferIsLongCharacterMember(CFCharacterSetInl
 #define CFCharacterSetInlineBufferIsLongCharacterMember(buffer, character) (CFCharacterSetIsLongCharacterMember(buffer->cset, character))
 #endif /* CF_INLINE */
 
+/*!
+@typedef CFCharacterSetCompiledBuffer
+ A character set prepared for bulk scans of UTF-16 text.
+ @field buffer The inline buffer used for characters above U+00FF.
+ @field planes Bit 0 is set if the set may contain BMP characters above
+ U+00FF; bits 1 through 16 are set for the supplementary planes that may
+ contain members.
+ @field latin1 The membership bitmap of U+0000 through U+00FF.
+ @field numRanges The number of runs in ranges, or 0xFF if the Latin-1
+ members do not fit in ranges.
+ @field ranges The first and last character of each run of Latin-1 members.
+ */
+typedef struct {
+    CFCharacterSetInlineBuffer buffer;
+    uint32_t planes;
+    uint8_t latin1[32];
+    uint8_t numRanges;
+    uint8_t ranges[8][2];
+} CFCharacterSetCompiledBuffer;
+
+/*!
+@function CFCharacterSetInitCompiledBuffer
+ Initializes compiled with cset. The buffer reflects the contents of cset at
+ the time of the call and does not retain it.
+ @param cset The character set used to initialize the buffer.
+ If this parameter is not a valid CFCharacterSet, the behavior is undefined.
+ @param compiled The reference to the compiled buffer to be initialized.
+ */
+CF_EXPORT
+void CFCharacterSetInitCompiledBuffer(CFCharacterSetRef cset, CFCharacterSetCompiledBuffer *compiled);
+
+/*!
+@function CFCharacterSetCompiledBufferFindFirstMember
+ Finds the first character of chars that is in the character set.
+ A surrogate pair is tested as a single UTF-32 character and reported at
+ the index of its high surrogate; unpaired surrogates are never reported.
+ @param compiled The reference to the compiled buffer to be searched.
+ @param chars The UTF-16 characters to scan.
+ @param length The number of characters in chars.
+ @result The index of the first member, or kCFNotFound.
+ */
+CF_EXPORT
+CFIndex CFCharacterSetCompiledBufferFindFirstMember(const CFCharacterSetCompiledBuffer *compiled, const UniChar *chars, CFIndex length);
+
+/*!
+@function CFCharacterSetFindFirstMember
+ Compiles theSet and calls CFCharacterSetCompiledBufferFindFirstMember().
+ Callers scanning many buffers against the same set should compile it once.
+ */
+CF_EXPORT
+CFIndex CFCharacterSetFindFirstMember(CFCharacterSetRef theSet, const UniChar *chars, CFIndex length);
+
 
 #if defined(__MACH__)
 #include <CoreFoundation/CFMessagePort.h>
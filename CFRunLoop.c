@@ -41,6 +41,9 @@
 #include <CoreFoundation/CFRunLoop.h>
 #include <CoreFoundation/CFSet.h>
 #include <CoreFoundation/CFBag.h>
+#include <CoreFoundation/CFNumber.h>
+#include <CoreFoundation/CFPropertyList.h>
+#include "CFPriv.h"
 #include "CFInternal.h"
 #include <math.h>
 #include <stdio.h>
@@ -66,6 +69,7 @@
 #include <dlfcn.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
 #endif
 
 static int _LogCFRunLoop = 0;
@@ -340,6 +344,8 @@ static CFTypeID __kCFRunLoopTimerTypeID = _kCFRuntimeNotATypeID;
 
 typedef struct __CFRunLoopMode *CFRunLoopModeRef;
 
+#define __kCFRunLoopActivityCount 8	/* kCFRunLoopEntry through kCFRunLoopExit */
+
 struct __CFRunLoopMode {
     CFRuntimeBase _base;
     CFSpinLock_t _lock;	/* must have the run loop locked before locking this */
@@ -348,6 +354,7 @@ struct __CFRunLoopMode {
     char _padding[3];
     CFMutableSetRef _sources;
     CFMutableSetRef _observers;
+    CFArrayRef _observerLists[__kCFRunLoopActivityCount];	/* per activity bit, sorted by order; replaced, never mutated, once published */
     CFMutableSetRef _timers;
     CFMutableArrayRef _submodes; // names of the submodes
     __CFPortSet _portSet;
@@ -395,8 +402,12 @@ static CFStringRef __CFRunLoopModeCopyDescription(CFTypeRef cf) {
 
 static void __CFRunLoopModeDeallocate(CFTypeRef cf) {
     CFRunLoopModeRef rlm = (CFRunLoopModeRef)cf;
+    CFIndex idx;
     if (NULL != rlm->_sources) CFRelease(rlm->_sources);
     if (NULL != rlm->_observers) CFRelease(rlm->_observers);
+    for (idx = 0; idx < __kCFRunLoopActivityCount; idx++) {
+	if (NULL != rlm->_observerLists[idx]) CFRelease(rlm->_observerLists[idx]);
+    }
     if (NULL != rlm->_timers) CFRelease(rlm->_timers);
     if (NULL != rlm->_submodes) CFRelease(rlm->_submodes);
     CFRelease(rlm->_name);
@@ -416,6 +427,9 @@ struct __CFRunLoop {
     CFRunLoopModeRef _currentMode;
     CFMutableSetRef _modes;
     void *_counterpart;
+    void * volatile _readySources;	/* signalled version 0 sources not yet seen by the run loop; pushed lock-free */
+    CFMutableArrayRef _pendingSources;	/* signalled version 0 sources sorted by order; rl must be locked */
+    struct __CFRunLoopInstrumentation * volatile _instr;	/* set once, kept until deallocation */
 };
 
 /* Bit 0 of the base reserved bits is used for stopped state */
@@ -462,6 +476,96 @@ CF_INLINE void __CFRunLoopUnlock(CFRunLoopRef rl) {
     __CFSpinUnlock(&(((CFRunLoopRef)rl)->_lock));
 }
 
+/* Instrumentation. Only the run loop's own thread records; other threads read the statistics
+   as they are, and copy trace events with a per-event sequence number instead of a lock. */
+
+enum {
+    __kCFRunLoopEventSource0 = 0,
+    __kCFRunLoopEventSource1,
+    __kCFRunLoopEventTimer,
+    __kCFRunLoopEventObserver,
+    __kCFRunLoopEventSleep,
+    __kCFRunLoopEventTimerLateness,	/* statistics only */
+    __kCFRunLoopEventKindCount
+};
+
+#define __kCFRunLoopHistogramBuckets	24	/* the last starts at 2^22 microseconds, about 4 seconds */
+#define __kCFRunLoopDefaultTraceCapacity	1024
+#define __kCFRunLoopMaxTraceCapacity	(1L << 20)
+
+typedef struct {
+    uint64_t _count;
+    uint64_t _totalTSR;
+    uint64_t _maxTSR;
+    uint64_t _histogram[__kCFRunLoopHistogramBuckets];
+} __CFRunLoopStatistic;
+
+typedef struct {
+    volatile uint64_t _seq;	/* 1 + the event's index once written, 0 while it is being written */
+    uint64_t _startTSR;
+    uint64_t _durationTSR;
+    const void *_object;
+    const void *_callout;
+    int64_t _extra;		/* lateness in TSR units for a timer, the activity for an observer */
+    uint32_t _kind;
+} __CFRunLoopTraceEvent;
+
+typedef struct {
+    CFIndex _mask;
+    volatile uint64_t _next;	/* index of the next event to write */
+    __CFRunLoopTraceEvent _events[1];
+} __CFRunLoopTrace;
+
+struct __CFRunLoopInstrumentation {
+    volatile CFOptionFlags _options;
+    uint64_t _tsrPerMicrosecond;
+    __CFRunLoopTrace * volatile _trace;	/* set once */
+    __CFRunLoopStatistic _stats[__kCFRunLoopEventKindCount];
+};
+
+/* Returns the start of a callout to pass to __CFRunLoopInstrumentEnd(), or 0 if nothing is being recorded */
+CF_INLINE int64_t __CFRunLoopInstrumentBegin(CFRunLoopRef rl) {
+    struct __CFRunLoopInstrumentation *instr = rl->_instr;
+    return (NULL != instr && 0 != instr->_options) ? (int64_t)__CFReadTSR() : 0;
+}
+
+static void __CFRunLoopStatisticAdd(__CFRunLoopStatistic *stat, uint64_t tsr, uint64_t tsrPerMicrosecond) {
+    uint64_t usec = tsr / tsrPerMicrosecond;
+    CFIndex bucket = (0 == usec) ? 0 : 64 - __CFCountLeadingZeros64(usec);
+    stat->_count++;
+    stat->_totalTSR += tsr;
+    if (stat->_maxTSR < tsr) stat->_maxTSR = tsr;
+    stat->_histogram[__CFMin(bucket, __kCFRunLoopHistogramBuckets - 1)]++;
+}
+
+static void __CFRunLoopInstrumentEnd(CFRunLoopRef rl, uint32_t kind, const void *object, const void *callout, int64_t startTSR, int64_t extra) {
+    struct __CFRunLoopInstrumentation *instr = rl->_instr;
+    CFOptionFlags options = instr->_options;
+    __CFRunLoopTrace *trace = instr->_trace;
+    uint64_t durationTSR = (uint64_t)((int64_t)__CFReadTSR() - startTSR);
+    if (options & kCFRunLoopInstrumentStatistics) {
+	__CFRunLoopStatisticAdd(&instr->_stats[kind], durationTSR, instr->_tsrPerMicrosecond);
+	if (__kCFRunLoopEventTimer == kind) {
+	    __CFRunLoopStatisticAdd(&instr->_stats[__kCFRunLoopEventTimerLateness], (0 < extra) ? (uint64_t)extra : 0, instr->_tsrPerMicrosecond);
+	}
+    }
+    if ((options & kCFRunLoopInstrumentTrace) && NULL != trace) {
+	uint64_t seq = trace->_next;
+	__CFRunLoopTraceEvent *event = &trace->_events[seq & trace->_mask];
+	event->_seq = 0;
+	_CFMemoryBarrier();
+	event->_startTSR = (uint64_t)startTSR;
+	event->_durationTSR = durationTSR;
+	event->_object = object;
+	event->_callout = callout;
+	event->_extra = extra;
+	event->_kind = kind;
+	_CFMemoryBarrier();
+	event->_seq = seq + 1;
+	trace->_next = seq + 1;
+    }
+}
+
 static CFStringRef __CFRunLoopCopyDescription(CFTypeRef cf) {
     CFRunLoopRef rl = (CFRunLoopRef)cf;
     CFMutableStringRef result;
@@ -497,6 +601,7 @@ static CFRunLoopModeRef __CFRunLoopFindMode(CFRunLoopRef rl, CFStringRef modeNam
     rlm->_stopped = false;
     rlm->_sources = NULL;
     rlm->_observers = NULL;
+    memset(rlm->_observerLists, 0, sizeof(rlm->_observerLists));
     rlm->_timers = NULL;
     rlm->_submodes = NULL;
     rlm->_portSet = __CFPortSetAllocate();
@@ -582,13 +687,14 @@ struct __CFRunLoopSource {
     CFSpinLock_t _lock;
     CFIndex _order;			/* immutable */
     CFMutableBagRef _runLoops;
+    CFRunLoopPoolRef _pool;		/* pool dispatching this version 0 source, if any */
     union {
 	CFRunLoopSourceContext version0;	/* immutable, except invalidation */
         CFRunLoopSourceContext1 version1;	/* immutable, except invalidation */
     } _context;
 };
 
-/* Bit 1 of the base reserved bits is used for signalled state */
+/* Bit 1 of the base reserved bits is used for signalled state, bit 2 while a pool worker performs the source */
 
 CF_INLINE Boolean __CFRunLoopSourceIsSignaled(CFRunLoopSourceRef rls) {
     return (Boolean)__CFBitfieldGetValue(rls->_bits, 1, 1);
@@ -602,6 +708,18 @@ CF_INLINE void __CFRunLoopSourceUnsetSignaled(CFRunLoopSourceRef rls) {
     __CFBitfieldSetValue(rls->_bits, 1, 1, 0);
 }
 
+CF_INLINE Boolean __CFRunLoopSourceIsPerforming(CFRunLoopSourceRef rls) {
+    return (Boolean)__CFBitfieldGetValue(rls->_bits, 2, 2);
+}
+
+CF_INLINE void __CFRunLoopSourceSetPerforming(CFRunLoopSourceRef rls) {
+    __CFBitfieldSetValue(rls->_bits, 2, 2, 1);
+}
+
+CF_INLINE void __CFRunLoopSourceUnsetPerforming(CFRunLoopSourceRef rls) {
+    __CFBitfieldSetValue(rls->_bits, 2, 2, 0);
+}
+
 CF_INLINE void __CFRunLoopSourceLock(CFRunLoopSourceRef rls) {
     __CFSpinLock(&(rls->_lock));
 }
@@ -610,6 +728,42 @@ CF_INLINE void __CFRunLoopSourceUnlock(CFRunLoopSourceRef rls) {
     __CFSpinUnlock(&(rls->_lock));
 }
 
+/* Signalling a version 0 source pushes it onto the ready stack of each run
+   loop it is scheduled on, so that a run loop pass only looks at signalled
+   sources. Producers are any thread; the run loop takes the whole stack at
+   once, so there is no ABA problem. */
+typedef struct __CFRunLoopReadySource {
+    struct __CFRunLoopReadySource *_next;
+    CFRunLoopSourceRef _source;
+} __CFRunLoopReadySource;
+
+/* rls is locked */
+static void __CFRunLoopPushReadySource(const void *value, void *context) {
+    CFRunLoopRef rl = (CFRunLoopRef)value;
+    __CFRunLoopReadySource *node = (__CFRunLoopReadySource *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFRunLoopReadySource), 0);
+    node->_source = (CFRunLoopSourceRef)CFRetain((CFRunLoopSourceRef)context);
+    do {
+	node->_next = (__CFRunLoopReadySource *)rl->_readySources;
+    } while (!_CFAtomicCompareAndSwapPtrBarrier(node->_next, node, &rl->_readySources));
+}
+
+static __CFRunLoopReadySource *__CFRunLoopTakeReadySources(CFRunLoopRef rl) {
+    __CFRunLoopReadySource *head, *fifo = NULL;
+    do {
+	head = (__CFRunLoopReadySource *)rl->_readySources;
+    } while (NULL != head && !_CFAtomicCompareAndSwapPtrBarrier(head, NULL, &rl->_readySources));
+    while (NULL != head) {	/* oldest first */
+	__CFRunLoopReadySource *next = head->_next;
+	head->_next = fifo;
+	fifo = head;
+	head = next;
+    }
+    return fifo;
+}
+
+static void __CFRunLoopPoolEnqueue(CFRunLoopPoolRef pool, CFRunLoopSourceRef rls, Boolean deferred);
+static void __CFRunLoopPoolForgetSource(CFRunLoopPoolRef pool, CFRunLoopSourceRef rls);
+
 /* rlm is not locked */
 static void __CFRunLoopSourceSchedule(CFRunLoopSourceRef rls, CFRunLoopRef rl, CFRunLoopModeRef rlm) {	/* DOES CALLOUT */
     __CFRunLoopSourceLock(rls);
@@ -617,6 +771,9 @@ static void __CFRunLoopSourceSchedule(CFRunLoopSourceRef rls, CFRunLoopRef rl, C
 	rls->_runLoops = CFBagCreateMutable(CFGetAllocator(rls), 0, NULL);
     }
     CFBagAddValue(rls->_runLoops, rl);
+    if (0 == rls->_context.version0.version && NULL == rls->_pool && __CFIsValid(rls) && __CFRunLoopSourceIsSignaled(rls)) {
+	__CFRunLoopPushReadySource(rl, (void *)rls);
+    }
     __CFRunLoopSourceUnlock(rls);	// have to unlock before the callout -- cannot help clients with safety
     if (0 == rls->_context.version0.version) {
 	if (NULL != rls->_context.version0.schedule) {
@@ -713,6 +870,32 @@ static void __CFRunLoopObserverCancel(CFRunLoopObserverRef rlo, CFRunLoopRef rl,
     __CFRunLoopObserverUnlock(rlo);
 }
 
+/* rlm is locked; firing retains the published list and walks it without the lock */
+static void __CFRunLoopModeUpdateObserverLists(CFRunLoopModeRef rlm, CFRunLoopObserverRef rlo, Boolean add) {
+    CFIndex bit, idx, cnt;
+    for (bit = 0; bit < __kCFRunLoopActivityCount; bit++) {
+	CFArrayRef oldList = rlm->_observerLists[bit];
+	CFMutableArrayRef list;
+	if (0 == (rlo->_activities & (1 << bit))) continue;
+	list = (NULL != oldList) ? CFArrayCreateMutableCopy(kCFAllocatorSystemDefault, 0, oldList) : CFArrayCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeArrayCallBacks);
+	cnt = CFArrayGetCount(list);
+	if (add) {
+	    /* after any observer of equal order, so equal orders fire in the order they were added */
+	    for (idx = cnt; 0 < idx && rlo->_order < ((CFRunLoopObserverRef)CFArrayGetValueAtIndex(list, idx - 1))->_order; idx--);
+	    CFArrayInsertValueAtIndex(list, idx, rlo);
+	} else {
+	    for (idx = 0; idx < cnt && CFArrayGetValueAtIndex(list, idx) != rlo; idx++);
+	    if (idx < cnt) CFArrayRemoveValueAtIndex(list, idx);
+	}
+	if (0 == CFArrayGetCount(list)) {
+	    CFRelease(list);
+	    list = NULL;
+	}
+	rlm->_observerLists[bit] = list;
+	if (NULL != oldList) CFRelease(oldList);
+    }
+}
+
 struct __CFRunLoopTimer {
     CFRuntimeBase _base;
     CFSpinLock_t _lock;
@@ -786,11 +969,18 @@ CF_INLINE void __CFRunLoopTimerPortMapUnlock(void) {
 }
 #endif
 
+#if !DEPLOYMENT_TARGET_MACOSX
+/* Without a timer port, a run loop asleep on another thread has to be woken to see a new fire date */
+CF_INLINE void __CFRunLoopWakeUpForTimer(CFRunLoopRef rl) {
+    if (rl != (CFRunLoopRef)__CFGetThreadSpecificData_inline()->_runLoop) CFRunLoopWakeUp(rl);
+}
+#endif
+
 static void __CFRunLoopTimerSchedule(CFRunLoopTimerRef rlt, CFRunLoopRef rl, CFRunLoopModeRef rlm) {
-#if DEPLOYMENT_TARGET_MACOSX
     __CFRunLoopTimerLock(rlt);
     if (0 == rlt->_rlCount) {
 	rlt->_runLoop = rl;
+#if DEPLOYMENT_TARGET_MACOSX
 	if (MACH_PORT_NULL == rlt->_port) {
 	    rlt->_port = mk_timer_create();
 	}
@@ -800,36 +990,44 @@ static void __CFRunLoopTimerSchedule(CFRunLoopTimerRef rlt, CFRunLoopRef rl, CFR
 	}
 	CFDictionarySetValue(__CFRLTPortMap, (void *)(uintptr_t)rlt->_port, rlt);
 	__CFRunLoopTimerPortMapUnlock();
+#endif
     }
     rlt->_rlCount++;
+#if DEPLOYMENT_TARGET_MACOSX
     mach_port_insert_member(mach_task_self(), rlt->_port, rlm->_portSet);
     mk_timer_arm(rlt->_port, __CFUInt64ToAbsoluteTime(rlt->_fireTSR));
-    __CFRunLoopTimerUnlock(rlt);
+#else
+    __CFRunLoopWakeUpForTimer(rl);
 #endif
+    __CFRunLoopTimerUnlock(rlt);
 }
 
 static void __CFRunLoopTimerCancel(CFRunLoopTimerRef rlt, CFRunLoopRef rl, CFRunLoopModeRef rlm) {
-#if DEPLOYMENT_TARGET_MACOSX
     __CFRunLoopTimerLock(rlt);
+#if DEPLOYMENT_TARGET_MACOSX
     __CFPortSetRemove(rlt->_port, rlm->_portSet);
+#endif
     rlt->_rlCount--;
     if (0 == rlt->_rlCount) {
+#if DEPLOYMENT_TARGET_MACOSX
 	__CFRunLoopTimerPortMapLock();
 	if (NULL != __CFRLTPortMap) {
 	    CFDictionaryRemoveValue(__CFRLTPortMap, (void *)(uintptr_t)rlt->_port);
 	}
 	__CFRunLoopTimerPortMapUnlock();
-	rlt->_runLoop = NULL;
 	mk_timer_cancel(rlt->_port, NULL);
+#endif
+	rlt->_runLoop = NULL;
     }
     __CFRunLoopTimerUnlock(rlt);
-#endif
 }
 
 // Caller must hold the Timer lock for safety
 static void __CFRunLoopTimerRescheduleWithAllModes(CFRunLoopTimerRef rlt, CFRunLoopRef rl) {
 #if DEPLOYMENT_TARGET_MACOSX
     mk_timer_arm(rlt->_port, __CFUInt64ToAbsoluteTime(rlt->_fireTSR));
+#else
+    __CFRunLoopWakeUpForTimer(rl);
 #endif
 }
 
@@ -976,6 +1174,10 @@ static void __CFRunLoopDeallocateObservers(const void *value, void *context) {
 	CFRetain(list[idx]);
     }
     CFSetRemoveAllValues(rlm->_observers);
+    for (idx = 0; idx < __kCFRunLoopActivityCount; idx++) {
+	if (NULL != rlm->_observerLists[idx]) CFRelease(rlm->_observerLists[idx]);
+	rlm->_observerLists[idx] = NULL;
+    }
     for (idx = 0; idx < cnt; idx++) {
 	__CFRunLoopObserverCancel((CFRunLoopObserverRef)list[idx], rl, rlm);
 	CFRelease(list[idx]);
@@ -1005,6 +1207,7 @@ static void __CFRunLoopDeallocateTimers(const void *value, void *context) {
 
 static void __CFRunLoopDeallocate(CFTypeRef cf) {
     CFRunLoopRef rl = (CFRunLoopRef)cf;
+    __CFRunLoopReadySource *node, *next;
     /* We try to keep the run loop in a valid state as long as possible,
        since sources may have non-retained references to the run loop.
        Another reason is that we don't want to lock the run loop for
@@ -1031,6 +1234,19 @@ static void __CFRunLoopDeallocate(CFTypeRef cf) {
     }
     __CFPortFree(rl->_wakeUpPort);
     rl->_wakeUpPort = CFPORT_NULL;
+    /* no source can push any more; all were cancelled above */
+    for (node = __CFRunLoopTakeReadySources(rl); NULL != node; node = next) {
+	next = node->_next;
+	CFRelease(node->_source);
+	CFAllocatorDeallocate(kCFAllocatorSystemDefault, node);
+    }
+    if (NULL != rl->_pendingSources) {
+	CFRelease(rl->_pendingSources);
+    }
+    if (NULL != rl->_instr) {
+	if (NULL != rl->_instr->_trace) CFAllocatorDeallocate(kCFAllocatorSystemDefault, rl->_instr->_trace);
+	CFAllocatorDeallocate(kCFAllocatorSystemDefault, rl->_instr);
+    }
     __CFRunLoopUnlock(rl);
 }
 
@@ -1128,6 +1344,9 @@ static CFRunLoopRef __CFRunLoopCreate(void) {
     loop->_modes = CFSetCreateMutable(CFGetAllocator(loop), 0, &kCFTypeSetCallBacks);
     _CFSetSetCapacity(loop->_modes, 10);
     loop->_counterpart = NULL;
+    loop->_readySources = NULL;
+    loop->_pendingSources = NULL;
+    loop->_instr = NULL;
     rlm = __CFRunLoopFindMode(loop, kCFRunLoopDefaultMode, true);
     if (NULL != rlm) __CFRunLoopModeUnlock(rlm);
     return loop;
@@ -1209,7 +1428,9 @@ CFRunLoopRef CFRunLoopGetMain(void) {
 
 CFRunLoopRef CFRunLoopGetCurrent(void) {
     CHECK_FOR_FORK();
-    return _CFRunLoop0(_CFThreadSelf());
+    __CFThreadSpecificData *tsd = __CFGetThreadSpecificData_inline();
+    if (!tsd->_runLoop) tsd->_runLoop = (void *)_CFRunLoop0(_CFThreadSelf());
+    return (CFRunLoopRef)tsd->_runLoop;
 }
 
 void _CFRunLoopSetCurrent(CFRunLoopRef rl) {
@@ -1231,6 +1452,7 @@ void _CFRunLoopSetCurrent(CFRunLoopRef rl) {
 	}
     }
     __CFSpinUnlock(&loopsLock);
+    __CFGetThreadSpecificData_inline()->_runLoop = NULL;	// Looked up again on next use
 }
 
 CFStringRef CFRunLoopCopyCurrentMode(CFRunLoopRef rl) {
@@ -1333,74 +1555,42 @@ void CFRunLoopAddCommonMode(CFRunLoopRef rl, CFStringRef modeName) {
     }
 }
 
-static CFComparisonResult __CFRunLoopObserverQSortComparator(const void *val1, const void *val2, void *context) {
-    CFRunLoopObserverRef o1 = *((CFRunLoopObserverRef *)val1);
-    CFRunLoopObserverRef o2 = *((CFRunLoopObserverRef *)val2);
-    if (!o1) {
-	return (!o2) ? kCFCompareEqualTo : kCFCompareLessThan;
-    }
-    if (!o2) {
-	return kCFCompareGreaterThan;
-    }
-    if (o1->_order < o2->_order) return kCFCompareLessThan;
-    if (o2->_order < o1->_order) return kCFCompareGreaterThan;
-    return kCFCompareEqualTo;
-}
-
-
 /* rl is unlocked, rlm is locked on entrance and exit */
 /* ALERT: this should collect all the candidate observers from the top level
  * and all submodes, recursively, THEN start calling them, in order to obey
  * the ordering parameter. */
 static void __CFRunLoopDoObservers(CFRunLoopRef rl, CFRunLoopModeRef rlm, CFRunLoopActivity activity) {	/* DOES CALLOUT */
     CHECK_FOR_FORK();
-    CFIndex idx, cnt;
-    CFArrayRef submodes;
+    CFIndex idx, cnt, bit;
+    CFArrayRef submodes, observers;
 
     /* Fire the observers */
     submodes = (NULL != rlm->_submodes && 0 < CFArrayGetCount(rlm->_submodes)) ? CFArrayCreateCopy(kCFAllocatorSystemDefault, rlm->_submodes) : NULL;
-    if (NULL != rlm->_observers) {
-	cnt = CFSetGetCount(rlm->_observers);
-	if (0 < cnt) {
-#if __GNUC__
-	    CFRunLoopObserverRef buffer[(cnt <= 1024) ? cnt : 1];
-#else
-	    CFRunLoopObserverRef buffer[1024];
-#endif
-	    CFRunLoopObserverRef *collectedObservers = (cnt <= 1024) ? buffer : (CFRunLoopObserverRef*)CFAllocatorAllocate(kCFAllocatorSystemDefault, cnt * sizeof(CFRunLoopObserverRef), 0);
-	    CFSetGetValues(rlm->_observers, (const void **)collectedObservers);
-	    for (idx = 0; idx < cnt; idx++) {
-		CFRunLoopObserverRef rlo = collectedObservers[idx];
-		if (0 != (rlo->_activities & activity) && __CFIsValid(rlo) && !__CFRunLoopObserverIsFiring(rlo)) {
-		    CFRetain(rlo);
-		} else {
-		    /* We're not interested in this one - set it to NULL so we don't process it later */
-		    collectedObservers[idx] = NULL;
+    bit = __CFCountTrailingZeros64(activity);
+    observers = (bit < __kCFRunLoopActivityCount) ? rlm->_observerLists[bit] : NULL;
+    if (NULL != observers) {
+	CFRetain(observers);	/* the list is immutable and keeps its observers alive */
+	__CFRunLoopModeUnlock(rlm);
+	for (idx = 0, cnt = CFArrayGetCount(observers); idx < cnt; idx++) {
+	    CFRunLoopObserverRef rlo = (CFRunLoopObserverRef)CFArrayGetValueAtIndex(observers, idx);
+	    if (__CFRunLoopObserverIsFiring(rlo)) continue;
+	    __CFRunLoopObserverLock(rlo);
+	    if (__CFIsValid(rlo)) {
+		__CFRunLoopObserverUnlock(rlo);
+		int64_t startTSR = __CFRunLoopInstrumentBegin(rl);
+		__CFRunLoopObserverSetFiring(rlo);
+		rlo->_callout(rlo, activity, rlo->_context.info);	/* CALLOUT */
+		__CFRunLoopObserverUnsetFiring(rlo);
+		if (0 != startTSR) __CFRunLoopInstrumentEnd(rl, __kCFRunLoopEventObserver, rlo, (const void *)rlo->_callout, startTSR, activity);
+		if (!__CFRunLoopObserverRepeats(rlo)) {
+		    CFRunLoopObserverInvalidate(rlo);
 		}
+	    } else {
+		__CFRunLoopObserverUnlock(rlo);
 	    }
-	    __CFRunLoopModeUnlock(rlm);
-	    CFQSortArray(collectedObservers, cnt, sizeof(CFRunLoopObserverRef), __CFRunLoopObserverQSortComparator, NULL);
-	    for (idx = 0; idx < cnt; idx++) {
-		CFRunLoopObserverRef rlo = collectedObservers[idx];
-		if (rlo) {
-		    __CFRunLoopObserverLock(rlo);
-		    if (__CFIsValid(rlo)) {
-			__CFRunLoopObserverUnlock(rlo);
-			__CFRunLoopObserverSetFiring(rlo);
-			rlo->_callout(rlo, activity, rlo->_context.info);	/* CALLOUT */
-			__CFRunLoopObserverUnsetFiring(rlo);
-			if (!__CFRunLoopObserverRepeats(rlo)) {
-			    CFRunLoopObserverInvalidate(rlo);
-			}
-		    } else {
-			__CFRunLoopObserverUnlock(rlo);
- 		    }
-		    CFRelease(rlo);
- 		}
-	    }
-	    __CFRunLoopModeLock(rlm);
-	    if (collectedObservers != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, collectedObservers);
 	}
+	CFRelease(observers);
+	__CFRunLoopModeLock(rlm);
     }
     if (NULL != submodes) {
 	__CFRunLoopModeUnlock(rlm);
@@ -1420,14 +1610,6 @@ static void __CFRunLoopDoObservers(CFRunLoopRef rl, CFRunLoopModeRef rlm, CFRunL
     }
 }
 
-static CFComparisonResult __CFRunLoopSourceComparator(const void *val1, const void *val2, void *context) {
-    CFRunLoopSourceRef o1 = (CFRunLoopSourceRef)val1;
-    CFRunLoopSourceRef o2 = (CFRunLoopSourceRef)val2;
-    if (o1->_order < o2->_order) return kCFCompareLessThan;
-    if (o2->_order < o1->_order) return kCFCompareGreaterThan;
-    return kCFCompareEqualTo;
-}
-
 static void __CFRunLoopCollectSources0(const void *value, void *context) {
     CFRunLoopSourceRef rls = (CFRunLoopSourceRef)value;
     CFTypeRef *sources = (CFTypeRef *)context;
@@ -1446,6 +1628,69 @@ static void __CFRunLoopCollectSources0(const void *value, void *context) {
     }
 }
 
+/* rl and rlm locked */
+static Boolean __CFRunLoopModeContainsSource(CFRunLoopRef rl, CFRunLoopModeRef rlm, CFRunLoopSourceRef rls) {
+    CFIndex idx, cnt;
+    if (NULL != rlm->_sources && CFSetContainsValue(rlm->_sources, rls)) return true;
+    for (idx = 0, cnt = (NULL != rlm->_submodes) ? CFArrayGetCount(rlm->_submodes) : 0; idx < cnt; idx++) {
+	CFStringRef modeName = (CFStringRef)CFArrayGetValueAtIndex(rlm->_submodes, idx);
+	CFRunLoopModeRef subrlm = __CFRunLoopFindMode(rl, modeName, false);
+	Boolean contains = false;
+	if (NULL != subrlm) {
+	    contains = (NULL != subrlm->_sources && CFSetContainsValue(subrlm->_sources, rls));
+	    __CFRunLoopModeUnlock(subrlm);
+	}
+	if (contains) return true;
+    }
+    return false;
+}
+
+/* rl and rlm locked; moves the signalled sources of rlm from the pending list into sources, in order */
+static void __CFRunLoopCollectPendingSources0(CFRunLoopRef rl, CFRunLoopModeRef rlm, Boolean stopAfterHandle, CFTypeRef *sources) {
+    __CFRunLoopReadySource *node, *next;
+    CFIndex idx, cnt;
+
+    node = __CFRunLoopTakeReadySources(rl);
+    if (NULL != node && NULL == rl->_pendingSources) {
+	rl->_pendingSources = CFArrayCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeArrayCallBacks);
+    }
+    for (; NULL != node; node = next) {
+	CFRunLoopSourceRef rls = node->_source;
+	next = node->_next;
+	cnt = CFArrayGetCount(rl->_pendingSources);
+	for (idx = 0; idx < cnt && CFArrayGetValueAtIndex(rl->_pendingSources, idx) != rls; idx++);	/* by identity; equal sources are distinct here */
+	if (idx == cnt) {
+	    CFIndex lo = 0, hi = cnt;
+	    while (lo < hi) {	/* after any source of equal order, so equal orders fire in signal order */
+		CFIndex mid = lo + (hi - lo) / 2;
+		if (((CFRunLoopSourceRef)CFArrayGetValueAtIndex(rl->_pendingSources, mid))->_order <= rls->_order) lo = mid + 1; else hi = mid;
+	    }
+	    CFArrayInsertValueAtIndex(rl->_pendingSources, lo, rls);
+	}
+	CFRelease(rls);
+	CFAllocatorDeallocate(kCFAllocatorSystemDefault, node);
+    }
+
+    for (idx = 0, cnt = (NULL != rl->_pendingSources) ? CFArrayGetCount(rl->_pendingSources) : 0; idx < cnt;) {
+	CFRunLoopSourceRef rls = (CFRunLoopSourceRef)CFArrayGetValueAtIndex(rl->_pendingSources, idx);
+	Boolean stale;
+	__CFRunLoopSourceLock(rls);
+	stale = !__CFIsValid(rls) || !__CFRunLoopSourceIsSignaled(rls) || NULL == rls->_runLoops || !CFBagContainsValue(rls->_runLoops, rl);
+	__CFRunLoopSourceUnlock(rls);
+	if (stale) {
+	    CFArrayRemoveValueAtIndex(rl->_pendingSources, idx);
+	    cnt--;
+	} else if (__CFRunLoopModeContainsSource(rl, rlm, rls)) {
+	    __CFRunLoopCollectSources0(rls, sources);
+	    CFArrayRemoveValueAtIndex(rl->_pendingSources, idx);
+	    cnt--;
+	    if (stopAfterHandle) break;
+	} else {
+	    idx++;	/* signalled, but not in this mode; it waits for a mode that has it */
+	}
+    }
+}
+
 /* rl is unlocked, rlm is locked on entrance and exit */
 static Boolean __CFRunLoopDoSources0(CFRunLoopRef rl, CFRunLoopModeRef rlm, Boolean stopAfterHandle) {	/* DOES CALLOUT */
     CHECK_FOR_FORK();
@@ -1457,20 +1702,7 @@ static Boolean __CFRunLoopDoSources0(CFRunLoopRef rl, CFRunLoopModeRef rlm, Bool
     __CFRunLoopLock(rl);
     __CFRunLoopModeLock(rlm);
     /* Fire the version 0 sources */
-    if (NULL != rlm->_sources && 0 < CFSetGetCount(rlm->_sources)) {
-	CFSetApplyFunction(rlm->_sources, (__CFRunLoopCollectSources0), &sources);
-    }
-    for (idx = 0, cnt = (NULL != rlm->_submodes) ? CFArrayGetCount(rlm->_submodes) : 0; idx < cnt; idx++) {
-	CFStringRef modeName = (CFStringRef)CFArrayGetValueAtIndex(rlm->_submodes, idx);
-	CFRunLoopModeRef subrlm;
-	subrlm = __CFRunLoopFindMode(rl, modeName, false);
-	if (NULL != subrlm) {
-	    if (NULL != subrlm->_sources && 0 < CFSetGetCount(subrlm->_sources)) {
-		CFSetApplyFunction(subrlm->_sources, (__CFRunLoopCollectSources0), &sources);
-	    }
-	    __CFRunLoopModeUnlock(subrlm);
-	}
-    }
+    __CFRunLoopCollectPendingSources0(rl, rlm, stopAfterHandle, &sources);
     __CFRunLoopUnlock(rl);
     if (NULL != sources) {
 	// sources is either a single (retained) CFRunLoopSourceRef or an array of (retained) CFRunLoopSourceRef
@@ -1482,16 +1714,17 @@ static Boolean __CFRunLoopDoSources0(CFRunLoopRef rl, CFRunLoopModeRef rlm, Bool
 	    if (__CFIsValid(rls)) {
 		__CFRunLoopSourceUnlock(rls);
 		if (NULL != rls->_context.version0.perform) {
+		    int64_t startTSR = __CFRunLoopInstrumentBegin(rl);
 		    rls->_context.version0.perform(rls->_context.version0.info); /* CALLOUT */
 		    CHECK_FOR_FORK();
+		    if (0 != startTSR) __CFRunLoopInstrumentEnd(rl, __kCFRunLoopEventSource0, rls, (const void *)rls->_context.version0.perform, startTSR, 0);
 		}
 		sourceHandled = true;
 	    } else {
 		__CFRunLoopSourceUnlock(rls);
 	    }
 	} else {
-	    cnt = CFArrayGetCount((CFArrayRef)sources);
-	    CFArraySortValues((CFMutableArrayRef)sources, CFRangeMake(0, cnt), (__CFRunLoopSourceComparator), NULL);
+	    cnt = CFArrayGetCount((CFArrayRef)sources);	/* already in order */
 	    for (idx = 0; idx < cnt; idx++) {
 		CFRunLoopSourceRef rls = (CFRunLoopSourceRef)CFArrayGetValueAtIndex((CFArrayRef)sources, idx);
 		__CFRunLoopSourceLock(rls);
@@ -1499,8 +1732,10 @@ static Boolean __CFRunLoopDoSources0(CFRunLoopRef rl, CFRunLoopModeRef rlm, Bool
 		if (__CFIsValid(rls)) {
 		    __CFRunLoopSourceUnlock(rls);
 		    if (NULL != rls->_context.version0.perform) {
+			int64_t startTSR = __CFRunLoopInstrumentBegin(rl);
 			rls->_context.version0.perform(rls->_context.version0.info); /* CALLOUT */
 		        CHECK_FOR_FORK();
+			if (0 != startTSR) __CFRunLoopInstrumentEnd(rl, __kCFRunLoopEventSource0, rls, (const void *)rls->_context.version0.perform, startTSR, 0);
 		    }
 		    sourceHandled = true;
 		} else {
@@ -1534,6 +1769,7 @@ static Boolean __CFRunLoopDoSource1(CFRunLoopRef rl, CFRunLoopModeRef rlm, CFRun
 	__CFRunLoopSourceUnsetSignaled(rls);
 	__CFRunLoopSourceUnlock(rls);
 	if (NULL != rls->_context.version1.perform) {
+	    int64_t startTSR = __CFRunLoopInstrumentBegin(rl);
 #if DEPLOYMENT_TARGET_MACOSX
 	    *reply = (mach_msg_header_t*)rls->_context.version1.perform(msg, size, kCFAllocatorSystemDefault, rls->_context.version1.info); /* CALLOUT */
 	    CHECK_FOR_FORK();
@@ -1542,6 +1778,7 @@ static Boolean __CFRunLoopDoSource1(CFRunLoopRef rl, CFRunLoopModeRef rlm, CFRun
             rls->_context.version1.perform(rls->_context.version1.info); /* CALLOUT */
 	    CHECK_FOR_FORK();
 #endif
+	    if (0 != startTSR) __CFRunLoopInstrumentEnd(rl, __kCFRunLoopEventSource1, rls, (const void *)rls->_context.version1.perform, startTSR, 0);
 	} else {
         if (_LogCFRunLoop) { CFLog(kCFLogLevelDebug, CFSTR("%p (%s) __CFRunLoopDoSource1 perform is NULL"), CFRunLoopGetCurrent(), *_CFGetProgname()); }
     }
@@ -1557,7 +1794,7 @@ static Boolean __CFRunLoopDoSource1(CFRunLoopRef rl, CFRunLoopModeRef rlm, CFRun
 
 static Boolean __CFRunLoopDoTimer(CFRunLoopRef rl, CFRunLoopModeRef rlm, CFRunLoopTimerRef rlt) {	/* DOES CALLOUT */
     Boolean timerHandled = false;
-    int64_t oldFireTSR = 0;
+    int64_t oldFireTSR = 0, startTSR;
 
     /* Fire a timer */
     CFRetain(rlt);
@@ -1570,8 +1807,10 @@ static Boolean __CFRunLoopDoTimer(CFRunLoopRef rl, CFRunLoopModeRef rlm, CFRunLo
 	__CFRunLoopTimerFireTSRLock();
 	oldFireTSR = rlt->_fireTSR;
 	__CFRunLoopTimerFireTSRUnlock();
+	startTSR = __CFRunLoopInstrumentBegin(rl);
 	rlt->_callout(rlt, rlt->_context.info);	/* CALLOUT */
 	CHECK_FOR_FORK();
+	if (0 != startTSR) __CFRunLoopInstrumentEnd(rl, __kCFRunLoopEventTimer, rlt, (const void *)rlt->_callout, startTSR, startTSR - oldFireTSR);
 	__CFRunLoopTimerUnsetFiring(rlt);
 	timerHandled = true;
     } else {
@@ -1861,6 +2100,7 @@ static int32_t __CFRunLoopRun(CFRunLoopRef rl, CFRunLoopModeRef rlm, CFTimeInter
         }
         if (rl == _CFRunLoop0(kNilThreadT)) _LastMainWaitSet = waitSet;
         __CFRunLoopModeUnlock(rlm);
+        int64_t sleepTSR = poll ? 0 : __CFRunLoopInstrumentBegin(rl);
 
 #if DEPLOYMENT_TARGET_MACOSX
         msg = (mach_msg_header_t *)buffer;
@@ -1933,8 +2173,31 @@ try_receive:
         }
         ResetEvent(rl->_wakeUpPort);
 #elif DEPLOYMENT_TARGET_LINUX
-		// XXX - More to fill in here.
+        // A version 1 source's semaphore cannot be waited on together with the wake-up port, so only sleep when there are none
+        if (!poll && 1 == waitSet->used) {
+            int64_t nextStop, timeoutTSR;
+            __CFRunLoopModeLock(rlm);
+            nextStop = __CFRunLoopGetNextTimerFireTSR(rl, rlm);
+            if (nextStop <= 0 || termTSR < nextStop) nextStop = termTSR;
+            timeoutTSR = nextStop - (int64_t)__CFReadTSR();
+            if (LLONG_MAX == nextStop) {
+                sem_wait(rl->_wakeUpPort);
+            } else if (0 < timeoutTSR) {
+                CFTimeInterval timeout = __CFTSRToTimeInterval(timeoutTSR);
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += (time_t)timeout;
+                deadline.tv_nsec += (long)((timeout - floor(timeout)) * 1.0e9);
+                if (1000000000 <= deadline.tv_nsec) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                sem_timedwait(rl->_wakeUpPort, &deadline);
+            }
+            while (0 == sem_trywait(rl->_wakeUpPort));	// wake-ups that piled up need only this one pass
+        }
 #endif
+        if (0 != sleepTSR) __CFRunLoopInstrumentEnd(rl, __kCFRunLoopEventSleep, NULL, NULL, sleepTSR, 0);
         if (destroyWaitSet) {
             __CFPortSetFree(waitSet);
             if (rl == _CFRunLoop0(kNilThreadT)) _LastMainWaitSet = CFPORTSET_NULL;
@@ -2438,6 +2701,7 @@ void CFRunLoopAddObserver(CFRunLoopRef rl, CFRunLoopObserverRef rlo, CFStringRef
 	}
 	if (NULL != rlm && !CFSetContainsValue(rlm->_observers, rlo)) {
 	    CFSetAddValue(rlm->_observers, rlo);
+	    __CFRunLoopModeUpdateObserverLists(rlm, rlo, true);
 	    __CFRunLoopModeUnlock(rlm);
 	    __CFRunLoopObserverSchedule(rlo, rl, rlm);
 	} else if (NULL != rlm) {
@@ -2470,6 +2734,7 @@ void CFRunLoopRemoveObserver(CFRunLoopRef rl, CFRunLoopObserverRef rlo, CFString
 	if (NULL != rlm && NULL != rlm->_observers && CFSetContainsValue(rlm->_observers, rlo)) {
 	    CFRetain(rlo);
 	    CFSetRemoveValue(rlm->_observers, rlo);
+	    __CFRunLoopModeUpdateObserverLists(rlm, rlo, false);
 	    __CFRunLoopModeUnlock(rlm);
 	    __CFRunLoopObserverCancel(rlo, rl, rlm);
 	    CFRelease(rlo);
@@ -2571,6 +2836,210 @@ void CFRunLoopRemoveTimer(CFRunLoopRef rl, CFRunLoopTimerRef rlt, CFStringRef mo
 }
 
 
+/* Instrumentation */
+
+static CFStringRef __CFRunLoopEventKindName(uint32_t kind) {
+    switch (kind) {
+    case __kCFRunLoopEventSource0: return CFSTR("source0");
+    case __kCFRunLoopEventSource1: return CFSTR("source1");
+    case __kCFRunLoopEventTimer: return CFSTR("timer");
+    case __kCFRunLoopEventObserver: return CFSTR("observer");
+    case __kCFRunLoopEventSleep: return CFSTR("sleep");
+    case __kCFRunLoopEventTimerLateness: return CFSTR("timerLateness");
+    }
+    return CFSTR("unknown");
+}
+
+static CFStringRef __CFRunLoopCopyCalloutName(const void *addr) {
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX
+    Dl_info info;
+    if (dladdr(addr, &info) && info.dli_saddr == addr && info.dli_sname) {
+	return CFStringCreateWithCString(kCFAllocatorSystemDefault, info.dli_sname, kCFStringEncodingUTF8);
+    }
+#endif
+    return CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("%p"), addr);
+}
+
+static void __CFRunLoopSetNumberValue(CFMutableDictionaryRef dict, CFStringRef key, CFNumberType type, const void *value) {
+    CFNumberRef num = CFNumberCreate(kCFAllocatorSystemDefault, type, value);
+    CFDictionarySetValue(dict, key, num);
+    CFRelease(num);
+}
+
+/* Copies the events still in the ring, oldest first, leaving out any overwritten while being copied */
+static CFIndex __CFRunLoopCopyTraceEvents(CFRunLoopRef rl, __CFRunLoopTraceEvent **events) {
+    struct __CFRunLoopInstrumentation *instr = rl->_instr;
+    __CFRunLoopTrace *trace = (NULL != instr) ? instr->_trace : NULL;
+    uint64_t next, seq;
+    CFIndex cnt = 0;
+    *events = NULL;
+    if (NULL == trace) return 0;
+    next = trace->_next;
+    _CFMemoryBarrier();
+    seq = ((uint64_t)trace->_mask < next) ? next - trace->_mask - 1 : 0;
+    if (seq == next) return 0;
+    *events = (__CFRunLoopTraceEvent *)CFAllocatorAllocate(kCFAllocatorSystemDefault, (CFIndex)(next - seq) * sizeof(__CFRunLoopTraceEvent), 0);
+    for (; seq < next; seq++) {
+	__CFRunLoopTraceEvent *event = &trace->_events[seq & trace->_mask];
+	uint64_t before = event->_seq;
+	_CFMemoryBarrier();
+	(*events)[cnt] = *event;
+	_CFMemoryBarrier();
+	if (before == seq + 1 && event->_seq == seq + 1) cnt++;
+    }
+    return cnt;
+}
+
+void _CFRunLoopSetInstrumentation(CFRunLoopRef rl, CFOptionFlags options, CFIndex traceCapacity) {
+    struct __CFRunLoopInstrumentation *instr = rl->_instr;
+    CHECK_FOR_FORK();
+    if (NULL == instr) {
+	if (0 == options) return;
+	instr = (struct __CFRunLoopInstrumentation *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(struct __CFRunLoopInstrumentation), 0);
+	memset(instr, 0, sizeof(struct __CFRunLoopInstrumentation));
+	instr->_tsrPerMicrosecond = __CFMax(__CFTimeIntervalToTSR(1.0e-6), 1);
+	if (!_CFAtomicCompareAndSwapPtrBarrier(NULL, instr, (void * volatile *)&rl->_instr)) {
+	    CFAllocatorDeallocate(kCFAllocatorSystemDefault, instr);
+	    instr = rl->_instr;
+	}
+    }
+    if ((options & kCFRunLoopInstrumentTrace) && NULL == instr->_trace) {
+	CFIndex capacity = 16;
+	__CFRunLoopTrace *trace;
+	if (traceCapacity <= 0) traceCapacity = __kCFRunLoopDefaultTraceCapacity;
+	while (capacity < traceCapacity && capacity < __kCFRunLoopMaxTraceCapacity) capacity <<= 1;
+	trace = (__CFRunLoopTrace *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFRunLoopTrace) + (capacity - 1) * sizeof(__CFRunLoopTraceEvent), 0);
+	memset(trace, 0, sizeof(__CFRunLoopTrace) + (capacity - 1) * sizeof(__CFRunLoopTraceEvent));
+	trace->_mask = capacity - 1;
+	if (!_CFAtomicCompareAndSwapPtrBarrier(NULL, trace, (void * volatile *)&instr->_trace)) {
+	    CFAllocatorDeallocate(kCFAllocatorSystemDefault, trace);
+	}
+    }
+    instr->_options = options;
+}
+
+CFOptionFlags _CFRunLoopGetInstrumentation(CFRunLoopRef rl) {
+    CHECK_FOR_FORK();
+    return (NULL != rl->_instr) ? rl->_instr->_options : 0;
+}
+
+CFDictionaryRef _CFRunLoopCopyStatistics(CFRunLoopRef rl) {
+    struct __CFRunLoopInstrumentation *instr = rl->_instr;
+    CFMutableDictionaryRef result = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    uint32_t kind;
+    CHECK_FOR_FORK();
+    for (kind = 0; NULL != instr && kind < __kCFRunLoopEventKindCount; kind++) {
+	__CFRunLoopStatistic stat = instr->_stats[kind];	/* the run loop may be updating it */
+	CFMutableDictionaryRef dict = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	CFNumberRef histogram[__kCFRunLoopHistogramBuckets];
+	CFArrayRef array;
+	CFTimeInterval total = __CFTSRToTimeInterval(stat._totalTSR), max = __CFTSRToTimeInterval(stat._maxTSR);
+	CFIndex idx;
+	__CFRunLoopSetNumberValue(dict, CFSTR("count"), kCFNumberSInt64Type, &stat._count);
+	__CFRunLoopSetNumberValue(dict, CFSTR("total"), kCFNumberDoubleType, &total);
+	__CFRunLoopSetNumberValue(dict, CFSTR("max"), kCFNumberDoubleType, &max);
+	for (idx = 0; idx < __kCFRunLoopHistogramBuckets; idx++) {
+	    histogram[idx] = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberSInt64Type, &stat._histogram[idx]);
+	}
+	array = CFArrayCreate(kCFAllocatorSystemDefault, (const void **)histogram, __kCFRunLoopHistogramBuckets, &kCFTypeArrayCallBacks);
+	for (idx = 0; idx < __kCFRunLoopHistogramBuckets; idx++) {
+	    CFRelease(histogram[idx]);
+	}
+	CFDictionarySetValue(dict, CFSTR("histogram"), array);
+	CFRelease(array);
+	CFDictionarySetValue(result, __CFRunLoopEventKindName(kind), dict);
+	CFRelease(dict);
+    }
+    return result;
+}
+
+void _CFRunLoopResetStatistics(CFRunLoopRef rl) {
+    CHECK_FOR_FORK();
+    if (NULL != rl->_instr) memset(rl->_instr->_stats, 0, sizeof(rl->_instr->_stats));
+}
+
+CFArrayRef _CFRunLoopCopyTrace(CFRunLoopRef rl) {
+    __CFRunLoopTraceEvent *events;
+    CFIndex idx, cnt;
+    CFMutableArrayRef result;
+    CFAbsoluteTime now1 = CFAbsoluteTimeGetCurrent();
+    int64_t now2 = (int64_t)__CFReadTSR();
+    CHECK_FOR_FORK();
+    cnt = __CFRunLoopCopyTraceEvents(rl, &events);
+    result = CFArrayCreateMutable(kCFAllocatorSystemDefault, cnt, &kCFTypeArrayCallBacks);
+    for (idx = 0; idx < cnt; idx++) {
+	__CFRunLoopTraceEvent *event = &events[idx];
+	CFMutableDictionaryRef dict = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	CFAbsoluteTime start = now1 - __CFTSRToTimeInterval(now2 - (int64_t)event->_startTSR);
+	CFTimeInterval duration = __CFTSRToTimeInterval(event->_durationTSR);
+	CFDictionarySetValue(dict, CFSTR("kind"), __CFRunLoopEventKindName(event->_kind));
+	__CFRunLoopSetNumberValue(dict, CFSTR("start"), kCFNumberDoubleType, &start);
+	__CFRunLoopSetNumberValue(dict, CFSTR("duration"), kCFNumberDoubleType, &duration);
+	if (NULL != event->_object) {
+	    CFStringRef object = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("%p"), event->_object);
+	    CFStringRef callout = __CFRunLoopCopyCalloutName(event->_callout);
+	    CFDictionarySetValue(dict, CFSTR("object"), object);
+	    CFDictionarySetValue(dict, CFSTR("callout"), callout);
+	    CFRelease(object);
+	    CFRelease(callout);
+	}
+	if (__kCFRunLoopEventTimer == event->_kind) {
+	    CFTimeInterval lateness = __CFTSRToTimeInterval(event->_extra);
+	    __CFRunLoopSetNumberValue(dict, CFSTR("lateness"), kCFNumberDoubleType, &lateness);
+	} else if (__kCFRunLoopEventObserver == event->_kind) {
+	    __CFRunLoopSetNumberValue(dict, CFSTR("activity"), kCFNumberSInt64Type, &event->_extra);
+	}
+	CFArrayAppendValue(result, dict);
+	CFRelease(dict);
+    }
+    if (NULL != events) CFAllocatorDeallocate(kCFAllocatorSystemDefault, events);
+    return result;
+}
+
+CFDataRef _CFRunLoopCreateTraceData(CFRunLoopRef rl, CFIndex format) {
+    CHECK_FOR_FORK();
+    if (kCFRunLoopTraceFormatXMLPropertyList == format) {
+	CFArrayRef trace = _CFRunLoopCopyTrace(rl);
+	CFDataRef data = CFPropertyListCreateXMLData(kCFAllocatorSystemDefault, trace);
+	CFRelease(trace);
+	return data;
+    } else if (kCFRunLoopTraceFormatChromeJSON == format) {
+	__CFRunLoopTraceEvent *events;
+	CFIndex idx, cnt = __CFRunLoopCopyTraceEvents(rl, &events);
+	CFMutableStringRef json = CFStringCreateMutable(kCFAllocatorSystemDefault, 0);
+	unsigned long tid = (unsigned long)((uintptr_t)rl & 0x7FFFFFFF);	/* the run loop stands in for its thread */
+	CFDataRef data;
+#if DEPLOYMENT_TARGET_WINDOWS
+	int pid = (int)GetCurrentProcessId();
+#else
+	int pid = (int)getpid();
+#endif
+	CFStringAppendFormat(json, NULL, CFSTR("{\"traceEvents\":[\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%lu,\"args\":{\"name\":\"CFRunLoop %p\"}}"), pid, tid, rl);
+	for (idx = 0; idx < cnt; idx++) {
+	    __CFRunLoopTraceEvent *event = &events[idx];
+	    CFStringRef kind = __CFRunLoopEventKindName(event->_kind);
+	    CFStringRef name = (NULL != event->_callout) ? __CFRunLoopCopyCalloutName(event->_callout) : (CFStringRef)CFRetain(kind);
+	    CFStringAppendFormat(json, NULL, CFSTR(",\n{\"name\":\"%@\",\"cat\":\"%@\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%lu"), name, kind, __CFTSRToTimeInterval(event->_startTSR) * 1.0e6, __CFTSRToTimeInterval(event->_durationTSR) * 1.0e6, pid, tid);
+	    if (__kCFRunLoopEventTimer == event->_kind) {
+		CFStringAppendFormat(json, NULL, CFSTR(",\"args\":{\"object\":\"%p\",\"lateness\":%.3f}"), event->_object, __CFTSRToTimeInterval(event->_extra) * 1.0e6);
+	    } else if (__kCFRunLoopEventObserver == event->_kind) {
+		CFStringAppendFormat(json, NULL, CFSTR(",\"args\":{\"object\":\"%p\",\"activity\":%lld}"), event->_object, (long long)event->_extra);
+	    } else if (NULL != event->_object) {
+		CFStringAppendFormat(json, NULL, CFSTR(",\"args\":{\"object\":\"%p\"}"), event->_object);
+	    }
+	    CFStringAppend(json, CFSTR("}"));
+	    CFRelease(name);
+	}
+	CFStringAppend(json, CFSTR("\n]}\n"));
+	data = CFStringCreateExternalRepresentation(kCFAllocatorSystemDefault, json, kCFStringEncodingUTF8, 0);
+	CFRelease(json);
+	if (NULL != events) CFAllocatorDeallocate(kCFAllocatorSystemDefault, events);
+	return data;
+    }
+    return NULL;
+}
+
+
 /* CFRunLoopSource */
 
 static Boolean __CFRunLoopSourceEqual(CFTypeRef cf1, CFTypeRef cf2) {	/* DOES CALLOUT */
@@ -2664,6 +3133,7 @@ CFRunLoopSourceRef CFRunLoopSourceCreate(CFAllocatorRef allocator, CFIndex order
     memory->_bits = 0;
     memory->_order = order;
     memory->_runLoops = NULL;
+    memory->_pool = NULL;
     size = 0;
     switch (context->version) {
     case 0:
@@ -2710,12 +3180,17 @@ static void __CFRunLoopSourceRemoveFromRunLoop(const void *value, void *context)
 
 void CFRunLoopSourceInvalidate(CFRunLoopSourceRef rls) {
     CHECK_FOR_FORK();
+    CFRunLoopPoolRef pool = NULL;
     __CFGenericValidateType(rls, __kCFRunLoopSourceTypeID);
     CFRetain(rls);
     __CFRunLoopSourceLock(rls);
     if (__CFIsValid(rls)) {
 	__CFUnsetValid(rls);
         __CFRunLoopSourceUnsetSignaled(rls);
+	if (NULL != rls->_pool) {
+	    pool = (CFRunLoopPoolRef)CFRetain(rls->_pool);
+	    rls->_pool = NULL;
+	}
 	if (NULL != rls->_runLoops) {
 	    CFTypeRef params[2] = {rls, NULL};
 	    CFBagRef bag = CFBagCreateCopy(kCFAllocatorSystemDefault, rls->_runLoops);
@@ -2731,6 +3206,10 @@ void CFRunLoopSourceInvalidate(CFRunLoopSourceRef rls) {
     } else {
 	__CFRunLoopSourceUnlock(rls);
     }
+    if (NULL != pool) {
+	__CFRunLoopPoolForgetSource(pool, rls);
+	CFRelease(pool);
+    }
     CFRelease(rls);
 }
 
@@ -2763,11 +3242,23 @@ void CFRunLoopSourceGetContext(CFRunLoopSourceRef rls, CFRunLoopSourceContext *c
 
 void CFRunLoopSourceSignal(CFRunLoopSourceRef rls) {
     CHECK_FOR_FORK();
+    CFRunLoopPoolRef pool = NULL;
     __CFRunLoopSourceLock(rls);
-    if (__CFIsValid(rls)) {
+    if (__CFIsValid(rls) && !__CFRunLoopSourceIsSignaled(rls)) {
 	__CFRunLoopSourceSetSignaled(rls);
+	if (0 == rls->_context.version0.version && NULL != rls->_pool) {
+	    if (!__CFRunLoopSourceIsPerforming(rls)) {	/* otherwise queued again when the perform returns */
+		pool = (CFRunLoopPoolRef)CFRetain(rls->_pool);
+	    }
+	} else if (0 == rls->_context.version0.version && NULL != rls->_runLoops) {
+	    CFBagApplyFunction(rls->_runLoops, (__CFRunLoopPushReadySource), (void *)rls);
+	}
     }
     __CFRunLoopSourceUnlock(rls);
+    if (NULL != pool) {
+	__CFRunLoopPoolEnqueue(pool, rls, false);
+	CFRelease(pool);
+    }
 }
 
 Boolean CFRunLoopSourceIsSignalled(CFRunLoopSourceRef rls) {
@@ -2778,6 +3269,542 @@ Boolean CFRunLoopSourceIsSignalled(CFRunLoopSourceRef rls) {
     return ret;
 }
 
+/* CFRunLoopPool */
+
+/* A pooled version 0 source is scheduled on every worker's run loop, but never goes on their ready
+   stacks: signalling it puts it on a work queue and wakes one worker. Each worker has its own queue,
+   used newest first for sources signalled from its own callouts; other threads' signals go to a
+   shared queue, and a worker with nothing to do takes the oldest entry of another worker's queue.
+   The signalled bit keeps a source on the queues at most once; a signal that arrives while a worker
+   performs the source is left for that worker to queue again when the perform returns, so a source
+   never runs concurrently with itself. */
+
+#define __kCFRunLoopPoolDispatchBatch	64	/* performs per pass before the worker's run loop gets a turn */
+#define __kCFRunLoopPoolMaxWorkers	256
+
+typedef struct __CFRunLoopPoolQueue {
+    CFSpinLock_t _lock;
+    CFIndex _head;
+    volatile CFIndex _count;
+    CFIndex _capacity;
+    CFRunLoopSourceRef *_items;		/* ring, oldest at _head; each entry retains its source */
+} __CFRunLoopPoolQueue;
+
+typedef struct __CFRunLoopPoolWorker {
+    CFRunLoopPoolRef _pool;
+    CFRunLoopRef volatile _runLoop;	/* set by the worker once its dispatch source is scheduled */
+    CFRunLoopSourceRef _dispatch;
+    Boolean _dispatching;		/* only touched by the worker itself */
+    __CFRunLoopPoolQueue _queue;
+} __CFRunLoopPoolWorker;
+
+struct __CFRunLoopPool {
+    CFRuntimeBase _base;
+    CFSpinLock_t _lock;			/* for _sources and validity */
+    CFMutableSetRef _sources;		/* pooled version 0 sources, by identity */
+    volatile uint32_t _nextWorker;	/* round robin hint; races are harmless */
+    CFIndex _workerCount;
+    __CFRunLoopPoolWorker *_workers;
+    __CFRunLoopPoolQueue _shared;
+};
+
+static CFTypeID __kCFRunLoopPoolTypeID = _kCFRuntimeNotATypeID;
+
+static const CFSetCallBacks __kCFRunLoopPoolSourceSetCallBacks = {0, __CFTypeCollectionRetain, __CFTypeCollectionRelease, NULL, NULL, NULL};
+
+static void __CFRunLoopPoolQueuePush(__CFRunLoopPoolQueue *queue, CFRunLoopSourceRef rls) {
+    CFRetain(rls);
+    __CFSpinLock(&queue->_lock);
+    if (queue->_count == queue->_capacity) {
+	CFIndex idx, capacity = (0 == queue->_capacity) ? 16 : 2 * queue->_capacity;
+	CFRunLoopSourceRef *items = (CFRunLoopSourceRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, capacity * sizeof(CFRunLoopSourceRef), 0);
+	if (__CFOASafe) __CFSetLastAllocationEventName(items, "CFRunLoopPool (queue)");
+	for (idx = 0; idx < queue->_count; idx++) {
+	    items[idx] = queue->_items[(queue->_head + idx) % queue->_capacity];
+	}
+	if (NULL != queue->_items) CFAllocatorDeallocate(kCFAllocatorSystemDefault, queue->_items);
+	queue->_items = items;
+	queue->_capacity = capacity;
+	queue->_head = 0;
+    }
+    queue->_items[(queue->_head + queue->_count) % queue->_capacity] = rls;
+    queue->_count++;
+    __CFSpinUnlock(&queue->_lock);
+}
+
+/* Returns a retained source, or NULL */
+static CFRunLoopSourceRef __CFRunLoopPoolQueuePop(__CFRunLoopPoolQueue *queue, Boolean newest) {
+    CFRunLoopSourceRef rls = NULL;
+    if (0 == queue->_count) return NULL;	/* a push this misses wakes a worker after it */
+    __CFSpinLock(&queue->_lock);
+    if (0 < queue->_count) {
+	if (newest) {
+	    rls = queue->_items[(queue->_head + queue->_count - 1) % queue->_capacity];
+	} else {
+	    rls = queue->_items[queue->_head];
+	    queue->_head = (queue->_head + 1) % queue->_capacity;
+	}
+	queue->_count--;
+    }
+    __CFSpinUnlock(&queue->_lock);
+    return rls;
+}
+
+static void __CFRunLoopPoolQueueDeallocate(__CFRunLoopPoolQueue *queue) {
+    CFRunLoopSourceRef rls;
+    while (NULL != (rls = __CFRunLoopPoolQueuePop(queue, false))) {
+	CFRelease(rls);
+    }
+    if (NULL != queue->_items) CFAllocatorDeallocate(kCFAllocatorSystemDefault, queue->_items);
+}
+
+/* The worker whose thread is the current one, if any */
+static __CFRunLoopPoolWorker *__CFRunLoopPoolCurrentWorker(CFRunLoopPoolRef pool) {
+    CFRunLoopRef rl = (CFRunLoopRef)__CFGetThreadSpecificData_inline()->_runLoop;
+    CFIndex idx;
+    if (NULL == rl) return NULL;
+    for (idx = 0; idx < pool->_workerCount; idx++) {
+	if (pool->_workers[idx]._runLoop == rl) return &pool->_workers[idx];
+    }
+    return NULL;
+}
+
+/* Gets one worker to look at the queues: a sleeping one other than the caller, if there is one */
+static void __CFRunLoopPoolWake(CFRunLoopPoolRef pool, __CFRunLoopPoolWorker *current) {
+    __CFRunLoopPoolWorker *target = NULL;
+    CFIndex idx, cnt = pool->_workerCount, start = (CFIndex)(pool->_nextWorker++ % (uint32_t)cnt);
+    for (idx = 0; idx < cnt && NULL == target; idx++) {
+	__CFRunLoopPoolWorker *worker = &pool->_workers[(start + idx) % cnt];
+	if (worker != current && __CFRunLoopIsSleeping(worker->_runLoop)) target = worker;
+    }
+    if (NULL == target) {
+	if (NULL != current && current->_dispatching) return;	/* its pass runs until the queues are empty */
+	target = (NULL != current) ? current : &pool->_workers[start];
+    }
+    CFRunLoopSourceSignal(target->_dispatch);
+    CFRunLoopWakeUp(target->_runLoop);
+}
+
+/* rls is not locked; deferred sources, signalled during their own perform, go to the back of the shared queue */
+static void __CFRunLoopPoolEnqueue(CFRunLoopPoolRef pool, CFRunLoopSourceRef rls, Boolean deferred) {
+    __CFRunLoopPoolWorker *current = __CFRunLoopPoolCurrentWorker(pool);
+    __CFRunLoopPoolQueuePush((NULL != current && !deferred) ? &current->_queue : &pool->_shared, rls);
+    __CFRunLoopPoolWake(pool, current);
+}
+
+static void __CFRunLoopPoolForgetSource(CFRunLoopPoolRef pool, CFRunLoopSourceRef rls) {
+    __CFSpinLock(&pool->_lock);
+    if (NULL != pool->_sources) CFSetRemoveValue(pool->_sources, rls);	/* the caller still holds rls */
+    __CFSpinUnlock(&pool->_lock);
+}
+
+/* Returns a retained source, or NULL when there is no work anywhere */
+static CFRunLoopSourceRef __CFRunLoopPoolNext(CFRunLoopPoolRef pool, __CFRunLoopPoolWorker *worker) {
+    CFIndex idx, cnt = pool->_workerCount, self = worker - pool->_workers;
+    CFRunLoopSourceRef rls = __CFRunLoopPoolQueuePop(&worker->_queue, true);
+    if (NULL == rls) rls = __CFRunLoopPoolQueuePop(&pool->_shared, false);
+    for (idx = 1; NULL == rls && idx < cnt; idx++) {
+	rls = __CFRunLoopPoolQueuePop(&pool->_workers[(self + idx) % cnt]._queue, false);
+    }
+    return rls;
+}
+
+static void __CFRunLoopPoolPerform(CFRunLoopPoolRef pool, CFRunLoopRef rl, CFRunLoopSourceRef rls) {	/* DOES CALLOUT */
+    CFRunLoopPoolRef requeue = NULL;
+    __CFRunLoopSourceLock(rls);
+    if (rls->_pool != pool || !__CFIsValid(rls) || !__CFRunLoopSourceIsSignaled(rls) || __CFRunLoopSourceIsPerforming(rls)) {
+	__CFRunLoopSourceUnlock(rls);	/* stale entry */
+	return;
+    }
+    __CFRunLoopSourceUnsetSignaled(rls);
+    __CFRunLoopSourceSetPerforming(rls);
+    __CFRunLoopSourceUnlock(rls);
+    if (NULL != rls->_context.version0.perform) {
+	int64_t startTSR = __CFRunLoopInstrumentBegin(rl);
+	rls->_context.version0.perform(rls->_context.version0.info); /* CALLOUT */
+	CHECK_FOR_FORK();
+	if (0 != startTSR) __CFRunLoopInstrumentEnd(rl, __kCFRunLoopEventSource0, rls, (const void *)rls->_context.version0.perform, startTSR, 0);
+    }
+    __CFRunLoopSourceLock(rls);
+    __CFRunLoopSourceUnsetPerforming(rls);
+    if (__CFIsValid(rls) && __CFRunLoopSourceIsSignaled(rls)) {	/* signalled during the perform */
+	if (NULL != rls->_pool) {
+	    requeue = (CFRunLoopPoolRef)CFRetain(rls->_pool);
+	} else if (NULL != rls->_runLoops) {
+	    CFBagApplyFunction(rls->_runLoops, (__CFRunLoopPushReadySource), (void *)rls);
+	}
+    }
+    __CFRunLoopSourceUnlock(rls);
+    if (NULL != requeue) {
+	__CFRunLoopPoolEnqueue(requeue, rls, true);
+	CFRelease(requeue);
+    }
+}
+
+/* The perform of each worker's dispatch source */
+static void __CFRunLoopPoolDispatch(void *info) {	/* DOES CALLOUT */
+    __CFRunLoopPoolWorker *worker = (__CFRunLoopPoolWorker *)info;
+    CFRunLoopPoolRef pool = worker->_pool;
+    Boolean wasDispatching = worker->_dispatching;
+    CFRunLoopSourceRef rls;
+    CFIndex handled = 0;
+    if (!__CFIsValid(pool)) {
+	CFRunLoopStop(worker->_runLoop);
+	return;
+    }
+    worker->_dispatching = true;
+    while (NULL != (rls = __CFRunLoopPoolNext(pool, worker))) {
+	__CFRunLoopPoolPerform(pool, worker->_runLoop, rls);
+	CFRelease(rls);
+	if (++handled == __kCFRunLoopPoolDispatchBatch) {
+	    CFRunLoopSourceSignal(worker->_dispatch);	/* back after the run loop's timers and ports */
+	    break;
+	}
+    }
+    worker->_dispatching = wasDispatching;
+}
+
+static void *__CFRunLoopPoolWorkerMain(void *arg) {
+    __CFRunLoopPoolWorker *worker = (__CFRunLoopPoolWorker *)arg;
+    CFRunLoopPoolRef pool = worker->_pool;	/* retained for this thread by CFRunLoopPoolCreate() */
+    CFRunLoopRef rl = CFRunLoopGetCurrent();
+    CFRunLoopAddSource(rl, worker->_dispatch, kCFRunLoopCommonModes);
+    CFRetain(rl);
+    _CFAtomicCompareAndSwapPtrBarrier(NULL, (void *)rl, (void * volatile *)&worker->_runLoop);
+    while (__CFIsValid(pool)) {
+	CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1.0e10, false);
+    }
+    CFRunLoopRemoveSource(rl, worker->_dispatch, kCFRunLoopCommonModes);
+    CFRelease(pool);
+    return NULL;
+}
+
+static Boolean __CFRunLoopPoolStartWorker(__CFRunLoopPoolWorker *worker) {
+#if DEPLOYMENT_TARGET_WINDOWS
+    return NULL != __CFStartSimpleThread((void *)__CFRunLoopPoolWorkerMain, worker);
+#else
+    pthread_attr_t attr;
+    pthread_t tid;
+    int ret;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&tid, &attr, __CFRunLoopPoolWorkerMain, worker);
+    pthread_attr_destroy(&attr);
+    return 0 == ret;
+#endif
+}
+
+static CFIndex __CFRunLoopPoolDefaultWorkerCount(void) {
+#if DEPLOYMENT_TARGET_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (CFIndex)info.dwNumberOfProcessors;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus < 1) ? 1 : (CFIndex)cpus;
+#endif
+}
+
+/* The worker whose run loop has the fewest sources and timers in its default mode */
+static __CFRunLoopPoolWorker *__CFRunLoopPoolLeastLoadedWorker(CFRunLoopPoolRef pool) {
+    __CFRunLoopPoolWorker *result = NULL;
+    CFIndex idx, load, minLoad = LONG_MAX;
+    for (idx = 0; idx < pool->_workerCount; idx++) {
+	CFRunLoopRef rl = pool->_workers[idx]._runLoop;
+	CFRunLoopModeRef rlm;
+	__CFRunLoopLock(rl);
+	rlm = __CFRunLoopFindMode(rl, kCFRunLoopDefaultMode, false);
+	__CFRunLoopUnlock(rl);
+	load = 0;
+	if (NULL != rlm) {
+	    if (NULL != rlm->_sources) load += CFSetGetCount(rlm->_sources);
+	    if (NULL != rlm->_timers) load += CFSetGetCount(rlm->_timers);
+	    __CFRunLoopModeUnlock(rlm);
+	}
+	if (load < minLoad) {
+	    minLoad = load;
+	    result = &pool->_workers[idx];
+	}
+    }
+    return result;
+}
+
+/* The worker's run loop if rl is one of the pool's, else NULL */
+static CFRunLoopRef __CFRunLoopPoolWorkerRunLoop(CFRunLoopPoolRef pool, CFRunLoopRef rl) {
+    CFIndex idx;
+    for (idx = 0; NULL != rl && idx < pool->_workerCount; idx++) {
+	if (pool->_workers[idx]._runLoop == rl) return rl;
+    }
+    return NULL;
+}
+
+static CFStringRef __CFRunLoopPoolCopyDescription(CFTypeRef cf) {
+    CFRunLoopPoolRef pool = (CFRunLoopPoolRef)cf;
+    return CFStringCreateWithFormat(CFGetAllocator(pool), NULL, CFSTR("<CFRunLoopPool %p [%p]>{valid = %s, workers = %ld, queued = %ld}"), cf, CFGetAllocator(pool), __CFIsValid(pool) ? "Yes" : "No", (long)pool->_workerCount, (long)pool->_shared._count);
+}
+
+/* Only reached once the pool is invalid and every worker has exited */
+static void __CFRunLoopPoolDeallocate(CFTypeRef cf) {
+    CFRunLoopPoolRef pool = (CFRunLoopPoolRef)cf;
+    CFIndex idx;
+    for (idx = 0; idx < pool->_workerCount; idx++) {
+	__CFRunLoopPoolWorker *worker = &pool->_workers[idx];
+	__CFRunLoopPoolQueueDeallocate(&worker->_queue);
+	CFRunLoopSourceInvalidate(worker->_dispatch);
+	CFRelease(worker->_dispatch);
+	CFRelease(worker->_runLoop);
+    }
+    __CFRunLoopPoolQueueDeallocate(&pool->_shared);
+    if (NULL != pool->_sources) CFRelease(pool->_sources);
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, pool->_workers);
+}
+
+static const CFRuntimeClass __CFRunLoopPoolClass = {
+    0,
+    "CFRunLoopPool",
+    NULL,      // init
+    NULL,      // copy
+    __CFRunLoopPoolDeallocate,
+    NULL,
+    NULL,
+    NULL,      // 
+    __CFRunLoopPoolCopyDescription
+};
+
+static void __CFRunLoopPoolInitialize(void) {
+    __kCFRunLoopPoolTypeID = _CFRuntimeRegisterClass(&__CFRunLoopPoolClass);
+}
+
+CFTypeID CFRunLoopPoolGetTypeID(void) {
+    if (_kCFRuntimeNotATypeID == __kCFRunLoopPoolTypeID) __CFRunLoopPoolInitialize();
+    return __kCFRunLoopPoolTypeID;
+}
+
+CFRunLoopPoolRef CFRunLoopPoolCreate(CFAllocatorRef allocator, CFIndex numWorkers) {
+    CHECK_FOR_FORK();
+    CFRunLoopPoolRef memory;
+    CFIndex idx, started = 0;
+    uint32_t size;
+    if (numWorkers < 1) numWorkers = __CFRunLoopPoolDefaultWorkerCount();
+    if (__kCFRunLoopPoolMaxWorkers < numWorkers) numWorkers = __kCFRunLoopPoolMaxWorkers;
+    size = sizeof(struct __CFRunLoopPool) - sizeof(CFRuntimeBase);
+    memory = (CFRunLoopPoolRef)_CFRuntimeCreateInstance(allocator, CFRunLoopPoolGetTypeID(), size, NULL);
+    if (NULL == memory) {
+	return NULL;
+    }
+    __CFSetValid(memory);
+    CF_SPINLOCK_INIT_FOR_STRUCTS(memory->_lock);
+    memory->_sources = CFSetCreateMutable(kCFAllocatorSystemDefault, 0, &__kCFRunLoopPoolSourceSetCallBacks);
+    memory->_nextWorker = 0;
+    memory->_workerCount = 0;
+    memset(&memory->_shared, 0, sizeof(__CFRunLoopPoolQueue));
+    CF_SPINLOCK_INIT_FOR_STRUCTS(memory->_shared._lock);
+    memory->_workers = (__CFRunLoopPoolWorker *)CFAllocatorAllocate(kCFAllocatorSystemDefault, numWorkers * sizeof(__CFRunLoopPoolWorker), 0);
+    if (__CFOASafe) __CFSetLastAllocationEventName(memory->_workers, "CFRunLoopPool (workers)");
+    memset(memory->_workers, 0, numWorkers * sizeof(__CFRunLoopPoolWorker));
+    for (idx = 0; idx < numWorkers; idx++) {
+	__CFRunLoopPoolWorker *worker = &memory->_workers[idx];
+	CFRunLoopSourceContext context = {0, worker, NULL, NULL, NULL, NULL, NULL, NULL, NULL, __CFRunLoopPoolDispatch};
+	worker->_pool = memory;
+	CF_SPINLOCK_INIT_FOR_STRUCTS(worker->_queue._lock);
+	worker->_dispatch = CFRunLoopSourceCreate(kCFAllocatorSystemDefault, 0, &context);
+	CFRetain(memory);
+	if (!__CFRunLoopPoolStartWorker(worker)) {	// Make do with the workers already running
+	    CFRelease(memory);
+	    CFRelease(worker->_dispatch);
+	    break;
+	}
+	started++;
+    }
+    for (idx = 0; idx < started; idx++) {
+	while (NULL == memory->_workers[idx]._runLoop) {
+#if DEPLOYMENT_TARGET_WINDOWS
+	    Sleep(0);
+#else
+	    sched_yield();
+#endif
+	}
+    }
+    memory->_workerCount = started;	/* no worker looks at the others before there is work */
+    if (0 == started) {
+	__CFUnsetValid(memory);
+	CFRelease(memory);
+	return NULL;
+    }
+    return memory;
+}
+
+CFIndex CFRunLoopPoolGetWorkerCount(CFRunLoopPoolRef pool) {
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    return pool->_workerCount;
+}
+
+CFRunLoopRef CFRunLoopPoolGetWorkerRunLoop(CFRunLoopPoolRef pool, CFIndex idx) {
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    CFAssert2(0 <= idx && idx < pool->_workerCount, __kCFLogAssertion, "%s(): index (%d) out of bounds", __PRETTY_FUNCTION__, idx);
+    return pool->_workers[idx]._runLoop;
+}
+
+void CFRunLoopPoolAddSource(CFRunLoopPoolRef pool, CFRunLoopSourceRef rls, CFStringRef modeName) {	/* DOES CALLOUT */
+    CHECK_FOR_FORK();
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    __CFGenericValidateType(rls, __kCFRunLoopSourceTypeID);
+    CFIndex idx;
+    if (0 == rls->_context.version0.version) {
+	Boolean pooled = false, enqueue = false;
+	__CFSpinLock(&pool->_lock);	/* before the source; keeps invalidation from missing it */
+	__CFRunLoopSourceLock(rls);
+	if (__CFIsValid(pool) && __CFIsValid(rls) && (NULL == rls->_pool || pool == rls->_pool)) {
+	    if (NULL == rls->_pool) {
+		rls->_pool = pool;
+		enqueue = __CFRunLoopSourceIsSignaled(rls) && !__CFRunLoopSourceIsPerforming(rls);
+		CFSetAddValue(pool->_sources, rls);
+	    }
+	    pooled = true;
+	}
+	__CFRunLoopSourceUnlock(rls);
+	__CFSpinUnlock(&pool->_lock);
+	if (!pooled) return;	/* a source is dispatched by one pool at a time */
+	for (idx = 0; idx < pool->_workerCount; idx++) {
+	    CFRunLoopAddSource(pool->_workers[idx]._runLoop, rls, modeName);
+	}
+	if (enqueue) __CFRunLoopPoolEnqueue(pool, rls, false);
+    } else {
+	CFRunLoopRef rl = NULL;
+	if (!__CFIsValid(pool)) return;
+	__CFRunLoopSourceLock(rls);
+	for (idx = 0; NULL == rl && NULL != rls->_runLoops && idx < pool->_workerCount; idx++) {
+	    if (CFBagContainsValue(rls->_runLoops, pool->_workers[idx]._runLoop)) rl = pool->_workers[idx]._runLoop;
+	}
+	__CFRunLoopSourceUnlock(rls);
+	if (NULL == rl) rl = __CFRunLoopPoolLeastLoadedWorker(pool)->_runLoop;
+	CFRunLoopAddSource(rl, rls, modeName);
+    }
+}
+
+void CFRunLoopPoolRemoveSource(CFRunLoopPoolRef pool, CFRunLoopSourceRef rls, CFStringRef modeName) {	/* DOES CALLOUT */
+    CHECK_FOR_FORK();
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    __CFGenericValidateType(rls, __kCFRunLoopSourceTypeID);
+    CFIndex idx;
+    Boolean scheduled = false;
+    for (idx = 0; idx < pool->_workerCount; idx++) {
+	CFRunLoopRemoveSource(pool->_workers[idx]._runLoop, rls, modeName);
+    }
+    if (0 != rls->_context.version0.version) return;
+    __CFRunLoopSourceLock(rls);
+    for (idx = 0; NULL != rls->_runLoops && idx < pool->_workerCount && !scheduled; idx++) {
+	scheduled = CFBagContainsValue(rls->_runLoops, pool->_workers[idx]._runLoop);
+    }
+    if (scheduled || pool != rls->_pool) {
+	__CFRunLoopSourceUnlock(rls);
+	return;
+    }
+    rls->_pool = NULL;	/* in no mode of any worker any more */
+    if (__CFIsValid(rls) && __CFRunLoopSourceIsSignaled(rls) && !__CFRunLoopSourceIsPerforming(rls) && NULL != rls->_runLoops) {
+	CFBagApplyFunction(rls->_runLoops, (__CFRunLoopPushReadySource), (void *)rls);
+    }
+    __CFRunLoopSourceUnlock(rls);
+    __CFRunLoopPoolForgetSource(pool, rls);
+}
+
+Boolean CFRunLoopPoolContainsSource(CFRunLoopPoolRef pool, CFRunLoopSourceRef rls, CFStringRef modeName) {
+    CHECK_FOR_FORK();
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    CFIndex idx;
+    for (idx = 0; idx < pool->_workerCount; idx++) {
+	if (CFRunLoopContainsSource(pool->_workers[idx]._runLoop, rls, modeName)) return true;
+    }
+    return false;
+}
+
+/* The worker run loop that has the timer in the mode, if any; a timer only knows its run loop where it has a timer port */
+static CFRunLoopRef __CFRunLoopPoolTimerRunLoop(CFRunLoopPoolRef pool, CFRunLoopTimerRef rlt, CFStringRef modeName) {
+    CFIndex idx;
+    for (idx = 0; idx < pool->_workerCount; idx++) {
+	if (CFRunLoopContainsTimer(pool->_workers[idx]._runLoop, rlt, modeName)) return pool->_workers[idx]._runLoop;
+    }
+    return NULL;
+}
+
+void CFRunLoopPoolAddTimer(CFRunLoopPoolRef pool, CFRunLoopTimerRef rlt, CFStringRef modeName) {
+    CHECK_FOR_FORK();
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    __CFGenericValidateType(rlt, __kCFRunLoopTimerTypeID);
+    CFRunLoopRef rl;
+    if (!__CFIsValid(pool)) return;
+    __CFRunLoopTimerLock(rlt);
+    rl = rlt->_runLoop;
+    __CFRunLoopTimerUnlock(rlt);
+    if (NULL != rl) {
+	if (NULL == __CFRunLoopPoolWorkerRunLoop(pool, rl)) return;	/* already scheduled elsewhere; CFRunLoopAddTimer() would ignore it too */
+    } else if (NULL != __CFRunLoopPoolTimerRunLoop(pool, rlt, modeName)) {
+	return;
+    } else {
+	rl = __CFRunLoopPoolLeastLoadedWorker(pool)->_runLoop;
+    }
+    CFRunLoopAddTimer(rl, rlt, modeName);
+}
+
+void CFRunLoopPoolRemoveTimer(CFRunLoopPoolRef pool, CFRunLoopTimerRef rlt, CFStringRef modeName) {
+    CHECK_FOR_FORK();
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    __CFGenericValidateType(rlt, __kCFRunLoopTimerTypeID);
+    CFRunLoopRef rl = __CFRunLoopPoolTimerRunLoop(pool, rlt, modeName);
+    if (NULL != rl) CFRunLoopRemoveTimer(rl, rlt, modeName);
+}
+
+Boolean CFRunLoopPoolContainsTimer(CFRunLoopPoolRef pool, CFRunLoopTimerRef rlt, CFStringRef modeName) {
+    CHECK_FOR_FORK();
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    __CFGenericValidateType(rlt, __kCFRunLoopTimerTypeID);
+    return (NULL != __CFRunLoopPoolTimerRunLoop(pool, rlt, modeName));
+}
+
+static void __CFRunLoopPoolDetachSource(const void *value, void *context) {
+    CFRunLoopSourceRef rls = (CFRunLoopSourceRef)value;
+    CFRunLoopPoolRef pool = (CFRunLoopPoolRef)context;
+    CFIndex idx;
+    __CFRunLoopSourceLock(rls);
+    if (pool == rls->_pool) rls->_pool = NULL;
+    __CFRunLoopSourceUnlock(rls);
+    for (idx = 0; idx < pool->_workerCount; idx++) {
+	CFTypeRef params[2] = {rls, NULL};
+	__CFRunLoopSourceRemoveFromRunLoop(pool->_workers[idx]._runLoop, params);
+    }
+}
+
+void CFRunLoopPoolInvalidate(CFRunLoopPoolRef pool) {	/* DOES CALLOUT */
+    CHECK_FOR_FORK();
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    CFMutableSetRef sources;
+    CFIndex idx;
+    CFRetain(pool);
+    __CFSpinLock(&pool->_lock);
+    if (!__CFIsValid(pool)) {
+	__CFSpinUnlock(&pool->_lock);
+	CFRelease(pool);
+	return;
+    }
+    __CFUnsetValid(pool);
+    sources = pool->_sources;
+    pool->_sources = NULL;
+    __CFSpinUnlock(&pool->_lock);
+    CFSetApplyFunction(sources, (__CFRunLoopPoolDetachSource), (void *)pool);
+    CFRelease(sources);
+    for (idx = 0; idx < pool->_workerCount; idx++) {	/* each worker stops from its dispatch source */
+	CFRunLoopSourceSignal(pool->_workers[idx]._dispatch);
+	CFRunLoopWakeUp(pool->_workers[idx]._runLoop);
+    }
+    CFRelease(pool);
+}
+
+Boolean CFRunLoopPoolIsValid(CFRunLoopPoolRef pool) {
+    CHECK_FOR_FORK();
+    __CFGenericValidateType(pool, __kCFRunLoopPoolTypeID);
+    return __CFIsValid(pool);
+}
+
 /* CFRunLoopObserver */
 
 static CFStringRef __CFRunLoopObserverCopyDescription(CFTypeRef cf) {	/* DOES CALLOUT */
@@ -335,11 +335,22 @@ __private_extern__ Boolean __CFRuntimeIsFreedObject(id anObject) {
 }
 #endif
 
+#if CF_TAGGED_OBJECTS
+// Type IDs of the tagged object classes, indexed by tagged class
+__private_extern__ CFTypeID __CFTaggedTypeIDs[8] = {_kCFRuntimeNotATypeID};
+#endif
+
 CFTypeID __CFGenericTypeID(const void *cf) {
+#if CF_TAGGED_OBJECTS
+    if (CF_IS_TAGGED_OBJ(cf)) return __CFTaggedTypeIDs[__CFTaggedObjectClass(cf)];
+#endif
     return (*(uint32_t *)(((CFRuntimeBase *)cf)->_cfinfo) >> 8) & 0xFFFF;
 }
 
 CF_INLINE CFTypeID __CFGenericTypeID_inline(const void *cf) {
+#if CF_TAGGED_OBJECTS
+    if (CF_IS_TAGGED_OBJ(cf)) return __CFTaggedTypeIDs[__CFTaggedObjectClass(cf)];
+#endif
     return (*(uint32_t *)(((CFRuntimeBase *)cf)->_cfinfo) >> 8) & 0xFFFF;
 }
 
@@ -384,6 +395,7 @@ CF_EXPORT CFTypeRef _CFRetain(CFTypeRef cf);
 CF_EXPORT CFHashCode _CFHash(CFTypeRef cf);
 
 CFTypeRef CFRetain(CFTypeRef cf) {
+    if (CF_IS_TAGGED_OBJ(cf)) return cf;
     if (CF_IS_COLLECTABLE(cf)) {
         // always honor CFRetain's with a GC-visible retain.
         auto_zone_retain(__CFCollectableZone, (void*)cf);
@@ -397,6 +409,7 @@ CFTypeRef CFRetain(CFTypeRef cf) {
 __private_extern__ void __CFAllocatorDeallocate(CFTypeRef cf);
 
 void CFRelease(CFTypeRef cf) {
+    if (CF_IS_TAGGED_OBJ(cf)) return;
 #if !DEPLOYMENT_TARGET_WINDOWS
     if (CF_IS_COLLECTABLE(cf)) {
         // release the GC-visible reference.
@@ -428,6 +441,7 @@ extern void CFCollection_non_gc_storage_error(void);
 
 __private_extern__ const void *__CFTypeCollectionRetain(CFAllocatorRef allocator, const void *ptr) {
     CFTypeRef cf = (CFTypeRef)ptr;
+    if (CF_IS_TAGGED_OBJ(cf)) return cf;
     // only collections allocated in the GC zone can opt-out of reference counting.
     if (CF_IS_COLLECTABLE_ALLOCATOR(allocator)) {
         if (CFTYPE_IS_OBJC(cf)) return cf;  // do nothing for OBJC objects.
@@ -463,6 +477,7 @@ __private_extern__ const void *__CFTypeCollectionRetain(CFAllocatorRef allocator
 
 __private_extern__ void __CFTypeCollectionRelease(CFAllocatorRef allocator, const void *ptr) {
     CFTypeRef cf = (CFTypeRef)ptr;
+    if (CF_IS_TAGGED_OBJ(cf)) return;
     // only collections allocated in the GC zone can opt-out of reference counting.
     if (CF_IS_COLLECTABLE_ALLOCATOR(allocator)) {
         if (CFTYPE_IS_OBJC(cf)) return; // do nothing for OBJC objects.
@@ -499,6 +514,9 @@ static CFMutableBagRef __CFRuntimeExternRefCountTable = NULL;
 #endif
 
 static uint64_t __CFGetFullRetainCount(CFTypeRef cf) {
+    if (CF_IS_TAGGED_OBJ(cf)) {
+        return (uint64_t)0x0fffffffffffffffULL;
+    }
 #if __LP64__
     uint32_t lowBits = ((CFRuntimeBase *)cf)->_rc;
     if (0 == lowBits) {
@@ -554,6 +572,7 @@ CFIndex CFGetRetainCount(CFTypeRef cf) {
 
 CFTypeRef CFMakeCollectable(CFTypeRef cf) {
     if (NULL == cf) return NULL;
+    if (CF_IS_TAGGED_OBJ(cf)) return cf;
     if (CF_IS_COLLECTABLE(cf)) {
 #if defined(DEBUG)
         CFAllocatorRef allocator = CFGetAllocator(cf);
@@ -632,6 +651,7 @@ extern CFAllocatorRef __CFAllocatorGetAllocator(CFTypeRef);
 
 CFAllocatorRef CFGetAllocator(CFTypeRef cf) {
     if (NULL == cf) return kCFAllocatorSystemDefault;
+    if (CF_IS_TAGGED_OBJ(cf)) return kCFAllocatorSystemDefault;
     if (__kCFAllocatorTypeID_CONST == __CFGenericTypeID_inline(cf)) {
 	return __CFAllocatorGetAllocator(cf);
     }
@@ -941,6 +961,7 @@ CFHashCode _CFHash(CFTypeRef cf) {
 
 CF_EXPORT CFTypeRef _CFRetain(CFTypeRef cf) {
     if (NULL == cf) return NULL;
+    if (CF_IS_TAGGED_OBJ(cf)) return cf;
 #if __LP64__
     uint32_t lowBits;
     do {
@@ -989,6 +1010,7 @@ CF_EXPORT CFTypeRef _CFRetain(CFTypeRef cf) {
 
 CF_EXPORT void _CFRelease(CFTypeRef cf) {
     Boolean isAllocator = false;
+    if (CF_IS_TAGGED_OBJ(cf)) return;
 #if __LP64__
     uint32_t lowBits;
     do {
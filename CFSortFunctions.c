@@ -55,6 +55,640 @@
 
 typedef CFComparisonResult (*Comparison_Func)(const void *, const void *, void *);
 
+/* Pointer-width sort engine =========================================== */
+
+/* Nearly every sort in CF is of an array of pointers (object references), so
+   CFQSortArray(), CFMergeSortArray() and CFArraySortValues() use the routines
+   below for pointer-sized elements instead of the generic BSD ones, which move
+   elements with swapfunc() and, for CFArray, call the comparator through
+   another wrapper. The unstable sort is a pattern-defeating quicksort (median
+   of 3 or ninther pivots, equal-element partitioning, heapsort fallback on
+   repeated bad partitions); the stable sort is a natural merge sort that
+   finds existing runs (timsort-style). Both detect input that is already
+   sorted or reversed in one pass. Scans are bounds checked, so an
+   inconsistent comparator gives a wrong order but never touches memory
+   outside the array.
+*/
+
+typedef struct {
+    CFComparatorFunction comparator;
+    void *context;
+    Boolean byValue;	// The comparator takes the values themselves (CFArray), rather than their addresses (CFQSortArray)
+} __CFSortInfo;
+
+#define __CF_SORT_INSERTION_THRESHOLD 24
+#define __CF_SORT_NINTHER_THRESHOLD 128
+#define __CF_SORT_PARTIAL_INSERTION_LIMIT 8
+#define __CF_SORT_MIN_MERGE 32
+#define __CF_SORT_MAX_RUNS 85	// Enough for any count, given the run length invariants
+
+CF_INLINE Boolean __CFSortLess(const __CFSortInfo *info, const void **x, const void **y) {
+    CFComparisonResult res = info->byValue ? (CFComparisonResult)INVOKE_CALLBACK3(info->comparator, *x, *y, info->context) : info->comparator(x, y, info->context);
+    return res < 0;
+}
+
+CF_INLINE void __CFSortSwap(const void **x, const void **y) {
+    const void *t = *x;
+    *x = *y;
+    *y = t;
+}
+
+// Branchless compare-exchange: afterwards *x <= *y
+CF_INLINE void __CFSortCompareSwap(const void **x, const void **y, const __CFSortInfo *info) {
+    Boolean swap = __CFSortLess(info, y, x);
+    const void *vx = *x, *vy = *y;
+    *x = swap ? vy : vx;
+    *y = swap ? vx : vy;
+}
+
+CF_INLINE void __CFSortThree(const void **a, const void **b, const void **c, const __CFSortInfo *info) {
+    __CFSortCompareSwap(a, b, info);
+    __CFSortCompareSwap(b, c, info);
+    __CFSortCompareSwap(a, b, info);
+}
+
+static void __CFSortReverse(const void **begin, const void **end) {
+    while (begin < --end) __CFSortSwap(begin++, end);
+}
+
+static void __CFSortInsertion(const void **begin, const void **end, const __CFSortInfo *info) {
+    const void **cur;
+    if (begin == end) return;
+    for (cur = begin + 1; cur < end; cur++) {
+        const void **sift = cur, **sift1 = cur - 1;
+        if (__CFSortLess(info, sift, sift1)) {
+            const void *tmp = *sift;
+            do { *sift-- = *sift1; } while (sift != begin && __CFSortLess(info, &tmp, --sift1));
+            *sift = tmp;
+        }
+    }
+}
+
+// Same as above, but gives up (returning false) once more than a few elements have had to move
+static Boolean __CFSortPartialInsertion(const void **begin, const void **end, const __CFSortInfo *info) {
+    const void **cur;
+    CFIndex moved = 0;
+    if (begin == end) return true;
+    for (cur = begin + 1; cur < end; cur++) {
+        const void **sift = cur, **sift1 = cur - 1;
+        if (__CFSortLess(info, sift, sift1)) {
+            const void *tmp = *sift;
+            do { *sift-- = *sift1; } while (sift != begin && __CFSortLess(info, &tmp, --sift1));
+            *sift = tmp;
+            moved += cur - sift;
+            if (moved > __CF_SORT_PARTIAL_INSERTION_LIMIT) return false;
+        }
+    }
+    return true;
+}
+
+static void __CFSortSiftDown(const void **a, CFIndex root, CFIndex count, const __CFSortInfo *info) {
+    for (;;) {
+        CFIndex child = 2 * root + 1;
+        if (child >= count) return;
+        if (child + 1 < count && __CFSortLess(info, a + child, a + child + 1)) child++;
+        if (!__CFSortLess(info, a + root, a + child)) return;
+        __CFSortSwap(a + root, a + child);
+        root = child;
+    }
+}
+
+static void __CFSortHeap(const void **begin, const void **end, const __CFSortInfo *info) {
+    CFIndex count = end - begin, idx;
+    for (idx = count / 2; idx-- > 0;) __CFSortSiftDown(begin, idx, count, info);
+    for (idx = count - 1; idx > 0; idx--) {
+        __CFSortSwap(begin, begin + idx);
+        __CFSortSiftDown(begin, 0, idx, info);
+    }
+}
+
+/* Partitions [begin, end) around the pivot *begin into < pivot, pivot, >= pivot; returns where the pivot ends up.
+   alreadyPartitioned is set if no elements had to be swapped.
+*/
+static const void **__CFSortPartitionRight(const void **begin, const void **end, const __CFSortInfo *info, Boolean *alreadyPartitioned) {
+    const void *pivot = *begin;
+    const void **first = begin, **last = end, **pivotPos;
+    do { first++; } while (first < end - 1 && __CFSortLess(info, first, &pivot));
+    if (first - 1 == begin) {
+        while (first < last && !__CFSortLess(info, --last, &pivot));
+    } else {
+        do { last--; } while (last > begin && !__CFSortLess(info, last, &pivot));
+    }
+    *alreadyPartitioned = (first >= last);
+    while (first < last) {
+        __CFSortSwap(first, last);
+        do { first++; } while (first < end - 1 && __CFSortLess(info, first, &pivot));
+        do { last--; } while (last > begin && !__CFSortLess(info, last, &pivot));
+    }
+    pivotPos = first - 1;
+    *begin = *pivotPos;
+    *pivotPos = pivot;
+    return pivotPos;
+}
+
+/* Partitions [begin, end) around the pivot *begin into <= pivot, pivot, > pivot; returns where the pivot ends up.
+   Used when the pivot equals the element just before the range, so everything equal to it is already in place once moved left.
+*/
+static const void **__CFSortPartitionLeft(const void **begin, const void **end, const __CFSortInfo *info) {
+    const void *pivot = *begin;
+    const void **first = begin, **last = end;
+    do { last--; } while (last > begin && __CFSortLess(info, &pivot, last));
+    if (last + 1 == end) {
+        while (first < last && !__CFSortLess(info, &pivot, ++first));
+    } else {
+        do { first++; } while (first < end - 1 && !__CFSortLess(info, &pivot, first));
+    }
+    while (first < last) {
+        __CFSortSwap(first, last);
+        do { last--; } while (last > begin && __CFSortLess(info, &pivot, last));
+        do { first++; } while (first < end - 1 && !__CFSortLess(info, &pivot, first));
+    }
+    *begin = *last;
+    *last = pivot;
+    return last;
+}
+
+static void __CFSortQuick(const void **begin, const void **end, const __CFSortInfo *info, CFIndex badAllowed, Boolean leftmost) {
+    for (;;) {
+        CFIndex size = end - begin, half = size / 2, lSize, rSize;
+        const void **pivotPos;
+        Boolean alreadyPartitioned;
+
+        if (size < __CF_SORT_INSERTION_THRESHOLD) {
+            __CFSortInsertion(begin, end, info);
+            return;
+        }
+        if (size > __CF_SORT_NINTHER_THRESHOLD) {
+            __CFSortThree(begin, begin + half, end - 1, info);
+            __CFSortThree(begin + 1, begin + (half - 1), end - 2, info);
+            __CFSortThree(begin + 2, begin + (half + 1), end - 3, info);
+            __CFSortThree(begin + (half - 1), begin + half, begin + (half + 1), info);
+            __CFSortSwap(begin, begin + half);
+        } else {
+            __CFSortThree(begin + half, begin, end - 1, info);
+        }
+
+        // The element before a non-leftmost range is no greater than anything in it; if it equals the pivot, so do all the elements that would go left
+        if (!leftmost && !__CFSortLess(info, begin - 1, begin)) {
+            begin = __CFSortPartitionLeft(begin, end, info) + 1;
+            continue;
+        }
+
+        pivotPos = __CFSortPartitionRight(begin, end, info, &alreadyPartitioned);
+        lSize = pivotPos - begin;
+        rSize = end - (pivotPos + 1);
+        if (lSize < size / 8 || rSize < size / 8) {	// Unbalanced; shuffle some elements to break up patterns, or give up on quicksort
+            if (--badAllowed == 0) {
+                __CFSortHeap(begin, end, info);
+                return;
+            }
+            if (lSize >= __CF_SORT_INSERTION_THRESHOLD) {
+                __CFSortSwap(begin, begin + lSize / 4);
+                __CFSortSwap(pivotPos - 1, pivotPos - lSize / 4);
+                if (lSize > __CF_SORT_NINTHER_THRESHOLD) {
+                    __CFSortSwap(begin + 1, begin + (lSize / 4 + 1));
+                    __CFSortSwap(begin + 2, begin + (lSize / 4 + 2));
+                    __CFSortSwap(pivotPos - 2, pivotPos - (lSize / 4 + 1));
+                    __CFSortSwap(pivotPos - 3, pivotPos - (lSize / 4 + 2));
+                }
+            }
+            if (rSize >= __CF_SORT_INSERTION_THRESHOLD) {
+                __CFSortSwap(pivotPos + 1, pivotPos + (1 + rSize / 4));
+                __CFSortSwap(end - 1, end - rSize / 4);
+                if (rSize > __CF_SORT_NINTHER_THRESHOLD) {
+                    __CFSortSwap(pivotPos + 2, pivotPos + (2 + rSize / 4));
+                    __CFSortSwap(pivotPos + 3, pivotPos + (3 + rSize / 4));
+                    __CFSortSwap(end - 2, end - (1 + rSize / 4));
+                    __CFSortSwap(end - 3, end - (2 + rSize / 4));
+                }
+            }
+        } else if (alreadyPartitioned && __CFSortPartialInsertion(begin, pivotPos, info) && __CFSortPartialInsertion(pivotPos + 1, end, info)) {
+            return;	// Probably nearly sorted to begin with
+        }
+
+        // Recurse into the smaller side and loop on the larger, to bound the stack depth
+        if (lSize < rSize) {
+            __CFSortQuick(begin, pivotPos, info, badAllowed, leftmost);
+            begin = pivotPos + 1;
+            leftmost = false;
+        } else {
+            __CFSortQuick(pivotPos + 1, end, info, badAllowed, false);
+            end = pivotPos;
+        }
+    }
+}
+
+/* Returns the length of the run at the start of [begin, end), which is either non-descending or strictly descending;
+   a descending run is reversed in place. Reversing only strictly descending runs keeps equal elements in order.
+*/
+static CFIndex __CFSortCountRunAndMakeAscending(const void **begin, const void **end, const __CFSortInfo *info) {
+    const void **cur = begin + 1;
+    if (cur >= end) return end - begin;
+    if (__CFSortLess(info, cur, begin)) {
+        while (++cur < end && __CFSortLess(info, cur, cur - 1));
+        __CFSortReverse(begin, cur);
+    } else {
+        while (++cur < end && !__CFSortLess(info, cur, cur - 1));
+    }
+    return cur - begin;
+}
+
+// [begin, start) is sorted; inserts the rest, each after any elements equal to it
+static void __CFSortBinaryInsertion(const void **begin, const void **end, const void **start, const __CFSortInfo *info) {
+    for (; start < end; start++) {
+        const void *pivot = *start;
+        const void **lo = begin, **hi = start;
+        while (lo < hi) {
+            const void **mid = lo + (hi - lo) / 2;
+            if (__CFSortLess(info, &pivot, mid)) hi = mid; else lo = mid + 1;
+        }
+        memmove(lo + 1, lo, (start - lo) * sizeof(void *));
+        *lo = pivot;
+    }
+}
+
+// Number of elements at the start of sorted [begin, begin + count) that are <= *key (upper == true) or < *key (upper == false)
+CF_INLINE Boolean __CFSortBelowKey(const void **elem, const void **key, Boolean upper, const __CFSortInfo *info) {
+    return upper ? !__CFSortLess(info, key, elem) : __CFSortLess(info, elem, key);
+}
+
+static CFIndex __CFSortBound(const void **begin, CFIndex count, const void **key, Boolean upper, const __CFSortInfo *info) {
+    CFIndex lo = 0, hi = count;
+    while (lo < hi) {
+        CFIndex mid = lo + (hi - lo) / 2;
+        if (__CFSortBelowKey(begin + mid, key, upper, info)) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Same as above, searching from the start in doubling steps; cheaper when the answer is small
+static CFIndex __CFSortGallop(const void **begin, CFIndex count, const void **key, Boolean upper, const __CFSortInfo *info) {
+    CFIndex lo = 0, step = 1;
+    while (lo + step <= count && __CFSortBelowKey(begin + lo + step - 1, key, upper, info)) {
+        lo += step;
+        step <<= 1;
+    }
+    return lo + __CFSortBound(begin + lo, (lo + step <= count ? step - 1 : count - lo), key, upper, info);
+}
+
+// Same as above, searching backwards from the end: number of elements at the end of [begin, begin + count) that are > *key (upper == true) or >= *key (upper == false)
+static CFIndex __CFSortGallopFromEnd(const void **begin, CFIndex count, const void **key, Boolean upper, const __CFSortInfo *info) {
+    CFIndex hi = 0, step = 1;
+    while (hi + step <= count && !__CFSortBelowKey(begin + count - hi - step, key, upper, info)) {
+        hi += step;
+        step <<= 1;
+    }
+    {
+        CFIndex span = (hi + step <= count) ? step - 1 : count - hi;
+        return hi + (span - __CFSortBound(begin + count - hi - span, span, key, upper, info));
+    }
+}
+
+#define __CF_SORT_MIN_GALLOP 7
+
+/* Stably merges the adjacent sorted ranges [a, a + na) and [a + na, a + na + nb); tmp must hold min(na, nb) elements.
+   When one side keeps winning, switches to galloping to move whole blocks at once, which is what makes nearly sorted input cheap.
+*/
+static void __CFSortMerge(const void **a, CFIndex na, CFIndex nb, const void **tmp, const __CFSortInfo *info) {
+    const void **b = a + na;
+    CFIndex skip;
+    // Elements of a no greater than b's first are already in place, as are elements of b no less than a's last
+    skip = __CFSortGallop(a, na, b, true, info);
+    a += skip;
+    na -= skip;
+    if (0 == na) return;
+    nb = __CFSortBound(b, nb, b - 1, false, info);
+    if (0 == nb) return;
+    if (na <= nb) {
+        const void **t = tmp, **tEnd = tmp + na, **bEnd = b + nb, **dst = a;
+        CFIndex winsA = 0, winsB = 0;
+        memmove(tmp, a, na * sizeof(void *));
+        while (t < tEnd && b < bEnd) {
+            Boolean takeB = __CFSortLess(info, b, t);
+            *dst++ = takeB ? *b : *t;
+            b += takeB;
+            t += !takeB;
+            winsB = takeB ? winsB + 1 : 0;
+            winsA = takeB ? 0 : winsA + 1;
+            if (winsA >= __CF_SORT_MIN_GALLOP && t < tEnd && b < bEnd) {	// Move all of a up to b's next element
+                CFIndex n = __CFSortGallop(t, tEnd - t, b, true, info);
+                memmove(dst, t, n * sizeof(void *));
+                dst += n;
+                t += n;
+                winsA = 0;
+            } else if (winsB >= __CF_SORT_MIN_GALLOP && t < tEnd && b < bEnd) {	// Move all of b below a's next element
+                CFIndex n = __CFSortGallop(b, bEnd - b, t, false, info);
+                memmove(dst, b, n * sizeof(void *));
+                dst += n;
+                b += n;
+                winsB = 0;
+            }
+        }
+        memmove(dst, t, (tEnd - t) * sizeof(void *));
+    } else {
+        const void **t = tmp + nb, **aEnd = a + na, **dst = b + nb;
+        CFIndex winsA = 0, winsB = 0;
+        memmove(tmp, b, nb * sizeof(void *));
+        while (t > tmp && aEnd > a) {
+            Boolean takeA = __CFSortLess(info, t - 1, aEnd - 1);
+            *--dst = takeA ? *(aEnd - 1) : *(t - 1);
+            aEnd -= takeA;
+            t -= !takeA;
+            winsA = takeA ? winsA + 1 : 0;
+            winsB = takeA ? 0 : winsB + 1;
+            if (winsA >= __CF_SORT_MIN_GALLOP && t > tmp && aEnd > a) {	// Move all of a above b's previous element
+                CFIndex n = __CFSortGallopFromEnd(a, aEnd - a, t - 1, true, info);
+                dst -= n;
+                aEnd -= n;
+                memmove(dst, aEnd, n * sizeof(void *));
+                winsA = 0;
+            } else if (winsB >= __CF_SORT_MIN_GALLOP && t > tmp && aEnd > a) {	// Move all of b no less than a's previous element
+                CFIndex n = __CFSortGallopFromEnd(tmp, t - tmp, aEnd - 1, false, info);
+                dst -= n;
+                t -= n;
+                memmove(dst, t, n * sizeof(void *));
+                winsB = 0;
+            }
+        }
+        memmove(dst - (t - tmp), tmp, (t - tmp) * sizeof(void *));
+    }
+}
+
+static void __CFSortPointersStable(const void **values, CFIndex count, const __CFSortInfo *info) {
+    const void **end = values + count, **lo = values;
+    const void *stackBuffer[256], **tmp;
+    struct { CFIndex base, len; } runs[__CF_SORT_MAX_RUNS];
+    CFIndex numRuns = 0, minRun, n;
+
+    if (count < 2) return;
+    if (count < __CF_SORT_MIN_MERGE) {
+        __CFSortBinaryInsertion(values, end, values + __CFSortCountRunAndMakeAscending(values, end, info), info);
+        return;
+    }
+    for (n = count, minRun = 0; n >= __CF_SORT_MIN_MERGE; n >>= 1) minRun |= n & 1;
+    minRun += n;
+    tmp = (count / 2 <= 256) ? stackBuffer : (const void **)CFAllocatorAllocate(kCFAllocatorSystemDefault, (count / 2) * sizeof(void *), 0);
+    if (tmp != stackBuffer && __CFOASafe) __CFSetLastAllocationEventName(tmp, "CFUtilities (sort-temp)");
+
+    while (lo < end) {
+        CFIndex runLen = __CFSortCountRunAndMakeAscending(lo, end, info);
+        if (runLen < minRun) {	// Extend short runs to minRun
+            CFIndex forced = (end - lo < minRun) ? end - lo : minRun;
+            __CFSortBinaryInsertion(lo, lo + forced, lo + runLen, info);
+            runLen = forced;
+        }
+        runs[numRuns].base = lo - values;
+        runs[numRuns].len = runLen;
+        numRuns++;
+        lo += runLen;
+        // Keep run lengths decreasing faster than the Fibonacci numbers, merging as needed
+        while (numRuns > 1) {
+            CFIndex idx = numRuns - 2;
+            if ((idx > 0 && runs[idx - 1].len <= runs[idx].len + runs[idx + 1].len) || (idx > 1 && runs[idx - 2].len <= runs[idx - 1].len + runs[idx].len)) {
+                if (runs[idx - 1].len < runs[idx + 1].len) idx--;
+            } else if (runs[idx].len > runs[idx + 1].len) {
+                break;
+            }
+            __CFSortMerge(values + runs[idx].base, runs[idx].len, runs[idx + 1].len, tmp, info);
+            runs[idx].len += runs[idx + 1].len;
+            if (idx + 2 < numRuns) runs[idx + 1] = runs[idx + 2];
+            numRuns--;
+        }
+    }
+    while (numRuns > 1) {
+        CFIndex idx = numRuns - 2;
+        if (idx > 0 && runs[idx - 1].len < runs[idx + 1].len) idx--;
+        __CFSortMerge(values + runs[idx].base, runs[idx].len, runs[idx + 1].len, tmp, info);
+        runs[idx].len += runs[idx + 1].len;
+        if (idx + 2 < numRuns) runs[idx + 1] = runs[idx + 2];
+        numRuns--;
+    }
+    if (tmp != stackBuffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, tmp);
+}
+
+static void __CFSortPointersUnstable(const void **values, CFIndex count, const __CFSortInfo *info) {
+    CFIndex badAllowed = 0, n;
+    if (count < 2) return;
+    if (__CFSortCountRunAndMakeAscending(values, values + count, info) == count) return;	// Already sorted (or was reversed)
+    for (n = count; n > 1; n >>= 1) badAllowed++;
+    __CFSortQuick(values, values + count, info, badAllowed, true);
+}
+
+static void __CFSortPointers(const void **values, CFIndex count, Boolean stable, CFComparatorFunction comparator, void *context, Boolean byValue) {
+    __CFSortInfo info;
+    info.comparator = comparator;
+    info.context = context;
+    info.byValue = byValue;
+    if (stable) {
+        __CFSortPointersStable(values, count, &info);
+    } else {
+        __CFSortPointersUnstable(values, count, &info);
+    }
+}
+
+// Pointer-sized elements that the collector doesn't need to see written (write-barrier) can use the engine above
+CF_INLINE Boolean __CFSortCanUsePointerEngine(void *list, CFIndex elementSize) {
+    if (elementSize != sizeof(void *) || ((uintptr_t)list % sizeof(void *)) != 0) return false;
+    return !(CF_USING_COLLECTABLE_MEMORY && (auto_zone_get_layout_type(__CFCollectableZone, list) & AUTO_UNSCANNED) == 0);
+}
+
+/* Comparator is passed the values themselves, as for CFArraySortValues(). */
+__private_extern__ void __CFSortValues(const void **values, CFIndex count, Boolean stable, CFComparatorFunction comparator, void *context) {
+    __CFSortPointers(values, count, stable, comparator, context, true);
+}
+
+/* Concurrent sort =====================================================
+
+   For large arrays the work is split over a bounded number of threads: each
+   sorts one slice with the routines above, then rounds of pairwise merges
+   (each pair itself split across the threads by binary search, so every
+   round keeps all threads busy) combine the slices through a scratch buffer
+   the size of the array. Merges take from the right-hand slice only when
+   strictly less, so the result is stable when the slices were sorted stably.
+   Below the threshold, or where threads are not available, it is the
+   ordinary serial sort.
+*/
+
+#if !defined(CF_SORT_CONCURRENT_MIN_SLICE)
+#define CF_SORT_CONCURRENT_MIN_SLICE 32768	// Fewest elements worth giving a thread
+#endif
+#if !defined(CF_SORT_CONCURRENT_MAX_THREADS)
+#define CF_SORT_CONCURRENT_MAX_THREADS 64
+#endif
+
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX || DEPLOYMENT_TARGET_FREEBSD
+
+// One unit of work: sort [dst, dst + na) in place (b == NULL), or merge a and b into dst
+typedef struct {
+    const void **a, **b, **dst;
+    CFIndex na, nb;
+} __CFSortJob;
+
+typedef struct {
+    const __CFSortInfo *info;
+    Boolean stable;
+    __CFSortJob *jobs;
+    CFIndex numJobs;
+    int32_t volatile nextJob;
+} __CFSortPhase;
+
+static void __CFSortMergeInto(const void **a, CFIndex na, const void **b, CFIndex nb, const void **dst, const __CFSortInfo *info) {
+    const void **aEnd = a + na, **bEnd = b + nb;
+    while (a < aEnd && b < bEnd) {
+        Boolean takeB = __CFSortLess(info, b, a);
+        *dst++ = takeB ? *b : *a;
+        b += takeB;
+        a += !takeB;
+    }
+    memmove(dst, a, (aEnd - a) * sizeof(void *));
+    memmove(dst + (aEnd - a), b, (bEnd - b) * sizeof(void *));
+}
+
+static void *__CFSortPhaseWorker(void *arg) {
+    __CFSortPhase *phase = (__CFSortPhase *)arg;
+    int32_t idx;
+    while ((idx = _CFAtomicIncrement32((int32_t *)&phase->nextJob) - 1) < phase->numJobs) {
+        __CFSortJob *job = &phase->jobs[idx];
+        if (NULL == job->b) {
+            if (phase->stable) __CFSortPointersStable(job->dst, job->na, phase->info); else __CFSortPointersUnstable(job->dst, job->na, phase->info);
+        } else {
+            __CFSortMergeInto(job->a, job->na, job->b, job->nb, job->dst, phase->info);
+        }
+    }
+    return NULL;
+}
+
+// Runs the jobs on up to numThreads threads, including the calling one
+static void __CFSortRunPhase(__CFSortPhase *phase, CFIndex numThreads) {
+    pthread_t threads[CF_SORT_CONCURRENT_MAX_THREADS];
+    CFIndex idx, started = 0;
+    phase->nextJob = 0;
+    if (numThreads > phase->numJobs) numThreads = phase->numJobs;
+    for (idx = 1; idx < numThreads; idx++) {
+        if (0 == pthread_create(&threads[started], NULL, __CFSortPhaseWorker, phase)) started++;	// If a thread can't be had, the others just do more
+    }
+    __CFSortPhaseWorker(phase);
+    for (idx = 0; idx < started; idx++) pthread_join(threads[idx], NULL);
+}
+
+static CFIndex __CFSortConcurrencyForCount(CFIndex count) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    CFIndex numThreads = count / CF_SORT_CONCURRENT_MIN_SLICE;
+    if (cpus < 1) cpus = 1;
+    if (numThreads > cpus) numThreads = cpus;
+    if (numThreads > CF_SORT_CONCURRENT_MAX_THREADS) numThreads = CF_SORT_CONCURRENT_MAX_THREADS;
+    return numThreads;
+}
+
+static void __CFSortPointersConcurrent(const void **values, CFIndex count, Boolean stable, CFComparatorFunction comparator, void *context, Boolean byValue) {
+    __CFSortInfo info;
+    __CFSortPhase phase;
+    CFIndex numThreads = __CFSortConcurrencyForCount(count), numSlices, idx;
+    CFIndex bounds[CF_SORT_CONCURRENT_MAX_THREADS + 1];
+    const void **src = values, **dst, **scratch;
+    
+    if (numThreads < 2) {
+        __CFSortPointers(values, count, stable, comparator, context, byValue);
+        return;
+    }
+    scratch = (const void **)CFAllocatorAllocate(kCFAllocatorSystemDefault, count * sizeof(void *), 0);
+    if (!scratch) {
+        __CFSortPointers(values, count, stable, comparator, context, byValue);
+        return;
+    }
+    if (__CFOASafe) __CFSetLastAllocationEventName(scratch, "CFUtilities (sort-temp)");
+    phase.jobs = (__CFSortJob *)CFAllocatorAllocate(kCFAllocatorSystemDefault, 2 * numThreads * sizeof(__CFSortJob), 0);
+    if (!phase.jobs) {
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, scratch);
+        __CFSortPointers(values, count, stable, comparator, context, byValue);
+        return;
+    }
+    info.comparator = comparator;
+    info.context = context;
+    info.byValue = byValue;
+    phase.info = &info;
+    phase.stable = stable;
+
+    // Sort the slices
+    numSlices = numThreads;
+    for (idx = 0; idx <= numSlices; idx++) bounds[idx] = (idx == numSlices) ? count : (count / numSlices) * idx;
+    for (idx = 0; idx < numSlices; idx++) {
+        phase.jobs[idx].a = phase.jobs[idx].b = NULL;
+        phase.jobs[idx].dst = values + bounds[idx];
+        phase.jobs[idx].na = bounds[idx + 1] - bounds[idx];
+        phase.jobs[idx].nb = 0;
+    }
+    phase.numJobs = numSlices;
+    __CFSortRunPhase(&phase, numThreads);
+
+    // Merge pairs of slices until one is left, alternating between the array and the scratch buffer
+    dst = scratch;
+    while (numSlices > 1) {
+        CFIndex numPairs = numSlices / 2, piecesPerPair = numThreads / numPairs, pair, piece, newNumSlices = 0;
+        if (piecesPerPair < 1) piecesPerPair = 1;
+        phase.numJobs = 0;
+        for (pair = 0; pair < numPairs; pair++) {
+            const void **a = src + bounds[2 * pair], **b = src + bounds[2 * pair + 1];
+            CFIndex na = bounds[2 * pair + 1] - bounds[2 * pair], nb = bounds[2 * pair + 2] - bounds[2 * pair + 1];
+            CFIndex aStart = 0, bStart = 0;
+            // Split a evenly; each piece of a takes the part of b that sorts before a's next piece
+            for (piece = 0; piece < piecesPerPair; piece++) {
+                CFIndex aEnd = (piece == piecesPerPair - 1) ? na : (na / piecesPerPair) * (piece + 1);
+                CFIndex bEnd = (piece == piecesPerPair - 1) ? nb : __CFSortBound(b, nb, a + aEnd, false, &info);
+                __CFSortJob *job = &phase.jobs[phase.numJobs++];
+                job->a = a + aStart;
+                job->na = aEnd - aStart;
+                job->b = b + bStart;
+                job->nb = bEnd - bStart;
+                job->dst = dst + bounds[2 * pair] + aStart + bStart;
+                aStart = aEnd;
+                bStart = bEnd;
+            }
+            bounds[newNumSlices++] = bounds[2 * pair];
+        }
+        if (numSlices & 1) {	// An odd slice out is carried over as is
+            __CFSortJob *job = &phase.jobs[phase.numJobs++];
+            job->a = src + bounds[numSlices - 1];
+            job->na = bounds[numSlices] - bounds[numSlices - 1];
+            job->b = job->a + job->na;
+            job->nb = 0;
+            job->dst = dst + bounds[numSlices - 1];
+            bounds[newNumSlices++] = bounds[numSlices - 1];
+        }
+        bounds[newNumSlices] = count;
+        numSlices = newNumSlices;
+        __CFSortRunPhase(&phase, numThreads);
+        dst = src;
+        src = (src == values) ? scratch : values;
+    }
+    if (src != values) memmove(values, src, count * sizeof(void *));
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, phase.jobs);
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, scratch);
+}
+
+#else
+
+static void __CFSortPointersConcurrent(const void **values, CFIndex count, Boolean stable, CFComparatorFunction comparator, void *context, Boolean byValue) {
+    __CFSortPointers(values, count, stable, comparator, context, byValue);
+}
+
+#endif
+
+/* Comparator is passed the values themselves, as for CFArraySortValues(). */
+__private_extern__ void __CFSortValuesConcurrent(const void **values, CFIndex count, Boolean stable, CFComparatorFunction comparator, void *context) {
+    __CFSortPointersConcurrent(values, count, stable, comparator, context, true);
+}
+
+/* Comparator is passed the address of the values. */
+void CFSortArrayConcurrent(void *list, CFIndex count, CFIndex elementSize, Boolean stable, CFComparatorFunction comparator, void *context) {
+    if (__CFSortCanUsePointerEngine(list, elementSize))
+        __CFSortPointersConcurrent((const void **)list, count, stable, comparator, context, false);
+    else if (stable)
+        CFMergeSortArray(list, count, elementSize, comparator, context);
+    else
+        CFQSortArray(list, count, elementSize, comparator, context);
+}
+
 /* stdlib.subproj/qsort.c ============================================== */
 
 /*-
@@ -371,7 +1005,9 @@ loop:	SWAPINIT(a, es);
 
 /* Comparator is passed the address of the values. */
 void CFQSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context) {
-    if (CF_USING_COLLECTABLE_MEMORY && (auto_zone_get_layout_type(__CFCollectableZone, list) & AUTO_UNSCANNED) == 0)
+    if (__CFSortCanUsePointerEngine(list, elementSize))
+        __CFSortPointers((const void **)list, count, false, comparator, context, false);
+    else if (CF_USING_COLLECTABLE_MEMORY && (auto_zone_get_layout_type(__CFCollectableZone, list) & AUTO_UNSCANNED) == 0)
         bsd_qsort_wb(list, count, elementSize, comparator, context);
     else
         bsd_qsort(list, count, elementSize, comparator, context);
@@ -1011,7 +1647,9 @@ insertionsort_wb(u_char *a, size_t n, size_t size, CFComparisonResult (*cmp)(con
 }
 
 void CFMergeSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context) {
-    if (CF_USING_COLLECTABLE_MEMORY && (auto_zone_get_layout_type(__CFCollectableZone, list) & AUTO_UNSCANNED) == 0)
+    if (__CFSortCanUsePointerEngine(list, elementSize))
+        __CFSortPointers((const void **)list, count, true, comparator, context, false);
+    else if (CF_USING_COLLECTABLE_MEMORY && (auto_zone_get_layout_type(__CFCollectableZone, list) & AUTO_UNSCANNED) == 0)
         bsd_mergesort_wb(list, count, elementSize, comparator, context);
     else
         bsd_mergesort(list, count, elementSize, comparator, context);
@@ -37,7 +37,11 @@
 */
 
 /*
-2-3 tree storing arbitrary sized values.
+B+-tree storing arbitrary sized values.
+
+The values are kept in leaves of up to maxLeafCapacity bytes, and the leaves are chained in order, so walking a range goes from leaf to leaf without going back through the tree. Non-leaf nodes have up to __CFStorageMaxChildren children and keep the byte count of each child next to the pointer to it, so choosing a child reads only the parent. All leaves are at the same depth.
+
+Lookups by index go through a small per-thread cache of the leaf last used in each storage (__CFStorageAccessCache, in the thread-specific data), so readers on different threads neither share nor invalidate a cache.
 
 ??? Currently elementSize cannot be greater than storage->maxLeafCapacity, which is less than or equal to __CFStorageMaxLeafCapacity
 
@@ -55,16 +59,8 @@ CFStorage is thread-safe for multiple readers, but not thread safe for simultane
 // Also, tests with StorageTimer.c done in 4/07 indicate that 4096 * 3 is better than smaller or larger node sizes.
 #define __CFStorageMaxLeafCapacity (4096 * 3)
 
-// If the max length of a node is less than can fit in a half-word (half of a long), we can get away without ever caching the high half-word the cachedRange
-#if __LP64__
-#if __CFStorageMaxLeafCapacity > 0xFFFFFFFFULL
-#define POSSIBLE_TO_HAVE_LENGTH_MORE_THAN_HALFWORD 1
-#endif
-#else
-#if __CFStorageMaxLeafCapacity > 0xFFFFUL
-#define POSSIBLE_TO_HAVE_LENGTH_MORE_THAN_HALFWORD 1
-#endif
-#endif
+// A non-leaf node's children and their byte counts fill a few cache lines; with full leaves a tree of depth 3 holds over 6M pointers
+#define __CFStorageMaxChildren 16
 
 #define COPYMEM(src,dst,n) CF_WRITE_BARRIER_MEMMOVE((dst), (src), (n))
 #define PAGE_LIMIT ((CFIndex)PAGE_SIZE / 2)
@@ -75,7 +71,7 @@ CF_INLINE int32_t roundToPage(int32_t num) {
 
 
 
-/* Each node in the storage.  isLeaf determines whether the node is a leaf node or a node inside the tree. If latter, number of children are determined by the number of non-NULL entries in child[]. (NULL entries are at the end.)
+/* Each node in the storage.  isLeaf determines whether the node is a leaf node or a node inside the tree. A node inside the tree has 1 to __CFStorageMaxChildren children; childBytes[i] is always child[i]->numBytes.
 */
 typedef struct __CFStorageNode {
     CFIndex numBytes;	/* Number of actual bytes in this node and all its children */
@@ -84,49 +80,42 @@ typedef struct __CFStorageNode {
         struct {
             CFIndex capacityInBytes;	// capacityInBytes is capacity of memory; this is either 0, or >= numBytes
             uint8_t *memory;
+            struct __CFStorageNode *prev, *next;	// The neighboring leaves
         } leaf;
         struct {
-            struct __CFStorageNode *child[3];
+            CFIndex numChildren;
+            CFIndex childBytes[__CFStorageMaxChildren];
+            struct __CFStorageNode *child[__CFStorageMaxChildren];
         } notLeaf;
     } info;
 } CFStorageNode;
 
-/* This is the struct used to store the cache in the CFStorage; it enables us to make the cache thread-safe for multiple readers (which update the cache).  The values in this cache store half the desired value in the top half, and the genCount of the writer in the low half. This cache is consistent only if all of the genCounts are the same.  Note that the cache does not provide thread-safety for readers in the presence of a writer.
-
-The cached range (location, length) is in terms of values; if the cached range is not (0,0), then the cached node needs to be non-NULL and pointing at a leaf node.
-*/
-typedef struct {
-    unsigned long locationHi, locationLo;	// cachedRange.location
-#if POSSIBLE_TO_HAVE_LENGTH_MORE_THAN_HALFWORD
-    unsigned long lengthHi;		    
-#endif
-    unsigned long lengthLo;			// cachedRange.length; note that we actually do not bother with lengthHi if __CFStorageMaxLeafCapacity is less than half-word
-    unsigned long cachedNodeHi, cachedNodeLo;	// cachedNode
-} CFStorageAccessCacheParts;
-
 /* The CFStorage object.
 */
 struct __CFStorage {
     CFRuntimeBase base;
     CFIndex valueSize;
     CFSpinLock_t cacheReaderMemoryAllocationLock;
-    int cacheGenerationCount;
-    CFStorageAccessCacheParts cacheParts;
+    int64_t serial;		    // Never reused, so a thread's cache entry cannot be mistaken for one of a later storage at the same address
+    int64_t mutations;		    // Counts insertions and deletions, which invalidate every thread's cache entry
     CFIndex maxLeafCapacity;	    // In terms of bytes
-    CFStorageNode rootNode;
+    CFStorageNode *rootNode;
     CFOptionFlags nodeHint;	    // __kCFAllocatorGCScannedMemory or 0.
 };
 
+static int64_t __CFStorageLastSerial = 0;
 
 
 
-/* Allocates the memory and initializes the capacity in a leaf. __CFStorageAllocLeafNodeMemory() is the entry point; __CFStorageAllocLeafNodeMemoryAux is called if actual reallocation is needed. __CFStorageAllocLeafNodeMemoryAux() locks not for mutations (mutations are not thread-safe in general), but for lazy allocation of storage during reading.
+/* Allocates the memory and initializes the capacity in a leaf. __CFStorageAllocLeafNodeMemory() is the entry point; __CFStorageAllocLeafNodeMemoryAux is called if actual reallocation is needed. __CFStorageAllocLeafNodeMemoryAux() locks not for mutations (mutations are not thread-safe in general), but for lazy allocation of storage during reading; it checks again under the lock, as another reader may have just allocated the memory.
 */
-static void __CFStorageAllocLeafNodeMemoryAux(CFAllocatorRef allocator, CFStorageRef storage, CFStorageNode *node, CFIndex cap) {
+static void __CFStorageAllocLeafNodeMemoryAux(CFAllocatorRef allocator, CFStorageRef storage, CFStorageNode *node, CFIndex cap, bool compact) {
     __CFSpinLock(&(storage->cacheReaderMemoryAllocationLock));
-    CF_WRITE_BARRIER_ASSIGN(allocator, node->info.leaf.memory, _CFAllocatorReallocateGC(allocator, node->info.leaf.memory, cap, storage->nodeHint));	// This will free...
-    if (__CFOASafe) __CFSetLastAllocationEventName(node->info.leaf.memory, "CFStorage (node bytes)");
-    node->info.leaf.capacityInBytes = cap;
+    if (compact ? (cap != node->info.leaf.capacityInBytes) : (cap > node->info.leaf.capacityInBytes)) {
+	CF_WRITE_BARRIER_ASSIGN(allocator, node->info.leaf.memory, _CFAllocatorReallocateGC(allocator, node->info.leaf.memory, cap, storage->nodeHint));	// This will free...
+	if (__CFOASafe) __CFSetLastAllocationEventName(node->info.leaf.memory, "CFStorage (node bytes)");
+	node->info.leaf.capacityInBytes = cap;
+    }
     __CFSpinUnlock(&(storage->cacheReaderMemoryAllocationLock));
 }
 
@@ -137,88 +126,45 @@ CF_INLINE void __CFStorageAllocLeafNodeMemory(CFAllocatorRef allocator, CFStorag
     } else {
         cap = (((cap + 63) / 64) * 64);
     }
-    if (compact ? (cap != node->info.leaf.capacityInBytes) : (cap > node->info.leaf.capacityInBytes)) __CFStorageAllocLeafNodeMemoryAux(allocator, storage, node, cap);
+    if (compact ? (cap != node->info.leaf.capacityInBytes) : (cap > node->info.leaf.capacityInBytes)) __CFStorageAllocLeafNodeMemoryAux(allocator, storage, node, cap, compact);
 }
 
 
 
 
-#if __LP64__
-#define genCountMask	0x00000000FFFFFFFFUL
-#define dataMask	0xFFFFFFFF00000000UL
-#define shiftLowWordBy	32
-#else
-#define genCountMask	0x0000FFFFUL
-#define dataMask	0xFFFF0000UL
-#define shiftLowWordBy	16
-#endif
-
-/* Sets the cache to point at the specified node. loc and len are in terms of values, not bytes. To clear the cache set these two to 0.
-   At least one of node or memory should be non-NULL. memory is consulted first when using the cache.
-*/
-CF_INLINE void __CFStorageSetCache(CFStorageRef storage, CFStorageNode *node, CFIndex loc, CFIndex len) {
-	unsigned int genCount = ((unsigned int)_CFAtomicIncrement32(&storage->cacheGenerationCount)) & genCountMask;
-    CFStorageAccessCacheParts cacheParts;
-    cacheParts.locationHi = (loc & dataMask) | genCount;
-    cacheParts.locationLo = (loc << shiftLowWordBy) | genCount;
-#if POSSIBLE_TO_HAVE_LENGTH_MORE_THAN_HALFWORD
-    cacheParts.lengthHi = (len & dataMask) | genCount;
-#endif
-    cacheParts.lengthLo = (len << shiftLowWordBy) | genCount;
-    cacheParts.cachedNodeHi = ((unsigned long)node & dataMask) | genCount;
-    cacheParts.cachedNodeLo = ((unsigned long)node << shiftLowWordBy) | genCount;
-    storage->cacheParts = cacheParts;
+CF_INLINE __CFStorageAccessCache *__CFStorageGetAccessCache(CFStorageRef storage) {
+    return &(__CFGetThreadSpecificData_inline()->_storageCache[storage->serial & (__kCFStorageAccessCacheCount - 1)]);
 }
 
-/* Thread-safely get the cached range and node info.
+/* Sets this thread's cache to point at the specified leaf. loc and len are in terms of values, not bytes.
 */
-CF_INLINE Boolean __CFStorageGetCache(CFStorageRef storage, CFRange *cachedRangePtr, CFStorageNode **cachedNodePtr) {
-    CFStorageAccessCacheParts cacheParts = storage->cacheParts;
-
-    unsigned int genCount = cacheParts.locationHi & genCountMask;
-    
-    // Check to make sure the genCounts of all the items are the same; if not, the cache was inconsistent
-    if ((cacheParts.locationLo & genCountMask) == genCount &&
-#if POSSIBLE_TO_HAVE_LENGTH_MORE_THAN_HALFWORD
-	(cacheParts.lengthHi & genCountMask) == genCount &&
-#endif
-	(cacheParts.lengthLo & genCountMask) == genCount &&
-	(cacheParts.cachedNodeHi & genCountMask) == genCount &&
-	(cacheParts.cachedNodeLo & genCountMask) == genCount) {
-	
-	*cachedNodePtr = (CFStorageNode *)((cacheParts.cachedNodeHi & dataMask) | ((cacheParts.cachedNodeLo & dataMask) >> shiftLowWordBy));
-	cachedRangePtr->location = (cacheParts.locationHi & dataMask) | ((cacheParts.locationLo & dataMask) >> shiftLowWordBy);
-	cachedRangePtr->length = (cacheParts.lengthLo & dataMask) >> shiftLowWordBy;
-#if POSSIBLE_TO_HAVE_LENGTH_MORE_THAN_HALFWORD
-	cachedRangePtr->length |= (cacheParts.lengthHi & dataMask);
-#endif
-
-	return true;
-    }
-    return false;
+CF_INLINE void __CFStorageSetCache(CFStorageRef storage, CFStorageNode *node, CFIndex loc, CFIndex len) {
+    __CFStorageAccessCache *cache = __CFStorageGetAccessCache(storage);
+    cache->_serial = storage->serial;
+    cache->_mutations = storage->mutations;
+    cache->_node = node;
+    cache->_location = loc;
+    cache->_length = len;
 }
 
-/* Gets the location for the specified absolute loc from the cached info.
+/* Gets the location for the specified absolute loc from this thread's cache.
    Returns NULL if the location is not in the cache.
 */
 CF_INLINE uint8_t *__CFStorageGetFromCache(CFStorageRef storage, CFIndex loc, CFRange *validConsecutiveValueRange) {
-    CFRange cachedRange = {0, 0};
-    CFStorageNode *cachedNode = 0;
+    __CFStorageAccessCache *cache = __CFStorageGetAccessCache(storage);
+    CFStorageNode *cachedNode;
 
-    // If we can't get values from the cache, return NULL
-    if (!__CFStorageGetCache(storage, &cachedRange, &cachedNode)) return NULL;
+    if (cache->_serial != storage->serial || cache->_mutations != storage->mutations) return NULL;
 
     // Check to see if the index is in the cache
-    if (loc < cachedRange.location || loc >= cachedRange.location + cachedRange.length) return NULL;
+    if (loc < cache->_location || loc >= cache->_location + cache->_length) return NULL;
 
     // If the cached node has no memory, return here; it will be allocated as a result of the non-cached lookup.
+    cachedNode = (CFStorageNode *)cache->_node;
     if (!cachedNode->info.leaf.memory) return NULL;
-    
-    // The cache has consistent values, and in fact, the values we're looking for!
-    uint8_t *result = cachedNode->info.leaf.memory + (loc - cachedRange.location) * storage->valueSize;
-    *validConsecutiveValueRange = cachedRange;
-    
-    return result;
+
+    *validConsecutiveValueRange = CFRangeMake(cache->_location, cache->_length);
+    return cachedNode->info.leaf.memory + (loc - cache->_location) * storage->valueSize;
 }
 
 
@@ -229,43 +175,50 @@ CF_INLINE uint8_t *__CFStorageGetFromCache(CFStorageRef storage, CFIndex loc, CF
    relativeByteNum (not optional, for performance reasons) returns the relative byte number of the specified byte in the child.
    Don't call with leaf nodes!
 */
-CF_INLINE void __CFStorageFindChild(CFStorageNode *node, CFIndex byteNum, bool forInsertion, CFIndex *childNum, CFIndex *relativeByteNum) {
+CF_INLINE CFIndex __CFStorageFindChild(CFStorageNode *node, CFIndex byteNum, bool forInsertion, CFIndex *relativeByteNum) {
+    const CFIndex *childBytes = node->info.notLeaf.childBytes;
+    CFIndex childNum = 0, lastChild = node->info.notLeaf.numChildren - 1;
     if (forInsertion) byteNum--;	/* If for insertion, we do <= checks, not <, so this accomplishes the same thing */
-    if (byteNum < node->info.notLeaf.child[0]->numBytes) *childNum = 0;
-    else {
-        byteNum -= node->info.notLeaf.child[0]->numBytes;
-        if (byteNum < node->info.notLeaf.child[1]->numBytes) *childNum = 1;
-        else {
-            byteNum -= node->info.notLeaf.child[1]->numBytes;
-            *childNum = 2;
-        }
-    }
+    while (childNum < lastChild && byteNum >= childBytes[childNum]) byteNum -= childBytes[childNum++];
     if (forInsertion) byteNum++;
     *relativeByteNum = byteNum;
+    return childNum;
 }
 
-/* Finds the location where the specified byte is stored. If validConsecutiveByteRange is not NULL, returns
-   the range of bytes that are consecutive with this one.
-   !!! Assumes the byteNum is within the range of this node.
+/* Finds the location where the specified byte is stored, the leaf it is in and the range of bytes in that leaf.
+   !!! Assumes the byteNum is within the range of the storage.
 */
-static void *__CFStorageFindByte(CFStorageRef storage, CFStorageNode *node, CFIndex byteNum, CFStorageNode **resultNode, CFRange *validConsecutiveByteRange) {
-    if (node->isLeaf) {
-        if (validConsecutiveByteRange) *validConsecutiveByteRange = CFRangeMake(0, node->numBytes);
-        __CFStorageAllocLeafNodeMemory(CFGetAllocator(storage), storage, node, node->numBytes, false);
-	if (resultNode) *resultNode = node;
-        return node->info.leaf.memory + byteNum; 
-    } else {
-        void *result;
-        CFIndex childNum;
+static uint8_t *__CFStorageFindByte(CFStorageRef storage, CFIndex byteNum, CFStorageNode **resultNode, CFRange *validConsecutiveByteRange) {
+    CFStorageNode *node = storage->rootNode;
+    CFIndex leafStart = 0;
+    while (!node->isLeaf) {
         CFIndex relativeByteNum;
-        __CFStorageFindChild(node, byteNum, false, &childNum, &relativeByteNum);
-        result = __CFStorageFindByte(storage, node->info.notLeaf.child[childNum], relativeByteNum, resultNode, validConsecutiveByteRange);
-        if (validConsecutiveByteRange) {
-            if (childNum > 0) validConsecutiveByteRange->location += node->info.notLeaf.child[0]->numBytes;
-            if (childNum > 1) validConsecutiveByteRange->location += node->info.notLeaf.child[1]->numBytes;
-        }
+        CFIndex childNum = __CFStorageFindChild(node, byteNum, false, &relativeByteNum);
+        leafStart += byteNum - relativeByteNum;
+        byteNum = relativeByteNum;
+        node = node->info.notLeaf.child[childNum];
+    }
+    __CFStorageAllocLeafNodeMemory(CFGetAllocator(storage), storage, node, node->numBytes, false);
+    *resultNode = node;
+    *validConsecutiveByteRange = CFRangeMake(leafStart, node->numBytes);
+    return node->info.leaf.memory + byteNum;
+}
+
+/* Returns the bytes from byteNum to the end of its leaf and sets *length to their number. Pass *node as NULL to start; each
+   later call returns the whole of the leaf after *node, so byteNum must then be where that leaf starts. Walking a range this
+   way follows the leaf chain instead of searching the tree for each leaf, and leaves the per-thread cache alone.
+*/
+static uint8_t *__CFStorageGetRun(CFStorageRef storage, CFStorageNode **node, CFIndex byteNum, CFIndex *length) {
+    if (NULL == *node) {
+        CFRange leafRange;
+        uint8_t *result = __CFStorageFindByte(storage, byteNum, node, &leafRange);
+        *length = leafRange.location + leafRange.length - byteNum;
         return result;
     }
+    *node = (*node)->info.leaf.next;
+    __CFStorageAllocLeafNodeMemory(CFGetAllocator(storage), storage, *node, (*node)->numBytes, false);
+    *length = (*node)->numBytes;
+    return (*node)->info.leaf.memory;
 }
 
 /* Guts of CFStorageGetValueAtIndex(); note that validConsecutiveValueRange is not optional.
@@ -276,7 +229,7 @@ CF_INLINE void *__CFStorageGetValueAtIndex(CFStorageRef storage, CFIndex idx, CF
     if (!(result = __CFStorageGetFromCache(storage, idx, validConsecutiveValueRange))) {
         CFRange rangeInBytes;
 	CFStorageNode *resultNode;
-        result = (uint8_t *)__CFStorageFindByte(storage, &storage->rootNode, idx * storage->valueSize, &resultNode, &rangeInBytes);
+        result = __CFStorageFindByte(storage, idx * storage->valueSize, &resultNode, &rangeInBytes);
 	CFRange rangeInValues = CFRangeMake(rangeInBytes.location / storage->valueSize, rangeInBytes.length / storage->valueSize);
         __CFStorageSetCache(storage, resultNode, rangeInValues.location, rangeInValues.length);
 	*validConsecutiveValueRange = rangeInValues;
@@ -287,13 +240,15 @@ CF_INLINE void *__CFStorageGetValueAtIndex(CFStorageRef storage, CFIndex idx, CF
 static CFStorageNode *__CFStorageCreateNode(CFAllocatorRef allocator, bool isLeaf, CFIndex numBytes) {
     CFStorageNode *newNode = (CFStorageNode *)_CFAllocatorAllocateGC(allocator, sizeof(CFStorageNode), __kCFAllocatorGCScannedMemory);
     if (__CFOASafe) __CFSetLastAllocationEventName(newNode, "CFStorage (node)");
+    if (NULL == newNode) HALT;
     newNode->isLeaf = isLeaf;
     newNode->numBytes = numBytes;
     if (isLeaf) {
         newNode->info.leaf.capacityInBytes = 0;
         newNode->info.leaf.memory = NULL;
+        newNode->info.leaf.prev = newNode->info.leaf.next = NULL;
     } else {
-        newNode->info.notLeaf.child[0] = newNode->info.notLeaf.child[1] = newNode->info.notLeaf.child[2] = NULL;
+        newNode->info.notLeaf.numChildren = 0;
     }
     return newNode;
 }
@@ -302,18 +257,107 @@ static void __CFStorageNodeDealloc(CFAllocatorRef allocator, CFStorageNode *node
     if (node->isLeaf) {
         _CFAllocatorDeallocateGC(allocator, node->info.leaf.memory);
     } else {
-        int cnt;
-        for (cnt = 0; cnt < 3; cnt++) if (node->info.notLeaf.child[cnt]) __CFStorageNodeDealloc(allocator, node->info.notLeaf.child[cnt], true);
+        CFIndex cnt;
+        for (cnt = 0; cnt < node->info.notLeaf.numChildren; cnt++) __CFStorageNodeDealloc(allocator, node->info.notLeaf.child[cnt], true);
     }
     if (freeNodeItself) _CFAllocatorDeallocateGC(allocator, node);
 }
 
+/* Puts newLeaf into the leaf chain right after leaf.
+*/
+static void __CFStorageLinkLeafAfter(CFAllocatorRef allocator, CFStorageNode *leaf, CFStorageNode *newLeaf) {
+    CFStorageNode *next = leaf->info.leaf.next;
+    CF_WRITE_BARRIER_ASSIGN(allocator, newLeaf->info.leaf.prev, leaf);
+    CF_WRITE_BARRIER_ASSIGN(allocator, newLeaf->info.leaf.next, next);
+    if (next) CF_WRITE_BARRIER_ASSIGN(allocator, next->info.leaf.prev, newLeaf);
+    CF_WRITE_BARRIER_ASSIGN(allocator, leaf->info.leaf.next, newLeaf);
+}
+
+/* Frees a whole subtree, first taking its leaves (which are consecutive) out of the leaf chain.
+*/
+static void __CFStorageRemoveSubtree(CFAllocatorRef allocator, CFStorageNode *node) {
+    CFStorageNode *first = node, *last = node;
+    while (!first->isLeaf) first = first->info.notLeaf.child[0];
+    while (!last->isLeaf) last = last->info.notLeaf.child[last->info.notLeaf.numChildren - 1];
+    if (first->info.leaf.prev) CF_WRITE_BARRIER_ASSIGN(allocator, first->info.leaf.prev->info.leaf.next, last->info.leaf.next);
+    if (last->info.leaf.next) CF_WRITE_BARRIER_ASSIGN(allocator, last->info.leaf.next->info.leaf.prev, first->info.leaf.prev);
+    __CFStorageNodeDealloc(allocator, node, true);
+}
+
+/* Inserts newNode as child number childNum of node, moving the children from childNum on up one.
+*/
+static void __CFStorageInsertChild(CFAllocatorRef allocator, CFStorageNode *node, CFIndex childNum, CFStorageNode *newNode) {
+    CFIndex cnt;
+    for (cnt = node->info.notLeaf.numChildren; cnt > childNum; cnt--) {
+        CF_WRITE_BARRIER_ASSIGN(allocator, node->info.notLeaf.child[cnt], node->info.notLeaf.child[cnt - 1]);
+        node->info.notLeaf.childBytes[cnt] = node->info.notLeaf.childBytes[cnt - 1];
+    }
+    CF_WRITE_BARRIER_ASSIGN(allocator, node->info.notLeaf.child[childNum], newNode);
+    node->info.notLeaf.childBytes[childNum] = newNode->numBytes;
+    node->info.notLeaf.numChildren++;
+}
+
+/* Removes child number childNum from node (but does not free it), moving the children after it down one.
+*/
+static void __CFStorageRemoveChild(CFAllocatorRef allocator, CFStorageNode *node, CFIndex childNum) {
+    CFIndex cnt;
+    node->info.notLeaf.numChildren--;
+    for (cnt = childNum; cnt < node->info.notLeaf.numChildren; cnt++) {
+        CF_WRITE_BARRIER_ASSIGN(allocator, node->info.notLeaf.child[cnt], node->info.notLeaf.child[cnt + 1]);
+        node->info.notLeaf.childBytes[cnt] = node->info.notLeaf.childBytes[cnt + 1];
+    }
+    node->info.notLeaf.child[node->info.notLeaf.numChildren] = NULL;
+}
+
+static CFIndex __CFStorageSumChildBytes(CFStorageNode *node) {
+    CFIndex cnt, numBytes = 0;
+    for (cnt = 0; cnt < node->info.notLeaf.numChildren; cnt++) numBytes += node->info.notLeaf.childBytes[cnt];
+    return numBytes;
+}
+
+/* Moves the children of node from childNum on to the end of another node.
+*/
+static void __CFStorageMoveChildren(CFAllocatorRef allocator, CFStorageNode *node, CFIndex childNum, CFStorageNode *toNode) {
+    CFIndex cnt;
+    for (cnt = childNum; cnt < node->info.notLeaf.numChildren; cnt++) {
+        CFIndex toNum = toNode->info.notLeaf.numChildren++;
+        CF_WRITE_BARRIER_ASSIGN(allocator, toNode->info.notLeaf.child[toNum], node->info.notLeaf.child[cnt]);
+        toNode->info.notLeaf.childBytes[toNum] = node->info.notLeaf.childBytes[cnt];
+        node->info.notLeaf.child[cnt] = NULL;
+    }
+    node->info.notLeaf.numChildren = childNum;
+    node->numBytes = __CFStorageSumChildBytes(node);
+    toNode->numBytes = __CFStorageSumChildBytes(toNode);
+}
+
+/* Merges right, the sibling after left, into left if they are small enough together, returning whether it did. Leaves merge
+   when their bytes fit in half a leaf and other nodes when their children fit in half a node, so a merged node has room to grow
+   again before it splits.
+*/
+static bool __CFStorageMergeNodes(CFAllocatorRef allocator, CFStorageRef storage, CFStorageNode *left, CFStorageNode *right) {
+    if (left->isLeaf) {
+        CFIndex numBytes = left->numBytes + right->numBytes;
+        if (numBytes > storage->maxLeafCapacity / 2) return false;
+        // Leaves are allocated lazily; a leaf with no memory has no values worth keeping
+        if (right->info.leaf.memory) {
+            __CFStorageAllocLeafNodeMemory(allocator, storage, left, numBytes, false);
+            COPYMEM(right->info.leaf.memory, left->info.leaf.memory + left->numBytes, right->numBytes);
+        } else if (left->info.leaf.memory) {
+            __CFStorageAllocLeafNodeMemory(allocator, storage, left, numBytes, false);
+        }
+        left->numBytes = numBytes;
+        __CFStorageRemoveSubtree(allocator, right);
+    } else {
+        if (left->info.notLeaf.numChildren + right->info.notLeaf.numChildren > __CFStorageMaxChildren / 2) return false;
+        __CFStorageMoveChildren(allocator, right, 0, left);
+        _CFAllocatorDeallocateGC(allocator, right);
+    }
+    return true;
+}
+
 static CFIndex __CFStorageGetNumChildren(CFStorageNode *node) {
     if (!node || node->isLeaf) return 0;
-    if (node->info.notLeaf.child[2]) return 3;
-    if (node->info.notLeaf.child[1]) return 2;
-    if (node->info.notLeaf.child[0]) return 1;
-    return 0;
+    return node->info.notLeaf.numChildren;
 }
 
 /* The boolean compact indicates whether leaf nodes that get smaller should be realloced.
@@ -326,14 +370,15 @@ static void __CFStorageDelete(CFAllocatorRef allocator, CFStorageRef storage, CF
             COPYMEM(node->info.leaf.memory + range.location + range.length, node->info.leaf.memory + range.location, node->numBytes - range.location);
 	    if (compact) __CFStorageAllocLeafNodeMemory(allocator, storage, node, node->numBytes, true);
 	}
-   } else {
-        bool childrenAreLeaves = node->info.notLeaf.child[0]->isLeaf;
+    } else {
+        CFIndex childNum;
 	node->numBytes -= range.length;
 	while (range.length > 0) {
             CFRange rangeToDelete;
             CFIndex relativeByteNum;
-            CFIndex childNum;
-            __CFStorageFindChild(node, range.location + range.length, true, &childNum, &relativeByteNum);
+            CFStorageNode *child;
+            childNum = __CFStorageFindChild(node, range.location + range.length, true, &relativeByteNum);
+            child = node->info.notLeaf.child[childNum];
             if (range.length > relativeByteNum) {
                 rangeToDelete.length = relativeByteNum;
                 rangeToDelete.location = 0;
@@ -341,76 +386,24 @@ static void __CFStorageDelete(CFAllocatorRef allocator, CFStorageRef storage, CF
                 rangeToDelete.length = range.length;
                 rangeToDelete.location = relativeByteNum - range.length;
             }
-            __CFStorageDelete(allocator, storage, node->info.notLeaf.child[childNum], rangeToDelete, compact);
-            if (node->info.notLeaf.child[childNum]->numBytes == 0) {		// Delete empty node and compact
-                int cnt;
-                _CFAllocatorDeallocateGC(allocator, node->info.notLeaf.child[childNum]);
-                for (cnt = childNum; cnt < 2; cnt++) {
-                    CF_WRITE_BARRIER_ASSIGN(allocator, node->info.notLeaf.child[cnt], node->info.notLeaf.child[cnt+1]);
-                }
-                node->info.notLeaf.child[2] = NULL;
+            if (rangeToDelete.length == child->numBytes) {	// The whole child goes; no need to look inside
+                __CFStorageRemoveChild(allocator, node, childNum);
+                __CFStorageRemoveSubtree(allocator, child);
+            } else {
+                __CFStorageDelete(allocator, storage, child, rangeToDelete, compact);
+                node->info.notLeaf.childBytes[childNum] = child->numBytes;
             }
 	    range.length -= rangeToDelete.length;
 	}
-        // At this point the remaining children are packed
-        if (childrenAreLeaves) {
-            // Children are leaves; if their total bytes is smaller than a leaf's worth, collapse into one...
-            if (node->numBytes > 0 && node->numBytes <= storage->maxLeafCapacity) {
-                __CFStorageAllocLeafNodeMemory(allocator, storage, node->info.notLeaf.child[0], node->numBytes, false);
-                if (node->info.notLeaf.child[1] && node->info.notLeaf.child[1]->numBytes) {
-                    COPYMEM(node->info.notLeaf.child[1]->info.leaf.memory, node->info.notLeaf.child[0]->info.leaf.memory + node->info.notLeaf.child[0]->numBytes, node->info.notLeaf.child[1]->numBytes);
-                    if (node->info.notLeaf.child[2] && node->info.notLeaf.child[2]->numBytes) {
-                        COPYMEM(node->info.notLeaf.child[2]->info.leaf.memory, node->info.notLeaf.child[0]->info.leaf.memory + node->info.notLeaf.child[0]->numBytes + node->info.notLeaf.child[1]->numBytes, node->info.notLeaf.child[2]->numBytes);
-                        __CFStorageNodeDealloc(allocator, node->info.notLeaf.child[2], true);
-                        node->info.notLeaf.child[2] = NULL;
-                    }
-                    __CFStorageNodeDealloc(allocator, node->info.notLeaf.child[1], true);
-                    node->info.notLeaf.child[1] = NULL;
-                }
-                node->info.notLeaf.child[0]->numBytes = node->numBytes;
-            }
-        } else {
-            // Children are not leaves; combine their children to assure each node has 2 or 3 children...
-	    // (Could try to bypass all this by noting up above whether the number of grandchildren changed...)
-            CFStorageNode *gChildren[9];
-            CFIndex cCnt, gCnt, cnt;
-            CFIndex totalG = 0;	// Total number of grandchildren
-            for (cCnt = 0; cCnt < 3; cCnt++) {
-                CFStorageNode *child = node->info.notLeaf.child[cCnt];
-                if (child) {
-		    for (gCnt = 0; gCnt < 3; gCnt++) if (child->info.notLeaf.child[gCnt]) {
-                        gChildren[totalG++] = child->info.notLeaf.child[gCnt];
-                        child->info.notLeaf.child[gCnt] = NULL;
-                    }
-		    child->numBytes = 0;
-		}
+        // Merge children that have become small with their neighbors, to keep the tree from filling with near-empty nodes
+        childNum = 0;
+        while (childNum + 1 < node->info.notLeaf.numChildren) {
+            if (__CFStorageMergeNodes(allocator, storage, node->info.notLeaf.child[childNum], node->info.notLeaf.child[childNum + 1])) {
+                __CFStorageRemoveChild(allocator, node, childNum + 1);
+                node->info.notLeaf.childBytes[childNum] = node->info.notLeaf.child[childNum]->numBytes;
+            } else {
+                childNum++;
             }
-            gCnt = 0;	// Total number of grandchildren placed
-	    for (cCnt = 0; cCnt < 3; cCnt++) {
-                // These tables indicate how many children each child should have, given the total number of grandchildren (last child gets remainder)
-                static const unsigned char forChild0[10] = {0, 1, 2, 3, 2, 3, 3, 3, 3, 3};
-                static const unsigned char forChild1[10] = {0, 0, 0, 0, 2, 2, 3, 2, 3, 3};
-		// sCnt is the number of grandchildren to be placed into child cCnt
-		// Depending on child number, pick the right number
-                CFIndex sCnt = (cCnt == 0) ? forChild0[totalG] : ((cCnt == 1) ? forChild1[totalG] : totalG);
-		// Assure we have that many grandchildren...
-		if (sCnt > totalG - gCnt) sCnt = totalG - gCnt;
-                if (sCnt) {
-                    if (!node->info.notLeaf.child[cCnt]) {
-                        CFStorageNode *newNode = __CFStorageCreateNode(allocator, false, 0);
-                        CF_WRITE_BARRIER_ASSIGN(allocator, node->info.notLeaf.child[cCnt], newNode);
-                    }
-                    for (cnt = 0; cnt < sCnt; cnt++) {
-                        node->info.notLeaf.child[cCnt]->numBytes += gChildren[gCnt]->numBytes;
-                        CF_WRITE_BARRIER_ASSIGN(allocator, node->info.notLeaf.child[cCnt]->info.notLeaf.child[cnt], gChildren[gCnt++]);
-                    }
-                } else {
-                    if (node->info.notLeaf.child[cCnt]) {
-                        _CFAllocatorDeallocateGC(allocator, node->info.notLeaf.child[cCnt]);
-                        node->info.notLeaf.child[cCnt] = NULL;
-                    }
-                }
-	    }
         }
     }
 }
@@ -424,12 +417,14 @@ static CFStorageNode *__CFStorageInsert(CFAllocatorRef allocator, CFStorageRef s
         if (size + node->numBytes > storage->maxLeafCapacity) {	// Need to create more child nodes
             if (byteNum == node->numBytes) {	// Inserting at end; easy...
                 CFStorageNode *newNode = __CFStorageCreateNode(allocator, true, size);
+                __CFStorageLinkLeafAfter(allocator, node, newNode);
                 __CFStorageSetCache(storage, newNode, absoluteByteNum / storage->valueSize, size / storage->valueSize);
                 return newNode;
-            } else if (byteNum == 0) {	// Inserting at front; also easy, but we need to swap node and newNode
-                CFStorageNode *newNode = __CFStorageCreateNode(allocator, true, 0);
-                CF_WRITE_BARRIER_MEMMOVE(newNode, node, sizeof(CFStorageNode));
-                node->isLeaf = true;
+            } else if (byteNum == 0) {	// Inserting at front; also easy, but the new node gets the old contents, as it comes after node
+                CFStorageNode *newNode = __CFStorageCreateNode(allocator, true, node->numBytes);
+                newNode->info.leaf.capacityInBytes = node->info.leaf.capacityInBytes;
+                CF_WRITE_BARRIER_ASSIGN(allocator, newNode->info.leaf.memory, node->info.leaf.memory);
+                __CFStorageLinkLeafAfter(allocator, node, newNode);
                 node->numBytes = size;
                 node->info.leaf.capacityInBytes = 0;
                 node->info.leaf.memory = NULL;
@@ -443,6 +438,7 @@ static CFStorageNode *__CFStorageInsert(CFAllocatorRef allocator, CFStorageRef s
                     COPYMEM(node->info.leaf.memory + byteNum, newNode->info.leaf.memory, node->numBytes - byteNum);
                     __CFStorageAllocLeafNodeMemory(allocator, storage, node, byteNum + size, false);
                 }
+                __CFStorageLinkLeafAfter(allocator, node, newNode);
                 node->numBytes = byteNum + size;
                 __CFStorageSetCache(storage, node, (absoluteByteNum - byteNum) / storage->valueSize, node->numBytes / storage->valueSize);
                 return newNode;
@@ -453,6 +449,7 @@ static CFStorageNode *__CFStorageInsert(CFAllocatorRef allocator, CFStorageRef s
                     COPYMEM(node->info.leaf.memory + byteNum, newNode->info.leaf.memory + byteNum + size - storage->maxLeafCapacity, node->numBytes - byteNum);
                     __CFStorageAllocLeafNodeMemory(allocator, storage, node, storage->maxLeafCapacity, false);
                 }
+                __CFStorageLinkLeafAfter(allocator, node, newNode);
                 node->numBytes = storage->maxLeafCapacity;
                 __CFStorageSetCache(storage, node, (absoluteByteNum - byteNum) / storage->valueSize, node->numBytes / storage->valueSize);
                 return newNode;
@@ -470,50 +467,41 @@ static CFStorageNode *__CFStorageInsert(CFAllocatorRef allocator, CFStorageRef s
         CFIndex relativeByteNum;
         CFIndex childNum;
         CFStorageNode *newNode;
-        __CFStorageFindChild(node, byteNum, true, &childNum, &relativeByteNum);
+        childNum = __CFStorageFindChild(node, byteNum, true, &relativeByteNum);
         newNode = __CFStorageInsert(allocator, storage, node->info.notLeaf.child[childNum], relativeByteNum, size, absoluteByteNum);
+        node->info.notLeaf.childBytes[childNum] = node->info.notLeaf.child[childNum]->numBytes;
+        node->numBytes += size;
         if (newNode) {
-            if (node->info.notLeaf.child[2] == NULL) {	// There's an empty slot for the new node, cool
-                if (childNum == 0) CF_WRITE_BARRIER_ASSIGN(allocator, node->info.notLeaf.child[2], node->info.notLeaf.child[1]);	// Make room
-                CF_WRITE_BARRIER_ASSIGN(allocator, node->info.notLeaf.child[childNum + 1], newNode);
-                node->numBytes += size;
-                return NULL;
-            } else {
-                CFStorageNode *anotherNode = __CFStorageCreateNode(allocator, false, 0);	// Create another node
-                if (childNum == 0) {	// Last two children go to new node
-                    CF_WRITE_BARRIER_ASSIGN(allocator, anotherNode->info.notLeaf.child[0], node->info.notLeaf.child[1]);
-                    CF_WRITE_BARRIER_ASSIGN(allocator, anotherNode->info.notLeaf.child[1], node->info.notLeaf.child[2]);
-                    CF_WRITE_BARRIER_ASSIGN(allocator, node->info.notLeaf.child[1], newNode);
-                    node->info.notLeaf.child[2] = NULL;
-                } else if (childNum == 1) {	// Last child goes to new node
-                    CF_WRITE_BARRIER_ASSIGN(allocator, anotherNode->info.notLeaf.child[0], newNode);
-                    CF_WRITE_BARRIER_ASSIGN(allocator, anotherNode->info.notLeaf.child[1], node->info.notLeaf.child[2]);
-                    node->info.notLeaf.child[2] = NULL;
-                } else {	// New node contains the new comers...
-                    CF_WRITE_BARRIER_ASSIGN(allocator, anotherNode->info.notLeaf.child[0], node->info.notLeaf.child[2]);
-                    CF_WRITE_BARRIER_ASSIGN(allocator, anotherNode->info.notLeaf.child[1], newNode);
-                    node->info.notLeaf.child[2] = NULL;
+            if (node->info.notLeaf.numChildren < __CFStorageMaxChildren) {	// There's an empty slot for the new node, cool
+                __CFStorageInsertChild(allocator, node, childNum + 1, newNode);
+            } else {	// Split in two, the second half going to another node
+                CFStorageNode *anotherNode = __CFStorageCreateNode(allocator, false, 0);
+                if (childNum + 1 <= __CFStorageMaxChildren / 2) {
+                    __CFStorageMoveChildren(allocator, node, __CFStorageMaxChildren / 2, anotherNode);
+                    __CFStorageInsertChild(allocator, node, childNum + 1, newNode);
+                    node->numBytes += newNode->numBytes;
+                } else {
+                    __CFStorageMoveChildren(allocator, node, __CFStorageMaxChildren / 2 + 1, anotherNode);
+                    __CFStorageInsertChild(allocator, anotherNode, childNum + 1 - (__CFStorageMaxChildren / 2 + 1), newNode);
+                    anotherNode->numBytes += newNode->numBytes;
                 }
-                node->numBytes = node->info.notLeaf.child[0]->numBytes + node->info.notLeaf.child[1]->numBytes;
-                anotherNode->numBytes = anotherNode->info.notLeaf.child[0]->numBytes + anotherNode->info.notLeaf.child[1]->numBytes;
                 return anotherNode;
             }
-        } else {
-            node->numBytes += size;
         }
     }
     return NULL;
 }
 
 CF_INLINE CFIndex __CFStorageGetCount(CFStorageRef storage) {
-    return storage->rootNode.numBytes / storage->valueSize;
+    return storage->rootNode->numBytes / storage->valueSize;
 }
 
 static Boolean __CFStorageEqual(CFTypeRef cf1, CFTypeRef cf2) {
     CFStorageRef storage1 = (CFStorageRef)cf1;
     CFStorageRef storage2 = (CFStorageRef)cf2;
     CFIndex loc, count, valueSize;
-    CFRange range1, range2;
+    CFIndex length1, length2;
+    CFStorageNode *node1, *node2;
     uint8_t *ptr1, *ptr2;
 
     count = __CFStorageGetCount(storage1);
@@ -522,19 +510,21 @@ static Boolean __CFStorageEqual(CFTypeRef cf1, CFTypeRef cf2) {
     valueSize = __CFStorageGetValueSize(storage1);
     if (valueSize != __CFStorageGetValueSize(storage2)) return false;
 
-    loc = range1.location = range1.length = range2.location = range2.length = 0;
+    count *= valueSize;
+    loc = length1 = length2 = 0;
+    node1 = node2 = NULL;
     ptr1 = ptr2 = NULL;
 
     while (loc < count) {
 	CFIndex cntThisTime;
-	if (loc >= range1.location + range1.length) ptr1 = (uint8_t *)CFStorageGetValueAtIndex(storage1, loc, &range1);
-	if (loc >= range2.location + range2.length) ptr2 = (uint8_t *)CFStorageGetValueAtIndex(storage2, loc, &range2);
-	cntThisTime = range1.location + range1.length;
-	if (range2.location + range2.length < cntThisTime) cntThisTime = range2.location + range2.length;
-	cntThisTime -= loc;
-	if (memcmp(ptr1, ptr2, valueSize * cntThisTime) != 0) return false;
-	ptr1 += valueSize * cntThisTime;
-	ptr2 += valueSize * cntThisTime;
+	if (0 == length1) ptr1 = __CFStorageGetRun(storage1, &node1, loc, &length1);
+	if (0 == length2) ptr2 = __CFStorageGetRun(storage2, &node2, loc, &length2);
+	cntThisTime = (length1 < length2) ? length1 : length2;
+	if (memcmp(ptr1, ptr2, cntThisTime) != 0) return false;
+	ptr1 += cntThisTime;
+	ptr2 += cntThisTime;
+	length1 -= cntThisTime;
+	length2 -= cntThisTime;
 	loc += cntThisTime;
     }
     return true;
@@ -546,25 +536,27 @@ static CFHashCode __CFStorageHash(CFTypeRef cf) {
 }
 
 static void __CFStorageDescribeNode(CFStorageNode *node, CFMutableStringRef str, CFIndex level) {
-    int cnt;
+    CFIndex cnt;
     for (cnt = 0; cnt < level; cnt++) CFStringAppendCString(str, "  ", CFStringGetSystemEncoding());
 
     if (node->isLeaf) {
         CFStringAppendFormat(str, NULL, CFSTR("Leaf %d/%d\n"), node->numBytes, node->info.leaf.capacityInBytes);
     } else {
         CFStringAppendFormat(str, NULL, CFSTR("Node %d\n"), node->numBytes);
-        for (cnt = 0; cnt < 3; cnt++) if (node->info.notLeaf.child[cnt]) __CFStorageDescribeNode(node->info.notLeaf.child[cnt], str, level+1);
+        for (cnt = 0; cnt < node->info.notLeaf.numChildren; cnt++) __CFStorageDescribeNode(node->info.notLeaf.child[cnt], str, level+1);
     }
 }
 
 static CFIndex __CFStorageGetNodeCapacity(CFStorageNode *node) {
+    CFIndex cnt, capacity = 0;
     if (!node) return 0;
     if (node->isLeaf) return node->info.leaf.capacityInBytes;
-    return __CFStorageGetNodeCapacity(node->info.notLeaf.child[0]) + __CFStorageGetNodeCapacity(node->info.notLeaf.child[1]) + __CFStorageGetNodeCapacity(node->info.notLeaf.child[2]);
+    for (cnt = 0; cnt < node->info.notLeaf.numChildren; cnt++) capacity += __CFStorageGetNodeCapacity(node->info.notLeaf.child[cnt]);
+    return capacity;
 }
 
 CFIndex __CFStorageGetCapacity(CFStorageRef storage) {
-    return __CFStorageGetNodeCapacity(&storage->rootNode) / storage->valueSize;
+    return __CFStorageGetNodeCapacity(storage->rootNode) / storage->valueSize;
 }
 
 CFIndex __CFStorageGetValueSize(CFStorageRef storage) {
@@ -577,7 +569,7 @@ static CFStringRef __CFStorageCopyDescription(CFTypeRef cf) {
     CFAllocatorRef allocator = CFGetAllocator(storage);
     result = CFStringCreateMutable(allocator, 0);
     CFStringAppendFormat(result, NULL, CFSTR("<CFStorage %p [%p]>[count = %u, capacity = %u]\n"), storage, allocator, __CFStorageGetCount(storage), __CFStorageGetCapacity(storage));
-    __CFStorageDescribeNode(&storage->rootNode, result, 0);
+    __CFStorageDescribeNode(storage->rootNode, result, 0);
     return result;
 }
 
@@ -585,7 +577,7 @@ static void __CFStorageDeallocate(CFTypeRef cf) {
     CFStorageRef storage = (CFStorageRef)cf;
     CFAllocatorRef allocator = CFGetAllocator(storage);
     if (CF_IS_COLLECTABLE_ALLOCATOR(allocator)) return; // XXX_PCB GC will take care of us.
-    __CFStorageNodeDealloc(allocator, &storage->rootNode, false);
+    __CFStorageNodeDealloc(allocator, storage->rootNode, true);
 }
 
 static CFTypeID __kCFStorageTypeID = _kCFRuntimeNotATypeID;
@@ -598,7 +590,7 @@ static const CFRuntimeClass __CFStorageClass = {
     __CFStorageDeallocate,
     __CFStorageEqual,
     __CFStorageHash,
-    NULL,	// 
+    NULL,	//
     __CFStorageCopyDescription
 };
 
@@ -617,24 +609,16 @@ CFStorageRef CFStorageCreate(CFAllocatorRef allocator, CFIndex valueSize) {
     }
     storage->valueSize = valueSize;
     CF_SPINLOCK_INIT_FOR_STRUCTS(storage->cacheReaderMemoryAllocationLock);
-    storage->cacheGenerationCount = 0;
-    storage->cacheParts.locationHi = 0;
-    storage->cacheParts.locationLo = 0;
-#if POSSIBLE_TO_HAVE_LENGTH_MORE_THAN_HALFWORD
-    storage->cacheParts.lengthHi = 0;
-#endif
-    storage->cacheParts.lengthLo = 0;
-    storage->cacheParts.cachedNodeHi = 0;
-    storage->cacheParts.cachedNodeLo = 0;
+    storage->serial = _CFAtomicIncrement64(&__CFStorageLastSerial);
+    storage->mutations = 0;
     storage->maxLeafCapacity = __CFStorageMaxLeafCapacity;
-    if (valueSize && ((storage->maxLeafCapacity % valueSize) != 0)) {	
+    if (valueSize && ((storage->maxLeafCapacity % valueSize) != 0)) {
         storage->maxLeafCapacity = (storage->maxLeafCapacity / valueSize) * valueSize;	// Make it fit perfectly (3406853)
     }
-    memset(&(storage->rootNode), 0, sizeof(CFStorageNode));
-    storage->rootNode.isLeaf = true;
     storage->nodeHint = __kCFAllocatorGCScannedMemory;
+    CF_WRITE_BARRIER_BASE_ASSIGN(allocator, storage, storage->rootNode, __CFStorageCreateNode(allocator, true, 0));
     if (__CFOASafe) __CFSetLastAllocationEventName(storage, "CFStorage");
-    return storage;    
+    return storage;
 }
 
 CFTypeID CFStorageGetTypeID(void) {
@@ -666,21 +650,14 @@ void CFStorageInsertValues(CFStorageRef storage, CFRange range) {
         if (insertThisTime > storage->maxLeafCapacity) {
             insertThisTime = (storage->maxLeafCapacity / storage->valueSize) * storage->valueSize;
         }
-        newNode = __CFStorageInsert(allocator, storage, &storage->rootNode, byteNum, insertThisTime, byteNum);
-        if (newNode) {
-            CFStorageNode *tempRootNode = __CFStorageCreateNode(allocator, false, 0);	// Will copy the (static) rootNode over to this
-            CF_WRITE_BARRIER_MEMMOVE(tempRootNode, &storage->rootNode, sizeof(CFStorageNode));
-            storage->rootNode.isLeaf = false;
-            CF_WRITE_BARRIER_BASE_ASSIGN(allocator, storage, storage->rootNode.info.notLeaf.child[0], tempRootNode);
-            CF_WRITE_BARRIER_BASE_ASSIGN(allocator, storage, storage->rootNode.info.notLeaf.child[1], newNode);
-            storage->rootNode.info.notLeaf.child[2] = NULL;
-            storage->rootNode.numBytes = tempRootNode->numBytes + newNode->numBytes;
-#if 1
-	    // ???
-	    __CFStorageSetCache(storage, NULL, 0, 0);
-#else
-            if (storage->cache.cachedNode == &(storage->rootNode)) CF_WRITE_BARRIER_BASE_ASSIGN(allocator, storage, storage->cache.cachedNode, tempRootNode);	// The cache should follow the node
-#endif
+        storage->mutations++;	// Before the insertion, which caches the leaf it changes
+        newNode = __CFStorageInsert(allocator, storage, storage->rootNode, byteNum, insertThisTime, byteNum);
+        if (newNode) {	// The root split; the two halves go under a new root
+            CFStorageNode *newRootNode = __CFStorageCreateNode(allocator, false, 0);
+            __CFStorageInsertChild(allocator, newRootNode, 0, storage->rootNode);
+            __CFStorageInsertChild(allocator, newRootNode, 1, newNode);
+            newRootNode->numBytes = storage->rootNode->numBytes + newNode->numBytes;
+            CF_WRITE_BARRIER_BASE_ASSIGN(allocator, storage, storage->rootNode, newRootNode);
 	}
         numBytesToInsert -= insertThisTime;
         byteNum += insertThisTime;
@@ -694,53 +671,59 @@ void CFStorageDeleteValues(CFStorageRef storage, CFRange range) {
     CFAllocatorRef allocator = CFGetAllocator(storage);
     range.location *= storage->valueSize;
     range.length *= storage->valueSize;
-    __CFStorageDelete(allocator, storage, &storage->rootNode, range, true);
-    while (__CFStorageGetNumChildren(&storage->rootNode) == 1) {
-        CFStorageNode *child = storage->rootNode.info.notLeaf.child[0];	// The single child
-        CF_WRITE_BARRIER_MEMMOVE(&storage->rootNode, child, sizeof(CFStorageNode));
-        _CFAllocatorDeallocateGC(allocator, child);
+    if (range.length <= 0) return;
+    storage->mutations++;
+    __CFStorageDelete(allocator, storage, storage->rootNode, range, true);
+    while (__CFStorageGetNumChildren(storage->rootNode) == 1) {
+        CFStorageNode *child = storage->rootNode->info.notLeaf.child[0];	// The single child
+        _CFAllocatorDeallocateGC(allocator, storage->rootNode);
+        CF_WRITE_BARRIER_BASE_ASSIGN(allocator, storage, storage->rootNode, child);
     }
-    if (__CFStorageGetNumChildren(&storage->rootNode) == 0 && !storage->rootNode.isLeaf) {
-	storage->rootNode.isLeaf = true;
-	storage->rootNode.info.leaf.capacityInBytes = 0;
-	storage->rootNode.info.leaf.memory = NULL;
+    if (__CFStorageGetNumChildren(storage->rootNode) == 0 && !storage->rootNode->isLeaf) {	// Everything was deleted
+        _CFAllocatorDeallocateGC(allocator, storage->rootNode);
+        CF_WRITE_BARRIER_BASE_ASSIGN(allocator, storage, storage->rootNode, __CFStorageCreateNode(allocator, true, 0));
     }
-    // !!! Need to update the cache
-    __CFStorageSetCache(storage, NULL, 0, 0);
 }
 
 void CFStorageGetValues(CFStorageRef storage, CFRange range, void *values) {
-    while (range.length > 0) {
-        CFRange leafRange;
-        void *storagePtr = __CFStorageGetValueAtIndex(storage, range.location, &leafRange);
-        CFIndex cntThisTime = range.length;
-        if (cntThisTime > leafRange.length - (range.location - leafRange.location)) cntThisTime = leafRange.length - (range.location - leafRange.location);
-        COPYMEM(storagePtr, values, cntThisTime * storage->valueSize);
-        values = (uint8_t *)values + (cntThisTime * storage->valueSize);
-        range.location += cntThisTime;
-        range.length -= cntThisTime;
+    CFStorageNode *node = NULL;
+    CFIndex byteNum = range.location * storage->valueSize;
+    CFIndex numBytes = range.length * storage->valueSize;
+    while (numBytes > 0) {
+        CFIndex cntThisTime;
+        void *storagePtr = __CFStorageGetRun(storage, &node, byteNum, &cntThisTime);
+        if (cntThisTime > numBytes) cntThisTime = numBytes;
+        COPYMEM(storagePtr, values, cntThisTime);
+        values = (uint8_t *)values + cntThisTime;
+        byteNum += cntThisTime;
+        numBytes -= cntThisTime;
     }
 }
 
 unsigned long _CFStorageFastEnumeration(CFStorageRef storage, struct __objcFastEnumerationStateEquivalent *state, void *stackbuffer, unsigned long count) {
-    // without trying to understand the data structure, each time through search for block containing index
-    CFRange leafRange;
+    // Each call returns the values of one leaf; extra[1] remembers the leaf, so the next call can follow the leaf chain
+    CFStorageNode *node;
+    CFIndex length;
     if (state->state == 0) { /* first time, get length */
         state->extra[0] = __CFStorageGetCount(storage);
+        state->extra[1] = 0;
     }
     if (state->state >= state->extra[0]) return 0;
-    state->itemsPtr = (unsigned long *)CFStorageGetValueAtIndex(storage, state->state, &leafRange);
-    state->state += leafRange.length;
-    return leafRange.length;
+    node = (CFStorageNode *)state->extra[1];
+    state->itemsPtr = (unsigned long *)__CFStorageGetRun(storage, &node, state->state * storage->valueSize, &length);
+    state->extra[1] = (unsigned long)node;
+    length /= storage->valueSize;
+    state->state += length;
+    return length;
 }
 
 void CFStorageApplyFunction(CFStorageRef storage, CFRange range, CFStorageApplierFunction applier, void *context) {
+    CFStorageNode *node = NULL;
     while (0 < range.length) {
-        CFRange leafRange;
         const void *storagePtr;
         CFIndex idx, cnt;
-        storagePtr = CFStorageGetValueAtIndex(storage, range.location, &leafRange);
-        cnt = __CFMin(range.length, leafRange.location + leafRange.length - range.location);
+        storagePtr = __CFStorageGetRun(storage, &node, range.location * storage->valueSize, &cnt);
+        cnt = __CFMin(range.length, cnt / storage->valueSize);
         for (idx = 0; idx < cnt; idx++) {
             applier(storagePtr, context);
             storagePtr = (const char *)storagePtr + storage->valueSize;
@@ -751,15 +734,17 @@ void CFStorageApplyFunction(CFStorageRef storage, CFRange range, CFStorageApplie
 }
 
 void CFStorageReplaceValues(CFStorageRef storage, CFRange range, const void *values) {
-    while (range.length > 0) {
-        CFRange leafRange;
-        void *storagePtr = __CFStorageGetValueAtIndex(storage, range.location, &leafRange);
-        CFIndex cntThisTime = range.length;
-        if (cntThisTime > leafRange.length - (range.location - leafRange.location)) cntThisTime = leafRange.length - (range.location - leafRange.location);
-        COPYMEM(values, storagePtr, cntThisTime * storage->valueSize);
-		values = (const uint8_t *)values + (cntThisTime * storage->valueSize);
-        range.location += cntThisTime;
-        range.length -= cntThisTime;
+    CFStorageNode *node = NULL;
+    CFIndex byteNum = range.location * storage->valueSize;
+    CFIndex numBytes = range.length * storage->valueSize;
+    while (numBytes > 0) {
+        CFIndex cntThisTime;
+        void *storagePtr = __CFStorageGetRun(storage, &node, byteNum, &cntThisTime);
+        if (cntThisTime > numBytes) cntThisTime = numBytes;
+        COPYMEM(values, storagePtr, cntThisTime);
+	values = (const uint8_t *)values + cntThisTime;
+        byteNum += cntThisTime;
+        numBytes -= cntThisTime;
     }
 }
 
@@ -769,18 +754,15 @@ static void __CFStorageNodeSetLayoutType(CFStorageNode *node, auto_zone_t *zone,
     if (node->isLeaf) {
         auto_zone_set_layout_type(zone, node->info.leaf.memory, type);
     } else {
-        CFStorageNode **children = node->info.notLeaf.child;
-        if (children[0]) __CFStorageNodeSetLayoutType(children[0], zone, type);
-        if (children[1]) __CFStorageNodeSetLayoutType(children[1], zone, type);
-        if (children[2]) __CFStorageNodeSetLayoutType(children[2], zone, type);
+        CFIndex cnt;
+        for (cnt = 0; cnt < node->info.notLeaf.numChildren; cnt++) __CFStorageNodeSetLayoutType(node->info.notLeaf.child[cnt], zone, type);
     }
 }
 
 __private_extern__ void _CFStorageSetWeak(CFStorageRef storage) {
     storage->nodeHint = 0;
-    __CFStorageNodeSetLayoutType(&storage->rootNode, __CFCollectableZone, CF_GET_GC_MEMORY_TYPE(storage->nodeHint));
+    __CFStorageNodeSetLayoutType(storage->rootNode, __CFCollectableZone, CF_GET_GC_MEMORY_TYPE(storage->nodeHint));
 }
 
 #undef COPYMEM
 #undef PAGE_LIMIT
-
@@ -43,12 +43,16 @@ CFStorage uses a balanced tree to store the values, and is most appropriate
 for situations where potentially a large number values (more than a hundred
 bytes' worth) will be stored and there will be a lot of editing (insertions and deletions).
 
-Getting to an item is O(log n), although caching the last result often reduces this
-to a constant time.
-
-The overhead of CFStorage is 48 bytes. There is no per item overhead; the 
-non-leaf nodes in the tree cost 20 bytes each, and the worst case extra
-capacity (unused space in the leaves) is 12%, typically much less.
+Getting to an item is O(log n), although caching the last result (separately for
+each thread) often reduces this to a constant time. Getting, replacing or applying a
+function to a range of values costs one search plus constant time per leaf.
+
+The overhead of CFStorage is 48 bytes plus one node. There is no per item overhead;
+the nodes in the tree cost 280 bytes each (a full leaf holds 12K of values, and a
+non-leaf node up to 16 children). Leaves get memory for their values in steps of 64
+bytes, or of a page past 2K, and give it back as values are deleted. There is no
+fixed bound on the unused space in the leaves: a leaf is split where values are
+inserted, and is merged with its neighbor only once both fit in half a leaf.
 
 Because CFStorage does not necessarily use a single block of memory to store the values,
 when you ask for a value, you get back the pointer to the value and optionally
@@ -49,6 +49,8 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <unicode/uloc.h>
+#include <unicode/ucol.h>
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX || DEPLOYMENT_TARGET_FREEBSD
 #include <unistd.h>
 #else
@@ -160,7 +162,7 @@ struct __notInlineMutable {
     void *buffer;
     CFIndex length;
         CFIndex capacity;                           // Capacity in bytes
-    unsigned int hasGap:1;                      // Currently unused
+    unsigned int hasGap:1;                      // Characters [gapLocation, gapLocation + gapLength) of the buffer are unused; see __CFStrCloseGap()
     unsigned int isFixedCapacity:1;
     unsigned int isExternalMutable:1;
     unsigned int capacityProvidedExternally:1;
@@ -169,6 +171,8 @@ struct __notInlineMutable {
 #else
     unsigned long desiredCapacity:28;
 #endif
+    CFIndex gapLocation;                        // In characters; only meaningful if hasGap
+    CFIndex gapLength;                          // In characters; only meaningful if hasGap
     CFAllocatorRef contentsAllocator;           // Optional
 };                             // The only mutable variant for CFString
 
@@ -377,7 +381,20 @@ CF_INLINE Boolean __CFStrIsExternalMutable(CFStringRef str)	{return str->variant
 CF_INLINE Boolean __CFStrHasContentsAllocator(CFStringRef str)	{return (str->base._cfinfo[CF_INFO_BITS] & __kCFHasContentsAllocatorMask) == __kCFHasContentsAllocator;}
 CF_INLINE void __CFStrSetIsFixed(CFMutableStringRef str)		    {str->variants.notInlineMutable.isFixedCapacity = 1;}
 CF_INLINE void __CFStrSetIsExternalMutable(CFMutableStringRef str)	    {str->variants.notInlineMutable.isExternalMutable = 1;}
+CF_INLINE Boolean __CFStrHasGap(CFStringRef str)			{return str->variants.notInlineMutable.hasGap;}
+CF_INLINE Boolean __CFStrIsGapped(CFStringRef str)			{return __CFStrIsMutable(str) && __CFStrHasGap(str);}
 CF_INLINE void __CFStrSetHasGap(CFMutableStringRef str)			    {str->variants.notInlineMutable.hasGap = 1;}
+CF_INLINE void __CFStrClearHasGap(CFMutableStringRef str)		    {str->variants.notInlineMutable.hasGap = 0;}
+
+static void __CFStrCloseGap(CFMutableStringRef str);
+static void __CFStrCopyContents(CFStringRef str, CFRange range, void *buffer, Boolean asCharacters);
+
+/* Returns ptr to the buffer of a mutable string that is about to be changed in place (which might include the length byte); any gap is closed first
+*/
+CF_INLINE void *__CFStrMutableContents(CFMutableStringRef str) {
+    if (__CFStrHasGap(str)) __CFStrCloseGap(str);
+    return str->variants.notInlineMutable.buffer;
+}
 
 // If capacity is provided externally, we only change it when we need to grow beyond it
 CF_INLINE Boolean __CFStrCapacityProvidedExternally(CFStringRef str)   		{return str->variants.notInlineMutable.capacityProvidedExternally;}
@@ -773,7 +790,7 @@ static void __CFStringHandleOutOfMemory(CFTypeRef obj) {
 /* Reallocates the backing store of the string to accomodate the new length. Space is reserved or characters are deleted as indicated by insertLength and the ranges in deleteRanges. The length is updated to reflect the new state. Will also maintain a length byte and a null byte in 8-bit strings. If length cannot fit in length byte, the space will still be reserved, but will be 0. (Hence the reason the length byte should never be looked at as length unless there is no explicit length.)
 */
 static void __CFStringChangeSizeMultiple(CFMutableStringRef str, const CFRange *deleteRanges, CFIndex numDeleteRanges, CFIndex insertLength, Boolean makeUnicode) {
-    const uint8_t *curContents = (uint8_t *)__CFStrContents(str);
+    const uint8_t *curContents = (uint8_t *)__CFStrMutableContents(str);
     CFIndex curLength = curContents ? __CFStrLength2(str, curContents) : 0;
     CFIndex newLength;
     
@@ -892,6 +909,95 @@ CF_INLINE void __CFStringChangeSize(CFMutableStringRef str, CFRange range, CFInd
     __CFStringChangeSizeMultiple(str, &range, 1, insertLength, makeUnicode);
 }
 
+/* Large mutable strings edited away from their end keep the unused part of their buffer as a "gap" at the last edit point, so a run of
+   nearby inserts and deletes moves only the characters between consecutive edits, rather than the whole tail of the string each time.
+   Characters at and after gapLocation sit gapLength characters further into the buffer than usual. Readers go across the gap without
+   changing the string (see __CFStrCopyContents()), and CFStringGetCharactersPtr() returns NULL while there is a gap; only in-place
+   mutations close it (__CFStrMutableContents()), so reads never write to the string.
+*/
+#if !defined(CF_STRING_MIN_GAP_LENGTH)
+#define CF_STRING_MIN_GAP_LENGTH 16384
+#endif
+
+static void __CFStrCloseGap(CFMutableStringRef str) {
+    CFIndex charSize = __CFStrIsUnicode(str) ? sizeof(UniChar) : sizeof(uint8_t);
+    uint8_t *contents = (uint8_t *)str->variants.notInlineMutable.buffer + __CFStrSkipAnyLengthByte(str);
+    CFIndex gapLocation = str->variants.notInlineMutable.gapLocation;
+    CFIndex gapLength = str->variants.notInlineMutable.gapLength;
+    CFIndex tailLength = __CFStrLength(str) - gapLocation;
+    memmove(contents + gapLocation * charSize, contents + (gapLocation + gapLength) * charSize, tailLength * charSize + (__CFStrHasNullByte(str) ? 1 : 0));	// Null byte, if any, goes along with the tail
+    __CFStrClearHasGap(str);
+}
+
+/* Same as __CFStringChangeSize() for one range, but leaves a gap after the inserted characters; returns false (doing nothing) if the string is not suitable.
+   On return, characters [0, range.location + insertLength) are contiguous at the start of the buffer (past any length byte).
+*/
+static Boolean __CFStringChangeSizeWithGap(CFMutableStringRef str, CFRange range, CFIndex insertLength, Boolean makeUnicode) {
+    CFIndex curLength = __CFStrLength(str);
+    CFIndex charSize, skip, nullBytes, gapLocation, gapLength, newLength;
+    uint8_t *contents;
+
+    if (__CFStrIsExternalMutable(str) || __CFStrIsFixed(str) || __CFStrCapacityProvidedExternally(str)) return false;
+    if (makeUnicode && !__CFStrIsUnicode(str)) return false;
+    if (!__CFStrHasGap(str) && (curLength < CF_STRING_MIN_GAP_LENGTH || range.location + range.length == curLength)) return false;	// Edits at the end don't move anything
+
+    charSize = __CFStrIsUnicode(str) ? sizeof(UniChar) : sizeof(uint8_t);
+    skip = __CFStrSkipAnyLengthByte(str);
+    nullBytes = __CFStrHasNullByte(str) ? 1 : 0;
+    contents = (uint8_t *)str->variants.notInlineMutable.buffer + skip;
+    newLength = curLength - range.length + insertLength;
+
+    if (__CFStrHasGap(str)) {
+        gapLocation = str->variants.notInlineMutable.gapLocation;
+        gapLength = str->variants.notInlineMutable.gapLength;
+    } else {	// Turn the spare room at the end of the buffer into the gap; moving the null byte to the end keeps it after the (empty) tail
+        gapLocation = curLength;
+        gapLength = (__CFStrCapacity(str) - skip - nullBytes) / charSize - curLength;
+        if (nullBytes) contents[(curLength + gapLength) * charSize] = 0;
+    }
+
+    // Move the gap to the edit point, then swallow the deleted characters
+    if (range.location < gapLocation) {
+        memmove(contents + (range.location + gapLength) * charSize, contents + range.location * charSize, (gapLocation - range.location) * charSize);
+    } else if (range.location > gapLocation) {
+        memmove(contents + gapLocation * charSize, contents + (gapLocation + gapLength) * charSize, (range.location - gapLocation) * charSize);
+    }
+    gapLocation = range.location;
+    gapLength += range.length;
+    curLength -= range.length;
+
+    str->variants.notInlineMutable.gapLocation = gapLocation;
+    str->variants.notInlineMutable.gapLength = gapLength;
+    __CFStrSetExplicitLength(str, curLength);
+    __CFStrSetHasGap(str);
+
+    if (gapLength < insertLength) {	// Grow; the new buffer gets the extra room as its gap
+        CFIndex curCapacity = __CFStrCapacity(str);
+        CFIndex newCapacity = __CFStrNewCapacity(str, skip + newLength * charSize + nullBytes, curCapacity, true, charSize);
+        CFIndex tailBytes = (curLength - gapLocation) * charSize + nullBytes;
+        CFIndex newGapLength;
+        uint8_t *newContents = (uint8_t *)__CFStrAllocateMutableContents(str, newCapacity);
+        if (!newContents) {	// The deletion is already done; let the regular path (which will close the gap) try to make room for the insertion
+            __CFStringChangeSize(str, CFRangeMake(gapLocation, 0), insertLength, false);
+            return true;
+        }
+        newGapLength = (newCapacity - skip - nullBytes) / charSize - curLength;
+        memmove(newContents, contents - skip, skip + gapLocation * charSize);
+        memmove(newContents + skip + (gapLocation + newGapLength) * charSize, contents + (gapLocation + gapLength) * charSize, tailBytes);
+        if (__CFStrFreeContentsWhenDone(str)) __CFStrDeallocateMutableContents(str, contents - skip);
+        __CFStrSetCapacity(str, newCapacity);
+        __CFStrSetContentPtr(str, newContents);
+        contents = newContents + skip;
+        gapLength = newGapLength;
+    }
+
+    str->variants.notInlineMutable.gapLocation = gapLocation + insertLength;
+    str->variants.notInlineMutable.gapLength = gapLength - insertLength;
+    if (skip) contents[-1] = __CFCanUseLengthByte(newLength) ? (uint8_t)newLength : 0;
+    __CFStrSetExplicitLength(str, newLength);
+    return true;
+}
+
 
 #if defined(DEBUG)
 static Boolean __CFStrIsConstantString(CFStringRef str);
@@ -940,6 +1046,18 @@ static Boolean __CFStringEqual(CFTypeRef cf1, CFTypeRef cf2) {
 
     if (len1 != __CFStrLength2(str2, contents2)) return false;
 
+    if (__CFStrIsGapped(str1) || __CFStrIsGapped(str2)) {	// Compare a piece at a time, reading across the gap(s)
+        UniChar buffer1[__kCFStringInlineBufferLength], buffer2[__kCFStringInlineBufferLength];
+        CFIndex idx, pieceLength;
+        for (idx = 0; idx < len1; idx += pieceLength) {
+            pieceLength = (len1 - idx < __kCFStringInlineBufferLength) ? len1 - idx : __kCFStringInlineBufferLength;
+            __CFStrCopyContents(str1, CFRangeMake(idx, pieceLength), buffer1, true);
+            __CFStrCopyContents(str2, CFRangeMake(idx, pieceLength), buffer2, true);
+            if (memcmp(buffer1, buffer2, pieceLength * sizeof(UniChar))) return false;
+        }
+        return true;
+    }
+
     contents1 += __CFStrSkipAnyLengthByte(str1);
     contents2 += __CFStrSkipAnyLengthByte(str2);
 
@@ -1121,7 +1239,17 @@ CFHashCode __CFStringHash(CFTypeRef cf) {
     const uint8_t *contents = (uint8_t *)__CFStrContents(str);
     CFIndex len = __CFStrLength2(str, contents);
 
-    if (__CFStrIsEightBit(str)) {
+    if (__CFStrIsGapped(str)) {	// Gather the characters to hash from either side of the gap, as CFStringHashNSString() does
+        UniChar buffer[HashEverythingLimit];
+        if (len <= HashEverythingLimit) {
+            __CFStrCopyContents(str, CFRangeMake(0, len), buffer, true);
+            return __CFStrHashCharacters(buffer, len, len);
+        }
+        __CFStrCopyContents(str, CFRangeMake(0, 32), buffer, true);
+        __CFStrCopyContents(str, CFRangeMake((len >> 1) - 16, 32), buffer + 32, true);
+        __CFStrCopyContents(str, CFRangeMake(len - 32, 32), buffer + 64, true);
+        return __CFStrHashCharacters(buffer, HashEverythingLimit, len);
+    } else if (__CFStrIsEightBit(str)) {
         contents += __CFStrSkipAnyLengthByte(str);
         return __CFStrHashEightBit(contents, len);
     } else {
@@ -1546,6 +1674,20 @@ CFStringRef  CFStringCreateWithFormat(CFAllocatorRef alloc, CFDictionaryRef form
     return result;
 }
 
+/* Copies a range of a mutable string with a gap, which cannot be handed to the funnel in one piece
+*/
+static CFStringRef __CFStringCreateImmutableCopyOfGappedString(CFAllocatorRef alloc, CFStringRef str, CFRange range) {
+    Boolean isUnicode = __CFStrIsUnicode(str);
+    CFIndex numBytes = range.length * (isUnicode ? sizeof(UniChar) : sizeof(uint8_t));
+    uint8_t *bytes = (uint8_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, numBytes ? numBytes : 1, 0);
+    CFStringRef result;
+
+    __CFStrCopyContents(str, range, bytes, false);
+    result = __CFStringCreateImmutableFunnel3(alloc, bytes, numBytes, isUnicode ? kCFStringEncodingUnicode : __CFStringGetEightBitStringEncoding(), false, isUnicode, false, false, false, ALLOCATORSFREEFUNC, 0);
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, bytes);
+    return result;
+}
+
 CFStringRef CFStringCreateWithSubstring(CFAllocatorRef alloc, CFStringRef str, CFRange range) {
 //      CF_OBJC_FUNCDISPATCH1(__kCFStringTypeID, CFStringRef , str, "_createSubstringWithRange:", CFRangeMake(range.location, range.length));
 
@@ -1554,6 +1696,8 @@ CFStringRef CFStringCreateWithSubstring(CFAllocatorRef alloc, CFStringRef str, C
 
     if ((range.location == 0) && (range.length == __CFStrLength(str))) {	/* The substring is the whole string... */
 	return (CFStringRef)CFStringCreateCopy(alloc, str);
+    } else if (__CFStrIsGapped(str)) {
+        return __CFStringCreateImmutableCopyOfGappedString(alloc, str, range);
     } else if (__CFStrIsEightBit(str)) {
 	const uint8_t *contents = (const uint8_t *)__CFStrContents(str);
         return __CFStringCreateImmutableFunnel3(alloc, contents + range.location + __CFStrSkipAnyLengthByte(str), range.length, __CFStringGetEightBitStringEncoding(), false, false, false, false, false, ALLOCATORSFREEFUNC, 0);
@@ -1573,7 +1717,9 @@ CFStringRef CFStringCreateCopy(CFAllocatorRef alloc, CFStringRef str) {
 	CFRetain(str);										// Then just retain instead of making a true copy
 	return str;
     }
-    if (__CFStrIsEightBit((CFStringRef)str)) {
+    if (__CFStrIsGapped((CFStringRef)str)) {
+        return __CFStringCreateImmutableCopyOfGappedString(alloc, str, CFRangeMake(0, __CFStrLength((CFStringRef)str)));
+    } else if (__CFStrIsEightBit((CFStringRef)str)) {
         const uint8_t *contents = (const uint8_t *)__CFStrContents((CFStringRef)str);
         return __CFStringCreateImmutableFunnel3(alloc, contents + __CFStrSkipAnyLengthByte((CFStringRef)str), __CFStrLength2((CFStringRef)str, contents), __CFStringGetEightBitStringEncoding(), false, false, false, false, false, ALLOCATORSFREEFUNC, 0);
     } else {
@@ -1774,8 +1920,10 @@ CF_INLINE void __CFStringReplace(CFMutableStringRef str, CFRange range, CFString
     if (replacement == str) copy = replacement = (CFStringRef)CFStringCreateCopy(kCFAllocatorSystemDefault, replacement);   // Very special and hopefully rare case
     CFIndex replacementLength = CFStringGetLength(replacement);
 
-    __CFStringChangeSize(str, range, replacementLength, (replacementLength > 0) && CFStrIsUnicode(replacement));
+    Boolean makeUnicode = (replacementLength > 0) && CFStrIsUnicode(replacement);
+    if (!__CFStringChangeSizeWithGap(str, range, replacementLength, makeUnicode)) __CFStringChangeSize(str, range, replacementLength, makeUnicode);
 
+    // Either way the replaced range now lies in the contiguous part of the buffer
     if (__CFStrIsUnicode(str)) {
         UniChar *contents = (UniChar *)__CFStrContents(str);
         CFStringGetCharacters(replacement, CFRangeMake(0, replacementLength), contents + range.location);
@@ -1805,6 +1953,7 @@ CF_INLINE CFMutableStringRef __CFStringCreateMutableFunnel(CFAllocatorRef alloc,
         __CFStrSetInfoBits(str, __kCFIsMutable | additionalInfoBits);
         str->variants.notInlineMutable.buffer = NULL;
         __CFStrSetExplicitLength(str, 0);
+	str->variants.notInlineMutable.gapLocation = str->variants.notInlineMutable.gapLength = 0;
 	str->variants.notInlineMutable.hasGap = str->variants.notInlineMutable.isFixedCapacity = str->variants.notInlineMutable.isExternalMutable = str->variants.notInlineMutable.capacityProvidedExternally = 0;
 	if (maxLength != 0) __CFStrSetIsFixed(str);
         __CFStrSetDesiredCapacity(str, (maxLength == 0) ? DEFAULTMINCAPACITY : maxLength);
@@ -1888,6 +2037,11 @@ UniChar CFStringGetCharacterAtIndex(CFStringRef str, CFIndex idx) {
 
     __CFAssertIsString(str);
     __CFAssertIndexIsInStringBounds(str, idx);
+    if (__CFStrIsGapped(str)) {
+        UniChar ch;
+        __CFStrCopyContents(str, CFRangeMake(idx, 1), &ch, true);
+        return ch;
+    }
     return __CFStringGetCharacterAtIndexGuts(str, idx, (const uint8_t *)__CFStrContents(str));
 }
 
@@ -1896,7 +2050,11 @@ UniChar CFStringGetCharacterAtIndex(CFStringRef str, CFIndex idx) {
 int _CFStringCheckAndGetCharacterAtIndex(CFStringRef str, CFIndex idx, UniChar *ch) {
     const uint8_t *contents = (const uint8_t *)__CFStrContents(str);
     if (idx >= __CFStrLength2(str, contents) && __CFStringNoteErrors()) return _CFStringErrBounds;
-    *ch = __CFStringGetCharacterAtIndexGuts(str, idx, contents);
+    if (__CFStrIsGapped(str)) {
+        __CFStrCopyContents(str, CFRangeMake(idx, 1), ch, true);
+    } else {
+        *ch = __CFStringGetCharacterAtIndexGuts(str, idx, contents);
+    }
     return _CFStringErrNone;
 }
 
@@ -1912,6 +2070,40 @@ CF_INLINE void __CFStringGetCharactersGuts(CFStringRef str, CFRange range, UniCh
     }
 }
 
+/* Copies characters in range of the contents into buffer without changing the string, reading across any gap: as UniChars if asCharacters, otherwise in
+   the string's own representation (bytes for eight-bit strings, without any length byte).
+*/
+static void __CFStrCopyContents(CFStringRef str, CFRange range, void *buffer, Boolean asCharacters) {
+    const uint8_t *contents = (const uint8_t *)__CFStrContents(str);
+    CFIndex charSize = __CFStrIsUnicode(str) ? sizeof(UniChar) : sizeof(uint8_t);
+    CFIndex gapLocation = 0, gapLength = 0;
+
+    if (__CFStrIsGapped(str)) {
+        gapLocation = str->variants.notInlineMutable.gapLocation;
+        gapLength = str->variants.notInlineMutable.gapLength;
+    }
+    while (range.length > 0) {
+        const uint8_t *pieceContents = contents;
+        CFIndex pieceLength = range.length;
+        if (gapLength) {
+            if (range.location < gapLocation) {
+                if (pieceLength > gapLocation - range.location) pieceLength = gapLocation - range.location;
+            } else {
+                pieceContents += gapLength * charSize;
+            }
+        }
+        if (asCharacters) {
+            __CFStringGetCharactersGuts(str, CFRangeMake(range.location, pieceLength), (UniChar *)buffer, pieceContents);
+            buffer = (UniChar *)buffer + pieceLength;
+        } else {
+            memmove(buffer, pieceContents + __CFStrSkipAnyLengthByte(str) + range.location * charSize, pieceLength * charSize);
+            buffer = (uint8_t *)buffer + pieceLength * charSize;
+        }
+        range.location += pieceLength;
+        range.length -= pieceLength;
+    }
+}
+
 /* This one is for the CF API
 */
 void CFStringGetCharacters(CFStringRef str, CFRange range, UniChar *buffer) {
@@ -1919,7 +2111,11 @@ void CFStringGetCharacters(CFStringRef str, CFRange range, UniChar *buffer) {
 
     __CFAssertIsString(str);
     __CFAssertRangeIsInStringBounds(str, range.location, range.length);
-    __CFStringGetCharactersGuts(str, range, buffer, (const uint8_t *)__CFStrContents(str));
+    if (__CFStrIsGapped(str)) {
+        __CFStrCopyContents(str, range, buffer, true);
+    } else {
+        __CFStringGetCharactersGuts(str, range, buffer, (const uint8_t *)__CFStrContents(str));
+    }
 }
 
 /* This one is for NSCFString usage; it doesn't do ObjC dispatch; but it does do range check
@@ -1927,7 +2123,11 @@ void CFStringGetCharacters(CFStringRef str, CFRange range, UniChar *buffer) {
 int _CFStringCheckAndGetCharacters(CFStringRef str, CFRange range, UniChar *buffer) {
      const uint8_t *contents = (const uint8_t *)__CFStrContents(str);
      if (range.location + range.length > __CFStrLength2(str, contents) && __CFStringNoteErrors()) return _CFStringErrBounds;
-     __CFStringGetCharactersGuts(str, range, buffer, contents);
+     if (__CFStrIsGapped(str)) {
+         __CFStrCopyContents(str, range, buffer, true);
+     } else {
+         __CFStringGetCharactersGuts(str, range, buffer, contents);
+     }
      return _CFStringErrNone;
 }
 
@@ -1942,12 +2142,11 @@ CFIndex CFStringGetBytes(CFStringRef str, CFRange range, CFStringEncoding encodi
         __CFAssertRangeIsInStringBounds(str, range.location, range.length);
 
         if (__CFStrIsEightBit(str) && ((__CFStringGetEightBitStringEncoding() == encoding) || (__CFStringGetEightBitStringEncoding() == kCFStringEncodingASCII && __CFStringEncodingIsSupersetOfASCII(encoding)))) {	// Requested encoding is equal to the encoding in string
-            const unsigned char *contents = (const unsigned char *)__CFStrContents(str);
             CFIndex cLength = range.length;
 
             if (buffer) {
                 if (cLength > maxBufLen) cLength = maxBufLen;
-                memmove(buffer, contents + __CFStrSkipAnyLengthByte(str) + range.location, cLength);
+                __CFStrCopyContents(str, CFRangeMake(range.location, cLength), buffer, false);
             }
             if (usedBufLen) *usedBufLen = cLength;
 
@@ -1963,7 +2162,7 @@ ConstStringPtr CFStringGetPascalStringPtr (CFStringRef str, CFStringEncoding enc
 
     if (!CF_IS_OBJC(__kCFStringTypeID, str)) {	/* ??? Hope the compiler optimizes this away if OBJC_MAPPINGS is not on */
         __CFAssertIsString(str);
-        if (__CFStrHasLengthByte(str) && __CFStrIsEightBit(str) && ((__CFStringGetEightBitStringEncoding() == encoding) || (__CFStringGetEightBitStringEncoding() == kCFStringEncodingASCII && __CFStringEncodingIsSupersetOfASCII(encoding)))) {	// Requested encoding is equal to the encoding in string || the contents is in ASCII
+        if (__CFStrHasLengthByte(str) && __CFStrIsEightBit(str) && !__CFStrIsGapped(str) && ((__CFStringGetEightBitStringEncoding() == encoding) || (__CFStringGetEightBitStringEncoding() == kCFStringEncodingASCII && __CFStringEncodingIsSupersetOfASCII(encoding)))) {	// Requested encoding is equal to the encoding in string || the contents is in ASCII
 	    const uint8_t *contents = (const uint8_t *)__CFStrContents(str);
 	    if (__CFStrHasExplicitLength(str) && (__CFStrLength2(str, contents) != (SInt32)(*contents))) return NULL;	// Invalid length byte
 	    return (ConstStringPtr)contents;
@@ -1983,7 +2182,7 @@ const char * CFStringGetCStringPtr(CFStringRef str, CFStringEncoding encoding) {
 
     __CFAssertIsString(str);
 
-    if (__CFStrHasNullByte(str)) {
+    if (__CFStrHasNullByte(str) && !__CFStrIsGapped(str)) {
         // Note: this is called a lot, 27000 times to open a small xcode project with one file open.
         // Of these uses about 1500 are for cStrings/utf8strings.
 	return (const char *)__CFStrContents(str) + __CFStrSkipAnyLengthByte(str);
@@ -1998,7 +2197,7 @@ const UniChar *CFStringGetCharactersPtr(CFStringRef str) {
     CF_OBJC_FUNCDISPATCH0(__kCFStringTypeID, const UniChar *, str, "_fastCharacterContents");
     
     __CFAssertIsString(str);
-    if (__CFStrIsUnicode(str)) return (const UniChar *)__CFStrContents(str);
+    if (__CFStrIsUnicode(str) && !__CFStrIsGapped(str)) return (const UniChar *)__CFStrContents(str);	// A gapped string's characters are not contiguous
     return NULL;
 }
 
@@ -2025,7 +2224,7 @@ Boolean CFStringGetPascalString(CFStringRef str, Str255 buffer, CFIndex bufferSi
 
         if (__CFStrIsEightBit(str) && ((__CFStringGetEightBitStringEncoding() == encoding) || (__CFStringGetEightBitStringEncoding() == kCFStringEncodingASCII && __CFStringEncodingIsSupersetOfASCII(encoding)))) {	// Requested encoding is equal to the encoding in string
 	    if (length >= bufferSize) return false;
-            memmove((void*)(1 + (const char*)buffer), (__CFStrSkipAnyLengthByte(str) + contents), length);
+            __CFStrCopyContents(str, CFRangeMake(0, length), (void *)(1 + (const char *)buffer), false);
             *buffer = (unsigned char)length;
 	    return true;
 	}
@@ -2063,7 +2262,7 @@ Boolean CFStringGetCString(CFStringRef str, char *buffer, CFIndex bufferSize, CF
 
     if (__CFStrIsEightBit(str) && ((__CFStringGetEightBitStringEncoding() == encoding) || (__CFStringGetEightBitStringEncoding() == kCFStringEncodingASCII && __CFStringEncodingIsSupersetOfASCII(encoding)))) {	// Requested encoding is equal to the encoding in string
         if (len >= bufferSize) return false;
-	memmove(buffer, contents + __CFStrSkipAnyLengthByte(str), len);
+	__CFStrCopyContents(str, CFRangeMake(0, len), buffer, false);
 	buffer[len] = 0;
         return true;
     } else {
@@ -2675,6 +2874,293 @@ CFComparisonResult CFStringCompare(CFStringRef string, CFStringRef str2, CFOptio
     return CFStringCompareWithOptions(string, str2, CFRangeMake(0, CFStringGetLength(string)), options);
 }
 
+/* Sorting by key ======================================================
+
+   CFStringSortValues() builds one binary key per string, such that comparing
+   keys with memcmp() orders the strings, and then sorts the keys; the string
+   folding (or collation) is done n times instead of on every one of the
+   n log n comparisons. The first 8 bytes of each key are kept as an integer
+   next to it, which settles most comparisons without touching the key bytes.
+
+   Literal keys are the characters as CFStringCompareWithOptions() folds them,
+   3 bytes per code point, or per UTF-16 unit when there is no folding (which
+   is how that comparison orders surrogates), offset by one so that 0 can end
+   the folded part before the kCFCompareForcedOrdering tie-breaker, with runs of digits under
+   kCFCompareNumerically written as '0', the number of digits, then the
+   digits. Under kCFCompareLocalized the keys are ICU collation keys for the
+   locale instead; otherwise the locale is ignored, as the comparison does.
+*/
+
+typedef struct {
+    uint64_t prefix;	// First 8 bytes of the key, big-endian, zero-padded
+    CFIndex offset;	// Of the key in the key buffer
+    CFIndex length;
+    CFStringRef string;
+} __CFStringSortEntry;
+
+typedef struct {
+    uint8_t *bytes;
+    CFIndex length;
+    CFIndex capacity;
+} __CFStringSortKeys;
+
+#define __kCFStringSortKeyNumberMark ('0' + 1)
+
+static Boolean __CFStringSortKeysReserve(__CFStringSortKeys *keys, CFIndex length) {
+    if (keys->length + length > keys->capacity) {
+        CFIndex newCapacity = __CFMax(2 * keys->capacity, keys->length + length + 4096);
+        uint8_t *newBytes = (uint8_t *)CFAllocatorReallocate(kCFAllocatorSystemDefault, keys->bytes, newCapacity, 0);
+        if (NULL == newBytes) return false;
+        if (NULL == keys->bytes && __CFOASafe) __CFSetLastAllocationEventName(newBytes, "CFString (sort keys)");
+        keys->bytes = newBytes;
+        keys->capacity = newCapacity;
+    }
+    return true;
+}
+
+CF_INLINE void __CFStringSortKeysAppendUnit(__CFStringSortKeys *keys, UTF32Char unit) {
+    uint8_t *bytes = keys->bytes + keys->length;
+    bytes[0] = (uint8_t)(unit >> 16);
+    bytes[1] = (uint8_t)(unit >> 8);
+    bytes[2] = (uint8_t)unit;
+    keys->length += 3;
+}
+
+static Boolean __CFStringAppendLiteralSortKey(__CFStringSortKeys *keys, CFStringRef string, CFOptionFlags compareOptions, const uint8_t *langCode) {
+    UTF32Char folded[kCFStringStackBufferLength];
+    CFStringInlineBuffer inlineBuf;
+    CFIndex length = CFStringGetLength(string), idx = 0;
+    bool equalityOptions = ((compareOptions & (kCFCompareCaseInsensitive|kCFCompareNonliteral|kCFCompareDiacriticsInsensitiveCompatibilityMask|kCFCompareWidthInsensitive)) ? true : false);
+    bool caseInsensitive = ((compareOptions & kCFCompareCaseInsensitive) ? true : false);
+    bool diacriticsInsensitive = ((compareOptions & kCFCompareDiacriticsInsensitiveCompatibilityMask) ? true : false);
+    bool numerically = ((compareOptions & kCFCompareNumerically) ? true : false);
+    const uint8_t *graphemeBMP = CFUniCharGetBitmapPtrForPlane(kCFUniCharGraphemeExtendCharacterSet, 0);
+
+    CFStringInitInlineBuffer(string, &inlineBuf, CFRangeMake(0, length));
+    while (idx < length) {
+        UTF16Char unit = CFStringGetCharacterFromInlineBuffer(&inlineBuf, idx), otherChar;
+        UTF32Char character = unit;
+        CFIndex usedLength = 1, foldedLength = 0, foldedIndex;
+
+        if (numerically && (character >= '0') && (character <= '9')) {
+            CFIndex start = idx, end;
+            while ((start + 1 < length) && ('0' == CFStringGetCharacterFromInlineBuffer(&inlineBuf, start)) && ((otherChar = CFStringGetCharacterFromInlineBuffer(&inlineBuf, start + 1)) >= '0') && (otherChar <= '9')) start++;	// Leading zeros don't count
+            for (end = start + 1; (end < length) && ((otherChar = CFStringGetCharacterFromInlineBuffer(&inlineBuf, end)) >= '0') && (otherChar <= '9'); end++);
+            if (!__CFStringSortKeysReserve(keys, 3 * (end - start + 2))) return false;
+            __CFStringSortKeysAppendUnit(keys, __kCFStringSortKeyNumberMark);
+            __CFStringSortKeysAppendUnit(keys, (UTF32Char)(end - start));
+            for (; start < end; start++) __CFStringSortKeysAppendUnit(keys, CFStringGetCharacterFromInlineBuffer(&inlineBuf, start) + 1);
+            idx = end;
+            continue;
+        }
+        // Without folding CFStringCompareWithOptions() compares UTF-16 units, so only a folded key takes a surrogate pair as one code point
+        if (equalityOptions && CFUniCharIsSurrogateHighCharacter(unit) && CFUniCharIsSurrogateLowCharacter((otherChar = CFStringGetCharacterFromInlineBuffer(&inlineBuf, idx + 1)))) {
+            character = CFUniCharGetLongCharacterForSurrogatePair(unit, otherChar);
+            usedLength = 2;
+        }
+        if (diacriticsInsensitive && (idx > 0) && (character >= 0x80) && CFUniCharIsMemberOfBitmap(character, ((character < 0x10000) ? graphemeBMP : CFUniCharGetBitmapPtrForPlane(kCFUniCharGraphemeExtendCharacterSet, (character >> 16))))) {
+            idx += usedLength;
+            continue;
+        }
+        if (!__CFStringSortKeysReserve(keys, 3 * kCFStringStackBufferLength)) return false;
+        if (equalityOptions && (character < 0x80) && ((NULL == langCode) || ('I' != character)) && (CFStringGetCharacterFromInlineBuffer(&inlineBuf, idx + 1) < 0x80)) {	// ASCII not followed by combining marks only case folds
+            if (caseInsensitive && (character >= 'A') && (character <= 'Z')) character += ('a' - 'A');
+        } else if (equalityOptions) {
+            foldedLength = __CFStringFoldCharacterClusterAtIndex(unit, &inlineBuf, idx, compareOptions, langCode, folded, kCFStringStackBufferLength, &usedLength);
+        }
+        if (foldedLength > 0) {
+            for (foldedIndex = 0; foldedIndex < foldedLength; foldedIndex++) __CFStringSortKeysAppendUnit(keys, folded[foldedIndex] + 1);
+        } else {
+            __CFStringSortKeysAppendUnit(keys, character + 1);
+        }
+        idx += usedLength;
+    }
+    if (compareOptions & kCFCompareForcedOrdering) {
+        if (!__CFStringSortKeysReserve(keys, 3 * (length + 1))) return false;
+        __CFStringSortKeysAppendUnit(keys, 0);
+        for (idx = 0; idx < length; idx++) __CFStringSortKeysAppendUnit(keys, CFStringGetCharacterFromInlineBuffer(&inlineBuf, idx) + 1);
+    }
+    return true;
+}
+
+CF_INLINE UCollator *__CFStringCloneCollator(const UCollator *collator, UErrorCode *status) {
+#if U_ICU_VERSION_MAJOR_NUM >= 71
+    return ucol_clone(collator, status);
+#else
+    return ucol_safeClone(collator, NULL, NULL, status);
+#endif
+}
+
+static UCollator *__CFStringOpenSortCollator(CFOptionFlags compareOptions, CFLocaleRef locale) {
+    char buffer[ULOC_FULLNAME_CAPACITY];
+    const char *localeID = "";
+    UErrorCode status = U_ZERO_ERROR;
+    UCollator *collator;
+
+    if ((NULL != locale) && CFStringGetCString(CFLocaleGetIdentifier(locale), buffer, sizeof(buffer), kCFStringEncodingASCII)) localeID = buffer;
+    // Opening a collator builds its tailoring; clone a shared prototype of the locale's collator and set attributes on the clone
+    CFStringRef key = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("ucol %s"), localeID);
+    const UCollator *proto = (const UCollator *)__CFICUPrototypeGet(key);
+    if (proto) {
+        collator = __CFStringCloneCollator(proto, &status);
+    } else {
+        collator = ucol_open(localeID, &status);
+        if (U_SUCCESS(status)) {
+            UErrorCode cstatus = U_ZERO_ERROR;
+            UCollator *copy = __CFStringCloneCollator(collator, &cstatus);
+            if (U_SUCCESS(cstatus) && !__CFICUPrototypeAdd(key, copy)) ucol_close(copy);
+        }
+    }
+    CFRelease(key);
+    if (U_FAILURE(status)) return NULL;
+    if (compareOptions & kCFCompareForcedOrdering) {
+        ucol_setAttribute(collator, UCOL_STRENGTH, UCOL_IDENTICAL, &status);
+    } else if (compareOptions & kCFCompareDiacriticsInsensitiveCompatibilityMask) {
+        ucol_setAttribute(collator, UCOL_STRENGTH, UCOL_PRIMARY, &status);
+        if (!(compareOptions & kCFCompareCaseInsensitive)) ucol_setAttribute(collator, UCOL_CASE_LEVEL, UCOL_ON, &status);
+    } else if (compareOptions & (kCFCompareCaseInsensitive|kCFCompareWidthInsensitive)) {
+        ucol_setAttribute(collator, UCOL_STRENGTH, UCOL_SECONDARY, &status);
+        if (!(compareOptions & kCFCompareCaseInsensitive)) ucol_setAttribute(collator, UCOL_CASE_LEVEL, UCOL_ON, &status);
+    }
+    if (compareOptions & kCFCompareNumerically) ucol_setAttribute(collator, UCOL_NUMERIC_COLLATION, UCOL_ON, &status);
+    if (compareOptions & kCFCompareNonliteral) ucol_setAttribute(collator, UCOL_NORMALIZATION_MODE, UCOL_ON, &status);
+    if (U_FAILURE(status)) {
+        ucol_close(collator);
+        return NULL;
+    }
+    return collator;
+}
+
+static Boolean __CFStringAppendCollatedSortKey(__CFStringSortKeys *keys, CFStringRef string, UCollator *collator) {
+    UniChar stackBuffer[256];
+    CFIndex length = CFStringGetLength(string);
+    const UniChar *characters = CFStringGetCharactersPtr(string);
+    UniChar *buffer = NULL;
+    int32_t keyLength;
+
+    if (NULL == characters) {
+        buffer = (length <= 256) ? stackBuffer : (UniChar *)CFAllocatorAllocate(kCFAllocatorSystemDefault, length * sizeof(UniChar), 0);
+        if (NULL == buffer) return false;
+        CFStringGetCharacters(string, CFRangeMake(0, length), buffer);
+        characters = buffer;
+    }
+    if (__CFStringSortKeysReserve(keys, 4 * length + 16)) {
+        keyLength = ucol_getSortKey(collator, characters, length, keys->bytes + keys->length, keys->capacity - keys->length);
+        if ((keyLength > keys->capacity - keys->length) && __CFStringSortKeysReserve(keys, keyLength)) keyLength = ucol_getSortKey(collator, characters, length, keys->bytes + keys->length, keys->capacity - keys->length);
+        if (keyLength > keys->capacity - keys->length) keyLength = 0;
+    } else {
+        keyLength = 0;
+    }
+    keys->length += keyLength;
+    if ((NULL != buffer) && (buffer != stackBuffer)) CFAllocatorDeallocate(kCFAllocatorSystemDefault, buffer);
+    return (keyLength > 0);
+}
+
+static CFComparisonResult __CFStringSortEntryCompare(const void *val1, const void *val2, void *context) {
+    const __CFStringSortEntry *entry1 = (const __CFStringSortEntry *)val1, *entry2 = (const __CFStringSortEntry *)val2;
+    const uint8_t *bytes = (const uint8_t *)context;
+    CFIndex minLength;
+    int cmpResult = 0;
+
+    if (entry1->prefix != entry2->prefix) return (entry1->prefix < entry2->prefix) ? kCFCompareLessThan : kCFCompareGreaterThan;
+    minLength = __CFMin(entry1->length, entry2->length);
+    if (minLength > 8) cmpResult = memcmp(bytes + entry1->offset + 8, bytes + entry2->offset + 8, minLength - 8);
+    if (0 == cmpResult) return (entry1->length < entry2->length) ? kCFCompareLessThan : ((entry1->length > entry2->length) ? kCFCompareGreaterThan : kCFCompareEqualTo);
+    return (cmpResult < 0) ? kCFCompareLessThan : kCFCompareGreaterThan;
+}
+
+typedef struct {
+    CFOptionFlags compareOptions;
+    CFLocaleRef locale;
+} __CFStringSortContext;
+
+static CFComparisonResult __CFStringSortStringCompare(const void *val1, const void *val2, void *context) {
+    const __CFStringSortContext *sortContext = (const __CFStringSortContext *)context;
+    CFStringRef string1 = (CFStringRef)val1, string2 = (CFStringRef)val2;
+    return CFStringCompareWithOptionsAndLocale(string1, string2, CFRangeMake(0, CFStringGetLength(string1)), sortContext->compareOptions, sortContext->locale);
+}
+
+// Orders two strings as their keys from __CFStringAppendCollatedSortKey() would
+static CFComparisonResult __CFStringSortCollatedCompare(const void *val1, const void *val2, void *context) {
+    CFStringRef strings[2] = {(CFStringRef)val1, (CFStringRef)val2};
+    UniChar stackBuffers[2][256], *buffers[2] = {NULL, NULL};
+    const UniChar *characters[2];
+    CFIndex lengths[2], idx;
+    UCollationResult result;
+
+    for (idx = 0; idx < 2; idx++) {
+        lengths[idx] = CFStringGetLength(strings[idx]);
+        characters[idx] = CFStringGetCharactersPtr(strings[idx]);
+        if (NULL == characters[idx]) {
+            UniChar *buffer = stackBuffers[idx];
+            if ((lengths[idx] > 256) && (NULL == (buffer = buffers[idx] = (UniChar *)CFAllocatorAllocate(kCFAllocatorSystemDefault, lengths[idx] * sizeof(UniChar), 0)))) {
+                __CFStringHandleOutOfMemory(strings[idx]);
+                buffer = stackBuffers[idx];
+                lengths[idx] = 256;	// Compare what fits
+            }
+            CFStringGetCharacters(strings[idx], CFRangeMake(0, lengths[idx]), buffer);
+            characters[idx] = buffer;
+        }
+    }
+    result = ucol_strcoll((const UCollator *)context, characters[0], lengths[0], characters[1], lengths[1]);
+    for (idx = 0; idx < 2; idx++) if (NULL != buffers[idx]) CFAllocatorDeallocate(kCFAllocatorSystemDefault, buffers[idx]);
+    return (UCOL_LESS == result) ? kCFCompareLessThan : ((UCOL_GREATER == result) ? kCFCompareGreaterThan : kCFCompareEqualTo);
+}
+
+void CFStringSortValues(CFStringRef *strings, CFIndex count, CFOptionFlags compareOptions, CFLocaleRef locale) {
+    __CFStringSortKeys keys = {NULL, 0, 0};
+    __CFStringSortEntry *entries;
+    const void **sorted = NULL;
+    UCollator *collator = NULL;
+    const uint8_t *langCode = NULL;
+    Boolean success = true;
+    CFIndex idx;
+
+    if (count < 2) return;
+    if (compareOptions & kCFCompareLocalized) {
+        CFLocaleRef currentLocale = CFLocaleCopyCurrent();
+        collator = __CFStringOpenSortCollator(compareOptions, (NULL != locale) ? locale : currentLocale);
+        // Without a collator, fold as CFStringCompareWithOptionsAndLocale() does, which only takes the current locale's case mappings
+        if (NULL == collator) langCode = (const uint8_t *)_CFStrGetLanguageIdentifierForLocale(currentLocale);
+        CFRelease(currentLocale);
+    }
+
+    entries = (__CFStringSortEntry *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count * (sizeof(__CFStringSortEntry) + sizeof(void *)), 0);
+    if (NULL == entries) {
+        success = false;
+    } else {
+        if (__CFOASafe) __CFSetLastAllocationEventName(entries, "CFString (sort entries)");
+        sorted = (const void **)(entries + count);
+        for (idx = 0; success && (idx < count); idx++) {
+            entries[idx].offset = keys.length;
+            entries[idx].string = strings[idx];
+            success = (NULL != collator) ? __CFStringAppendCollatedSortKey(&keys, strings[idx], collator) : __CFStringAppendLiteralSortKey(&keys, strings[idx], compareOptions, langCode);
+            entries[idx].length = keys.length - entries[idx].offset;
+        }
+    }
+    if (success) {
+        for (idx = 0; idx < count; idx++) {
+            const uint8_t *key = keys.bytes + entries[idx].offset;
+            CFIndex byteIndex, prefixLength = __CFMin(entries[idx].length, 8);
+            uint64_t prefix = 0;
+            for (byteIndex = 0; byteIndex < 8; byteIndex++) prefix = (prefix << 8) | ((byteIndex < prefixLength) ? key[byteIndex] : 0);
+            entries[idx].prefix = prefix;
+            sorted[idx] = &entries[idx];
+        }
+        __CFSortValues(sorted, count, true, __CFStringSortEntryCompare, keys.bytes);
+        for (idx = 0; idx < count; idx++) strings[idx] = ((const __CFStringSortEntry *)sorted[idx])->string;
+    } else if (NULL != collator) {	// Out of memory for the keys; sort the slow way
+        __CFSortValues((const void **)strings, count, true, __CFStringSortCollatedCompare, collator);
+    } else {
+        __CFStringSortContext context = {compareOptions, locale};
+        __CFSortValues((const void **)strings, count, true, __CFStringSortStringCompare, &context);
+    }
+
+    if (NULL != keys.bytes) CFAllocatorDeallocate(kCFAllocatorSystemDefault, keys.bytes);
+    if (NULL != entries) CFAllocatorDeallocate(kCFAllocatorSystemDefault, entries);
+    if (NULL != collator) ucol_close(collator);
+}
+
 Boolean CFStringFindWithOptionsAndLocale(CFStringRef string, CFStringRef stringToFind, CFRange rangeToSearch, CFOptionFlags compareOptions, CFLocaleRef locale, CFRange *result)  {
     /* No objc dispatch needed here since CFStringInlineBuffer works with both CFString and NSString */
     CFIndex findStrLen = CFStringGetLength(stringToFind);
@@ -3587,6 +4073,9 @@ CFRange CFStringGetRangeOfComposedCharactersAtIndex(CFStringRef theString, CFInd
 #define SURROGATE_START 0xD800
 #define SURROGATE_END 0xDFFF
 
+#define __kCFStringCompiledSetScanMinLength 32
+#define __kCFStringCompiledSetScanChunkLength 256
+
 CF_EXPORT Boolean CFStringFindCharacterFromSet(CFStringRef theString, CFCharacterSetRef theSet, CFRange rangeToSearch, CFOptionFlags searchOptions, CFRange *result) {
     CFStringInlineBuffer stringBuffer;
     CFCharacterSetInlineBuffer csetBuffer;
@@ -3600,6 +4089,38 @@ CF_EXPORT Boolean CFStringFindCharacterFromSet(CFStringRef theString, CFCharacte
 
     if ((rangeToSearch.location + rangeToSearch.length > CFStringGetLength(theString)) || (rangeToSearch.length == 0)) return false;
 
+    // Longer forward searches compile the set once and scan whole runs of characters
+    if (!(searchOptions & (kCFCompareBackwards | kCFCompareAnchored)) && (rangeToSearch.length >= __kCFStringCompiledSetScanMinLength)) {
+        CFCharacterSetCompiledBuffer compiledSet;
+        UniChar chunk[__kCFStringCompiledSetScanChunkLength];
+        const UniChar *characters = CFStringGetCharactersPtr(theString);
+        CFIndex location = rangeToSearch.location;
+        CFIndex limit = rangeToSearch.location + rangeToSearch.length;
+
+        CFCharacterSetInitCompiledBuffer(theSet, &compiledSet);
+        while (location < limit) {
+            CFIndex count = limit - location;
+            const UniChar *scan;
+            CFIndex index;
+
+            if (characters) {
+                scan = characters + location;
+            } else {
+                if (count > __kCFStringCompiledSetScanChunkLength) count = __kCFStringCompiledSetScanChunkLength;
+                CFStringGetCharacters(theString, CFRangeMake(location, count), chunk);
+                if ((location + count < limit) && CFUniCharIsSurrogateHighCharacter(chunk[count - 1])) count--; // Keep surrogate pairs in one chunk
+                scan = chunk;
+            }
+            index = CFCharacterSetCompiledBufferFindFirstMember(&compiledSet, scan, count);
+            if (kCFNotFound != index) {
+                if (result) *result = CFRangeMake(location + index, ((index + 1 < count) && CFUniCharIsSurrogateHighCharacter(scan[index]) && CFUniCharIsSurrogateLowCharacter(scan[index + 1])) ? 2 : 1);
+                return true;
+            }
+            location += count;
+        }
+        return false;
+    }
+
     if (searchOptions & kCFCompareBackwards) {
         fromLoc = rangeToSearch.location + rangeToSearch.length - 1;
         toLoc = rangeToSearch.location;
@@ -3638,6 +4159,8 @@ CF_EXPORT Boolean CFStringFindCharacterFromSet(CFStringRef theString, CFCharacte
                 if (CFUniCharIsSurrogateHighCharacter(highChar) && CFUniCharIsSurrogateLowCharacter(lowChar) && CFCharacterSetInlineBufferIsLongCharacterMember(&csetBuffer, CFUniCharGetLongCharacterForSurrogatePair(highChar, lowChar))) {
                     if (result) *result = CFRangeMake((cnt < otherCharIndex ? cnt : otherCharIndex), 2);
                     return true;
+                } else if (!CFUniCharIsSurrogateHighCharacter(highChar) || !CFUniCharIsSurrogateLowCharacter(lowChar)) {
+                    cnt += step; // Unpaired surrogate; the next character is tested on its own
                 } else if (otherCharIndex == toLoc) {
                     done = true;
                 } else {
@@ -3798,10 +4321,8 @@ CFStringRef CFStringCreateByCombiningStrings(CFAllocatorRef alloc, CFArrayRef ar
             } else {
                 if (!isSepCFString) { // NSString
                     CFStringGetCharacters(separatorString, CFRangeMake(0, CFStringGetLength(separatorString)), (UniChar *)bufPtr);
-                } else if (canBeEightbit || __CFStrIsUnicode(separatorString)) {
-                    memmove(bufPtr, (const uint8_t *)__CFStrContents(separatorString) + __CFStrSkipAnyLengthByte(separatorString), separatorNumByte);
-                } else {	
-                    __CFStrConvertBytesToUnicode((uint8_t *)__CFStrContents(separatorString) + __CFStrSkipAnyLengthByte(separatorString), (UniChar *)bufPtr, __CFStrLength(separatorString));
+                } else {
+                    __CFStrCopyContents(separatorString, CFRangeMake(0, __CFStrLength(separatorString)), bufPtr, !canBeEightbit && !__CFStrIsUnicode(separatorString));
                 }
                 separatorContents = bufPtr;
             }
@@ -3814,14 +4335,10 @@ CFStringRef CFStringCreateByCombiningStrings(CFAllocatorRef alloc, CFArrayRef ar
             CFStringGetCharacters(otherString, CFRangeMake(0, otherLength), (UniChar *)bufPtr);
             bufPtr += otherLength * sizeof(UniChar);
         } else {
-            const uint8_t * otherContents = (const uint8_t *)__CFStrContents(otherString);
-            CFIndex otherNumByte = __CFStrLength2(otherString, otherContents) * (canBeEightbit ? sizeof(uint8_t) : sizeof(UniChar));
+            CFIndex otherLength = __CFStrLength(otherString);
+            CFIndex otherNumByte = otherLength * (canBeEightbit ? sizeof(uint8_t) : sizeof(UniChar));
 
-            if (canBeEightbit || __CFStrIsUnicode(otherString)) {
-                memmove(bufPtr, otherContents + __CFStrSkipAnyLengthByte(otherString), otherNumByte);
-            } else {
-                __CFStrConvertBytesToUnicode(otherContents + __CFStrSkipAnyLengthByte(otherString), (UniChar *)bufPtr, __CFStrLength2(otherString, otherContents));
-            }
+            __CFStrCopyContents(otherString, CFRangeMake(0, otherLength), bufPtr, !canBeEightbit && !__CFStrIsUnicode(otherString));
             bufPtr += otherNumByte;
         }
     }
@@ -3871,6 +4388,17 @@ CFStringRef CFStringCreateFromExternalRepresentation(CFAllocatorRef alloc, CFDat
 }
 
 
+static CFDataRef __CFStringCreateDataWithEightBitContents(CFAllocatorRef alloc, CFStringRef string) {
+    CFIndex length = __CFStrLength(string);
+    uint8_t *bytes;
+
+    if (!__CFStrIsGapped(string)) return CFDataCreate(alloc, ((uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string)), length);
+    bytes = (uint8_t *)CFAllocatorAllocate(alloc, length ? length : 1, 0);
+    if (__CFOASafe) __CFSetLastAllocationEventName(bytes, "CFData (store)");
+    __CFStrCopyContents(string, CFRangeMake(0, length), bytes, false);
+    return CFDataCreateWithBytesNoCopy(alloc, bytes, length, alloc);
+}
+
 CFDataRef CFStringCreateExternalRepresentation(CFAllocatorRef alloc, CFStringRef string, CFStringEncoding encoding, uint8_t lossByte) {
     CFIndex length;
     CFIndex guessedByteLength;
@@ -3884,7 +4412,7 @@ CFDataRef CFStringCreateExternalRepresentation(CFAllocatorRef alloc, CFStringRef
         __CFAssertIsString(string);
         length = __CFStrLength(string);
         if (__CFStrIsEightBit(string) && ((__CFStringGetEightBitStringEncoding() == encoding) || (__CFStringGetEightBitStringEncoding() == kCFStringEncodingASCII && __CFStringEncodingIsSupersetOfASCII(encoding)))) {	// Requested encoding is equal to the encoding in string
-            return CFDataCreate(alloc, ((uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string)), __CFStrLength(string));
+            return __CFStringCreateDataWithEightBitContents(alloc, string);
         }
     }
 
@@ -3894,7 +4422,7 @@ CFDataRef CFStringCreateExternalRepresentation(CFAllocatorRef alloc, CFStringRef
         guessedByteLength = (length + 1) * ((((encoding >> 26)  & 2) == 0) ? sizeof(UTF16Char) : sizeof(UTF32Char)); // UTF32 format has the bit set
     } else if (((guessedByteLength = CFStringGetMaximumSizeForEncoding(length, encoding)) > length) && !CF_IS_OBJC(__kCFStringTypeID, string)) { // Multi byte encoding
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX || DEPLOYMENT_TARGET_FREEBSD
-        if (__CFStrIsUnicode(string)) {
+        if (__CFStrIsUnicode(string) && !__CFStrIsGapped(string)) {
             CFIndex aLength = CFStringEncodingByteLengthForCharacters(encoding, kCFStringEncodingPrependBOM, (const UniChar*)__CFStrContents(string), __CFStrLength(string));
             if (aLength > 0) guessedByteLength = aLength;
         } else {
@@ -3905,7 +4433,7 @@ CFDataRef CFStringCreateExternalRepresentation(CFAllocatorRef alloc, CFStringRef
 	//   otherwise, if there was a lossByte but still result != length, we fail
         if ((result != length) && (!result || !lossByte)) return NULL;
         if (guessedByteLength == length && __CFStrIsEightBit(string) && __CFStringEncodingIsSupersetOfASCII(encoding)) { // It's all ASCII !!
-            return CFDataCreate(alloc, ((uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string)), __CFStrLength(string));
+            return __CFStringCreateDataWithEightBitContents(alloc, string);
         }
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX || DEPLOYMENT_TARGET_FREEBSD
         }
@@ -3993,7 +4521,7 @@ void CFStringDelete(CFMutableStringRef str, CFRange range) {
     CF_OBJC_FUNCDISPATCH1(__kCFStringTypeID, void, str, "deleteCharactersInRange:", range);
     __CFAssertIsStringAndMutable(str);
     __CFAssertRangeIsInStringBounds(str, range.location, range.length);
-    __CFStringChangeSize(str, range, 0, false);
+    if (!__CFStringChangeSizeWithGap(str, range, 0, false)) __CFStringChangeSize(str, range, 0, false);
 }
 
 
@@ -4252,7 +4780,7 @@ void CFStringPad(CFMutableStringRef string, CFStringRef padString, CFIndex lengt
         
         __CFStringChangeSize(string, CFRangeMake(originalLength, 0), padRemaining, isUnicode);
 
-        contents = (uint8_t *)__CFStrContents(string) + charSize * originalLength + __CFStrSkipAnyLengthByte(string);
+        contents = (uint8_t *)__CFStrMutableContents(string) + charSize * originalLength + __CFStrSkipAnyLengthByte(string);
         padLength = padStringLength - indexIntoPad;
         padLength = padRemaining < padLength ? padRemaining : padLength;
 
@@ -4289,7 +4817,7 @@ void CFStringTrim(CFMutableStringRef string, CFStringRef trimString) {
 
     if (newStartIndex < length) {
         CFIndex charSize = __CFStrIsUnicode(string) ? sizeof(UniChar) : sizeof(uint8_t);
-        uint8_t *contents = (uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
+        uint8_t *contents = (uint8_t *)__CFStrMutableContents(string) + __CFStrSkipAnyLengthByte(string);
 
         length -= newStartIndex;
         if (__CFStrLength(trimString) < length) {
@@ -4324,7 +4852,7 @@ void CFStringTrimWhitespace(CFMutableStringRef string) {
     newStartIndex = buffer_idx;
 
     if (newStartIndex < length) {
-        uint8_t *contents = (uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
+        uint8_t *contents = (uint8_t *)__CFStrMutableContents(string) + __CFStrSkipAnyLengthByte(string);
         CFIndex charSize = (__CFStrIsUnicode(string) ? sizeof(UniChar) : sizeof(uint8_t));
 
         buffer_idx = length - 1;
@@ -4354,7 +4882,7 @@ void CFStringLowercase(CFMutableStringRef string, CFLocaleRef locale) {
     langCode = (const uint8_t *)(_CFCanUseLocale(locale) ? _CFStrGetLanguageIdentifierForLocale(locale) : NULL);
 
     if (!langCode && isEightBit) {
-        uint8_t *contents = (uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
+        uint8_t *contents = (uint8_t *)__CFStrMutableContents(string) + __CFStrSkipAnyLengthByte(string);
         for (;currentIndex < length;currentIndex++) {
             if (contents[currentIndex] >= 'A' && contents[currentIndex] <= 'Z') {
                 contents[currentIndex] += 'a' - 'A';
@@ -4373,7 +4901,7 @@ void CFStringLowercase(CFMutableStringRef string, CFLocaleRef locale) {
 
         if (isEightBit) __CFStringChangeSize(string, CFRangeMake(0, 0), 0, true);
 
-        contents = (UniChar *)__CFStrContents(string);
+        contents = (UniChar *)__CFStrMutableContents(string);
 
         for (;currentIndex < length;currentIndex++) {
 
@@ -4391,13 +4919,13 @@ void CFStringLowercase(CFMutableStringRef string, CFLocaleRef locale) {
                 switch (mappedLength) {
                     case 0:
                     __CFStringChangeSize(string, CFRangeMake(currentIndex, 2), 0, true);
-                    contents = (UniChar *)__CFStrContents(string);
+                    contents = (UniChar *)__CFStrMutableContents(string);
                     length -= 2;
                     break;
 
                     case 1:
                     __CFStringChangeSize(string, CFRangeMake(currentIndex + 1, 1), 0, true);
-                    contents = (UniChar *)__CFStrContents(string);
+                    contents = (UniChar *)__CFStrMutableContents(string);
                     --length;
                     break;
 
@@ -4408,7 +4936,7 @@ void CFStringLowercase(CFMutableStringRef string, CFLocaleRef locale) {
                     default:
                     --mappedLength; // Skip the current char
                     __CFStringChangeSize(string, CFRangeMake(currentIndex + 1, 0), mappedLength - 1, true);
-                    contents = (UniChar *)__CFStrContents(string);
+                    contents = (UniChar *)__CFStrMutableContents(string);
                     memmove(contents + currentIndex + 1, mappedCharacters + 1, mappedLength * sizeof(UniChar));
                     length += (mappedLength - 1);
                     currentIndex += mappedLength;
@@ -4416,12 +4944,12 @@ void CFStringLowercase(CFMutableStringRef string, CFLocaleRef locale) {
                 }
             } else if (mappedLength == 0) {
                 __CFStringChangeSize(string, CFRangeMake(currentIndex, 1), 0, true);
-                contents = (UniChar *)__CFStrContents(string);
+                contents = (UniChar *)__CFStrMutableContents(string);
                 --length;
             } else if (mappedLength > 1) {
                 --mappedLength; // Skip the current char
                 __CFStringChangeSize(string, CFRangeMake(currentIndex + 1, 0), mappedLength, true);
-                contents = (UniChar *)__CFStrContents(string);
+                contents = (UniChar *)__CFStrMutableContents(string);
                 memmove(contents + currentIndex + 1, mappedCharacters + 1, mappedLength * sizeof(UniChar));
                 length += mappedLength;
                 currentIndex += mappedLength;
@@ -4445,7 +4973,7 @@ void CFStringUppercase(CFMutableStringRef string, CFLocaleRef locale) {
     langCode = (const uint8_t *)(_CFCanUseLocale(locale) ? _CFStrGetLanguageIdentifierForLocale(locale) : NULL);
 
     if (!langCode && isEightBit) {
-        uint8_t *contents = (uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
+        uint8_t *contents = (uint8_t *)__CFStrMutableContents(string) + __CFStrSkipAnyLengthByte(string);
         for (;currentIndex < length;currentIndex++) {
             if (contents[currentIndex] >= 'a' && contents[currentIndex] <= 'z') {
                 contents[currentIndex] -= 'a' - 'A';
@@ -4464,7 +4992,7 @@ void CFStringUppercase(CFMutableStringRef string, CFLocaleRef locale) {
 
         if (isEightBit) __CFStringChangeSize(string, CFRangeMake(0, 0), 0, true);
 
-        contents = (UniChar *)__CFStrContents(string);
+        contents = (UniChar *)__CFStrMutableContents(string);
 
         for (;currentIndex < length;currentIndex++) {
             if (CFUniCharIsSurrogateHighCharacter(contents[currentIndex]) && (currentIndex + 1 < length) && CFUniCharIsSurrogateLowCharacter(contents[currentIndex + 1])) {
@@ -4482,13 +5010,13 @@ void CFStringUppercase(CFMutableStringRef string, CFLocaleRef locale) {
                 switch (mappedLength) {
                     case 0:
                     __CFStringChangeSize(string, CFRangeMake(currentIndex, 2), 0, true);
-                    contents = (UniChar *)__CFStrContents(string);
+                    contents = (UniChar *)__CFStrMutableContents(string);
                     length -= 2;
                     break;
 
                     case 1:
                     __CFStringChangeSize(string, CFRangeMake(currentIndex + 1, 1), 0, true);
-                    contents = (UniChar *)__CFStrContents(string);
+                    contents = (UniChar *)__CFStrMutableContents(string);
                     --length;
                     break;
 
@@ -4499,7 +5027,7 @@ void CFStringUppercase(CFMutableStringRef string, CFLocaleRef locale) {
                     default:
                     --mappedLength; // Skip the current char
                     __CFStringChangeSize(string, CFRangeMake(currentIndex + 1, 0), mappedLength - 1, true);
-                    contents = (UniChar *)__CFStrContents(string);
+                    contents = (UniChar *)__CFStrMutableContents(string);
                     memmove(contents + currentIndex + 1, mappedCharacters + 1, mappedLength * sizeof(UniChar));
                     length += (mappedLength - 1);
                     currentIndex += mappedLength;
@@ -4507,12 +5035,12 @@ void CFStringUppercase(CFMutableStringRef string, CFLocaleRef locale) {
                 }
             } else if (mappedLength == 0) {
                 __CFStringChangeSize(string, CFRangeMake(currentIndex, 1), 0, true);
-                contents = (UniChar *)__CFStrContents(string);
+                contents = (UniChar *)__CFStrMutableContents(string);
                 --length;
             } else if (mappedLength > 1) {
                 --mappedLength; // Skip the current char
                 __CFStringChangeSize(string, CFRangeMake(currentIndex + 1, 0), mappedLength, true);
-                contents = (UniChar *)__CFStrContents(string);
+                contents = (UniChar *)__CFStrMutableContents(string);
                 memmove(contents + currentIndex + 1, mappedCharacters + 1, mappedLength * sizeof(UniChar));
                 length += mappedLength;
                 currentIndex += mappedLength;
@@ -4541,7 +5069,7 @@ void CFStringCapitalize(CFMutableStringRef string, CFLocaleRef locale) {
     langCode = (const uint8_t *)(_CFCanUseLocale(locale) ? _CFStrGetLanguageIdentifierForLocale(locale) : NULL);
 
     if (!langCode && isEightBit) {
-        uint8_t *contents = (uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
+        uint8_t *contents = (uint8_t *)__CFStrMutableContents(string) + __CFStrSkipAnyLengthByte(string);
         for (;currentIndex < length;currentIndex++) {
             if (contents[currentIndex] > 127) {
                 break;
@@ -4566,7 +5094,7 @@ void CFStringCapitalize(CFMutableStringRef string, CFLocaleRef locale) {
 
         if (isEightBit) __CFStringChangeSize(string, CFRangeMake(0, 0), 0, true);
 
-        contents = (UniChar *)__CFStrContents(string);
+        contents = (UniChar *)__CFStrMutableContents(string);
 
         for (;currentIndex < length;currentIndex++) {
             if (CFUniCharIsSurrogateHighCharacter(contents[currentIndex]) && (currentIndex + 1 < length) && CFUniCharIsSurrogateLowCharacter(contents[currentIndex + 1])) {
@@ -4583,13 +5111,13 @@ void CFStringCapitalize(CFMutableStringRef string, CFLocaleRef locale) {
                 switch (mappedLength) {
                     case 0:
                     __CFStringChangeSize(string, CFRangeMake(currentIndex, 2), 0, true);
-                    contents = (UniChar *)__CFStrContents(string);
+                    contents = (UniChar *)__CFStrMutableContents(string);
                     length -= 2;
                     break;
 
                     case 1:
                     __CFStringChangeSize(string, CFRangeMake(currentIndex + 1, 1), 0, true);
-                    contents = (UniChar *)__CFStrContents(string);
+                    contents = (UniChar *)__CFStrMutableContents(string);
                     --length;
                     break;
 
@@ -4600,7 +5128,7 @@ void CFStringCapitalize(CFMutableStringRef string, CFLocaleRef locale) {
                     default:
                     --mappedLength; // Skip the current char
                     __CFStringChangeSize(string, CFRangeMake(currentIndex + 1, 0), mappedLength - 1, true);
-                    contents = (UniChar *)__CFStrContents(string);
+                    contents = (UniChar *)__CFStrMutableContents(string);
                     memmove(contents + currentIndex + 1, mappedCharacters + 1, mappedLength * sizeof(UniChar));
                     length += (mappedLength - 1);
                     currentIndex += mappedLength;
@@ -4608,12 +5136,12 @@ void CFStringCapitalize(CFMutableStringRef string, CFLocaleRef locale) {
                 }
             } else if (mappedLength == 0) {
                 __CFStringChangeSize(string, CFRangeMake(currentIndex, 1), 0, true);
-                contents = (UniChar *)__CFStrContents(string);
+                contents = (UniChar *)__CFStrMutableContents(string);
                 --length;
             } else if (mappedLength > 1) {
                 --mappedLength; // Skip the current char
                 __CFStringChangeSize(string, CFRangeMake(currentIndex + 1, 0), mappedLength, true);
-                contents = (UniChar *)__CFStrContents(string);
+                contents = (UniChar *)__CFStrMutableContents(string);
                 memmove(contents + currentIndex + 1, mappedCharacters + 1, mappedLength * sizeof(UniChar));
                 length += mappedLength;
                 currentIndex += mappedLength;
@@ -4664,10 +5192,138 @@ CF_INLINE void __CFFillInUTF16(const UTF32Char *characters, UTF16Char *dst, uint
     }
 }
 
+/* Normalization quick check. A character is stable in a form when CFStringNormalize() leaves it as is wherever it follows a starter
+   and precedes another stable character; stable characters with a nonzero combining class are stable only in canonical order.
+   The BMP answers are kept as one bitmap per form, built from the decomposition, combining class and non-base data on first use. */
+static uint8_t *__CFStringNormalizationStableBitmaps[kCFStringNormalizationFormKC + 1] = {NULL, NULL, NULL, NULL};
+static const uint8_t *__CFStringNormalizationCombiningBMP = NULL;
+
+// The bitmaps and combining class table passed in are the ones for the character's plane
+static bool __CFStringIsNormalizationStable(UTF32Char character, CFStringNormalizationForm theForm, const uint8_t *decomposable, const uint8_t *compatibility, const uint8_t *nonBase, const uint8_t *combining) {
+    UTF32Char decomposed[MAX_DECOMP_BUF];
+    UTF32Char composed;
+    CFIndex length, idx;
+
+    if ((character >= 0xD800) && (character <= 0xDFFF)) return false; // checked as surrogate pairs
+    if ((theForm & kCFStringNormalizationFormKD) && CFUniCharIsMemberOfBitmap(character, compatibility)) return false;
+    if (!(theForm & kCFStringNormalizationFormC)) return !CFUniCharIsMemberOfBitmap(character, decomposable);
+
+    // Anything that can combine with the character before it is left to the full pass
+    if ((0 != CFUniCharGetCombiningPropertyForCharacter(character, combining)) || CFUniCharIsMemberOfBitmap(character, nonBase) || ((character >= HANGUL_LBASE) && (character < (HANGUL_LBASE + 0x100)))) return false;
+    if (!CFUniCharIsMemberOfBitmap(character, decomposable) || ((character >= HANGUL_SBASE) && (character < (HANGUL_SBASE + HANGUL_SCOUNT)))) return true;
+
+    // A precomposed character is stable if its decomposition composes back into it
+    length = ((character < 0x10000) ? CFUniCharDecomposeCharacter(character, decomposed, MAX_DECOMP_BUF) : 0);
+    if (length < 2) return false;
+    composed = decomposed[0];
+    for (idx = 0; idx < length; idx++) {
+        if (decomposed[idx] > 0xFFFF) return false;
+        if ((theForm & kCFStringNormalizationFormKD) && (CFUniCharIsMemberOfBitmap(decomposed[idx], compatibility) || ((idx > 0) && !CFUniCharIsMemberOfBitmap(decomposed[idx], nonBase)))) return false;
+        if ((idx > 0) && (0xFFFD == (composed = CFUniCharPrecomposeCharacter(composed, decomposed[idx])))) return false;
+    }
+    return (composed == character);
+}
+
+static bool __CFStringIsNormalizationStableNonBMP(UTF32Char character, CFStringNormalizationForm theForm) {
+    uint32_t plane = (character >> 16);
+    return __CFStringIsNormalizationStable(character, theForm, CFUniCharGetBitmapPtrForPlane(kCFUniCharCanonicalDecomposableCharacterSet, plane), CFUniCharGetBitmapPtrForPlane(kCFUniCharCompatibilityDecomposableCharacterSet, plane), CFUniCharGetBitmapPtrForPlane(kCFUniCharNonBaseCharacterSet, plane), (const uint8_t *)CFUniCharGetUnicodePropertyDataForPlane(kCFUniCharCombiningProperty, plane));
+}
+
+static const uint8_t *__CFStringGetNormalizationStableBitmap(CFStringNormalizationForm theForm) {
+    uint8_t *bitmap = __CFStringNormalizationStableBitmaps[theForm];
+
+    if (NULL == bitmap) {
+        const uint8_t *decomposable = CFUniCharGetBitmapPtrForPlane(kCFUniCharCanonicalDecomposableCharacterSet, 0);
+        const uint8_t *compatibility = CFUniCharGetBitmapPtrForPlane(kCFUniCharCompatibilityDecomposableCharacterSet, 0);
+        const uint8_t *nonBase = CFUniCharGetBitmapPtrForPlane(kCFUniCharNonBaseCharacterSet, 0);
+        const uint8_t *combining = (const uint8_t *)CFUniCharGetUnicodePropertyDataForPlane(kCFUniCharCombiningProperty, 0);
+        UTF32Char character;
+
+        bitmap = (uint8_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, 0x10000 / 8, 0);
+        memset(bitmap, 0, 0x10000 / 8);
+        for (character = 0; character < 0x10000; character++) {
+            if (__CFStringIsNormalizationStable(character, theForm, decomposable, compatibility, nonBase, combining)) CFUniCharAddCharacterToBitmap(character, bitmap);
+        }
+        __CFStringNormalizationCombiningBMP = combining;
+        if (!_CFAtomicCompareAndSwapPtrBarrier(NULL, bitmap, (void *volatile *)&__CFStringNormalizationStableBitmaps[theForm])) {
+            CFAllocatorDeallocate(kCFAllocatorSystemDefault, bitmap);
+            bitmap = __CFStringNormalizationStableBitmaps[theForm];
+        }
+    }
+    return bitmap;
+}
+
+/* Returns the index of the starter the full pass has to begin at, or length when the characters are already normalized in theForm.
+   ASCII is stable in every form, so it is skipped a word at a time. */
+static CFIndex __CFStringNormalizationQuickCheck(const UTF16Char *characters, CFIndex length, CFStringNormalizationForm theForm) {
+    const uint8_t *stableBMP = __CFStringGetNormalizationStableBitmap(theForm);
+    const uint8_t *combiningBMP = __CFStringNormalizationCombiningBMP;
+    CFIndex idx = 0, starter = 0, characterLength;
+    uint8_t currentClass, lastClass = 0;
+    UTF32Char character;
+    uint64_t word;
+
+    while (idx < length) {
+        if (idx + 4 <= length) {
+            memmove(&word, characters + idx, sizeof(word));
+            if (0 == (word & 0xFF80FF80FF80FF80ULL)) {
+                idx += 4;
+                starter = idx - 1;
+                lastClass = 0;
+                continue;
+            }
+        }
+        character = characters[idx];
+        characterLength = 1;
+        if (CFUniCharIsMemberOfBitmap(character, stableBMP)) {
+            currentClass = CFUniCharGetCombiningPropertyForCharacter(character, combiningBMP);
+        } else if (CFUniCharIsSurrogateHighCharacter(character) && (idx + 1 < length) && CFUniCharIsSurrogateLowCharacter(characters[idx + 1])) {
+            character = CFUniCharGetLongCharacterForSurrogatePair(character, characters[idx + 1]);
+            if (!__CFStringIsNormalizationStableNonBMP(character, theForm)) break;
+            currentClass = CFUniCharGetCombiningPropertyForCharacter(character, (const uint8_t *)CFUniCharGetUnicodePropertyDataForPlane(kCFUniCharCombiningProperty, (character >> 16)));
+            characterLength = 2;
+        } else if ((character >= 0xD800) && (character <= 0xDFFF)) {
+            currentClass = 0; // unpaired surrogate
+        } else {
+            break;
+        }
+        if ((0 != currentClass) && (currentClass < lastClass)) break;
+        if (0 == currentClass) starter = idx;
+        lastClass = currentClass;
+        idx += characterLength;
+    }
+    return ((idx < length) ? starter : length);
+}
+
+/* The same for the bytes of an 8-bit string; returns the index of the first byte that needs the full pass. */
+static CFIndex __CFStringNormalizationQuickCheckEightBit(const uint8_t *bytes, CFIndex length, CFStringNormalizationForm theForm) {
+    const uint8_t *stableBMP = NULL;
+    CFIndex idx = 0;
+    uint64_t word;
+
+    while (idx < length) {
+        if (idx + 8 <= length) {
+            memmove(&word, bytes + idx, sizeof(word));
+            if (0 == (word & 0x8080808080808080ULL)) {
+                idx += 8;
+                continue;
+            }
+        }
+        if (bytes[idx] > 127) {
+            if (!__CFCharToUniCharFunc) break;
+            if (NULL == stableBMP) stableBMP = __CFStringGetNormalizationStableBitmap(theForm);
+            if (!CFUniCharIsMemberOfBitmap(__CFCharToUniCharTable[bytes[idx]], stableBMP) || (0 != CFUniCharGetCombiningPropertyForCharacter(__CFCharToUniCharTable[bytes[idx]], __CFStringNormalizationCombiningBMP))) break;
+        }
+        ++idx;
+    }
+    return idx;
+}
+
 void CFStringNormalize(CFMutableStringRef string, CFStringNormalizationForm theForm) {
     CFIndex currentIndex = 0;
     CFIndex length;
     bool needToReorder = true;
+    bool isKnownForm = ((theForm >= kCFStringNormalizationFormD) && (theForm <= kCFStringNormalizationFormKC));
 
     CF_OBJC_FUNCDISPATCH1(__kCFStringTypeID, void, string, "_cfNormalize:", theForm);
 
@@ -4680,20 +5336,24 @@ void CFStringNormalize(CFMutableStringRef string, CFStringNormalizationForm theF
 
         if (theForm == kCFStringNormalizationFormC) return; // 8bit form has no decomposition
 
-        contents = (uint8_t *)__CFStrContents(string) + __CFStrSkipAnyLengthByte(string);
+        contents = (uint8_t *)__CFStrMutableContents(string) + __CFStrSkipAnyLengthByte(string);
 
-        for (;currentIndex < length;currentIndex++) {
-            if (contents[currentIndex] > 127) {
-                __CFStringChangeSize(string, CFRangeMake(0, 0), 0, true); // need to do harm way
-                needToReorder = false;
-                break;
-            }
+        if (isKnownForm) {
+            currentIndex = __CFStringNormalizationQuickCheckEightBit(contents, length, theForm);
+        } else {
+            while ((currentIndex < length) && (contents[currentIndex] < 128)) ++currentIndex;
         }
+        if (currentIndex < length) {
+            __CFStringChangeSize(string, CFRangeMake(0, 0), 0, true); // need to do harm way
+            needToReorder = false;
+        }
+    } else if (isKnownForm) {
+        currentIndex = __CFStringNormalizationQuickCheck((const UTF16Char *)__CFStrMutableContents(string), length, theForm);
     }
 
     if (currentIndex < length) {
-        UTF16Char *limit = (UTF16Char *)__CFStrContents(string) + length;
-        UTF16Char *contents = (UTF16Char *)__CFStrContents(string) + currentIndex;
+        UTF16Char *limit = (UTF16Char *)__CFStrMutableContents(string) + length;
+        UTF16Char *contents = (UTF16Char *)__CFStrMutableContents(string) + currentIndex;
         UTF32Char buffer[MAX_DECOMP_BUF];
         UTF32Char *mappedCharacters = buffer;
         CFIndex allocatedLength = MAX_DECOMP_BUF;
@@ -4955,7 +5615,7 @@ void CFStringNormalize(CFMutableStringRef string, CFStringNormalizationForm theF
                     __CFStringChangeSize(string, CFRangeMake(currentIndex, currentLength), utf16Length, true);
                     currentLength = utf16Length;
                 }
-                contents = (UTF16Char *)__CFStrContents(string);
+                contents = (UTF16Char *)__CFStrMutableContents(string);
                 limit = contents + __CFStrLength(string);
                 contents += currentIndex;
                 __CFFillInUTF16(mappedCharacters, contents, mappedLength);
@@ -5001,7 +5661,7 @@ void CFStringFold(CFMutableStringRef theString, CFStringCompareFlags theFlags, C
     if ((NULL != cString) && (theFlags & (kCFCompareCaseInsensitive|kCFCompareDiacriticInsensitive))) {
         const uint8_t *cStringPtr = cString;
         const uint8_t *cStringLimit = cString + length;
-        uint8_t *cStringContents = (isObjc ? NULL : (uint8_t *)__CFStrContents(theString) + __CFStrSkipAnyLengthByte(theString));
+        uint8_t *cStringContents = (isObjc ? NULL : (uint8_t *)__CFStrMutableContents(theString) + __CFStrSkipAnyLengthByte(theString));
         
         while (cStringPtr < cStringLimit) {
             if ((*cStringPtr < 0x80) && (NULL == langCode)) {
@@ -5055,7 +5715,7 @@ void CFStringFold(CFMutableStringRef theString, CFStringCompareFlags theFlags, C
                 length = __CFStrLength(theString);
                 CFStringInitInlineBuffer(theString, &stringBuffer, CFRangeMake(0, length));
 
-                contents = (UTF16Char *)__CFStrContents(theString) + currentIndex;
+                contents = (UTF16Char *)__CFStrMutableContents(theString) + currentIndex;
                 characters = buffer;
                 charactersLimit = characters + bufferLength;
                 while (characters < charactersLimit) *(contents++) = (UTF16Char)*(characters++);
@@ -5106,7 +5766,7 @@ void CFStringFold(CFMutableStringRef theString, CFStringCompareFlags theFlags, C
                         CFStringInitInlineBuffer(theString, &stringBuffer, CFRangeMake(0, length));
                     }
 
-                    (void)CFUniCharFromUTF32(buffer, bufferLength, (UTF16Char *)__CFStrContents(theString) + currentIndex, true, __CF_BIG_ENDIAN__);
+                    (void)CFUniCharFromUTF32(buffer, bufferLength, (UTF16Char *)__CFStrMutableContents(theString) + currentIndex, true, __CF_BIG_ENDIAN__);
 
                     currentIndex += utf16Length;
                 } else {
@@ -5377,6 +6037,86 @@ void CFStringAppendFormatAndArguments(CFMutableStringRef outputString, CFDiction
     }}
 #endif //__MACH__
 
+/* Parsed specs of recently used constant format strings (CFSTR()s), so that formatting with them again skips the parse.
+   Constant strings are never freed, so the string pointer is the key. Entries are copied in and out under the lock.
+*/
+#if !defined(CF_STRING_FORMAT_CACHE_SIZE)
+#define CF_STRING_FORMAT_CACHE_SIZE 64
+#endif
+#define __kCFStringFormatCacheMaxSpecs 16
+
+typedef struct {
+    CFStringRef format;
+    SInt32 numSpecs;
+    SInt32 sizeSpecs;
+    CFFormatSpec specs[__kCFStringFormatCacheMaxSpecs];
+} __CFStringFormatCacheEntry;
+
+static __CFStringFormatCacheEntry __CFStringFormatCache[CF_STRING_FORMAT_CACHE_SIZE];
+static CFSpinLock_t __CFStringFormatCacheLock = CFSpinLockInit;
+
+CF_INLINE __CFStringFormatCacheEntry *__CFStringFormatCacheEntryFor(CFStringRef format) {
+    return &__CFStringFormatCache[(((uintptr_t)format) >> 4) % CF_STRING_FORMAT_CACHE_SIZE];
+}
+
+static Boolean __CFStringFormatCacheLookup(CFStringRef format, CFFormatSpec *specs, SInt32 *numSpecs, SInt32 *sizeSpecs) {
+    __CFStringFormatCacheEntry *entry = __CFStringFormatCacheEntryFor(format);
+    Boolean found = false;
+    __CFSpinLock(&__CFStringFormatCacheLock);
+    if (entry->format == format) {
+        memmove(specs, entry->specs, entry->numSpecs * sizeof(CFFormatSpec));
+        *numSpecs = entry->numSpecs;
+        *sizeSpecs = entry->sizeSpecs;
+        found = true;
+    }
+    __CFSpinUnlock(&__CFStringFormatCacheLock);
+    return found;
+}
+
+static void __CFStringFormatCacheStore(CFStringRef format, const CFFormatSpec *specs, SInt32 numSpecs, SInt32 sizeSpecs) {
+    __CFStringFormatCacheEntry *entry = __CFStringFormatCacheEntryFor(format);
+    if (numSpecs > __kCFStringFormatCacheMaxSpecs) return;
+    __CFSpinLock(&__CFStringFormatCacheLock);
+    memmove(entry->specs, specs, numSpecs * sizeof(CFFormatSpec));
+    entry->numSpecs = numSpecs;
+    entry->sizeSpecs = sizeSpecs;
+    entry->format = format;
+    __CFSpinUnlock(&__CFStringFormatCacheLock);
+}
+
+/* Formats %d, %i and %u with no flags, width or precision straight into buffer (which must hold at least 21 chars), without snprintf(); returns the length, or -1 if the spec needs the general path.
+*/
+static CFIndex __CFStringFormatSimpleInteger(const CFFormatSpec *spec, UniChar conversion, int64_t value, char *buffer) {
+    Boolean isSigned, isNegative = false;
+    uint64_t magnitude;
+    char digits[20];
+    CFIndex numDigits = 0, len = 0;
+
+    if (spec->flags || -1 != spec->widthArg || -1 != spec->precArg || -1 != spec->widthArgNum || -1 != spec->precArgNum) return -1;
+    if (CFFormatDefaultSize != spec->size && CFFormatSize4 != spec->size && CFFormatSize8 != spec->size) return -1;
+    if ('d' == conversion || 'i' == conversion) {
+        isSigned = true;
+    } else if ('u' == conversion) {
+        isSigned = false;
+    } else {
+        return -1;
+    }
+    if (CFFormatSize8 != spec->size) value = isSigned ? (int64_t)(SInt32)value : (int64_t)(UInt32)value;	// Same truncation as the SInt32 case of SNPRINTF
+    if (isSigned && value < 0) {
+        isNegative = true;
+        magnitude = (uint64_t)0 - (uint64_t)value;
+    } else {
+        magnitude = (uint64_t)value;
+    }
+    do {
+        digits[numDigits++] = '0' + (char)(magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (isNegative) buffer[len++] = '-';
+    while (numDigits) buffer[len++] = digits[--numDigits];
+    return len;
+}
+
 void _CFStringAppendFormatAndArgumentsAux(CFMutableStringRef outputString, CFStringRef (*copyDescFunc)(void *, const void *), CFDictionaryRef formatOptions, CFStringRef formatString, va_list args) {
     SInt32 numSpecs, sizeSpecs, sizeArgNum, formatIdx, curSpec, argNum;
     CFIndex formatLen;
@@ -5392,6 +6132,7 @@ void _CFStringAppendFormatAndArgumentsAux(CFMutableStringRef outputString, CFStr
     CFPrintValue localValuesBuffer[VPRINTF_BUFFER_LEN];
     CFPrintValue *values;
     CFAllocatorRef tmpAlloc = NULL;
+    Boolean cacheable;
     
     intmax_t dummyLocation;	    // A place for %n to do its thing in; should be the widest possible int value
 
@@ -5402,7 +6143,7 @@ void _CFStringAppendFormatAndArgumentsAux(CFMutableStringRef outputString, CFStr
     values = NULL;
     
     formatLen = CFStringGetLength(formatString);
-    if (!CF_IS_OBJC(__kCFStringTypeID, formatString)) {
+    if (!CF_IS_OBJC(__kCFStringTypeID, formatString) && !__CFStrIsGapped(formatString)) {	// A gapped format string is copied out below
         __CFAssertIsString(formatString);
         if (!__CFStrIsUnicode(formatString)) {
             cformat = (const uint8_t *)__CFStrContents(formatString);
@@ -5418,13 +6159,17 @@ void _CFStringAppendFormatAndArgumentsAux(CFMutableStringRef outputString, CFStr
         uformat = formatChars;
     }
 
+    tmpAlloc = __CFGetDefaultAllocator();
+    cacheable = !formatChars && __CFStrIsConstant(formatString);
+    if (cacheable && __CFStringFormatCacheLookup(formatString, localSpecsBuffer, &numSpecs, &sizeSpecs)) {
+        specs = localSpecsBuffer;
+    } else {
     /* Compute an upper bound for the number of format specifications */
     if (cformat) {
         for (formatIdx = 0; formatIdx < formatLen; formatIdx++) if ('%' == cformat[formatIdx]) sizeSpecs++;
     } else {
         for (formatIdx = 0; formatIdx < formatLen; formatIdx++) if ('%' == uformat[formatIdx]) sizeSpecs++;
     }
-    tmpAlloc = __CFGetDefaultAllocator();
     specs = ((2 * sizeSpecs + 1) > VPRINTF_BUFFER_LEN) ? (CFFormatSpec *)CFAllocatorAllocate(tmpAlloc, (2 * sizeSpecs + 1) * sizeof(CFFormatSpec), 0) : localSpecsBuffer;
     if (specs != localSpecsBuffer && __CFOASafe) __CFSetLastAllocationEventName(specs, "CFString (temp)");
 
@@ -5465,6 +6210,8 @@ void _CFStringAppendFormatAndArgumentsAux(CFMutableStringRef outputString, CFStr
 
     }
     numSpecs = curSpec;
+    if (cacheable) __CFStringFormatCacheStore(formatString, specs, numSpecs, sizeSpecs);
+    }
     // Max of three args per spec, reasoning thus: 1 width, 1 prec, 1 value
     values = ((3 * sizeSpecs + 1) > VPRINTF_BUFFER_LEN) ? (CFPrintValue *)CFAllocatorAllocate(tmpAlloc, (3 * sizeSpecs + 1) * sizeof(CFPrintValue), 0) : localValuesBuffer;
     if (values != localValuesBuffer && __CFOASafe) __CFSetLastAllocationEventName(values, "CFString (temp)");
@@ -5604,6 +6351,17 @@ void _CFStringAppendFormatAndArgumentsAux(CFMutableStringRef outputString, CFStr
                 SInt32 cidx, idx, loc;
 		Boolean appended = false;
                 loc = specs[curSpec].loc;
+                if (CFFormatLongType == specs[curSpec].type) {
+                    UniChar conversion = cformat ? (UniChar)cformat[loc + specs[curSpec].len - 1] : uformat[loc + specs[curSpec].len - 1];
+                    CFIndex len = __CFStringFormatSimpleInteger(&specs[curSpec], conversion, values[specs[curSpec].mainArgNum].value.int64Value, buffer);
+                    if (len >= 0) {
+                        __CFStringAppendBytes(outputString, buffer, len, kCFStringEncodingASCII);
+#if !defined(__GNUC__)
+                        if (dynamicBuffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, dynamicBuffer);
+#endif
+                        break;
+                    }
+                }
                 // In preparation to call snprintf(), copy the format string out
                 if (cformat) {
                     for (idx = 0, cidx = 0; cidx < specs[curSpec].len; idx++, cidx++) {
@@ -5756,6 +6514,11 @@ void _CFStringAppendFormatAndArgumentsAux(CFMutableStringRef outputString, CFStr
 	case CFFormatObjectType:
             if (NULL != values[specs[curSpec].mainArgNum].value.pointerValue) {
                 CFStringRef str = NULL;
+                CFTypeRef cf = (CFTypeRef)values[specs[curSpec].mainArgNum].value.pointerValue;
+		if (!copyDescFunc && !CF_IS_OBJC(__kCFStringTypeID, cf) && __kCFStringTypeID == __CFGenericTypeID(cf)) {	// A CFString's description is a copy of itself; skip making it
+		    CFStringAppend(outputString, (CFStringRef)cf);
+		    break;
+		}
 		if (copyDescFunc) {
 		    str = copyDescFunc(values[specs[curSpec].mainArgNum].value.pointerValue, formatOptions);
 		} else {
@@ -215,6 +215,7 @@ struct __CFTimeZone {
     CFDataRef _data;		/* immutable */
     CFTZPeriod *_periods;	/* immutable */
     int32_t _periodCnt;		/* immutable */
+    volatile CFIndex _lastPeriod;	/* the period last looked up; only a hint, any thread may replace it */
 };
 
 /* startSec is the whole integer seconds from a CFAbsoluteTime, giving dates
@@ -260,16 +261,35 @@ static CFComparisonResult __CFCompareTZPeriods(const void *val1, const void *val
     return kCFCompareGreaterThan;
 }
 
+/* Period idx is the one for sec if it is the last period starting before sec, or the first period if none does.
+   As with __CFCompareTZPeriods, a time exactly at a period's start still belongs to the period before. */
+CF_INLINE Boolean __CFTZPeriodsContain(CFTimeZoneRef tz, CFIndex idx, int32_t sec) {
+    return (0 == idx || __CFTZPeriodStartSeconds(&(tz->_periods[idx])) < sec) && (tz->_periodCnt <= idx + 1 || sec <= __CFTZPeriodStartSeconds(&(tz->_periods[idx + 1])));
+}
+
+/* The same period as a CFBSearch() with __CFCompareTZPeriods, without a callout per probe */
+CF_INLINE CFIndex __CFTZPeriodsFind(const CFTZPeriod *periods, CFIndex cnt, int32_t sec) {
+    const CFTZPeriod *base = periods;
+    while (1 < cnt) {
+	CFIndex half = cnt / 2;
+	base = (__CFTZPeriodStartSeconds(base + half) < sec) ? base + half : base;
+	cnt -= half;
+    }
+    return base - periods;
+}
+
 static CFIndex __CFBSearchTZPeriods(CFTimeZoneRef tz, CFAbsoluteTime at) {
-    CFTZPeriod elem;
-    __CFTZPeriodInit(&elem, (int32_t)floor(at), NULL, 0, false);
-    CFIndex idx = CFBSearch(&elem, sizeof(CFTZPeriod), tz->_periods, tz->_periodCnt, __CFCompareTZPeriods, NULL);
-    if (tz->_periodCnt <= idx) {
-	idx = tz->_periodCnt;
-    } else if (0 == idx) {
-	idx = 1;
+    /* clamped, since converting a time outside the periods' range to int32_t would be undefined */
+    int32_t sec = (at < (CFAbsoluteTime)INT32_MAX) ? ((at > (CFAbsoluteTime)INT32_MIN) ? (int32_t)floor(at) : INT32_MIN) : INT32_MAX;
+    CFIndex idx = tz->_lastPeriod;
+    if (__CFTZPeriodsContain(tz, idx, sec)) return idx;
+    if (idx + 1 < tz->_periodCnt && __CFTZPeriodsContain(tz, idx + 1, sec)) {
+	idx++;	/* times moving forward across a transition */
+    } else {
+	idx = __CFTZPeriodsFind(tz->_periods, tz->_periodCnt, sec);
     }
-    return idx - 1;
+    ((struct __CFTimeZone *)tz)->_lastPeriod = idx;
+    return idx;
 }
 
 
@@ -834,6 +854,7 @@ CFTimeZoneRef CFTimeZoneCreate(CFAllocatorRef allocator, CFStringRef name, CFDat
     ((struct __CFTimeZone *)memory)->_data = CFDataCreateCopy(allocator, data);
     ((struct __CFTimeZone *)memory)->_periods = tzp;
     ((struct __CFTimeZone *)memory)->_periodCnt = cnt;
+    ((struct __CFTimeZone *)memory)->_lastPeriod = 0;
     if (NULL == __CFTimeZoneCache) {
 	__CFTimeZoneCache = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
     }
@@ -1152,6 +1173,33 @@ CFTimeInterval CFTimeZoneGetSecondsFromGMT(CFTimeZoneRef tz, CFAbsoluteTime at)
 #endif
 }
 
+void CFTimeZoneGetSecondsFromGMTForTimes(CFTimeZoneRef tz, const CFAbsoluteTime *times, CFTimeInterval *offsets, CFIndex count) {
+    CFIndex idx;
+#if !DEPLOYMENT_TARGET_WINDOWS
+    if (!CF_IS_OBJC(CFTimeZoneGetTypeID(), tz)) {
+	CFIndex period = -1;
+	CFAbsoluteTime start = 0.0, end = 0.0;	/* times in [start, end) fall in period */
+	CFTimeInterval offset = 0.0;
+	__CFGenericValidateType(tz, CFTimeZoneGetTypeID());
+	for (idx = 0; idx < count; idx++) {
+	    CFAbsoluteTime at = times[idx];
+	    if (!(start <= at && at < end)) {
+		period = __CFBSearchTZPeriods(tz, at);
+		/* floor(at) is past a start s exactly when at >= s + 1 */
+		start = (0 == period) ? -HUGE_VAL : (CFAbsoluteTime)__CFTZPeriodStartSeconds(&(tz->_periods[period])) + 1.0;
+		end = (tz->_periodCnt <= period + 1) ? HUGE_VAL : (CFAbsoluteTime)__CFTZPeriodStartSeconds(&(tz->_periods[period + 1])) + 1.0;
+		offset = __CFTZPeriodGMTOffset(&(tz->_periods[period]));
+	    }
+	    offsets[idx] = offset;
+	}
+	return;
+    }
+#endif
+    for (idx = 0; idx < count; idx++) {
+	offsets[idx] = CFTimeZoneGetSecondsFromGMT(tz, times[idx]);
+    }
+}
+
 CFStringRef CFTimeZoneCopyAbbreviation(CFTimeZoneRef tz, CFAbsoluteTime at) {
     CFStringRef result;
     CFIndex idx;
@@ -430,17 +430,6 @@ void CFTreeRemoveAllChildren(CFTreeRef tree) {
     }
 }
 
-struct _tcompareContext {
-    CFComparatorFunction func;
-    void *context;
-};
-
-static CFComparisonResult __CFTreeCompareValues(const void *v1, const void *v2, struct _tcompareContext *context) {
-    const void **val1 = (const void **)v1;
-    const void **val2 = (const void **)v2;
-    return (CFComparisonResult)(INVOKE_CALLBACK3(context->func, *val1, *val2, context->context));
-}
-
 void CFTreeSortChildren(CFTreeRef tree, CFComparatorFunction comparator, void *context) {
     CFIndex children;
     __CFGenericValidateType(tree, __kCFTreeTypeID);
@@ -449,7 +438,6 @@ void CFTreeSortChildren(CFTreeRef tree, CFComparatorFunction comparator, void *c
     if (1 < children) {
         CFIndex idx;
         CFTreeRef nextChild;
-        struct _tcompareContext ctx;
         CFTreeRef *list, buffer[128];
         CFAllocatorRef allocator = __CFGetAllocator(tree);
 
@@ -461,9 +449,7 @@ void CFTreeSortChildren(CFTreeRef tree, CFComparatorFunction comparator, void *c
             nextChild = nextChild->_sibling;
         }
 
-        ctx.func = comparator;
-        ctx.context = context;
-        CFQSortArray(list, children, sizeof(CFTreeRef), (CFComparatorFunction)__CFTreeCompareValues, &ctx);
+        __CFSortValues((const void **)list, children, false, comparator, context);
 
         CF_WRITE_BARRIER_BASE_ASSIGN(allocator, tree, tree->_child, list[0]);
         for (idx = 1; idx < children; idx++) {
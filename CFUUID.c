@@ -39,6 +39,13 @@
 #include "CFInternal.h"
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX
 #include <uuid/uuid.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#if DEPLOYMENT_TARGET_LINUX
+#include <sys/syscall.h>
+#endif
 #elif DEPLOYMENT_TARGET_WINDOWS
 #include <objbase.h>
 #include <stdlib.h>
@@ -64,6 +71,110 @@ static CFHashCode __CFhashUUIDBytes(const void *ptr) {
     return CFHashBytes((uint8_t *)ptr, 16);
 }
 
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX
+
+/* Random UUIDs come from a ChaCha20 generator in each thread's data, keyed from the system's random source. Each refill
+   makes four blocks; the first 32 bytes replace the key and the rest are handed out, so earlier output cannot be recovered
+   from the state. A fork bumps the generation, which makes every thread in the child reseed before its next UUID. */
+static volatile uint32_t __CFUUIDForkGeneration = 1;
+
+static void __CFUUIDChildAfterFork(void) {
+    __CFUUIDForkGeneration++;
+}
+
+static Boolean __CFUUIDReadSeed(uint8_t *seed, CFIndex length) {
+    CFIndex done = 0;
+    ssize_t got;
+    int fd;
+
+#if DEPLOYMENT_TARGET_LINUX && defined(SYS_getrandom)
+    while (done < length) {
+        got = syscall(SYS_getrandom, seed + done, length - done, 0);
+        if (got < 0 && EINTR == errno) continue;
+        if (got <= 0) break;
+        done += got;
+    }
+    if (done == length) return true;
+    done = 0;
+#endif
+    fd = open("/dev/urandom", O_RDONLY, 0);
+    if (fd < 0) return false;
+    while (done < length) {
+        got = read(fd, seed + done, length - done);
+        if (got < 0 && EINTR == errno) continue;
+        if (got <= 0) break;
+        done += got;
+    }
+    close(fd);
+    return (done == length);
+}
+
+#define ROTATE(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTERROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTATE(d, 16); \
+    c += d; b ^= c; b = ROTATE(b, 12); \
+    a += b; d ^= a; d = ROTATE(d, 8); \
+    c += d; b ^= c; b = ROTATE(b, 7);
+
+static void __CFUUIDChaChaBlock(const uint32_t *key, uint32_t counter, uint8_t *out) {
+    uint32_t input[16], x[16];
+    int idx;
+
+    input[0] = 0x61707865; input[1] = 0x3320646e; input[2] = 0x79622d32; input[3] = 0x6b206574;
+    for (idx = 0; idx < 8; idx++) input[4 + idx] = key[idx];
+    input[12] = counter; input[13] = 0; input[14] = 0; input[15] = 0;
+    memmove(x, input, sizeof(x));
+    for (idx = 0; idx < 10; idx++) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (idx = 0; idx < 16; idx++) {
+        uint32_t v = x[idx] + input[idx];
+        out[4 * idx] = (uint8_t)v; out[4 * idx + 1] = (uint8_t)(v >> 8); out[4 * idx + 2] = (uint8_t)(v >> 16); out[4 * idx + 3] = (uint8_t)(v >> 24);
+    }
+}
+
+#undef QUARTERROUND
+#undef ROTATE
+
+static Boolean __CFUUIDRandomRefill(__CFUUIDRandomState *state) {
+    uint8_t blocks[256];
+    uint32_t idx;
+
+    if (state->_generation != __CFUUIDForkGeneration) {
+        uint32_t generation = __CFUUIDForkGeneration;
+        if (!__CFUUIDReadSeed((uint8_t *)state->_key, sizeof(state->_key))) return false;
+        state->_generation = generation;
+    }
+    for (idx = 0; idx < 4; idx++) __CFUUIDChaChaBlock(state->_key, idx, blocks + 64 * idx);
+    for (idx = 0; idx < 8; idx++) state->_key[idx] = (uint32_t)blocks[4 * idx] | ((uint32_t)blocks[4 * idx + 1] << 8) | ((uint32_t)blocks[4 * idx + 2] << 16) | ((uint32_t)blocks[4 * idx + 3] << 24);
+    memmove(state->_buffer, blocks + 32, sizeof(state->_buffer));
+    memset(blocks, 0, sizeof(blocks));
+    state->_available = sizeof(state->_buffer);
+    return true;
+}
+
+static Boolean __CFUUIDGenerateRandomBytes(CFUUIDBytes *bytes) {
+    __CFUUIDRandomState *state = &(__CFGetThreadSpecificData_inline()->_uuidRandom);
+    uint8_t *out = (uint8_t *)bytes;
+
+    if ((state->_generation != __CFUUIDForkGeneration || state->_available < 16) && !__CFUUIDRandomRefill(state)) return false;
+    state->_available -= 16;
+    memmove(out, state->_buffer + state->_available, 16);
+    memset(state->_buffer + state->_available, 0, 16);
+    out[6] = (out[6] & 0x0F) | 0x40;	// version 4
+    out[8] = (out[8] & 0x3F) | 0x80;	// RFC 4122 variant
+    return true;
+}
+
+#endif
+
 #if !defined(_MSC_VER)
 #import "auto_stubs.h"
 #endif
@@ -93,12 +204,17 @@ static void __CFUUIDAddUniqueUUID(CFUUIDRef uuid) {
 
 static void __CFUUIDRemoveUniqueUUID(CFUUIDRef uuid) {
     __CFSpinLock(&CFUUIDGlobalDataLock);
-    if (_uniquedUUIDs != NULL) {
+    // An ununiqued UUID with the same bytes must not take a uniqued one's entry with it
+    if (_uniquedUUIDs != NULL && CFDictionaryGetValue(_uniquedUUIDs, &(uuid->_bytes)) == uuid) {
         CFDictionaryRemoveValue(_uniquedUUIDs, &(uuid->_bytes));
     }
     __CFSpinUnlock(&CFUUIDGlobalDataLock);
 }
 
+CF_INLINE Boolean __CFUUIDIsUniqued(CFUUIDRef uuid) {
+    return __CFBitfieldGetValue(((const CFRuntimeBase *)uuid)->_cfinfo[CF_INFO_BITS], 0, 0) == 0;
+}
+
 static CFUUIDRef __CFUUIDGetUniquedUUID(CFUUIDBytes *bytes) {
     CFUUIDRef uuid = NULL;
     __CFSpinLock(&CFUUIDGlobalDataLock);
@@ -111,7 +227,15 @@ static CFUUIDRef __CFUUIDGetUniquedUUID(CFUUIDBytes *bytes) {
 
 static void __CFUUIDDeallocate(CFTypeRef cf) {    
     struct __CFUUID *uuid = (struct __CFUUID *)cf;
-    __CFUUIDRemoveUniqueUUID(uuid);
+    if (__CFUUIDIsUniqued(uuid)) __CFUUIDRemoveUniqueUUID(uuid);
+}
+
+static Boolean __CFUUIDEqual(CFTypeRef cf1, CFTypeRef cf2) {
+    return __CFisEqualUUIDBytes(&((CFUUIDRef)cf1)->_bytes, &((CFUUIDRef)cf2)->_bytes);
+}
+
+static CFHashCode __CFUUIDHash(CFTypeRef cf) {
+    return __CFhashUUIDBytes(&((CFUUIDRef)cf)->_bytes);
 }
 
 static CFStringRef __CFUUIDCopyDescription(CFTypeRef cf) {
@@ -133,14 +257,17 @@ static const CFRuntimeClass __CFUUIDClass = {
     NULL,	// init
     NULL,	// copy
     __CFUUIDDeallocate,
-    NULL,	// equal
-    NULL,	// hash
+    __CFUUIDEqual,
+    __CFUUIDHash,
     __CFUUIDCopyFormattingDescription,
     __CFUUIDCopyDescription
 };
 
 __private_extern__ void __CFUUIDInitialize(void) {
     __kCFUUIDTypeID = _CFRuntimeRegisterClass(&__CFUUIDClass);
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX
+    pthread_atfork(NULL, NULL, __CFUUIDChildAfterFork);
+#endif
 }
 
 CFTypeID CFUUIDGetTypeID(void) {
@@ -171,10 +298,10 @@ CFUUIDRef CFUUIDCreate(CFAllocatorRef alloc) {
     /* Create a new bytes struct and then call the primitive. */
     CFUUIDBytes bytes;
     uint32_t retval = 0;
-    
-    __CFSpinLock(&CFUUIDGlobalDataLock);
-    static Boolean useV1UUIDs = false, checked = false;
+    static volatile Boolean useV1UUIDs = false, checked = false;
+
     if (!checked) {
+        // Racing threads compute the same answer
         const char *value = getenv("CFUUIDVersionNumber");
         if (value) {
             if (1 == strtoul_l(value, NULL, 0, NULL)) useV1UUIDs = true;
@@ -183,6 +310,10 @@ CFUUIDRef CFUUIDCreate(CFAllocatorRef alloc) {
         }
         checked = true;
     }
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX
+    if (!useV1UUIDs && __CFUUIDGenerateRandomBytes(&bytes)) return __CFUUIDCreateWithBytesPrimitive(alloc, bytes, false);
+#endif
+    __CFSpinLock(&CFUUIDGlobalDataLock);
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX
     uuid_t uuid;
     if (useV1UUIDs) uuid_generate_time(uuid); else uuid_generate_random(uuid);
@@ -222,21 +353,6 @@ CFUUIDRef CFUUIDCreateWithBytes(CFAllocatorRef alloc, uint8_t byte0, uint8_t byt
     return __CFUUIDCreateWithBytesPrimitive(alloc, bytes, false);
 }
 
-static void _intToHexChars(UInt32 in, UniChar *out, int digits) {
-    int shift;
-    UInt32 d;
-
-    while (--digits >= 0) {
-        shift = digits << 2;
-        d = 0x0FL & (in >> shift);
-        if (d <= 9) {
-            *out++ = (UniChar)'0' + d;
-        } else {
-            *out++ = (UniChar)'A' + (d - 10);
-        }
-    }
-}
-
 static uint8_t _byteFromHexChars(UniChar *in) {
     uint8_t result = 0;
     UniChar c;
@@ -324,48 +440,60 @@ CFUUIDRef CFUUIDCreateFromString(CFAllocatorRef alloc, CFStringRef uuidStr) {
     return __CFUUIDCreateWithBytesPrimitive(alloc, bytes, false);
 }
 
+// Writes the 36 characters of the canonical form, without a terminator
+static void __CFUUIDFormatBytes(const CFUUIDBytes *bytes, char *out) {
+    static const char hexDigits[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+    const uint8_t *src = (const uint8_t *)bytes;
+    CFIndex idx;
+
+    for (idx = 0; idx < 16; idx++) {
+        if (4 == idx || 6 == idx || 8 == idx || 10 == idx) *out++ = '-';
+        *out++ = hexDigits[src[idx] >> 4];
+        *out++ = hexDigits[src[idx] & 0x0F];
+    }
+}
+
 CFStringRef CFUUIDCreateString(CFAllocatorRef alloc, CFUUIDRef uuid) {
     CFMutableStringRef str = CFStringCreateMutable(alloc, 0);
-    UniChar buff[12];
-
-    // First segment (4 bytes, 8 digits + 1 dash)
-    _intToHexChars(uuid->_bytes.byte0, buff, 2);
-    _intToHexChars(uuid->_bytes.byte1, &(buff[2]), 2);
-    _intToHexChars(uuid->_bytes.byte2, &(buff[4]), 2);
-    _intToHexChars(uuid->_bytes.byte3, &(buff[6]), 2);
-    buff[8] = (UniChar)'-';
-    CFStringAppendCharacters(str, buff, 9);
-
-    // Second segment (2 bytes, 4 digits + 1 dash)
-    _intToHexChars(uuid->_bytes.byte4, buff, 2);
-    _intToHexChars(uuid->_bytes.byte5, &(buff[2]), 2);
-    buff[4] = (UniChar)'-';
-    CFStringAppendCharacters(str, buff, 5);
-
-    // Third segment (2 bytes, 4 digits + 1 dash)
-    _intToHexChars(uuid->_bytes.byte6, buff, 2);
-    _intToHexChars(uuid->_bytes.byte7, &(buff[2]), 2);
-    buff[4] = (UniChar)'-';
-    CFStringAppendCharacters(str, buff, 5);
-
-    // Fourth segment (2 bytes, 4 digits + 1 dash)
-    _intToHexChars(uuid->_bytes.byte8, buff, 2);
-    _intToHexChars(uuid->_bytes.byte9, &(buff[2]), 2);
-    buff[4] = (UniChar)'-';
-    CFStringAppendCharacters(str, buff, 5);
-
-    // Fifth segment (6 bytes, 12 digits)
-    _intToHexChars(uuid->_bytes.byte10, buff, 2);
-    _intToHexChars(uuid->_bytes.byte11, &(buff[2]), 2);
-    _intToHexChars(uuid->_bytes.byte12, &(buff[4]), 2);
-    _intToHexChars(uuid->_bytes.byte13, &(buff[6]), 2);
-    _intToHexChars(uuid->_bytes.byte14, &(buff[8]), 2);
-    _intToHexChars(uuid->_bytes.byte15, &(buff[10]), 2);
-    CFStringAppendCharacters(str, buff, 12);
+    char cBuff[36];
+    UniChar buff[36];
+    CFIndex idx;
+
+    __CFUUIDFormatBytes(&(uuid->_bytes), cBuff);
+    for (idx = 0; idx < 36; idx++) buff[idx] = (UniChar)cBuff[idx];
+    CFStringAppendCharacters(str, buff, 36);
 
     return str;
 }
 
+Boolean CFUUIDGetCStringForBytes(const CFUUIDBytes *bytes, char *buffer, CFIndex bufferSize) {
+    if (bufferSize < 37) return false;
+    __CFUUIDFormatBytes(bytes, buffer);
+    buffer[36] = '\0';
+    return true;
+}
+
+void CFUUIDGetBytesDirect(CFUUIDBytes *bytes) {
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_LINUX
+    if (__CFUUIDGenerateRandomBytes(bytes)) return;
+    uuid_generate_random((uint8_t *)bytes);
+#elif DEPLOYMENT_TARGET_WINDOWS
+    UuidCreate((UUID *)bytes);
+#else
+    #error Unknown or unspecified DEPLOYMENT_TARGET
+#endif
+}
+
+CFUUIDRef CFUUIDCreateUnuniqued(CFAllocatorRef alloc) {
+    struct __CFUUID *uuid = (struct __CFUUID *)_CFRuntimeCreateInstance(alloc, __kCFUUIDTypeID, sizeof(struct __CFUUID) - sizeof(CFRuntimeBase), NULL);
+
+    if (NULL == uuid) return NULL;
+    CFUUIDGetBytesDirect(&(uuid->_bytes));
+    // Marks the instance as absent from the uniquing table
+    __CFBitfieldSetValue(((CFRuntimeBase *)uuid)->_cfinfo[CF_INFO_BITS], 0, 0, 1);
+    return (CFUUIDRef)uuid;
+}
+
 CFUUIDRef CFUUIDGetConstantUUIDWithBytes(CFAllocatorRef alloc, uint8_t byte0, uint8_t byte1, uint8_t byte2, uint8_t byte3, uint8_t byte4, uint8_t byte5, uint8_t byte6, uint8_t byte7, uint8_t byte8, uint8_t byte9, uint8_t byte10, uint8_t byte11, uint8_t byte12, uint8_t byte13, uint8_t byte14, uint8_t byte15) {
     CFUUIDBytes bytes;
     // CodeWarrior can't handle the structure assignment of bytes, so we must explode this - REW, 10/8/99
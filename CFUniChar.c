@@ -75,6 +75,8 @@ extern size_t strlcat(char *dst, const char *src, size_t siz);
 
 #if DEPLOYMENT_TARGET_MACOSX
 #define USE_MACHO_SEGMENT 1
+#elif CF_USE_EMBEDDED_UNICODE_DATA && (DEPLOYMENT_TARGET_LINUX || DEPLOYMENT_TARGET_FREEBSD)
+#define USE_EMBEDDED_DATA 1
 #endif //__MACH__
 
 enum {
@@ -113,7 +115,33 @@ static const void *__CFGetSectDataPtr(const char *segname, const char *sectname,
 
 #endif
 
-#if !USE_MACHO_SEGMENT
+#if USE_EMBEDDED_DATA
+
+// The data files are assembled into the library's read-only data; CF_UNICHAR_DATA_DIR is where the build finds them
+#if __CF_BIG_ENDIAN__
+#define __CFUniCharEmbeddedMappingFile "CFUnicodeData-B.mapping"
+#else
+#define __CFUniCharEmbeddedMappingFile "CFUnicodeData-L.mapping"
+#endif
+
+#define __CFUniCharEmbedFile(symbol, fileName) __asm__(".section .rodata\n.balign 16\n" #symbol ":\n.incbin \"" CF_UNICHAR_DATA_DIR "/" fileName "\"\n.previous\n")
+
+__CFUniCharEmbedFile(__CFUniCharEmbeddedBitmaps, "CFCharacterSetBitmaps.bitmap");
+__CFUniCharEmbedFile(__CFUniCharEmbeddedMappings, __CFUniCharEmbeddedMappingFile);
+__CFUniCharEmbedFile(__CFUniCharEmbeddedProperties, "CFUniCharPropertyDatabase.data");
+
+__private_extern__ extern const uint8_t __CFUniCharEmbeddedBitmaps[];
+__private_extern__ extern const uint8_t __CFUniCharEmbeddedMappings[];
+__private_extern__ extern const uint8_t __CFUniCharEmbeddedProperties[];
+
+static const void *__CFGetEmbeddedDataPtr(const char *fileName) {
+    if (0 == strcmp(fileName, "CFCharacterSetBitmaps.bitmap")) return __CFUniCharEmbeddedBitmaps;
+    if (0 == strcmp(fileName, __CFUniCharEmbeddedMappingFile)) return __CFUniCharEmbeddedMappings;
+    if (0 == strcmp(fileName, "CFUniCharPropertyDatabase.data")) return __CFUniCharEmbeddedProperties;
+    return NULL;
+}
+
+#elif !USE_MACHO_SEGMENT
 
 #if DEPLOYMENT_TARGET_WINDOWS
 extern const char* _CFDLLPath(void);
@@ -241,6 +269,9 @@ static bool __CFUniCharLoadFile(const char *bitmapName, const void **bytes) {
 #if USE_MACHO_SEGMENT
 	*bytes = __CFGetSectDataPtr("__UNICODE", bitmapName, NULL);
     return *bytes ? true : false;
+#elif USE_EMBEDDED_DATA
+    *bytes = __CFGetEmbeddedDataPtr(bitmapName);
+    return *bytes ? true : false;
 #else
     char cpath[MAXPATHLEN];
     __CFUniCharCharacterSetPath(cpath);
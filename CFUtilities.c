@@ -556,6 +556,36 @@ void CFShow(const void *obj) {
 }
 
 
+static CFMutableConcurrentDictionaryRef __CFICUPrototypes = NULL;
+
+#define __CFICUPrototypesMax 256
+
+static CFMutableConcurrentDictionaryRef __CFICUPrototypeTable(void) {
+    CFMutableConcurrentDictionaryRef table = __CFICUPrototypes;
+    if (!table) {
+	table = CFConcurrentDictionaryCreateMutable(kCFAllocatorSystemDefault, &kCFTypeDictionaryKeyCallBacks, NULL);
+	if (!_CFAtomicCompareAndSwapPtrBarrier(NULL, table, (void *volatile *)&__CFICUPrototypes)) {
+	    CFRelease(table);
+	    table = __CFICUPrototypes;
+	}
+    }
+    return table;
+}
+
+__private_extern__ const void *__CFICUPrototypeGet(CFStringRef key) {
+    CFMutableConcurrentDictionaryRef table = __CFICUPrototypes;
+    return table ? CFConcurrentDictionaryGetValue(table, key) : NULL;
+}
+
+__private_extern__ Boolean __CFICUPrototypeAdd(CFStringRef key, const void *prototype) {
+    CFMutableConcurrentDictionaryRef table = __CFICUPrototypeTable();
+    // Prototypes are never removed, since other threads may be cloning them; past the cap, callers just open their own
+    if (__CFICUPrototypesMax <= CFConcurrentDictionaryGetCount(table)) return false;
+    CFConcurrentDictionaryAddValue(table, key, prototype);
+    return CFConcurrentDictionaryGetValue(table, key) == prototype;
+}
+
+
 
 void CFLog(int32_t lev, CFStringRef format, ...) {
     CFStringRef result;
@@ -0,0 +1,446 @@
+/*
+ *  bit_vector_test.c
+ *  CFLite
+ *
+ *  Checks compressed bit vectors against a plain array of bits: chunks moving between the array,
+ *  bitmap and run forms as bits change, set operations between chunks of every form, round trips
+ *  through the serialized form, and rejection of serialized bytes that have been corrupted.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreFoundation/CFPriv.h>
+
+#define CHUNK_BITS 65536
+#define NUM_CHUNKS 6
+#define MODEL_BITS (NUM_CHUNKS * CHUNK_BITS)
+
+// Chunk forms, as written in the serialized form
+enum {
+   ARRAY_CHUNK = 0,
+   BITMAP_CHUNK = 1,
+   RUN_CHUNK = 2
+};
+
+static const char *chunkNames[] = {"array", "bitmap", "runs"};
+
+typedef struct {
+   CFIndex count;
+   UInt8 bits[MODEL_BITS];
+} Model;
+
+static void model_set (Model *model, CFIndex idx, CFBit value)
+{
+   model->bits[idx] = value;
+}
+
+static bool matches_model (CFBitVectorRef bv, const Model *model, const char *what)
+{
+   CFIndex idx, setBits = 0;
+   CFIndex count = CFBitVectorGetCount(bv);
+
+   if (count != model->count) {
+      printf("%s: count %ld, expected %ld\n", what, (long)count, (long)model->count);
+      return false;
+   }
+   for (idx = 0; idx < count; idx++) {
+      if (CFBitVectorGetBitAtIndex(bv, idx) != model->bits[idx]) {
+         printf("%s: bit %ld is %d, expected %d\n", what, (long)idx, (int)CFBitVectorGetBitAtIndex(bv, idx), (int)model->bits[idx]);
+         return false;
+      }
+      setBits += model->bits[idx];
+   }
+   if (CFBitVectorGetCountOfBit(bv, CFRangeMake(0, count), 1) != setBits) {
+      printf("%s: %ld bits set, expected %ld\n", what, (long)CFBitVectorGetCountOfBit(bv, CFRangeMake(0, count), 1), (long)setBits);
+      return false;
+   }
+   return true;
+}
+
+static Model *create_model (CFIndex count)
+{
+   Model *model = calloc(1, sizeof(Model));
+   model->count = count;
+   return model;
+}
+
+static void set_bits (CFMutableBitVectorRef bv, Model *model, CFIndex first, CFIndex length, CFBit value)
+{
+   CFIndex idx;
+
+   CFBitVectorSetBits(bv, CFRangeMake(first, length), value);
+   for (idx = first; idx < first + length; idx++) model_set(model, idx, value);
+}
+
+static void set_random_bits (CFMutableBitVectorRef bv, Model *model, CFIndex first, CFIndex length, CFIndex number, CFBit value)
+{
+   CFIndex n;
+
+   for (n = 0; n < number; n++) {
+      CFIndex idx = first + random() % length;
+      CFBitVectorSetBitAtIndex(bv, idx, value);
+      model_set(model, idx, value);
+   }
+}
+
+// The form of the chunk holding bit idx in the serialized bytes, or -1 if it has no bits set
+static int chunk_form (CFBitVectorRef bv, CFIndex idx)
+{
+   CFDataRef data = CFBitVectorCreateCompressedData(kCFAllocatorDefault, bv);
+   const UInt8 *bytes = CFDataGetBytePtr(data) + 16;
+   UInt32 numChunks = CFDataGetBytePtr(data)[12] | (CFDataGetBytePtr(data)[13] << 8);
+   int form = -1;
+
+   while (numChunks--) {
+      CFIndex key = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16);
+      int type = bytes[4];
+      CFIndex setBits = (bytes[6] | (bytes[7] << 8)) + 1, numRuns = bytes[8] | (bytes[9] << 8);
+      if (key == idx / CHUNK_BITS) {
+         form = type;
+         break;
+      }
+      bytes += 10 + (type == ARRAY_CHUNK ? 2 * setBits : type == BITMAP_CHUNK ? CHUNK_BITS / 8 : 4 * numRuns);
+   }
+   CFRelease(data);
+   return form;
+}
+
+static bool has_form (CFBitVectorRef bv, CFIndex idx, int expected, const char *what)
+{
+   int form = chunk_form(bv, idx);
+
+   if (form != expected) {
+      printf("%s: chunk is kept as %s, expected %s\n", what, form < 0 ? "nothing" : chunkNames[form], expected < 0 ? "nothing" : chunkNames[expected]);
+      return false;
+   }
+   return true;
+}
+
+bool check_chunk_forms ()
+{
+   CFMutableBitVectorRef bv = CFBitVectorCreateMutableCompressed(kCFAllocatorDefault);
+   Model *model = create_model(CHUNK_BITS);
+   CFIndex idx;
+   bool result = true;
+
+   CFShow(CFSTR("Checking that chunks change form as their bits change:"));
+
+   CFBitVectorSetCount(bv, CHUNK_BITS);
+   srandom(1);
+   set_random_bits(bv, model, 0, CHUNK_BITS, 200, 1);
+   result = matches_model(bv, model, "Sparse bits") && has_form(bv, 0, ARRAY_CHUNK, "Sparse bits") && result;
+   set_random_bits(bv, model, 0, CHUNK_BITS, 8000, 1);
+   result = matches_model(bv, model, "Dense bits") && has_form(bv, 0, BITMAP_CHUNK, "Dense bits") && result;
+   set_bits(bv, model, 0, CHUNK_BITS, 0);
+   result = matches_model(bv, model, "Cleared bits") && has_form(bv, 0, -1, "Cleared bits") && result;
+   set_bits(bv, model, 1000, 30000, 1);
+   result = matches_model(bv, model, "One run") && has_form(bv, 0, RUN_CHUNK, "One run") && result;
+   for (idx = 2000; idx < 30000; idx += 1000) {
+      CFBitVectorFlipBitAtIndex(bv, idx);
+      model_set(model, idx, 0);
+   }
+   result = matches_model(bv, model, "Split runs") && has_form(bv, 0, RUN_CHUNK, "Split runs") && result;
+   // Clearing every other bit makes too many runs
+   for (idx = 1000; idx < 31000; idx += 2) {
+      CFBitVectorSetBitAtIndex(bv, idx, 0);
+      model_set(model, idx, 0);
+   }
+   result = matches_model(bv, model, "Alternate bits") && has_form(bv, 0, BITMAP_CHUNK, "Alternate bits") && result;
+   set_bits(bv, model, 0, 30000, 0);
+   result = matches_model(bv, model, "Few bits left") && has_form(bv, 0, ARRAY_CHUNK, "Few bits left") && result;
+   CFBitVectorFlipBits(bv, CFRangeMake(0, CHUNK_BITS));
+   for (idx = 0; idx < CHUNK_BITS; idx++) model_set(model, idx, !model->bits[idx]);
+   result = matches_model(bv, model, "Flipped bits") && has_form(bv, 0, RUN_CHUNK, "Flipped bits") && result;
+   CFBitVectorSetAllBits(bv, 0);
+   for (idx = 0; idx < CHUNK_BITS; idx++) model_set(model, idx, 0);
+   result = matches_model(bv, model, "All bits cleared") && has_form(bv, 0, -1, "All bits cleared") && result;
+
+   CFRelease(bv);
+   free(model);
+
+   printf("\n");
+   return result;
+}
+
+// Gives each chunk of a vector a different form, in an order that depends on rotate
+static void fill_chunks (CFMutableBitVectorRef bv, Model *model, int rotate)
+{
+   CFIndex first;
+
+   for (first = 0; first < model->count; first += CHUNK_BITS) {
+      CFIndex length = (model->count - first < CHUNK_BITS) ? model->count - first : CHUNK_BITS;
+      switch ((first / CHUNK_BITS + rotate) % 4) {
+      case 0: break;
+      case 1: set_random_bits(bv, model, first, length, 300, 1); break;
+      case 2: set_random_bits(bv, model, first, length, 20000, 1); break;
+      case 3: set_bits(bv, model, first + 500 * rotate, length / 3, 1); set_bits(bv, model, first + length / 2, length / 8, 1); break;
+      }
+   }
+}
+
+static CFMutableBitVectorRef create_dense (const Model *model)
+{
+   CFMutableBitVectorRef bv = CFBitVectorCreateMutable(kCFAllocatorDefault, 0);
+   CFIndex idx;
+
+   CFBitVectorSetCount(bv, model->count);
+   for (idx = 0; idx < model->count; idx++) if (model->bits[idx]) CFBitVectorSetBitAtIndex(bv, idx, 1);
+   return bv;
+}
+
+bool check_set_operations ()
+{
+   static void (*const operations[])(CFMutableBitVectorRef, CFBitVectorRef) = {CFBitVectorAndBits, CFBitVectorOrBits, CFBitVectorXorBits, CFBitVectorAndNotBits};
+   static const char *operationNames[] = {"and", "or", "xor", "and not"};
+   CFIndex op, rotate, idx;
+   bool result = true;
+
+   CFShow(CFSTR("Checking set operations between chunks of every form:"));
+
+   srandom(2);
+   for (rotate = 0; rotate < 4 && result; rotate++) {
+      CFMutableBitVectorRef first = CFBitVectorCreateMutableCompressed(kCFAllocatorDefault);
+      CFMutableBitVectorRef second = CFBitVectorCreateMutableCompressed(kCFAllocatorDefault);
+      Model *firstModel = create_model(MODEL_BITS), *secondModel = create_model(MODEL_BITS - CHUNK_BITS / 2);
+      CFMutableBitVectorRef firstDense, secondDense;
+
+      CFBitVectorSetCount(first, firstModel->count);
+      CFBitVectorSetCount(second, secondModel->count);
+      fill_chunks(first, firstModel, 0);
+      fill_chunks(second, secondModel, rotate);
+      firstDense = create_dense(firstModel);
+      secondDense = create_dense(secondModel);
+
+      for (op = 0; op < 4 && result; op++) {
+         CFMutableBitVectorRef bothCompressed = CFBitVectorCreateMutableCopy(kCFAllocatorDefault, 0, first);
+         CFMutableBitVectorRef withDense = CFBitVectorCreateMutableCopy(kCFAllocatorDefault, 0, first);
+         CFMutableBitVectorRef dense = CFBitVectorCreateMutableCopy(kCFAllocatorDefault, 0, firstDense);
+         Model *expected = create_model(firstModel->count);
+         char what[64];
+
+         // Bits past the end of the second vector count as clear
+         for (idx = 0; idx < expected->count; idx++) {
+            CFBit a = firstModel->bits[idx], b = (idx < secondModel->count) ? secondModel->bits[idx] : 0;
+            expected->bits[idx] = (op == 0) ? (a & b) : (op == 1) ? (a | b) : (op == 2) ? (a ^ b) : (a & !b);
+         }
+         operations[op](bothCompressed, second);
+         operations[op](withDense, secondDense);
+         operations[op](dense, second);
+         snprintf(what, sizeof(what), "Compressed %s compressed, pattern %ld", operationNames[op], (long)rotate);
+         result = matches_model(bothCompressed, expected, what) && result;
+         snprintf(what, sizeof(what), "Compressed %s dense, pattern %ld", operationNames[op], (long)rotate);
+         result = matches_model(withDense, expected, what) && result;
+         snprintf(what, sizeof(what), "Dense %s compressed, pattern %ld", operationNames[op], (long)rotate);
+         result = matches_model(dense, expected, what) && result;
+         if (!CFBitVectorIsCompressed(bothCompressed) || !CFBitVectorIsCompressed(withDense) || CFBitVectorIsCompressed(dense)) {
+            printf("The %s changed whether a vector is compressed\n", operationNames[op]);
+            result = false;
+         }
+         CFRelease(bothCompressed);
+         CFRelease(withDense);
+         CFRelease(dense);
+         free(expected);
+      }
+      CFRelease(first);
+      CFRelease(second);
+      CFRelease(firstDense);
+      CFRelease(secondDense);
+      free(firstModel);
+      free(secondModel);
+   }
+
+   printf("\n");
+   return result;
+}
+
+bool check_round_trips ()
+{
+   CFMutableBitVectorRef bv = CFBitVectorCreateMutableCompressed(kCFAllocatorDefault);
+   CFMutableBitVectorRef dense;
+   Model *model = create_model(MODEL_BITS - 7);
+   CFDataRef data, denseData, copyData;
+   CFBitVectorRef copy;
+   bool result = true;
+
+   CFShow(CFSTR("Checking round trips through the serialized form:"));
+
+   CFBitVectorSetCount(bv, model->count);
+   srandom(3);
+   fill_chunks(bv, model, 1);
+   set_bits(bv, model, model->count - 10, 10, 1);
+   data = CFBitVectorCreateCompressedData(kCFAllocatorDefault, bv);
+   copy = CFBitVectorCreateWithCompressedBytes(kCFAllocatorDefault, CFDataGetBytePtr(data), CFDataGetLength(data));
+   if (NULL == copy) {
+      printf("Serialized bytes were rejected\n");
+      result = false;
+   } else {
+      result = matches_model(copy, model, "Round trip") && result;
+      if (!CFBitVectorIsCompressed(copy) || !CFEqual(copy, bv)) {
+         printf("The round trip is not an equal compressed vector\n");
+         result = false;
+      }
+      copyData = CFBitVectorCreateCompressedData(kCFAllocatorDefault, copy);
+      if (!CFEqual(copyData, data)) {
+         printf("Serializing the round trip gives different bytes\n");
+         result = false;
+      }
+      CFRelease(copyData);
+      CFRelease(copy);
+   }
+
+   // A dense vector with the same bits serializes to the same bytes
+   dense = create_dense(model);
+   denseData = CFBitVectorCreateCompressedData(kCFAllocatorDefault, dense);
+   if (!CFEqual(denseData, data)) {
+      printf("A dense vector serializes differently\n");
+      result = false;
+   }
+   CFRelease(denseData);
+
+   // So does an empty vector
+   CFRelease(data);
+   CFBitVectorSetCount(bv, 0);
+   data = CFBitVectorCreateCompressedData(kCFAllocatorDefault, bv);
+   copy = CFBitVectorCreateWithCompressedBytes(kCFAllocatorDefault, CFDataGetBytePtr(data), CFDataGetLength(data));
+   if (NULL == copy || 0 != CFBitVectorGetCount(copy)) {
+      printf("An empty vector does not round trip\n");
+      result = false;
+   }
+   if (copy) CFRelease(copy);
+
+   CFRelease(data);
+   CFRelease(dense);
+   CFRelease(bv);
+   free(model);
+
+   printf("\n");
+   return result;
+}
+
+static void put_integer (UInt8 *bytes, UInt64 value, CFIndex size)
+{
+   CFIndex idx;
+
+   for (idx = 0; idx < size; idx++) bytes[idx] = (UInt8)(value >> (8 * idx));
+}
+
+static bool rejects (const UInt8 *bytes, CFIndex length, const char *what)
+{
+   CFBitVectorRef bv = CFBitVectorCreateWithCompressedBytes(kCFAllocatorDefault, bytes, length);
+
+   if (bv) {
+      printf("Bytes with %s were accepted\n", what);
+      CFRelease(bv);
+      return false;
+   }
+   return true;
+}
+
+bool check_corrupted_bytes ()
+{
+   CFMutableBitVectorRef bv = CFBitVectorCreateMutableCompressed(kCFAllocatorDefault);
+   CFDataRef data;
+   CFIndex length, n;
+   UInt8 *bytes;
+   bool result = true;
+
+   CFShow(CFSTR("Checking that corrupted serialized bytes are rejected:"));
+
+   // One array chunk with bits 5 and 9 at offset 16, then a run chunk with bits 70000-70099 at offset 30
+   CFBitVectorSetCount(bv, 2 * CHUNK_BITS);
+   CFBitVectorSetBitAtIndex(bv, 5, 1);
+   CFBitVectorSetBitAtIndex(bv, 9, 1);
+   CFBitVectorSetBits(bv, CFRangeMake(70000, 100), 1);
+   data = CFBitVectorCreateCompressedData(kCFAllocatorDefault, bv);
+   length = CFDataGetLength(data);
+   bytes = malloc(length + 1);
+#define RESET() memmove(bytes, CFDataGetBytePtr(data), length)
+   RESET();
+   if (length != 44 || bytes[20] != ARRAY_CHUNK || bytes[34] != RUN_CHUNK) {
+      printf("Unexpected serialized form (%ld bytes)\n", (long)length);
+      result = false;
+   } else {
+      bytes[0] = 'X';
+      result = rejects(bytes, length, "the wrong cookie") && result;
+      RESET();
+      result = rejects(bytes, 15, "a short header") && result;
+      for (n = 16; n < length; n++) {
+         if (!rejects(bytes, n, "a truncated chunk")) {
+            result = false;
+            break;
+         }
+      }
+      bytes[length] = 0;
+      result = rejects(bytes, length + 1, "a trailing byte") && result;
+      put_integer(bytes + 4, (UInt64)1 << 63, 8);
+      result = rejects(bytes, length, "a negative count") && result;
+      RESET();
+      put_integer(bytes + 4, 70050, 8);
+      result = rejects(bytes, length, "bits set past the count") && result;
+      RESET();
+      put_integer(bytes + 4, CHUNK_BITS, 8);
+      result = rejects(bytes, length, "a chunk past the count") && result;
+      RESET();
+      put_integer(bytes + 12, 3, 4);
+      result = rejects(bytes, length, "too many chunks") && result;
+      RESET();
+      put_integer(bytes + 30, 0, 4);
+      result = rejects(bytes, length, "chunks out of order") && result;
+      RESET();
+      put_integer(bytes + 20, 3, 2);
+      result = rejects(bytes, length, "an unknown chunk form") && result;
+      RESET();
+      put_integer(bytes + 22, 2, 2);
+      result = rejects(bytes, length, "the wrong number of set bits") && result;
+      RESET();
+      put_integer(bytes + 26, 9, 2);
+      put_integer(bytes + 28, 9, 2);
+      result = rejects(bytes, length, "a repeated array value") && result;
+      RESET();
+      put_integer(bytes + 40, 70100 - CHUNK_BITS, 2);
+      result = rejects(bytes, length, "a run that ends before it starts") && result;
+      RESET();
+
+      // Any other damage is either rejected or gives a well-formed vector
+      srandom(4);
+      for (n = 0; n < 2000; n++) {
+         CFBitVectorRef damaged;
+         RESET();
+         bytes[random() % length] ^= 1 << (random() % 8);
+         damaged = CFBitVectorCreateWithCompressedBytes(kCFAllocatorDefault, bytes, length);
+         if (damaged) {
+            CFIndex count = CFBitVectorGetCount(damaged), last = CFBitVectorGetLastIndexOfBit(damaged, CFRangeMake(0, count), 1);
+            if (last != kCFNotFound && last >= count) {
+               printf("Damaged bytes gave a vector with bit %ld set past its count %ld\n", (long)last, (long)count);
+               result = false;
+            }
+            CFRelease(damaged);
+         }
+      }
+   }
+#undef RESET
+
+   free(bytes);
+   CFRelease(data);
+   CFRelease(bv);
+
+   printf("\n");
+   return result;
+}
+
+int main (int argc, const char *argv[])
+{
+   bool result = true;
+
+   result = check_chunk_forms() && result;
+   result = check_set_operations() && result;
+   result = check_round_trips() && result;
+   result = check_corrupted_bytes() && result;
+
+   printf(result ? "All bit vector checks passed\n" : "Bit vector checks FAILED\n");
+   return result ? 0 : 1;
+}
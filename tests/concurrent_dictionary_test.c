@@ -0,0 +1,272 @@
+/*
+ *  concurrent_dictionary_test.c
+ *  CFLite
+ *
+ *  Checks CFConcurrentDictionary against a CFMutableDictionary holding the same entries, that
+ *  snapshots do not see later changes, and that readers and snapshots running alongside a writer
+ *  only ever see whole entries and consistent versions, with every value released exactly once.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreFoundation/CFPriv.h>
+
+#define NUM_KEYS 2000
+#define VALUE_FOR_KEY(key, n) ((const void *)((long)(n) * 100000 + (long)(key)))
+#define KEY_OF_VALUE(value) ((long)(value) % 100000)
+
+static volatile long liveValues;		// Values retained by the dictionaries and not yet released
+
+static const void *retain_value (CFAllocatorRef allocator, const void *value)
+{
+   __sync_add_and_fetch(&liveValues, 1);
+   return value;
+}
+
+static void release_value (CFAllocatorRef allocator, const void *value)
+{
+   __sync_sub_and_fetch(&liveValues, 1);
+}
+
+// Puts every key in one of seven buckets, so the trie has to keep colliding entries together
+static CFHashCode colliding_hash (const void *key)
+{
+   return (CFHashCode)key % 7;
+}
+
+static Boolean pointers_equal (const void *key1, const void *key2)
+{
+   return key1 == key2;
+}
+
+static const CFDictionaryValueCallBacks valueCallBacks = {0, retain_value, release_value, NULL, NULL};
+static const CFDictionaryKeyCallBacks pointerKeyCallBacks = {0, NULL, NULL, NULL, NULL, NULL};
+static const CFDictionaryKeyCallBacks collidingKeyCallBacks = {0, NULL, NULL, NULL, pointers_equal, colliding_hash};
+
+static void sum_values (const void *key, const void *value, void *context)
+{
+   *(long *)context += (long)value;
+}
+
+static bool matches_model (CFConcurrentDictionaryRef cd, CFDictionaryRef model)
+{
+   long key, cdSum = 0, modelSum = 0;
+
+   if (CFConcurrentDictionaryGetCount(cd) != CFDictionaryGetCount(model)) {
+      printf("Count %ld, expected %ld\n", (long)CFConcurrentDictionaryGetCount(cd), (long)CFDictionaryGetCount(model));
+      return false;
+   }
+   for (key = 1; key <= NUM_KEYS; key++) {
+      const void *value = NULL, *expected = NULL;
+      Boolean present = CFConcurrentDictionaryGetValueIfPresent(cd, (const void *)key, &value);
+      if (present != CFDictionaryGetValueIfPresent(model, (const void *)key, &expected) || value != expected) {
+         printf("Key %ld maps to %ld, expected %ld\n", key, present ? (long)value : -1L, (long)expected);
+         return false;
+      }
+   }
+   CFConcurrentDictionaryApplyFunction(cd, sum_values, &cdSum);
+   CFDictionaryApplyFunction(model, sum_values, &modelSum);
+   if (cdSum != modelSum) {
+      printf("CFConcurrentDictionaryApplyFunction() visited the wrong values\n");
+      return false;
+   }
+   return true;
+}
+
+bool check_against_model (const CFDictionaryKeyCallBacks *keyCallBacks)
+{
+   CFMutableConcurrentDictionaryRef cd = CFConcurrentDictionaryCreateMutable(kCFAllocatorDefault, keyCallBacks, &valueCallBacks);
+   CFMutableDictionaryRef model = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, keyCallBacks, NULL);
+   CFDictionaryRef copy;
+   long op;
+   bool result = true;
+
+   printf("Checking set, add and remove against a CFDictionary%s:\n", keyCallBacks == &collidingKeyCallBacks ? " with colliding hashes" : "");
+
+   srandom(1);
+   for (op = 0; op < 50000 && result; op++) {
+      long key = random() % NUM_KEYS + 1;
+      const void *value = VALUE_FOR_KEY(key, random() % 1000);
+      switch (random() % 4) {
+      case 0:
+         CFConcurrentDictionaryRemoveValue(cd, (const void *)key);
+         CFDictionaryRemoveValue(model, (const void *)key);
+         break;
+      case 1:
+         CFConcurrentDictionaryAddValue(cd, (const void *)key, value);
+         CFDictionaryAddValue(model, (const void *)key, value);
+         break;
+      default:
+         CFConcurrentDictionarySetValue(cd, (const void *)key, value);
+         CFDictionarySetValue(model, (const void *)key, value);
+         break;
+      }
+      if (0 == op % 5000) result = matches_model(cd, model);
+   }
+   if (result) result = matches_model(cd, model);
+
+   copy = CFConcurrentDictionaryCreateDictionary(kCFAllocatorDefault, cd);
+   if (!CFEqual(copy, model)) {
+      printf("CFConcurrentDictionaryCreateDictionary() does not match\n");
+      result = false;
+   }
+   CFRelease(copy);
+
+   CFConcurrentDictionaryRemoveAllValues(cd);
+   CFDictionaryRemoveAllValues(model);
+   if (result) result = matches_model(cd, model);
+
+   CFRelease(cd);
+   CFRelease(model);
+   if (liveValues != 0) {
+      printf("%ld values were not released\n", liveValues);
+      result = false;
+   }
+
+   printf("\n");
+   return result;
+}
+
+bool check_snapshots ()
+{
+   CFMutableConcurrentDictionaryRef cd = CFConcurrentDictionaryCreateMutable(kCFAllocatorDefault, &pointerKeyCallBacks, &valueCallBacks);
+   CFConcurrentDictionaryRef snapshot, later;
+   long key;
+   bool result = true;
+
+   CFShow(CFSTR("Checking that snapshots do not see later changes:"));
+
+   for (key = 1; key <= 100; key++) CFConcurrentDictionarySetValue(cd, (const void *)key, VALUE_FOR_KEY(key, 1));
+   snapshot = CFConcurrentDictionaryCopySnapshot(cd);
+   for (key = 1; key <= 100; key += 2) CFConcurrentDictionaryRemoveValue(cd, (const void *)key);
+   for (key = 2; key <= 100; key += 2) CFConcurrentDictionarySetValue(cd, (const void *)key, VALUE_FOR_KEY(key, 2));
+   CFConcurrentDictionarySetValue(cd, (const void *)101, VALUE_FOR_KEY(101, 2));
+
+   if (CFConcurrentDictionaryGetCount(snapshot) != 100 || CFConcurrentDictionaryGetCount(cd) != 51) {
+      printf("Counts are %ld and %ld, expected 100 and 51\n", (long)CFConcurrentDictionaryGetCount(snapshot), (long)CFConcurrentDictionaryGetCount(cd));
+      result = false;
+   }
+   for (key = 1; key <= 100; key++) {
+      if (CFConcurrentDictionaryGetValue(snapshot, (const void *)key) != VALUE_FOR_KEY(key, 1)) {
+         printf("The snapshot sees a change to key %ld\n", key);
+         result = false;
+         break;
+      }
+   }
+   if (CFConcurrentDictionaryGetValue(snapshot, (const void *)101)) {
+      printf("The snapshot sees a later addition\n");
+      result = false;
+   }
+   later = CFConcurrentDictionaryCopySnapshot(cd);
+   if (CFEqual(snapshot, cd) || !CFEqual(later, cd)) {
+      printf("CFEqual() does not compare the current entries\n");
+      result = false;
+   }
+
+   CFRelease(later);
+   CFRelease(cd);
+   // The snapshot keeps its entries after the dictionary it came from is gone
+   if (liveValues != 100 || CFConcurrentDictionaryGetValue(snapshot, (const void *)100) != VALUE_FOR_KEY(100, 1)) {
+      printf("The snapshot lost entries when the dictionary was released\n");
+      result = false;
+   }
+   CFRelease(snapshot);
+   if (liveValues != 0) {
+      printf("%ld values were not released\n", liveValues);
+      result = false;
+   }
+
+   printf("\n");
+   return result;
+}
+
+static CFMutableConcurrentDictionaryRef sharedDictionary;
+static volatile int writerDone;
+static volatile int readerFailed;
+
+static void check_entry (const void *key, const void *value, void *context)
+{
+   if (KEY_OF_VALUE(value) != (long)key) readerFailed = 1;
+   (*(CFIndex *)context)++;
+}
+
+static void *read_while_writing (void *info)
+{
+   while (!writerDone && !readerFailed) {
+      CFConcurrentDictionaryRef snapshot;
+      CFDictionaryRef copy;
+      CFIndex count, visited = 0;
+      long key;
+
+      for (key = 1; key <= NUM_KEYS; key += 7) {
+         const void *value;
+         if (CFConcurrentDictionaryGetValueIfPresent(sharedDictionary, (const void *)key, &value) && KEY_OF_VALUE(value) != key) readerFailed = 1;
+      }
+      snapshot = CFConcurrentDictionaryCopySnapshot(sharedDictionary);
+      count = CFConcurrentDictionaryGetCount(snapshot);
+      CFConcurrentDictionaryApplyFunction(snapshot, check_entry, &visited);
+      copy = CFConcurrentDictionaryCreateDictionary(kCFAllocatorDefault, snapshot);
+      if (visited != count || CFDictionaryGetCount(copy) != count) readerFailed = 1;
+      CFRelease(copy);
+      CFRelease(snapshot);
+   }
+   return NULL;
+}
+
+bool check_readers_during_writes (const CFDictionaryKeyCallBacks *keyCallBacks)
+{
+   pthread_t threads[2];
+   long op, idx;
+   bool result = true;
+
+   printf("Checking readers and snapshots alongside a writer%s:\n", keyCallBacks == &collidingKeyCallBacks ? " with colliding hashes" : "");
+
+   sharedDictionary = CFConcurrentDictionaryCreateMutable(kCFAllocatorDefault, keyCallBacks, &valueCallBacks);
+   writerDone = 0;
+   readerFailed = 0;
+   for (idx = 0; idx < 2; idx++) pthread_create(&threads[idx], NULL, read_while_writing, NULL);
+   srandom(2);
+   for (op = 0; op < 20000 && !readerFailed; op++) {
+      long key = random() % NUM_KEYS + 1;
+      if (0 == random() % 3) CFConcurrentDictionaryRemoveValue(sharedDictionary, (const void *)key);
+      else CFConcurrentDictionarySetValue(sharedDictionary, (const void *)key, VALUE_FOR_KEY(key, random() % 1000));
+   }
+   writerDone = 1;
+   for (idx = 0; idx < 2; idx++) pthread_join(threads[idx], NULL);
+
+   if (readerFailed) {
+      printf("A reader saw a torn entry or an inconsistent snapshot\n");
+      result = false;
+   }
+   // Each replaced or removed value has been released once, and no value still in use was
+   if (liveValues != CFConcurrentDictionaryGetCount(sharedDictionary)) {
+      printf("%ld values are retained for %ld entries\n", liveValues, (long)CFConcurrentDictionaryGetCount(sharedDictionary));
+      result = false;
+   }
+   CFRelease(sharedDictionary);
+   if (liveValues != 0) {
+      printf("%ld values were not released\n", liveValues);
+      result = false;
+   }
+
+   printf("\n");
+   return result;
+}
+
+int main (int argc, const char *argv[])
+{
+   bool result = true;
+
+   result = check_against_model(&pointerKeyCallBacks) && result;
+   result = check_against_model(&collidingKeyCallBacks) && result;
+   result = check_snapshots() && result;
+   result = check_readers_during_writes(&pointerKeyCallBacks) && result;
+   result = check_readers_during_writes(&collidingKeyCallBacks) && result;
+
+   printf(result ? "All concurrent dictionary checks passed\n" : "Concurrent dictionary checks FAILED\n");
+   return result ? 0 : 1;
+}
@@ -0,0 +1,258 @@
+/*
+ *  runloop_test.c
+ *  CFLite
+ *
+ *  Checks that a run loop sleeps until it is woken up (by CFRunLoopWakeUp() after a source is
+ *  signalled from another thread, or by a timer being added), that invalidated timers leave their
+ *  run loop, and that a CFRunLoopPool never performs a source on two workers at once.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreFoundation/CFPriv.h>
+
+static CFRunLoopRef loop;			// Of the thread running run_loop_thread()
+static volatile int loopReady;
+static volatile double loopCPUSeconds;
+
+static double thread_cpu_seconds ()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+static void stop_loop (void *info)
+{
+   CFRunLoopStop(CFRunLoopGetCurrent());
+}
+
+static void stop_loop_timer (CFRunLoopTimerRef timer, void *info)
+{
+   CFRunLoopStop(CFRunLoopGetCurrent());
+}
+
+// Runs the current run loop with the given source for up to 10 seconds
+static void *run_loop_thread (void *info)
+{
+   CFRunLoopSourceRef source = (CFRunLoopSourceRef)info;
+   double start;
+
+   loop = CFRunLoopGetCurrent();
+   CFRunLoopAddSource(loop, source, kCFRunLoopDefaultMode);
+   loopReady = 1;
+   start = thread_cpu_seconds();
+   CFRunLoopRunInMode(kCFRunLoopDefaultMode, 10.0, false);
+   loopCPUSeconds = thread_cpu_seconds() - start;
+   CFRunLoopRemoveSource(loop, source, kCFRunLoopDefaultMode);
+   return NULL;
+}
+
+static pthread_t start_loop (CFRunLoopSourceRef source)
+{
+   pthread_t thread;
+
+   loopReady = 0;
+   pthread_create(&thread, NULL, run_loop_thread, (void *)source);
+   while (!loopReady || !CFRunLoopIsWaiting(loop)) usleep(1000);
+   return thread;
+}
+
+bool check_wake_up ()
+{
+   CFRunLoopSourceContext context = {0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, stop_loop};
+   CFRunLoopSourceRef source = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+   CFAbsoluteTime start;
+   pthread_t thread;
+   bool result = true;
+
+   CFShow(CFSTR("Checking that a sleeping run loop is woken up by a signalled source:"));
+
+   thread = start_loop(source);
+   usleep(300000);
+   start = CFAbsoluteTimeGetCurrent();
+   CFRunLoopSourceSignal(source);
+   CFRunLoopWakeUp(loop);
+   pthread_join(thread, NULL);
+   if (CFAbsoluteTimeGetCurrent() - start > 2.0) {
+      printf("The run loop did not wake up\n");
+      result = false;
+   }
+   // Spinning for 0.3 seconds would have used about that much processor time
+   if (loopCPUSeconds > 0.1) {
+      printf("The run loop used %.3f seconds of processor time waiting\n", loopCPUSeconds);
+      result = false;
+   }
+   CFRelease(source);
+
+   printf("\n");
+   return result;
+}
+
+bool check_timer_added_from_other_thread ()
+{
+   CFRunLoopSourceContext context = {0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+   CFRunLoopSourceRef source = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+   CFRunLoopTimerRef timer;
+   CFAbsoluteTime start;
+   pthread_t thread;
+   bool result = true;
+
+   CFShow(CFSTR("Checking that adding a timer wakes a run loop sleeping on another thread:"));
+
+   thread = start_loop(source);
+   start = CFAbsoluteTimeGetCurrent();
+   timer = CFRunLoopTimerCreate(kCFAllocatorDefault, start + 0.1, 0, 0, 0, stop_loop_timer, NULL);
+   CFRunLoopAddTimer(loop, timer, kCFRunLoopDefaultMode);
+   pthread_join(thread, NULL);
+   if (CFAbsoluteTimeGetCurrent() - start > 2.0) {
+      printf("The timer did not fire on time\n");
+      result = false;
+   }
+   CFRelease(timer);
+   CFRelease(source);
+
+   printf("\n");
+   return result;
+}
+
+static void count_fire (CFRunLoopTimerRef timer, void *info)
+{
+   (*(int *)info)++;
+}
+
+bool check_timer_removal ()
+{
+   CFRunLoopRef rl = CFRunLoopGetCurrent();
+   CFRunLoopTimerContext context = {0, NULL, NULL, NULL, NULL};
+   CFRunLoopTimerRef timer;
+   int fires = 0;
+   bool result = true;
+
+   CFShow(CFSTR("Checking that invalidated timers leave their run loop:"));
+
+   context.info = &fires;
+   timer = CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + 0.01, 0.01, 0, 0, count_fire, &context);
+   CFRunLoopAddTimer(rl, timer, kCFRunLoopDefaultMode);
+   CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.1, false);
+   CFRunLoopTimerInvalidate(timer);
+   if (fires == 0 || CFRunLoopContainsTimer(rl, timer, kCFRunLoopDefaultMode)) {
+      printf("A repeating timer fired %d times and was %sremoved when invalidated\n", fires, CFRunLoopContainsTimer(rl, timer, kCFRunLoopDefaultMode) ? "not " : "");
+      result = false;
+   }
+   CFRelease(timer);
+
+   // A timer that does not repeat is invalidated once it has fired
+   fires = 0;
+   timer = CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + 0.01, 0, 0, 0, count_fire, &context);
+   CFRunLoopAddTimer(rl, timer, kCFRunLoopDefaultMode);
+   CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.1, false);
+   if (fires != 1 || CFRunLoopTimerIsValid(timer) || CFRunLoopContainsTimer(rl, timer, kCFRunLoopDefaultMode)) {
+      printf("A one-shot timer fired %d times and was %sremoved\n", fires, CFRunLoopContainsTimer(rl, timer, kCFRunLoopDefaultMode) ? "not " : "");
+      result = false;
+   }
+   CFRelease(timer);
+
+   printf("\n");
+   return result;
+}
+
+#define NUM_POOL_SOURCES 8
+#define NUM_POOL_SIGNALS 2000
+
+static CFRunLoopSourceRef poolSources[NUM_POOL_SOURCES];
+static volatile int performing[NUM_POOL_SOURCES];
+static volatile long performs;
+static volatile int overlapped;
+static volatile int lastRound, performedInLastRound[NUM_POOL_SOURCES];
+
+static void pool_perform (void *info)
+{
+   long idx = (long)info;
+
+   if (__sync_add_and_fetch(&performing[idx], 1) != 1) overlapped = 1;
+   if (lastRound) performedInLastRound[idx] = 1;
+   if (0 == idx % 2) sched_yield();	// Give another worker the chance to take the source if it could
+   __sync_add_and_fetch(&performs, 1);
+   __sync_sub_and_fetch(&performing[idx], 1);
+}
+
+static void *signal_pool_sources (void *info)
+{
+   long signal;
+
+   for (signal = 0; signal < NUM_POOL_SIGNALS; signal++) {
+      CFRunLoopSourceSignal(poolSources[random() % NUM_POOL_SOURCES]);
+      if (0 == signal % 64) usleep(100);
+   }
+   return NULL;
+}
+
+bool check_pool_performs_once_at_a_time ()
+{
+   CFRunLoopPoolRef pool = CFRunLoopPoolCreate(kCFAllocatorDefault, 4);
+   pthread_t threads[3];
+   CFAbsoluteTime deadline;
+   long idx;
+   bool result = true;
+
+   CFShow(CFSTR("Checking that a run loop pool performs each source on one worker at a time:"));
+
+   for (idx = 0; idx < NUM_POOL_SOURCES; idx++) {
+      CFRunLoopSourceContext context = {0, (void *)idx, NULL, NULL, NULL, NULL, NULL, NULL, NULL, pool_perform};
+      poolSources[idx] = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+      CFRunLoopPoolAddSource(pool, poolSources[idx], kCFRunLoopDefaultMode);
+   }
+   srandom(1);
+   for (idx = 0; idx < 3; idx++) pthread_create(&threads[idx], NULL, signal_pool_sources, NULL);
+   for (idx = 0; idx < 3; idx++) pthread_join(threads[idx], NULL);
+
+   // A signal, even one that arrives during a perform, is never lost
+   __sync_synchronize();
+   lastRound = 1;
+   __sync_synchronize();
+   for (idx = 0; idx < NUM_POOL_SOURCES; idx++) CFRunLoopSourceSignal(poolSources[idx]);
+   deadline = CFAbsoluteTimeGetCurrent() + 5.0;
+   for (idx = 0; idx < NUM_POOL_SOURCES && CFAbsoluteTimeGetCurrent() < deadline; ) {
+      if (performedInLastRound[idx]) idx++; else usleep(1000);
+   }
+   if (idx < NUM_POOL_SOURCES) {
+      printf("Source %ld was signalled but not performed\n", idx);
+      result = false;
+   }
+   if (overlapped) {
+      printf("A source was performed on two workers at once\n");
+      result = false;
+   }
+   if (0 == performs) {
+      printf("No source was performed\n");
+      result = false;
+   }
+
+   CFRunLoopPoolInvalidate(pool);
+   for (idx = 0; idx < NUM_POOL_SOURCES; idx++) CFRelease(poolSources[idx]);
+   CFRelease(pool);
+
+   printf("\n");
+   return result;
+}
+
+int main (int argc, const char *argv[])
+{
+   bool result = true;
+
+   result = check_wake_up() && result;
+   result = check_timer_added_from_other_thread() && result;
+   result = check_timer_removal() && result;
+   result = check_pool_performs_once_at_a_time() && result;
+
+   printf(result ? "All run loop checks passed\n" : "Run loop checks FAILED\n");
+   return result ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+/*
+ *  sort_benchmark.c
+ *  CFLite
+ *
+ *  Times CFQSortArray(), CFMergeSortArray() and CFArraySortValues() on random, sorted,
+ *  reversed, nearly sorted and many-duplicate inputs, beside the BSD qsort and merge sort
+ *  they used before (see bsd_sort.c) and the C library's qsort(), and checks that every
+ *  result is correctly (and, for the merge sorts, stably) ordered.
+ *
+ *  Usage: sort_benchmark [count]     (default 1000000)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreFoundation/CFPriv.h>
+
+// The previous implementations, from bsd_sort.c
+extern void bsd_qsort (void *a, size_t n, size_t es, CFComparatorFunction cmp, void *thunk);
+extern int bsd_mergesort (void *base, size_t nmemb, size_t size, CFComparatorFunction cmp, void *context);
+
+typedef struct {
+   long key;
+   long order;     // Original position, to check stability
+} Record;
+
+typedef enum { kRandom, kSorted, kReversed, kNearlySorted, kFewUnique, kPatternCount } Pattern;
+
+static const char *patternNames[kPatternCount] = { "random", "sorted", "reversed", "nearly sorted", "few unique" };
+
+static long patternKey (Pattern pattern, long idx, long count)
+{
+   switch (pattern) {
+   case kRandom:        return random ();
+   case kSorted:        return idx;
+   case kReversed:      return count - idx;
+   case kNearlySorted:  return (random () % 100 == 0) ? random () % count : idx;
+   case kFewUnique:     return random () % 16;
+   default:             return 0;
+   }
+}
+
+// For CFQSortArray() and CFMergeSortArray(): passed the addresses of the values
+static CFComparisonResult compareRecordPointers (const void *val1, const void *val2, void *context)
+{
+   const Record *r1 = *(const Record **)val1, *r2 = *(const Record **)val2;
+   return (r1->key < r2->key) ? kCFCompareLessThan : (r1->key > r2->key) ? kCFCompareGreaterThan : kCFCompareEqualTo;
+}
+
+// For CFArraySortValues(): passed the values themselves
+static CFComparisonResult compareRecords (const void *val1, const void *val2, void *context)
+{
+   const Record *r1 = (const Record *)val1, *r2 = (const Record *)val2;
+   return (r1->key < r2->key) ? kCFCompareLessThan : (r1->key > r2->key) ? kCFCompareGreaterThan : kCFCompareEqualTo;
+}
+
+static int compareRecordPointersLibC (const void *val1, const void *val2)
+{
+   return (int)compareRecordPointers (val1, val2, NULL);
+}
+
+static bool checkOrder (const char *name, Pattern pattern, Record **list, long count, bool stable)
+{
+   long idx;
+   for (idx = 1; idx < count; idx++) {
+      if (list[idx - 1]->key > list[idx]->key || (stable && list[idx - 1]->key == list[idx]->key && list[idx - 1]->order > list[idx]->order)) {
+         printf ("FAILED: %s on %s input is out of order at %ld\n", name, patternNames[pattern], idx);
+         return false;
+      }
+   }
+   return true;
+}
+
+static double secondsSince (clock_t start)
+{
+   return (double)(clock () - start) / CLOCKS_PER_SEC;
+}
+
+int main (int argc, const char** argv)
+{
+   long count = (argc > 1) ? atol (argv[1]) : 1000000;
+   Record *records = (Record *)malloc (count * sizeof (Record));
+   Record **list = (Record **)malloc (count * sizeof (Record *));
+   bool ok = true;
+   Pattern pattern;
+   long idx;
+
+   printf ("%-14s %13s %13s %13s %13s %13s %13s\n", "input", "CFQSortArray", "BSD qsort", "CFMergeSort", "BSD mergesort", "CFArraySort", "libc qsort");
+   for (pattern = kRandom; pattern < kPatternCount; pattern++) {
+      double times[6];
+      int which;
+
+      srandom (1);
+      for (idx = 0; idx < count; idx++) {
+         records[idx].key = patternKey (pattern, idx, count);
+         records[idx].order = idx;
+      }
+      for (which = 0; which < 6; which++) {
+         clock_t start;
+         for (idx = 0; idx < count; idx++) list[idx] = &records[idx];
+         start = clock ();
+         switch (which) {
+         case 0:
+            CFQSortArray (list, count, sizeof (Record *), compareRecordPointers, NULL);
+            times[which] = secondsSince (start);
+            ok = checkOrder ("CFQSortArray", pattern, list, count, false) && ok;
+            break;
+         case 1:
+            bsd_qsort (list, count, sizeof (Record *), compareRecordPointers, NULL);
+            times[which] = secondsSince (start);
+            ok = checkOrder ("bsd_qsort", pattern, list, count, false) && ok;
+            break;
+         case 2:
+            CFMergeSortArray (list, count, sizeof (Record *), compareRecordPointers, NULL);
+            times[which] = secondsSince (start);
+            ok = checkOrder ("CFMergeSortArray", pattern, list, count, true) && ok;
+            break;
+         case 3:
+            bsd_mergesort (list, count, sizeof (Record *), compareRecordPointers, NULL);
+            times[which] = secondsSince (start);
+            ok = checkOrder ("bsd_mergesort", pattern, list, count, true) && ok;
+            break;
+         case 4: {
+            CFMutableArrayRef array = CFArrayCreateMutable (kCFAllocatorDefault, count, NULL);
+            for (idx = 0; idx < count; idx++) CFArrayAppendValue (array, list[idx]);
+            start = clock ();
+            CFArraySortValues (array, CFRangeMake (0, count), compareRecords, NULL);
+            times[which] = secondsSince (start);
+            CFArrayGetValues (array, CFRangeMake (0, count), (const void **)list);
+            CFRelease (array);
+            ok = checkOrder ("CFArraySortValues", pattern, list, count, false) && ok;
+            break;
+         }
+         case 5:
+            qsort (list, count, sizeof (Record *), compareRecordPointersLibC);
+            times[which] = secondsSince (start);
+            ok = checkOrder ("qsort", pattern, list, count, false) && ok;
+            break;
+         }
+      }
+      printf ("%-14s %12.3fs %12.3fs %12.3fs %12.3fs %12.3fs %12.3fs\n", patternNames[pattern], times[0], times[1], times[2], times[3], times[4], times[5]);
+   }
+
+   free (list);
+   free (records);
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,267 @@
+/*
+ *  storage_test.c
+ *  CFLite
+ *
+ *  Checks CFStorage against a plain array of the same values through random insertions, deletions
+ *  and replacements, reading back with CFStorageGetValueAtIndex(), CFStorageGetValues() and
+ *  CFStorageApplyFunction(), and checks that a thread that has read the storage sees later changes.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreFoundation/CFStorage.h>
+
+#define MAX_VALUES 60000
+
+// 12 bytes, so that values do not divide a leaf evenly
+typedef struct {
+   UInt32 serial;
+   UInt32 check;
+   UInt32 pad;
+} Value;
+
+typedef struct {
+   CFIndex count;
+   Value values[MAX_VALUES];
+} Model;
+
+static UInt32 lastSerial;
+
+static Value make_value ()
+{
+   Value value;
+
+   value.serial = ++lastSerial;
+   value.check = ~value.serial;
+   value.pad = value.serial * 3;
+   return value;
+}
+
+static CFRange random_range (CFIndex count, CFIndex maxLength)
+{
+   CFIndex location = random() % (count + 1);
+   CFIndex length = random() % (maxLength + 1);
+
+   if (length > count - location) length = count - location;
+   return CFRangeMake(location, length);
+}
+
+typedef struct {
+   const Model *model;
+   CFIndex next;
+   bool matched;
+} ApplyContext;
+
+static void check_applied_value (const void *val, void *context)
+{
+   ApplyContext *apply = (ApplyContext *)context;
+
+   if (memcmp(val, &apply->model->values[apply->next], sizeof(Value)) != 0) apply->matched = false;
+   apply->next++;
+}
+
+static bool matches_model (CFStorageRef storage, const Model *model, const char *what)
+{
+   Value *buffer;
+   CFIndex idx;
+   CFRange range;
+   ApplyContext apply;
+   bool result = true;
+
+   if (CFStorageGetCount(storage) != model->count) {
+      printf("%s: count %ld, expected %ld\n", what, (long)CFStorageGetCount(storage), (long)model->count);
+      return false;
+   }
+   if (__CFStorageGetCapacity(storage) < model->count) {
+      printf("%s: capacity %ld is less than the count\n", what, (long)__CFStorageGetCapacity(storage));
+      return false;
+   }
+
+   // Every value, a leaf at a time
+   for (idx = 0; idx < model->count && result; ) {
+      Value *value = (Value *)CFStorageGetValueAtIndex(storage, idx, &range);
+      if (range.location > idx || range.location + range.length <= idx || range.location + range.length > model->count) {
+         printf("%s: index %ld gave the consecutive range {%ld, %ld}\n", what, (long)idx, (long)range.location, (long)range.length);
+         result = false;
+      } else if (memcmp(value - (idx - range.location), &model->values[range.location], range.length * sizeof(Value)) != 0) {
+         printf("%s: values {%ld, %ld} differ\n", what, (long)range.location, (long)range.length);
+         result = false;
+      }
+      idx = range.location + range.length;
+   }
+
+   // Random ranges
+   buffer = malloc((model->count + 1) * sizeof(Value));
+   for (idx = 0; idx < 20 && result; idx++) {
+      range = random_range(model->count, model->count);
+      CFStorageGetValues(storage, range, buffer);
+      if (memcmp(buffer, &model->values[range.location], range.length * sizeof(Value)) != 0) {
+         printf("%s: CFStorageGetValues() of {%ld, %ld} differs\n", what, (long)range.location, (long)range.length);
+         result = false;
+      }
+      apply.model = model;
+      apply.next = range.location;
+      apply.matched = true;
+      CFStorageApplyFunction(storage, range, check_applied_value, &apply);
+      if (!apply.matched || apply.next != range.location + range.length) {
+         printf("%s: CFStorageApplyFunction() over {%ld, %ld} differs\n", what, (long)range.location, (long)range.length);
+         result = false;
+      }
+   }
+   free(buffer);
+   return result;
+}
+
+static void insert_values (CFStorageRef storage, Model *model, CFRange range)
+{
+   CFIndex idx;
+
+   memmove(&model->values[range.location + range.length], &model->values[range.location], (model->count - range.location) * sizeof(Value));
+   for (idx = range.location; idx < range.location + range.length; idx++) model->values[idx] = make_value();
+   model->count += range.length;
+   CFStorageInsertValues(storage, range);
+   CFStorageReplaceValues(storage, range, &model->values[range.location]);
+}
+
+static void delete_values (CFStorageRef storage, Model *model, CFRange range)
+{
+   memmove(&model->values[range.location], &model->values[range.location + range.length], (model->count - range.location - range.length) * sizeof(Value));
+   model->count -= range.length;
+   CFStorageDeleteValues(storage, range);
+}
+
+static void replace_values (CFStorageRef storage, Model *model, CFRange range)
+{
+   CFIndex idx;
+
+   for (idx = range.location; idx < range.location + range.length; idx++) model->values[idx] = make_value();
+   if (1 == range.length && random() % 2) {
+      *(Value *)CFStorageGetValueAtIndex(storage, range.location, NULL) = model->values[range.location];
+   } else {
+      CFStorageReplaceValues(storage, range, &model->values[range.location]);
+   }
+}
+
+bool check_against_model ()
+{
+   CFStorageRef storage = CFStorageCreate(kCFAllocatorDefault, sizeof(Value));
+   Model *model = calloc(1, sizeof(Model));
+   CFIndex op;
+   bool result = true;
+
+   CFShow(CFSTR("Checking insertions, deletions and replacements against an array:"));
+
+   srandom(1);
+   for (op = 0; op < 4000 && result; op++) {
+      // Mostly small edits, with a few large ones that add or remove whole leaves; grow, then shrink
+      CFIndex maxLength = (0 == random() % 20) ? 5000 : 20;
+      int kind = random() % 10;
+      if (op >= 2500 && kind < 4) kind += 4;
+      if (kind < 4 && model->count + maxLength <= MAX_VALUES) {
+         CFRange range = random_range(model->count, 0);
+         range.length = 1 + random() % maxLength;
+         insert_values(storage, model, range);
+      } else if (kind < 7) {
+         delete_values(storage, model, random_range(model->count, maxLength));
+      } else {
+         replace_values(storage, model, random_range(model->count, maxLength));
+      }
+      if (0 == op % 100) {
+         char what[64];
+         snprintf(what, sizeof(what), "After %ld edits", (long)op + 1);
+         result = matches_model(storage, model, what);
+      }
+   }
+   if (result) result = matches_model(storage, model, "After all edits");
+
+   // Emptying the storage and filling it again
+   delete_values(storage, model, CFRangeMake(0, model->count));
+   if (result) result = matches_model(storage, model, "Emptied");
+   insert_values(storage, model, CFRangeMake(0, 3000));
+   insert_values(storage, model, CFRangeMake(1500, 2000));
+   if (result) result = matches_model(storage, model, "Refilled");
+
+   CFRelease(storage);
+   free(model);
+
+   printf("\n");
+   return result;
+}
+
+static CFStorageRef sharedStorage;
+static Model *sharedModel;
+static volatile int turn;			// Odd while the reader thread reads
+static volatile int readerFailed;
+
+static void *read_in_turn (void *info)
+{
+   int myTurn;
+
+   for (myTurn = 1; myTurn < 100; myTurn += 2) {
+      CFIndex idx;
+      while (turn != myTurn) usleep(100);
+      for (idx = 0; idx < sharedModel->count; idx += 97) {
+         if (memcmp(CFStorageGetValueAtIndex(sharedStorage, idx, NULL), &sharedModel->values[idx], sizeof(Value)) != 0) readerFailed = 1;
+      }
+      __sync_synchronize();
+      turn = myTurn + 1;
+   }
+   return NULL;
+}
+
+bool check_other_thread_sees_changes ()
+{
+   pthread_t thread;
+   int myTurn;
+   bool result = true;
+
+   CFShow(CFSTR("Checking that a thread that has read the storage sees later changes:"));
+
+   sharedStorage = CFStorageCreate(kCFAllocatorDefault, sizeof(Value));
+   sharedModel = calloc(1, sizeof(Model));
+   srandom(2);
+   insert_values(sharedStorage, sharedModel, CFRangeMake(0, 20000));
+   turn = 0;
+   readerFailed = 0;
+   pthread_create(&thread, NULL, read_in_turn, NULL);
+   for (myTurn = 0; myTurn < 100; myTurn += 2) {
+      while (turn != myTurn) usleep(100);
+      // The reader's cached leaf moves, shrinks or goes away
+      switch (myTurn % 6) {
+      case 0: insert_values(sharedStorage, sharedModel, CFRangeMake(random() % sharedModel->count, 1 + random() % 3000)); break;
+      case 2: delete_values(sharedStorage, sharedModel, random_range(sharedModel->count, 3000)); break;
+      case 4: replace_values(sharedStorage, sharedModel, random_range(sharedModel->count, 3000)); break;
+      }
+      __sync_synchronize();
+      turn = myTurn + 1;
+   }
+   pthread_join(thread, NULL);
+   if (readerFailed) {
+      printf("The other thread read a stale value\n");
+      result = false;
+   }
+   result = matches_model(sharedStorage, sharedModel, "After reading on another thread") && result;
+
+   CFRelease(sharedStorage);
+   free(sharedModel);
+
+   printf("\n");
+   return result;
+}
+
+int main (int argc, const char *argv[])
+{
+   bool result = true;
+
+   result = check_against_model() && result;
+   result = check_other_thread_sees_changes() && result;
+
+   printf(result ? "All storage checks passed\n" : "Storage checks FAILED\n");
+   return result ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+/*
+ *  string_sort_test.c
+ *  CFLite
+ *
+ *  Checks that CFStringSortValues() puts strings in the order CFStringCompareWithOptionsAndLocale()
+ *  gives them, including strings with characters outside the BMP, which are stored as surrogate
+ *  pairs, and with a locale, and that kCFCompareLocalized sorts by the locale's collation.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreFoundation/CFPriv.h>
+
+static const UniChar pieces[][2] = {
+   {0x0061, 0}, {0x0041, 0}, {0x0031, 0}, {0x0039, 0}, {0x00E9, 0}, {0x0301, 0},
+   {0xE000, 0}, {0xFF21, 0}, {0xFF41, 0}, {0xFFFD, 0},
+   {0xD83D, 0xDE00},	// U+1F600
+   {0xD835, 0xDC00},	// U+1D400
+   {0xD800, 0xDC00}	// U+10000
+};
+#define NUM_PIECES (sizeof(pieces) / sizeof(pieces[0]))
+
+static CFStringRef create_string (UniChar first, UniChar second)
+{
+   UniChar chars[2] = {first, second};
+   return CFStringCreateWithCharacters(kCFAllocatorDefault, chars, (second != 0) ? 2 : 1);
+}
+
+static CFStringRef create_random_string ()
+{
+   UniChar chars[12];
+   CFIndex length = 0;
+   int count = 1 + random() % 5, idx;
+
+   for (idx = 0; idx < count; idx++) {
+      const UniChar *piece = pieces[random() % NUM_PIECES];
+      chars[length++] = piece[0];
+      if (piece[1] != 0) chars[length++] = piece[1];
+   }
+   return CFStringCreateWithCharacters(kCFAllocatorDefault, chars, length);
+}
+
+static bool check_order (CFStringRef *strings, CFIndex count, CFOptionFlags options, CFLocaleRef locale)
+{
+   CFIndex idx;
+
+   CFStringSortValues(strings, count, options, locale);
+   for (idx = 1; idx < count; idx++) {
+      if (CFStringCompareWithOptionsAndLocale(strings[idx - 1], strings[idx], CFRangeMake(0, CFStringGetLength(strings[idx - 1])), options, locale) == kCFCompareGreaterThan) {
+         printf("Options 0x%lx%s: out of order at %ld\n", (unsigned long)options, locale ? " with a locale" : "", (long)idx);
+         CFShow(strings[idx - 1]);
+         CFShow(strings[idx]);
+         return false;
+      }
+   }
+   return true;
+}
+
+static const CFOptionFlags options[] = {
+   0, kCFCompareNumerically, kCFCompareForcedOrdering, kCFCompareCaseInsensitive,
+   kCFCompareCaseInsensitive | kCFCompareNumerically, kCFCompareNonliteral
+};
+#define NUM_OPTIONS (sizeof(options) / sizeof(options[0]))
+
+bool check_surrogates_against_private_use ()
+{
+   CFStringRef strings[4];
+   bool result = true;
+   unsigned opt;
+   int idx;
+
+   CFShow(CFSTR("Checking a surrogate pair against U+E000 and U+FF21:"));
+
+   for (opt = 0; opt < NUM_OPTIONS; opt++) {
+      strings[0] = create_string(0xD83D, 0xDE00);
+      strings[1] = create_string(0xFF21, 0);
+      strings[2] = create_string(0xE000, 0);
+      strings[3] = create_string(0xD83D, 0xDE00);
+      if (!check_order(strings, 4, options[opt], NULL)) result = false;
+      // U+1F600 is D83D DE00 in UTF-16, which sorts before the BMP characters above U+D7FF
+      if (!(options[opt] & (kCFCompareCaseInsensitive | kCFCompareNonliteral)) && CFStringGetLength(strings[0]) != 2) {
+         printf("Options 0x%lx: surrogate pair should sort first\n", (unsigned long)options[opt]);
+         result = false;
+      }
+      for (idx = 0; idx < 4; idx++) CFRelease(strings[idx]);
+   }
+
+   printf("\n");
+   return result;
+}
+
+bool check_random_strings (CFLocaleRef locale)
+{
+   CFStringRef strings[2000], sorted[2000];
+   bool result = true;
+   unsigned opt;
+   int idx;
+
+   CFShow(locale ? CFSTR("Checking random strings with surrogate pairs and a locale:") : CFSTR("Checking random strings with surrogate pairs:"));
+
+   srandom(1);
+   for (idx = 0; idx < 2000; idx++) strings[idx] = create_random_string();
+   for (opt = 0; opt < NUM_OPTIONS; opt++) {
+      for (idx = 0; idx < 2000; idx++) sorted[idx] = strings[idx];
+      if (!check_order(sorted, 2000, options[opt], locale)) result = false;
+   }
+   for (idx = 0; idx < 2000; idx++) CFRelease(strings[idx]);
+
+   printf("\n");
+   return result;
+}
+
+bool check_localized (CFLocaleRef locale)
+{
+   CFStringRef strings[3];
+   bool result = true;
+
+   CFShow(CFSTR("Checking a locale with and without kCFCompareLocalized:"));
+
+   // Without kCFCompareLocalized the locale doesn't change the order, so "B" (U+0042) comes before "a"
+   strings[0] = CFSTR("a");
+   strings[1] = CFSTR("B");
+   if (!check_order(strings, 2, 0, locale)) result = false;
+   if (!CFEqual(strings[0], CFSTR("B"))) {
+      printf("A locale alone should not collate\n");
+      result = false;
+   }
+
+   // With it the locale's collation puts "a" first, and "B" after "b"
+   strings[0] = CFSTR("B");
+   strings[1] = CFSTR("b");
+   strings[2] = CFSTR("a");
+   CFStringSortValues(strings, 3, kCFCompareLocalized, locale);
+   if (!CFEqual(strings[0], CFSTR("a")) || !CFEqual(strings[1], CFSTR("b")) || !CFEqual(strings[2], CFSTR("B"))) {
+      printf("kCFCompareLocalized should sort by collation\n");
+      result = false;
+   }
+
+   printf("\n");
+   return result;
+}
+
+int main (int argc, const char *argv[])
+{
+   CFLocaleRef locale = CFLocaleCreate(kCFAllocatorDefault, CFSTR("en_US"));
+   bool result = true;
+
+   result = check_surrogates_against_private_use() && result;
+   result = check_random_strings(NULL) && result;
+   result = check_random_strings(locale) && result;
+   result = check_localized(locale) && result;
+   CFRelease(locale);
+
+   printf(result ? "All string sort checks passed\n" : "String sort checks FAILED\n");
+   return result ? 0 : 1;
+}